@@ -0,0 +1,260 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Agregador.h
+ * @brief Resumen por ventanas fijas de las mediciones: mínimo, máximo, media, varianza y cuántas.
+ * @author Sento Marcos Ibarra
+ *
+ * Las ventanas son consecutivas y no se solapan (tumbling): la primera
+ * empieza con la primera medición y cada una dura lo mismo. La medición
+ * que cae fuera de la abierta la cierra y abre la siguiente, alineada con
+ * las anteriores (si ha habido un hueco de varias, se saltan):
+ *
+ *   Agregador< Sensores::NUM > elAgregador ( 60000 ); // ventanas de 1 min
+ *
+ *   if ( elAgregador.anyadir( valores, millis() ) ) {
+ *     // cerrado( k ): la ventana anterior del sensor k
+ *   }
+ *
+ * Cada tipo de medición se lleva en un Acumulador de tamaño fijo: nada
+ * crece con las mediciones. En vez de la actualización de Welford (media y
+ * M2 con una división por medición) se suman x y x^2 en enteros: así son
+ * exactos (no hay cancelación que evitar, que es a lo que viene Welford en
+ * coma flotante) y cada medición cuesta una multiplicación y tres sumas.
+ * Con int16 y como mucho 65535 mediciones por ventana, la suma cabe en 32
+ * bits y la de cuadrados en 64; la varianza sale de las dos al cerrar.
+ *
+ * La ventana cerrada y la abierta son dos juegos de acumuladores que se
+ * turnan: cerrar no copia nada.
+ *
+ * No depende de Arduino.
+ */
+
+#ifndef AGREGADOR_H_INCLUIDO
+#define AGREGADOR_H_INCLUIDO
+
+#include <stdint.h>
+
+/**
+ * @class Acumulador
+ * @brief Mínimo, máximo, suma y suma de cuadrados de las mediciones de un tipo.
+ */
+class Acumulador {
+
+public:
+
+  static const uint16_t MAX_MEDICIONES = 0xFFFF;  ///< Las que vengan después no cuentan.
+
+private:
+
+  uint16_t n;
+  int16_t elMinimo;
+  int16_t elMaximo;
+  int32_t suma;            ///< |suma| <= 32768 x 65535 < 2^31.
+  uint64_t sumaCuadrados;  ///< < 2^30 x 65535.
+
+public:
+
+  /**
+   * @brief Constructor: vacío.
+   */
+  Acumulador()
+    : n(0), elMinimo(0), elMaximo(0), suma(0), sumaCuadrados(0) {
+  }  // ()
+
+  /**
+   * @function vaciar
+   */
+  void vaciar() {
+    (*this).n = 0;
+    (*this).suma = 0;
+    (*this).sumaCuadrados = 0;
+  }  // ()
+
+  /**
+   * @function anyadir
+   * @brief Cuenta una medición.
+   */
+  void anyadir(int16_t x) {
+    if ((*this).n == MAX_MEDICIONES) {
+      return;
+    }
+    if ((*this).n == 0 || x < (*this).elMinimo) {
+      (*this).elMinimo = x;
+    }
+    if ((*this).n == 0 || x > (*this).elMaximo) {
+      (*this).elMaximo = x;
+    }
+    (*this).n++;
+    (*this).suma += x;
+    (*this).sumaCuadrados += (uint32_t)((int32_t)x * x);
+  }  // ()
+
+  uint16_t cuantas() const {
+    return (*this).n;
+  }  // ()
+
+  int16_t minimo() const {
+    return (*this).elMinimo;
+  }  // ()
+
+  int16_t maximo() const {
+    return (*this).elMaximo;
+  }  // ()
+
+  /**
+   * @function media
+   * @brief Redondeada al entero más cercano (0 si no hay ninguna).
+   */
+  int16_t media() const {
+    if ((*this).n == 0) {
+      return 0;
+    }
+    int32_t medio = (*this).n / 2;
+    return (int16_t)((*this).suma >= 0 ? ((*this).suma + medio) / (*this).n
+                                       : -((-(*this).suma + medio) / (*this).n));
+  }  // ()
+
+  /**
+   * @function varianza
+   * @brief Varianza muestral (con n - 1), redondeada: (n S2 - S^2) / (n (n - 1)).
+   * @return 0 con menos de dos mediciones.
+   */
+  uint32_t varianza() const {
+    if ((*this).n < 2) {
+      return 0;
+    }
+    uint64_t n = (*this).n;
+    int64_t s = (*this).suma;
+    uint64_t numerador = n * (*this).sumaCuadrados - (uint64_t)(s * s);  // < 2^62, y exacto
+    uint64_t denominador = n * (n - 1);
+    return (uint32_t)((numerador + denominador / 2) / denominador);
+  }  // ()
+
+};  // class
+
+/**
+ * @class Agregador
+ * @brief Ventanas fijas de las mediciones de N sensores.
+ * @tparam N Mediciones por ciclo (las de una lista de sensores).
+ */
+template<uint8_t N>
+class Agregador {
+
+private:
+
+  Acumulador losAcumuladores[2][N];
+  uint8_t abierta;  ///< Juego de la ventana abierta; el otro es la cerrada.
+
+  uint32_t laDuracion;  ///< ms.
+  bool hayAbierta;
+  uint32_t inicioAbierta;
+  uint32_t inicioCerrada;
+  uint32_t cerradas;
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param duracion_ Lo que dura cada ventana (ms, no 0).
+   */
+  Agregador(uint32_t duracion_)
+    : losAcumuladores(), abierta(0), laDuracion(duracion_), hayAbierta(false),
+      inicioAbierta(0), inicioCerrada(0), cerradas(0) {
+  }  // ()
+
+  /**
+   * @function anyadir
+   * @brief Añade las mediciones de un ciclo a la ventana que toca.
+   * @param valores N mediciones.
+   * @param instante Cuándo se han tomado (millis()).
+   * @return true si antes se ha cerrado la ventana que estaba abierta.
+   */
+  bool anyadir(const int16_t* valores, uint32_t instante) {
+    bool cierra = false;
+
+    if ((*this).hayAbierta && instante - (*this).inicioAbierta >= (*this).laDuracion) {
+      (*this).inicioCerrada = (*this).inicioAbierta;
+      (*this).inicioAbierta += (instante - (*this).inicioAbierta) / (*this).laDuracion * (*this).laDuracion;
+      (*this).abierta ^= 1;
+      for (uint8_t k = 0; k < N; k++) {
+        (*this).losAcumuladores[(*this).abierta][k].vaciar();
+      }
+      (*this).cerradas++;
+      cierra = true;
+    }
+
+    if (!(*this).hayAbierta) {
+      (*this).inicioAbierta = instante;
+      (*this).hayAbierta = true;
+    }
+
+    for (uint8_t k = 0; k < N; k++) {
+      (*this).losAcumuladores[(*this).abierta][k].anyadir(valores[k]);
+    }
+    return cierra;
+  }  // ()
+
+  /**
+   * @function cambiarDuracion
+   * @brief Otra duración: se tira la ventana abierta y la siguiente
+   * medición abre una nueva, que empieza en ella (inicioAbierto()) y ya dura
+   * lo nuevo. La cerrada se queda como estaba.
+   */
+  void cambiarDuracion(uint32_t duracion_) {
+    if (duracion_ == (*this).laDuracion) {
+      return;
+    }
+    (*this).laDuracion = duracion_;
+    (*this).hayAbierta = false;
+    for (uint8_t k = 0; k < N; k++) {
+      (*this).losAcumuladores[(*this).abierta][k].vaciar();
+    }
+  }  // ()
+
+  uint32_t duracion() const {
+    return (*this).laDuracion;
+  }  // ()
+
+  /**
+   * @function cerrado
+   * @brief Lo de la última ventana cerrada (vacío si aún no hay).
+   * @param k Posición del sensor.
+   */
+  const Acumulador& cerrado(uint8_t k) const {
+    return (*this).losAcumuladores[(*this).abierta ^ 1][k];
+  }  // ()
+
+  /**
+   * @function inicioCerrado
+   * @brief Cuándo empezó la última ventana cerrada (millis()).
+   */
+  uint32_t inicioCerrado() const {
+    return (*this).inicioCerrada;
+  }  // ()
+
+  /**
+   * @function inicioAbierto
+   * @brief Cuándo empezó la ventana abierta (millis()): lo que lleva de ella
+   * es ahora - inicioAbierto(), sobre duracion(). Sin sentido hasta que la
+   * abre una medición.
+   */
+  uint32_t inicioAbierto() const {
+    return (*this).inicioAbierta;
+  }  // ()
+
+  /**
+   * @function ventanasCerradas
+   * @brief Cuántas se han cerrado: si cambia, hay una nueva.
+   */
+  uint32_t ventanasCerradas() const {
+    return (*this).cerradas;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,305 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file AlmacenFlash.h
+ * @brief Registro circular en la flash interna: se añade al final y se lee desde un cursor.
+ * @author Sento Marcos Ibarra
+ *
+ * Si no hay ningún teléfono cerca, lo que se anuncia se pierde. Aquí cada
+ * registro (TAM_REGISTRO bytes, p.ej. un RegistroMedicion) se guarda para
+ * descargarlo después (DescargaRegistros.h).
+ *
+ * La zona son PAGINAS páginas de 4 KiB a partir de una dirección. Los
+ * registros se juntan en RAM en una página entera y, cuando está llena, se
+ * escribe de una vez: un borrado y una programación por página, que es lo
+ * que hace de todas formas flash_nrf5x (su caché es de una página). Las
+ * páginas se escriben en orden y en círculo, así que todas se borran lo
+ * mismo (una vez por vuelta) y la nueva pisa a la más antigua.
+ *
+ * Cada página lleva una cabecera:
+ *
+ *   byte 0-3   MAGIA
+ *   byte 4-7   número de página (uint32, crece siempre: la ranura es número % PAGINAS)
+ *   byte 8-9   registros en la página
+ *   byte 10-11 CRC-16 (CCITT) de los registros
+ *
+ * Al arrancar, montar() lee las cabeceras (y comprueba los CRC): las que no
+ * cuadran, p.ej. una página a medio escribir al quedarse sin batería, se
+ * dan por vacías.
+ *
+ * Cursor: el registro i de la página n es n * POR_PAGINA + i. No se repite
+ * nunca, así que quien descarga puede seguir por donde se quedó aunque en
+ * medio se hayan escrito páginas nuevas. Los huecos (páginas a medias, por
+ * volcar() o por un reinicio, y páginas malas) se saltan al leer.
+ *
+ * Lo que está aún en la página de RAM se pierde si se va la corriente:
+ * volcar() la escribe a medias (el resto de la página queda sin usar).
+ */
+
+#ifndef ALMACEN_FLASH_H_INCLUIDO
+#define ALMACEN_FLASH_H_INCLUIDO
+
+#include <stdint.h>
+#include <string.h>
+
+#include "flash/flash_nrf5x.h"
+#include "TramaMediciones.h"
+#include "Crc16.h"
+
+/**
+ * @class AlmacenFlash
+ * @brief Páginas de registros de tamaño fijo, en círculo, con la última en RAM.
+ * @tparam TAM_REGISTRO Bytes de cada registro.
+ * @tparam PAGINAS Páginas de flash de la zona.
+ */
+template<uint8_t TAM_REGISTRO, uint16_t PAGINAS>
+class AlmacenFlash {
+
+public:
+
+  /**
+   * @brief Forma de las páginas.
+   */
+  enum {
+    TAMANYO_REGISTRO = TAM_REGISTRO,
+    TAMANYO_PAGINA = 4096,
+    TAMANYO_CABECERA = 12,
+    POR_PAGINA = (TAMANYO_PAGINA - TAMANYO_CABECERA) / TAM_REGISTRO  ///< Registros por página.
+  };
+
+  static const uint32_t MAGIA = 0x3344524C;  ///< "3DRL".
+
+private:
+
+  static_assert(TAM_REGISTRO > 0 && TAM_REGISTRO <= TAMANYO_PAGINA - TAMANYO_CABECERA,
+                "el registro tiene que caber en una página");
+  static_assert(PAGINAS >= 2, "con una sola página, al escribirla se perdería todo");
+
+  static const uint32_t NINGUNA = 0xFFFFFFFF;
+
+  const uint32_t direccion;  ///< De la primera página (múltiplo de TAMANYO_PAGINA).
+
+  uint32_t numeroEnRanura[PAGINAS];  ///< Número de la página que hay en cada ranura, o NINGUNA.
+  uint16_t cuentaEnRanura[PAGINAS];
+
+  uint32_t numeroActual;  ///< El de la página que se está llenando en RAM.
+  uint16_t cuentaActual;
+  uint8_t laPagina[TAMANYO_PAGINA];  ///< Cabecera y registros, tal como irá a la flash.
+
+  // .........................................................
+  // .........................................................
+  uint32_t direccionRanura(uint16_t ranura) const {
+    return (*this).direccion + (uint32_t)ranura * TAMANYO_PAGINA;
+  }  // ()
+
+  // .........................................................
+  // la más antigua que aún puede estar en la flash: la ranura de
+  // la página en RAM guarda la de hace una vuelta hasta escribirla
+  // .........................................................
+  uint32_t paginaMasAntigua() const {
+    return (*this).numeroActual < PAGINAS ? 0 : (*this).numeroActual - PAGINAS;
+  }  // ()
+
+  /**
+   * @brief Escribe la página de RAM (si tiene algo) en su ranura y empieza otra.
+   */
+  void escribirPagina() {
+    if ((*this).cuentaActual == 0) {
+      return;
+    }
+
+    uint16_t bytes = (*this).cuentaActual * TAM_REGISTRO;
+    uint8_t* cabecera = &(*this).laPagina[0];
+    TramaMediciones::escribir32(&cabecera[0], MAGIA);
+    TramaMediciones::escribir32(&cabecera[4], (*this).numeroActual);
+    TramaMediciones::escribir16(&cabecera[8], (*this).cuentaActual);
+    TramaMediciones::escribir16(&cabecera[10], crc16(&cabecera[TAMANYO_CABECERA], bytes));
+    memset(&cabecera[TAMANYO_CABECERA + bytes], 0xFF, TAMANYO_PAGINA - TAMANYO_CABECERA - bytes);
+
+    uint16_t ranura = (*this).numeroActual % PAGINAS;
+    flash_nrf5x_write((*this).direccionRanura(ranura), &(*this).laPagina[0], TAMANYO_PAGINA);
+    flash_nrf5x_flush();
+
+    (*this).numeroEnRanura[ranura] = (*this).numeroActual;
+    (*this).cuentaEnRanura[ranura] = (*this).cuentaActual;
+
+    (*this).numeroActual++;
+    (*this).cuentaActual = 0;
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor. No toca la flash: eso lo hace montar().
+   * @param direccion_ De la primera página. La zona no puede solaparse con
+   *        el programa ni con InternalFS (0xED000-0xF4000 en el nRF52840).
+   */
+  AlmacenFlash(uint32_t direccion_)
+    : direccion(direccion_), numeroEnRanura(), cuentaEnRanura(),
+      numeroActual(0), cuentaActual(0) {
+    for (uint16_t r = 0; r < PAGINAS; r++) {
+      (*this).numeroEnRanura[r] = NINGUNA;
+    }
+  }  // ()
+
+  /**
+   * @function montar
+   * @brief Lee las cabeceras de la zona y sigue a continuación de la página más nueva.
+   * @return Páginas válidas encontradas.
+   */
+  uint16_t montar() {
+    uint16_t validas = 0;
+    uint32_t mayor = 0;
+
+    for (uint16_t r = 0; r < PAGINAS; r++) {
+      (*this).numeroEnRanura[r] = NINGUNA;
+
+      // la página de RAM aún está libre: sirve para leer la entera
+      flash_nrf5x_read(&(*this).laPagina[0], (*this).direccionRanura(r), TAMANYO_PAGINA);
+      const uint8_t* cabecera = &(*this).laPagina[0];
+      uint32_t numero = TramaMediciones::leer32(&cabecera[4]);
+      uint16_t cuenta = TramaMediciones::leer16(&cabecera[8]);
+
+      if (TramaMediciones::leer32(&cabecera[0]) != MAGIA
+          || numero == NINGUNA || numero % PAGINAS != r
+          || cuenta == 0 || cuenta > POR_PAGINA
+          || TramaMediciones::leer16(&cabecera[10])
+             != crc16(&cabecera[TAMANYO_CABECERA], cuenta * TAM_REGISTRO)) {
+        continue;
+      }
+
+      (*this).numeroEnRanura[r] = numero;
+      (*this).cuentaEnRanura[r] = cuenta;
+      if (validas == 0 || numero > mayor) {
+        mayor = numero;
+      }
+      validas++;
+    }  // for
+
+    (*this).numeroActual = (validas == 0 ? 0 : mayor + 1);
+    (*this).cuentaActual = 0;
+
+    //
+    // las de vueltas anteriores (no deberían quedar) no cuentan
+    //
+    for (uint16_t r = 0; r < PAGINAS; r++) {
+      if ((*this).numeroEnRanura[r] != NINGUNA
+          && (*this).numeroEnRanura[r] < (*this).paginaMasAntigua()) {
+        (*this).numeroEnRanura[r] = NINGUNA;
+        validas--;
+      }
+    }
+
+    return validas;
+  }  // ()
+
+  /**
+   * @function anyadir
+   * @brief Añade un registro. Si llena la página de RAM, la escribe en la flash.
+   * @param registro TAM_REGISTRO bytes.
+   * @return true si se ha escrito una página.
+   */
+  bool anyadir(const uint8_t* registro) {
+    memcpy(&(*this).laPagina[TAMANYO_CABECERA + (*this).cuentaActual * TAM_REGISTRO],
+           registro, TAM_REGISTRO);
+    (*this).cuentaActual++;
+
+    if ((*this).cuentaActual < POR_PAGINA) {
+      return false;
+    }
+    (*this).escribirPagina();
+    return true;
+  }  // ()
+
+  /**
+   * @function volcar
+   * @brief Escribe ya la página de RAM, aunque no esté llena (p.ej. antes de apagar).
+   */
+  void volcar() {
+    (*this).escribirPagina();
+  }  // ()
+
+  /**
+   * @function primero
+   * @brief Cursor del registro más antiguo que queda.
+   */
+  uint32_t primero() const {
+    for (uint32_t n = (*this).paginaMasAntigua(); n < (*this).numeroActual; n++) {
+      if ((*this).numeroEnRanura[n % PAGINAS] == n) {
+        return n * POR_PAGINA;
+      }
+    }
+    return (*this).numeroActual * POR_PAGINA;
+  }  // ()
+
+  /**
+   * @function siguiente
+   * @brief Cursor que tendrá el próximo registro (uno más que el último).
+   */
+  uint32_t siguiente() const {
+    return (*this).numeroActual * POR_PAGINA + (*this).cuentaActual;
+  }  // ()
+
+  /**
+   * @function leer
+   * @brief Lee registros seguidos a partir de un cursor, de la flash o de la página de RAM.
+   *
+   * Si en cursor no hay nada (ya se ha pisado, o es un hueco), se mueve al
+   * primero que hay después. Los registros leídos son cursor, cursor + 1...
+   * (dentro de una página no hay huecos), así que para seguir: cursor += n.
+   *
+   * @param cursor Desde dónde; se deja en el del primer registro leído.
+   * @param destino maximo * TAM_REGISTRO bytes.
+   * @param maximo Registros como mucho.
+   * @return Registros leídos; 0 si no hay más.
+   */
+  uint16_t leer(uint32_t& cursor, uint8_t* destino, uint16_t maximo) {
+    if (cursor < (*this).paginaMasAntigua() * POR_PAGINA) {
+      cursor = (*this).primero();
+    }
+
+    while (cursor < (*this).siguiente()) {
+      uint32_t pagina = cursor / POR_PAGINA;
+      uint16_t i = cursor % POR_PAGINA;
+
+      if (pagina == (*this).numeroActual) {
+        uint16_t n = (*this).cuentaActual - i;
+        n = (n < maximo ? n : maximo);
+        memcpy(destino, &(*this).laPagina[TAMANYO_CABECERA + i * TAM_REGISTRO], n * TAM_REGISTRO);
+        return n;
+      }
+
+      uint16_t ranura = pagina % PAGINAS;
+      if ((*this).numeroEnRanura[ranura] != pagina || i >= (*this).cuentaEnRanura[ranura]) {
+        cursor = (pagina + 1) * POR_PAGINA;  // hueco: a la página siguiente
+        continue;
+      }
+
+      uint16_t n = (*this).cuentaEnRanura[ranura] - i;
+      n = (n < maximo ? n : maximo);
+      flash_nrf5x_read(destino,
+                       (*this).direccionRanura(ranura) + TAMANYO_CABECERA + i * TAM_REGISTRO,
+                       n * TAM_REGISTRO);
+      return n;
+    }  // while
+
+    return 0;
+  }  // ()
+
+  /**
+   * @function paginasEscritas
+   * @brief Páginas escritas desde que se empezó a usar la zona.
+   *
+   * Cada ranura se ha borrado unas paginasEscritas() / PAGINAS veces.
+   */
+  uint32_t paginasEscritas() const {
+    return (*this).numeroActual;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
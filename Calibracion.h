@@ -0,0 +1,250 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Calibracion.h
+ * @brief De cuentas del ADC a ppb y ºC en coma fija, con compensación de temperatura por tabla.
+ * @author Sento Marcos Ibarra
+ *
+ * Cada sensor ULPSM viene con sus coeficientes (código de sensibilidad en
+ * nA/ppm, ganancia del transimpedancia, cero...). Se escriben en un
+ * CoeficientesSensor y TablaCalibracion los convierte en enteros. Los de
+ * la etiqueta del sketch se convierten al compilar; los de cada placa se
+ * graban en su página de flash (CalibracionEnFlash) y, si están, se
+ * convierten una vez al arrancar. Al medir no hay ni un float:
+ *
+ *   ppb = (Vgas - Vref - cero(T)) * ppbPorCuenta * compensacion(T)
+ *
+ * con cero(T) y compensacion(T) interpolados en la tabla, cada PASO_TABLA ºC
+ * desde TEMPERATURA_MINIMA. El span del sensor cambia con la temperatura
+ * como 1 + a (T - 20) + b (T - 20)^2 y el cero se desplaza linealmente.
+ *
+ * Formatos (QN = N bits de fracción):
+ *  - medias de cuentas del ADC: Q4
+ *  - temperatura: Q8 (1/256 ºC)
+ *  - cero: Q8 (cuentas)
+ *  - ppbPorCuenta, gradosPorCuenta: Q16
+ *  - compensación: Q14
+ *
+ * En la flash, una página para ellos solos (se graba en fábrica, con
+ * guardar() o directamente con el programador):
+ *
+ *   byte 0-3  MAGIA
+ *   byte 4-5  bytes de coeficientes (sizeof(CoeficientesSensor))
+ *   byte 6-7  CRC-16 (CCITT) de los coeficientes
+ *   byte 8-   el CoeficientesSensor tal cual (double IEEE 754, little-endian)
+ *
+ * Escrito en C++11: los constexpr son de una sola expresión.
+ */
+
+#ifndef CALIBRACION_H_INCLUIDO
+#define CALIBRACION_H_INCLUIDO
+
+#include <stdint.h>
+#include <string.h>
+
+#include "flash/flash_nrf5x.h"
+#include "TramaMediciones.h"
+#include "Crc16.h"
+
+/**
+ * @struct CoeficientesSensor
+ * @brief Lo que dice la etiqueta (y la calibración) de un sensor concreto.
+ */
+struct CoeficientesSensor {
+  double sensibilidad;       ///< nA/ppm (negativa en el de ozono).
+  double ganancia;           ///< kV/A del amplificador de transimpedancia.
+  double ceroMv;             ///< Vgas - Vref con aire limpio a 20 ºC, en mV.
+  double derivaCeroMv;       ///< Cuánto se mueve el cero por ºC, en mV.
+  double spanLineal;         ///< a, por ºC.
+  double spanCuadratico;     ///< b, por ºC^2.
+  double alimentacionMv;     ///< V+ del sensor, en mV (para Vtemp).
+  double milivoltiosPorCuenta;  ///< Del ADC: fondo de escala / 2^bits.
+};
+
+/**
+ * @struct TablaCalibracion
+ * @brief Coeficientes en coma fija y tabla de compensación por temperatura.
+ */
+struct TablaCalibracion {
+
+  /**
+   * @brief Forma de la tabla.
+   */
+  enum {
+    TEMPERATURA_MINIMA = -24,  ///< ºC de la primera entrada.
+    LOG2_PASO = 3,
+    PASO_TABLA = 1 << LOG2_PASO,  ///< ºC entre entradas.
+    ENTRADAS = 11                 ///< De -24 a 56 ºC.
+  };
+
+  int32_t ppbPorCuentaQ16;
+  int32_t gradosPorCuentaQ16;
+  int32_t ceroQ8[ENTRADAS];            ///< Cero, en cuentas del ADC.
+  uint16_t compensacionQ14[ENTRADAS];  ///< 1 / span.
+
+  // .........................................................
+  // al compilar
+  // .........................................................
+  static constexpr int32_t redondear(double x) {
+    return (int32_t)(x < 0 ? x - 0.5 : x + 0.5);
+  }  // ()
+
+  static constexpr double temperatura(int i) {
+    return TEMPERATURA_MINIMA + i * PASO_TABLA;
+  }  // ()
+
+  static constexpr int32_t cero(const CoeficientesSensor& c, int i) {
+    return redondear((c.ceroMv + c.derivaCeroMv * (temperatura(i) - 20))
+                     / c.milivoltiosPorCuenta * 256);
+  }  // ()
+
+  static constexpr uint16_t compensacion(const CoeficientesSensor& c, int i) {
+    return (uint16_t)redondear(16384.0
+                               / (1 + c.spanLineal * (temperatura(i) - 20)
+                                  + c.spanCuadratico * (temperatura(i) - 20) * (temperatura(i) - 20)));
+  }  // ()
+
+  /**
+   * @brief Constructor (al compilar) a partir de los coeficientes del sensor.
+   *
+   * ppb por mV = 1000 / (sensibilidad * ganancia / 1000)
+   */
+  constexpr TablaCalibracion(const CoeficientesSensor& c)
+    : ppbPorCuentaQ16(redondear(1e6 / (c.sensibilidad * c.ganancia)
+                                * c.milivoltiosPorCuenta * 65536)),
+      gradosPorCuentaQ16(redondear(87.0 / c.alimentacionMv * c.milivoltiosPorCuenta * 65536)),
+      ceroQ8{ cero(c, 0), cero(c, 1), cero(c, 2), cero(c, 3), cero(c, 4), cero(c, 5),
+              cero(c, 6), cero(c, 7), cero(c, 8), cero(c, 9), cero(c, 10) },
+      compensacionQ14{ compensacion(c, 0), compensacion(c, 1), compensacion(c, 2),
+                       compensacion(c, 3), compensacion(c, 4), compensacion(c, 5),
+                       compensacion(c, 6), compensacion(c, 7), compensacion(c, 8),
+                       compensacion(c, 9), compensacion(c, 10) } {
+    static_assert(ENTRADAS == 11, "cambiar también la lista de cero() y compensacion()");
+  }  // ()
+
+  // .........................................................
+  // al medir
+  // .........................................................
+
+  /**
+   * @function temperaturaQ8
+   * @brief T = 87 / V+ * Vtemp - 18 (hoja del ULPSM).
+   * @param vtempQ4 Media de Vtemp en cuentas, Q4.
+   * @return ºC en Q8.
+   */
+  int32_t temperaturaQ8(int32_t vtempQ4) const {
+    return (int32_t)(((int64_t)vtempQ4 * (*this).gradosPorCuentaQ16 + (1 << 11)) >> 12) - 18 * 256;
+  }  // ()
+
+  /**
+   * @function ppb
+   * @brief Concentración compensada en temperatura.
+   * @param diferenciaQ4 Media de Vgas - Vref en cuentas, Q4.
+   * @param temperaturaQ8_ ºC en Q8.
+   * @return ppb, saturado a int16 (lo que cabe en el minor de un iBeacon).
+   */
+  int16_t ppb(int32_t diferenciaQ4, int32_t temperaturaQ8_) const {
+
+    //
+    // posición en la tabla: entrada i y fracción (Q(8 + LOG2_PASO)) hacia la i+1
+    //
+    int32_t desde = temperaturaQ8_ - TEMPERATURA_MINIMA * 256;
+    int32_t maximo = (ENTRADAS - 1) * PASO_TABLA * 256;
+    desde = (desde < 0 ? 0 : desde > maximo ? maximo : desde);
+
+    const uint8_t BITS_FRACCION = 8 + LOG2_PASO;
+    int32_t i = desde >> BITS_FRACCION;
+    int32_t f = desde & ((1 << BITS_FRACCION) - 1);
+    int32_t j = (i + 1 < ENTRADAS ? i + 1 : i);
+
+    int32_t ceroT = (*this).ceroQ8[i]
+                    + (((*this).ceroQ8[j] - (*this).ceroQ8[i]) * f >> BITS_FRACCION);
+    int32_t compensacionT = (*this).compensacionQ14[i]
+                            + ((((int32_t)(*this).compensacionQ14[j] - (*this).compensacionQ14[i]) * f)
+                               >> BITS_FRACCION);
+
+    //
+    // Q8 * Q16 = Q24 -> ppb; luego * Q14
+    //
+    int64_t p = ((int64_t)(diferenciaQ4 * 16 - ceroT) * (*this).ppbPorCuentaQ16 + (1 << 23)) >> 24;
+    p = (p * compensacionT + (1 << 13)) >> 14;
+
+    return (int16_t)(p > 32767 ? 32767 : p < -32768 ? -32768 : p);
+  }  // ()
+
+};  // struct
+
+/**
+ * @struct CalibracionEnFlash
+ * @brief Los coeficientes de la placa, en su página de flash.
+ */
+struct CalibracionEnFlash {
+
+  static const uint32_t MAGIA = 0x33444341;  ///< "3DCA".
+
+  enum {
+    TAMANYO_CABECERA = 8
+  };
+
+  /**
+   * @function validos
+   * @brief Si se puede hacer una tabla con ellos (sin dividir por 0 ni NaN).
+   */
+  static bool validos(const CoeficientesSensor& c) {
+    return c.sensibilidad * c.ganancia != 0 && c.alimentacionMv > 0 && c.milivoltiosPorCuenta > 0
+           && c.ceroMv == c.ceroMv && c.derivaCeroMv == c.derivaCeroMv
+           && c.spanLineal == c.spanLineal && c.spanCuadratico == c.spanCuadratico;
+  }  // ()
+
+  /**
+   * @function cargar
+   * @brief Lee los coeficientes grabados.
+   * @param direccion Su página de flash.
+   * @param c Donde se dejan (no cambia si no hay o no valen).
+   * @return false si no hay, están a medio escribir o no valen.
+   */
+  static bool cargar(uint32_t direccion, CoeficientesSensor& c) {
+    uint8_t pagina[TAMANYO_CABECERA + sizeof(CoeficientesSensor)];
+    flash_nrf5x_read(&pagina[0], direccion, sizeof(pagina));
+    if (TramaMediciones::leer32(&pagina[0]) != MAGIA
+        || TramaMediciones::leer16(&pagina[4]) != sizeof(CoeficientesSensor)
+        || TramaMediciones::leer16(&pagina[6])
+             != crc16(&pagina[TAMANYO_CABECERA], sizeof(CoeficientesSensor))) {
+      return false;
+    }
+    CoeficientesSensor leidos;
+    memcpy(&leidos, &pagina[TAMANYO_CABECERA], sizeof(leidos));
+    if (!validos(leidos)) {
+      return false;
+    }
+    c = leidos;
+    return true;
+  }  // ()
+
+  /**
+   * @function guardar
+   * @brief Graba los coeficientes de esta placa (en fábrica: un borrado de página).
+   * @return false si no valen (no se graba nada).
+   */
+  static bool guardar(uint32_t direccion, const CoeficientesSensor& c) {
+    if (!validos(c)) {
+      return false;
+    }
+    uint8_t pagina[TAMANYO_CABECERA + sizeof(CoeficientesSensor)];
+    memcpy(&pagina[TAMANYO_CABECERA], &c, sizeof(c));
+    TramaMediciones::escribir32(&pagina[0], MAGIA);
+    TramaMediciones::escribir16(&pagina[4], sizeof(CoeficientesSensor));
+    TramaMediciones::escribir16(&pagina[6],
+                                crc16(&pagina[TAMANYO_CABECERA], sizeof(CoeficientesSensor)));
+    flash_nrf5x_write(direccion, &pagina[0], sizeof(pagina));
+    flash_nrf5x_flush();
+    return true;
+  }  // ()
+
+};  // struct
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,160 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file ColaSPSC.h
+ * @brief Cola circular sin cerrojos para un solo productor y un solo consumidor.
+ * @author Sento Marcos Ibarra
+ *
+ * Quien mete sólo escribe elUltimo y quien saca sólo escribe elPrimero;
+ * cada uno lee el del otro con acquire y publica el suyo con release.
+ * Ninguna operación espera ni desactiva interrupciones: el productor puede
+ * ser una interrupción (o una tarea de más prioridad) y el consumidor una
+ * tarea, sin secciones críticas.
+ *
+ *   ColaSPSC< Medicion, 8 > laCola;
+ *
+ *   laCola.meter( m );                         // productor
+ *   uint16_t n = laCola.sacar( & lote[0], 8 ); // consumidor: todo lo que haya
+ *
+ * Los índices no dan la vuelta (se usa & (N - 1)), así que N tiene que ser
+ * potencia de 2 y caben N elementos, no N - 1. Si la cola está llena, lo
+ * que no cabe se pierde y se cuenta en perdidas(): el productor no depende
+ * de lo que tarde el consumidor.
+ *
+ * Para esperar sin gastar CPU, el consumidor se bloquea en otra cosa (una
+ * notificación de FreeRTOS, p.ej.) y el productor le avisa después de
+ * meter: la cola no sabe de tareas.
+ */
+
+#ifndef COLA_SPSC_H_INCLUIDO
+#define COLA_SPSC_H_INCLUIDO
+
+#include <atomic>
+#include <type_traits>
+
+/**
+ * Separación entre los dos índices: en la placa (Cortex-M4, sin caché) basta
+ * con una palabra; en el ordenador, una línea de caché, para que productor y
+ * consumidor no se roben la línea el uno al otro.
+ */
+#ifndef ALINEACION_COLA_SPSC
+#ifdef ANFITRION
+#define ALINEACION_COLA_SPSC 64
+#else
+#define ALINEACION_COLA_SPSC 4
+#endif
+#endif
+
+/**
+ * @class ColaSPSC
+ * @brief Cola de N elementos de tipo T entre un productor y un consumidor.
+ * @tparam T Se copia byte a byte.
+ * @tparam N Potencia de 2.
+ */
+template<typename T, uint16_t N>
+class ColaSPSC {
+
+private:
+
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N tiene que ser potencia de 2");
+  static_assert(std::is_trivially_copyable<T>::value, "la cola copia los elementos byte a byte");
+
+  static const uint32_t MASCARA = N - 1;
+
+  T losElementos[N];
+
+  alignas(ALINEACION_COLA_SPSC) std::atomic<uint32_t> elPrimero;  ///< Siguiente a sacar: sólo lo escribe el consumidor.
+  alignas(ALINEACION_COLA_SPSC) std::atomic<uint32_t> elUltimo;   ///< Siguiente hueco: sólo lo escribe el productor.
+  std::atomic<uint32_t> perdidos;                                ///< También del productor.
+
+public:
+
+  /**
+   * @brief Constructor: vacía.
+   */
+  ColaSPSC()
+    : elPrimero(0), elUltimo(0), perdidos(0) {
+  }  // ()
+
+  /**
+   * @function meter
+   * @brief (Productor) Copia x al final, sin esperar.
+   * @return false si estaba llena (se cuenta en perdidas()).
+   */
+  bool meter(const T& x) {
+    return (*this).meter(&x, 1) == 1;
+  }  // ()
+
+  /**
+   * @function meter
+   * @brief (Productor) Copia al final los n de xs que quepan, en orden; los
+   * demás se pierden.
+   * @return Los que se han metido.
+   */
+  uint16_t meter(const T* xs, uint16_t n) {
+    uint32_t ultimo = (*this).elUltimo.load(std::memory_order_relaxed);
+    uint32_t primero = (*this).elPrimero.load(std::memory_order_acquire);  // lo ya sacado se puede pisar
+    uint32_t libres = N - (ultimo - primero);
+    uint16_t caben = n < libres ? n : (uint16_t)libres;
+    for (uint16_t i = 0; i < caben; i++) {
+      (*this).losElementos[(ultimo + i) & MASCARA] = xs[i];
+    }
+    (*this).elUltimo.store(ultimo + caben, std::memory_order_release);  // después de copiar
+    if (caben < n) {
+      (*this).perdidos.store((*this).perdidos.load(std::memory_order_relaxed) + (n - caben),
+                             std::memory_order_relaxed);
+    }
+    return caben;
+  }  // ()
+
+  /**
+   * @function sacar
+   * @brief (Consumidor) Saca el primero, si hay.
+   * @return false si estaba vacía.
+   */
+  bool sacar(T& x) {
+    return (*this).sacar(&x, 1) == 1;
+  }  // ()
+
+  /**
+   * @function sacar
+   * @brief (Consumidor) Saca hasta max elementos, los más antiguos primero.
+   * @return Los que se han sacado.
+   */
+  uint16_t sacar(T* xs, uint16_t max) {
+    uint32_t primero = (*this).elPrimero.load(std::memory_order_relaxed);
+    uint32_t ultimo = (*this).elUltimo.load(std::memory_order_acquire);  // lo copiado antes, ya se ve
+    uint32_t hay = ultimo - primero;
+    uint16_t n = max < hay ? max : (uint16_t)hay;
+    for (uint16_t i = 0; i < n; i++) {
+      xs[i] = (*this).losElementos[(primero + i) & MASCARA];
+    }
+    (*this).elPrimero.store(primero + n, std::memory_order_release);  // después de copiar
+    return n;
+  }  // ()
+
+  /**
+   * @function cuantos
+   * @brief Los que hay. Desde el otro lado, una foto que puede estar vieja.
+   */
+  uint16_t cuantos() const {
+    uint32_t primero = (*this).elPrimero.load(std::memory_order_acquire);  // primero: si no, podría salir negativo
+    uint32_t hay = (*this).elUltimo.load(std::memory_order_acquire) - primero;
+    return (uint16_t)(hay < N ? hay : N);
+  }  // ()
+
+  /**
+   * @function perdidas
+   * @brief Elementos que no cabían.
+   */
+  uint32_t perdidas() const {
+    return (*this).perdidos.load(std::memory_order_relaxed);
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
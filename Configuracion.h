@@ -0,0 +1,416 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Configuracion.h
+ * @brief Ajustes que se cambian sin volver a grabar: por una característica, en TLV, y guardados en flash.
+ * @author Sento Marcos Ibarra
+ *
+ * Lo que se escribe en la característica es una lista de TLV, uno detrás
+ * de otro:
+ *
+ *   tipo (1 byte)  longitud (1 byte)  valor (longitud bytes, big-endian)
+ *
+ *   0x01 PERIODO_CICLO        4  ms entre mediciones
+ *   0x02 INTERVALO_REPOSO     2  0.625 ms: el del anuncio adaptativo sin cambios...
+ *   0x03 INTERVALO_MAXIMO     2  ...y hasta dónde se dobla
+ *   0x04 INTERVALO_EXTENDIDO  2  0.625 ms: el de los anuncios extendidos
+ *   0x05 POTENCIA             1  dBm, con signo (EmisoraBLE::potenciaValida())
+ *   0x06 VENTANA              4  ms de cada ventana de resúmenes (Agregador.h); 0: sin resúmenes
+ *   0x7F DE_FABRICA           0  todo como al grabar (lo que venga detrás, encima)
+ *
+ *   p.ej. 01 04 00 00 27 10 05 01 00: un ciclo cada 10 s, a 0 dBm
+ *
+ * Todo o nada: si un TLV está mal (tipo desconocido, longitud que no es la
+ * suya, valor fuera de rango o que se sale de lo escrito) no cambia nada.
+ * Lo que depende de dos ajustes se mira con todos ya leídos: el reposo no
+ * puede pasar del máximo y en una ventana tiene que haber al menos un ciclo
+ * por sensor (ciclosPorVentana, lo mismo que comprueba el sketch al compilar).
+ * Se lee sin copiar (LectorTLV va por el buffer que da Bluefruit) y sólo
+ * se guarda el resultado, unos Ajustes.
+ *
+ * Como la descarga, pedir() (desde el callback de escritura) sólo lo anota;
+ * tomarPendiente() lo recoge en el siguiente ciclo y quien lo recoge lo
+ * aplica todo a la vez y lo guarda(). Si se escribe varias veces antes, se
+ * acumula: lo que no cabe en una escritura (con el MTU mínimo, 20 bytes)
+ * puede ir en dos y se aplica junto.
+ *
+ * En la flash, una página para ellos solos:
+ *
+ *   byte 0-3  MAGIA
+ *   byte 4-5  bytes de TLV
+ *   byte 6-7  CRC-16 (CCITT) de los TLV
+ *   byte 8-   los TLV de todos los ajustes (lo mismo que se lee en la característica)
+ *
+ * cargar() los lee con el mismo lector: una página a medio escribir o de
+ * otra versión se queda en los de fábrica. Lo que no está en la página
+ * (p.ej. VENTANA en una guardada antes de que existiera) también.
+ */
+
+#ifndef CONFIGURACION_H_INCLUIDO
+#define CONFIGURACION_H_INCLUIDO
+
+#include <stdint.h>
+#include <string.h>
+
+#include "flash/flash_nrf5x.h"
+#include "TramaMediciones.h"
+#include "Crc16.h"
+#include "EmisoraBLE.h"
+
+/**
+ * @class LectorTLV
+ * @brief Recorre una lista de TLV en un buffer, sin copiarlo.
+ */
+class LectorTLV {
+
+private:
+
+  const uint8_t* p;
+  const uint8_t* fin;
+  bool roto;  ///< Un TLV se sale del buffer.
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param datos El buffer (tiene que seguir ahí mientras se lee).
+   * @param tam Sus bytes.
+   */
+  LectorTLV(const uint8_t* datos, uint16_t tam)
+    : p(datos), fin(datos + tam), roto(false) {
+  }  // ()
+
+  /**
+   * @function siguiente
+   * @brief El TLV siguiente.
+   * @param tipo Su tipo.
+   * @param valor Dónde empieza su valor, dentro del buffer.
+   * @param longitud Bytes del valor.
+   * @return false si no quedan más o el que queda se sale (ver estaRoto()).
+   */
+  bool siguiente(uint8_t& tipo, const uint8_t*& valor, uint8_t& longitud) {
+    if ((*this).p == (*this).fin) {
+      return false;
+    }
+    if ((*this).fin - (*this).p < 2 || (*this).fin - (*this).p - 2 < (*this).p[1]) {
+      (*this).roto = true;
+      return false;
+    }
+    tipo = (*this).p[0];
+    longitud = (*this).p[1];
+    valor = (*this).p + 2;
+    (*this).p += 2 + longitud;
+    return true;
+  }  // ()
+
+  /**
+   * @function estaRoto
+   * @brief Si se ha parado en un TLV que se sale del buffer.
+   */
+  bool estaRoto() const {
+    return (*this).roto;
+  }  // ()
+
+};  // class
+
+/**
+ * @class Configuracion
+ * @brief Los ajustes en uso, los que esperan al siguiente ciclo y su copia en flash.
+ */
+class Configuracion {
+
+public:
+
+  /**
+   * @enum TipoTLV
+   */
+  enum TipoTLV {
+    PERIODO_CICLO = 0x01,
+    INTERVALO_REPOSO = 0x02,
+    INTERVALO_MAXIMO = 0x03,
+    INTERVALO_EXTENDIDO = 0x04,
+    POTENCIA = 0x05,
+    VENTANA = 0x06,
+    DE_FABRICA = 0x7F
+  };
+
+  /**
+   * @struct Ajustes
+   */
+  struct Ajustes {
+    uint32_t periodoCiclo;        ///< ms.
+    uint16_t intervaloReposo;     ///< 0.625 ms.
+    uint16_t intervaloMaximo;     ///< 0.625 ms.
+    uint16_t intervaloExtendido;  ///< 0.625 ms.
+    int8_t potencia;              ///< dBm.
+    uint32_t ventana;             ///< ms; 0: se publica cada medición.
+  };
+
+  static const uint32_t PERIODO_MAXIMO = 3600000;  ///< 1 h.
+  static const uint16_t INTERVALO_MINIMO = 32;     ///< 20 ms, lo que deja BLE.
+  static const uint16_t INTERVALO_TOPE = 16384;    ///< 10.24 s.
+
+  /**
+   * @brief Bytes de los TLV de todos los ajustes: lo que cabe en la característica.
+   */
+  static const uint8_t TAMANYO_TLV = (2 + 4) + 3 * (2 + 2) + (2 + 1) + (2 + 4);
+
+  static const uint32_t MAGIA = 0x33444346;  ///< "3DCF".
+
+private:
+
+  enum {
+    TAMANYO_CABECERA = 8
+  };
+
+  const Ajustes deFabrica;
+  const uint32_t periodoMinimo;
+  const uint8_t ciclosPorVentana;  ///< Los que tiene que haber como poco en una ventana.
+  const uint32_t direccion;        ///< De su página de flash.
+
+  Ajustes vigentes;   ///< Sólo los cambia tomarPendiente().
+  Ajustes pendientes;
+  volatile bool hayPendientes;
+
+  volatile uint32_t rechazadas;  ///< Las cuenta pedir(), en su sección crítica.
+
+  // .........................................................
+  // un TLV encima de a; false si no vale
+  // .........................................................
+  bool aplicarTLV(Ajustes& a, uint8_t tipo, const uint8_t* valor, uint8_t longitud) const {
+    switch (tipo) {
+    case PERIODO_CICLO: {
+      if (longitud != 4) {
+        return false;
+      }
+      uint32_t v = TramaMediciones::leer32(valor);
+      if (v < (*this).periodoMinimo || v > PERIODO_MAXIMO) {
+        return false;
+      }
+      a.periodoCiclo = v;
+      return true;
+    }
+    case INTERVALO_REPOSO:
+    case INTERVALO_MAXIMO:
+    case INTERVALO_EXTENDIDO: {
+      if (longitud != 2) {
+        return false;
+      }
+      uint16_t v = TramaMediciones::leer16(valor);
+      if (v < INTERVALO_MINIMO || v > INTERVALO_TOPE) {
+        return false;
+      }
+      (tipo == INTERVALO_REPOSO ? a.intervaloReposo
+       : tipo == INTERVALO_MAXIMO ? a.intervaloMaximo
+                                  : a.intervaloExtendido) = v;
+      return true;
+    }
+    case POTENCIA:
+      if (longitud != 1 || !EmisoraBLE::potenciaValida((int8_t)valor[0])) {
+        return false;
+      }
+      a.potencia = (int8_t)valor[0];
+      return true;
+    case VENTANA: {
+      if (longitud != 4) {
+        return false;
+      }
+      uint32_t v = TramaMediciones::leer32(valor);
+      if (v != 0 && (v < (*this).periodoMinimo || v > PERIODO_MAXIMO)) {
+        return false;
+      }
+      a.ventana = v;
+      return true;
+    }
+    case DE_FABRICA:
+      if (longitud != 0) {
+        return false;
+      }
+      a = (*this).deFabrica;
+      return true;
+    default:
+      return false;
+    }  // switch
+  }  // ()
+
+  // .........................................................
+  // todos los TLV encima de a, o nada
+  // .........................................................
+  bool leer(Ajustes& a, const uint8_t* datos, uint16_t tam) const {
+    Ajustes nuevos = a;
+    LectorTLV lector(datos, tam);
+    uint8_t tipo;
+    const uint8_t* valor;
+    uint8_t longitud;
+    while (lector.siguiente(tipo, valor, longitud)) {
+      if (!(*this).aplicarTLV(nuevos, tipo, valor, longitud)) {
+        return false;
+      }
+    }
+    if (lector.estaRoto() || nuevos.intervaloReposo > nuevos.intervaloMaximo) {
+      return false;
+    }
+    if (nuevos.ventana != 0
+        && (uint64_t)nuevos.ventana < (uint64_t)(*this).ciclosPorVentana * nuevos.periodoCiclo) {
+      return false;
+    }
+    a = nuevos;
+    return true;
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  static uint8_t* ponerTLV(uint8_t* p, uint8_t tipo, uint8_t longitud) {
+    p[0] = tipo;
+    p[1] = longitud;
+    return p + 2;
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor: con los de fábrica hasta que se llame a cargar().
+   * @param deFabrica_ Los ajustes con los que se ha grabado.
+   * @param periodoMinimo_ El periodo de ciclo más corto que se admite (ms).
+   * @param ciclosPorVentana_ Ciclos que tiene que haber como poco en una ventana de resúmenes.
+   * @param direccion_ Página de flash para guardarlos (múltiplo de 4096, sólo para esto).
+   */
+  Configuracion(const Ajustes& deFabrica_, uint32_t periodoMinimo_, uint8_t ciclosPorVentana_,
+                uint32_t direccion_)
+    : deFabrica(deFabrica_), periodoMinimo(periodoMinimo_), ciclosPorVentana(ciclosPorVentana_),
+      direccion(direccion_),
+      vigentes(deFabrica_), pendientes(deFabrica_), hayPendientes(false), rechazadas(0) {
+  }  // ()
+
+  /**
+   * @function cargar
+   * @brief Lee los guardados, si los hay y están bien.
+   * @return false si se queda con los de fábrica.
+   */
+  bool cargar() {
+    uint8_t cabecera[TAMANYO_CABECERA];
+    flash_nrf5x_read(&cabecera[0], (*this).direccion, TAMANYO_CABECERA);
+    uint16_t tam = TramaMediciones::leer16(&cabecera[4]);
+    if (TramaMediciones::leer32(&cabecera[0]) != MAGIA || tam > TAMANYO_TLV) {
+      return false;
+    }
+    uint8_t tlv[TAMANYO_TLV];
+    flash_nrf5x_read(&tlv[0], (*this).direccion + TAMANYO_CABECERA, tam);
+    if (TramaMediciones::leer16(&cabecera[6]) != crc16(&tlv[0], tam)) {
+      return false;
+    }
+    return (*this).leer((*this).vigentes, &tlv[0], tam);
+  }  // ()
+
+  /**
+   * @function pedir
+   * @brief Lo escrito en la característica: se comprueba entero y, si vale,
+   * espera al siguiente ciclo.
+   *
+   * Para llamarlo desde el callback de escritura: no toca nada más. Todo
+   * (leer lo que ya había pendiente, comprobar, dejarlo pendiente o contar
+   * el rechazo) va en una sección crítica, para que tomarPendiente() no se
+   * cuele en medio y se pierda una escritura: son unos pocos TLV, poco rato.
+   *
+   * @return false si no valía (no cambia nada; se cuenta en peticionesRechazadas()).
+   */
+  bool pedir(const uint8_t* datos, uint16_t tam) {
+    taskENTER_CRITICAL();
+    Ajustes a = (*this).hayPendientes ? (*this).pendientes : (*this).vigentes;
+    bool vale = (*this).leer(a, datos, tam);
+    if (vale) {
+      (*this).pendientes = a;
+      (*this).hayPendientes = true;
+    } else {
+      (*this).rechazadas++;
+    }
+    taskEXIT_CRITICAL();
+    return vale;
+  }  // ()
+
+  /**
+   * @function tomarPendiente
+   * @brief Al empezar un ciclo: si han pedido algo, pasa a estar en uso.
+   * @return true si ha cambiado: hay que aplicar actuales() (y guardar()).
+   */
+  bool tomarPendiente() {
+    taskENTER_CRITICAL();
+    bool hay = (*this).hayPendientes;
+    if (hay) {
+      (*this).vigentes = (*this).pendientes;
+      (*this).hayPendientes = false;
+    }
+    taskEXIT_CRITICAL();
+    return hay;
+  }  // ()
+
+  /**
+   * @function actuales
+   * @brief Los ajustes en uso.
+   */
+  const Ajustes& actuales() const {
+    return (*this).vigentes;
+  }  // ()
+
+  /**
+   * @function codificar
+   * @brief Los TLV de todos los ajustes en uso.
+   * @param destino TAMANYO_TLV bytes.
+   * @return TAMANYO_TLV.
+   */
+  uint8_t codificar(uint8_t* destino) const {
+    const Ajustes& a = (*this).vigentes;
+    uint8_t* p = destino;
+    p = ponerTLV(p, PERIODO_CICLO, 4);
+    TramaMediciones::escribir32(p, a.periodoCiclo);
+    p = ponerTLV(p + 4, INTERVALO_REPOSO, 2);
+    TramaMediciones::escribir16(p, a.intervaloReposo);
+    p = ponerTLV(p + 2, INTERVALO_MAXIMO, 2);
+    TramaMediciones::escribir16(p, a.intervaloMaximo);
+    p = ponerTLV(p + 2, INTERVALO_EXTENDIDO, 2);
+    TramaMediciones::escribir16(p, a.intervaloExtendido);
+    p = ponerTLV(p + 2, POTENCIA, 1);
+    p[0] = (uint8_t)a.potencia;
+    p = ponerTLV(p + 1, VENTANA, 4);
+    TramaMediciones::escribir32(p, a.ventana);
+    return (uint8_t)(p + 4 - destino);
+  }  // ()
+
+  /**
+   * @function guardar
+   * @brief Escribe los ajustes en uso en su página, si no están ya (un
+   * borrado y una programación: no en cada ciclo).
+   * @return true si se ha escrito.
+   */
+  bool guardar() {
+    uint8_t pagina[TAMANYO_CABECERA + TAMANYO_TLV];
+    uint8_t tam = (*this).codificar(&pagina[TAMANYO_CABECERA]);
+    TramaMediciones::escribir32(&pagina[0], MAGIA);
+    TramaMediciones::escribir16(&pagina[4], tam);
+    TramaMediciones::escribir16(&pagina[6], crc16(&pagina[TAMANYO_CABECERA], tam));
+
+    uint8_t enFlash[TAMANYO_CABECERA + TAMANYO_TLV];
+    flash_nrf5x_read(&enFlash[0], (*this).direccion, TAMANYO_CABECERA + tam);
+    if (memcmp(&enFlash[0], &pagina[0], TAMANYO_CABECERA + tam) == 0) {
+      return false;
+    }
+    flash_nrf5x_write((*this).direccion, &pagina[0], TAMANYO_CABECERA + tam);
+    flash_nrf5x_flush();
+    return true;
+  }  // ()
+
+  /**
+   * @function peticionesRechazadas
+   * @brief Escrituras que no valían.
+   */
+  uint32_t peticionesRechazadas() const {
+    return (*this).rechazadas;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
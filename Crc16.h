@@ -0,0 +1,42 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Crc16.h
+ * @brief CRC-16 CCITT de lo que se guarda en la flash.
+ * @author Sento Marcos Ibarra
+ *
+ * Lo usan las páginas del almacén (AlmacenFlash.h), de los ajustes
+ * (Configuracion.h) y de la calibración (Calibracion.h). No tiene que ver
+ * con los anuncios: va bit a bit, sin tabla, porque se calcula al escribir o
+ * leer una página, no en cada ciclo.
+ *
+ * No depende de Arduino.
+ */
+
+#ifndef CRC16_H_INCLUIDO
+#define CRC16_H_INCLUIDO
+
+#include <stdint.h>
+
+/**
+ * @function crc16
+ * @brief CRC-16 CCITT (polinomio 0x1021, valor inicial 0xFFFF).
+ * @param p Los datos.
+ * @param n Cuántos bytes.
+ */
+inline uint16_t crc16(const uint8_t* p, uint16_t n) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < n; i++) {
+    crc ^= (uint16_t)p[i] << 8;
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
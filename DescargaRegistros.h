@@ -0,0 +1,195 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file DescargaRegistros.h
+ * @brief Descarga por GATT de lo guardado en un AlmacenFlash, a partir de un cursor.
+ * @author Sento Marcos Ibarra
+ *
+ * Usa una característica (READ | WRITE | NOTIFY, valor de hasta 244 bytes):
+ *
+ *  - el teléfono escribe un cursor (uint32, big-endian): se le notifica
+ *    todo lo guardado desde ahí (0 = desde lo más antiguo que quede). Si
+ *    escribe otra cosa, se para.
+ *  - cada elemento notificado es el cursor del registro (uint32,
+ *    big-endian) y el registro. Van tantos por notificación como quepan
+ *    (NotificadorEnLotes), p.ej. 17 de 14 bytes con un MTU de 247.
+ *  - al empezar y al acabar, el valor de la característica (lo que se lee)
+ *    es el primer cursor que queda y el siguiente (uint32 + uint32). Un
+ *    cursor más allá del final no descarga nada: sólo pone el valor al día.
+ *
+ * Para seguir donde se quedó (p.ej. tras perder la conexión) basta pedir
+ * el último cursor recibido + 1. Lo que se añada mientras tanto también se
+ * descarga.
+ *
+ * El callback de escritura de Bluefruit no se ejecuta en la tarea de
+ * loop(): pedir() sólo deja la petición y atender() (una tarea del
+ * planificador) hace el trabajo. Mientras hay algo que enviar, atender()
+ * llena la cola de la SoftDevice y devuelve true: volviendo a llamarlo
+ * enseguida, se envía tan deprisa como da la conexión.
+ */
+
+#ifndef DESCARGA_REGISTROS_H_INCLUIDO
+#define DESCARGA_REGISTROS_H_INCLUIDO
+
+#include "NotificadorEnLotes.h"
+#include "TramaMediciones.h"
+
+/**
+ * @class DescargaRegistros
+ * @brief Petición de descarga y su envío en lotes.
+ * @tparam A Un AlmacenFlash.
+ */
+template<typename A>
+class DescargaRegistros {
+
+public:
+
+  static const uint8_t TAMANYO_ELEMENTO = 4 + A::TAMANYO_REGISTRO;  ///< Cursor y registro.
+
+  static const uint8_t TAMANYO_VALOR = 244;  ///< MTU_MAXIMO - 3: lo más que se notifica de una vez.
+
+private:
+
+  static const uint16_t ELEMENTOS_EN_COLA = 2 * ((NotificadorEnLotes<TAMANYO_ELEMENTO>::MTU_MAXIMO - 3)
+                                                 / TAMANYO_ELEMENTO);
+  static const uint8_t LEIDOS_DE_UNA_VEZ = 16;
+
+  A& elAlmacen;
+  ServicioEnEmisora::Caracteristica& laCaracteristica;
+  NotificadorEnLotes<TAMANYO_ELEMENTO, ELEMENTOS_EN_COLA> elNotificador;
+
+  //
+  // la petición: la escribe el callback (otra tarea), la recoge atender()
+  //
+  volatile uint32_t cursorPedido;
+  volatile uint16_t conexionPedida;
+  volatile bool hayPeticion;
+  volatile bool pararPedido;
+
+  uint32_t cursor;    ///< El siguiente a encolar.
+  uint16_t conexion;
+  bool enMarcha;
+
+  // .........................................................
+  // .........................................................
+  void ponerRango() {
+    uint8_t valor[8];
+    TramaMediciones::escribir32(&valor[0], (*this).elAlmacen.primero());
+    TramaMediciones::escribir32(&valor[4], (*this).elAlmacen.siguiente());
+    (*this).laCaracteristica.escribirDatos(&valor[0], sizeof(valor));
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  void acabar() {
+    (*this).enMarcha = false;
+    (*this).elNotificador.vaciar();
+    (*this).ponerRango();
+  }  // ()
+
+  /**
+   * @brief Encola registros del almacén mientras quepan.
+   */
+  void rellenar() {
+    uint8_t registros[LEIDOS_DE_UNA_VEZ * A::TAMANYO_REGISTRO];
+    uint8_t elemento[TAMANYO_ELEMENTO];
+
+    uint16_t sitio = ELEMENTOS_EN_COLA - (*this).elNotificador.pendientes();
+    while (sitio > 0) {
+      uint16_t n = (*this).elAlmacen.leer((*this).cursor, &registros[0],
+                                          sitio < LEIDOS_DE_UNA_VEZ ? sitio : LEIDOS_DE_UNA_VEZ);
+      if (n == 0) {
+        return;
+      }
+      for (uint16_t k = 0; k < n; k++) {
+        TramaMediciones::escribir32(&elemento[0], (*this).cursor + k);
+        memcpy(&elemento[4], &registros[k * A::TAMANYO_REGISTRO], A::TAMANYO_REGISTRO);
+        (*this).elNotificador.notificar(&elemento[0]);
+      }
+      (*this).cursor += n;
+      sitio -= n;
+    }
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param almacen De donde se lee.
+   * @param car Característica READ | WRITE | NOTIFY con valor de TAMANYO_VALOR bytes.
+   *        Su callback de escritura tiene que llamar a pedir().
+   */
+  DescargaRegistros(A& almacen, ServicioEnEmisora::Caracteristica& car)
+    : elAlmacen(almacen), laCaracteristica(car), elNotificador(car),
+      cursorPedido(0), conexionPedida(0), hayPeticion(false), pararPedido(false),
+      cursor(0), conexion(0), enMarcha(false) {
+  }  // ()
+
+  /**
+   * @function pedir
+   * @brief Lo escrito en la característica: un cursor (empezar) u otra cosa (parar).
+   *
+   * Para llamarlo desde el callback de escritura: no hace nada más que anotarlo.
+   */
+  void pedir(uint16_t conexion_, const uint8_t* datos, uint16_t tam) {
+    if (tam == 4) {
+      (*this).cursorPedido = TramaMediciones::leer32(datos);
+      (*this).pararPedido = false;
+    } else {
+      (*this).pararPedido = true;
+    }
+    (*this).conexionPedida = conexion_;
+    (*this).hayPeticion = true;  // lo último
+  }  // ()
+
+  /**
+   * @function atender
+   * @brief Recoge la petición, si la hay, y envía lo que pueda.
+   * @return true si queda algo por enviar: hay que volver a llamarlo pronto.
+   */
+  bool atender() {
+    if ((*this).hayPeticion) {
+      (*this).hayPeticion = false;
+      (*this).elNotificador.vaciar();
+      (*this).cursor = (*this).cursorPedido;
+      (*this).conexion = (*this).conexionPedida;
+      (*this).enMarcha = !(*this).pararPedido;
+      (*this).ponerRango();
+    }
+
+    if (!(*this).enMarcha) {
+      return false;
+    }
+
+    BLEConnection* laConexion = Bluefruit.Connection((*this).conexion);
+    if (laConexion == NULL || !laConexion->connected()) {
+      (*this).acabar();  // al volver, que pida desde donde se quedó
+      return false;
+    }
+
+    (*this).rellenar();
+    (*this).elNotificador.enviar((*this).conexion);
+
+    if ((*this).elNotificador.pendientes() == 0
+        && (*this).cursor >= (*this).elAlmacen.siguiente()) {
+      (*this).acabar();
+      return false;
+    }
+    return true;
+  }  // ()
+
+  /**
+   * @function descargando
+   * @brief Si hay una descarga en marcha.
+   */
+  bool descargando() const {
+    return (*this).enMarcha;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
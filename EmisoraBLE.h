@@ -6,6 +6,20 @@
  * 
  * Esta clase maneja la configuración de emisoras BLE, incluyendo el encendido, la configuración de los beacons y
  * la gestión de servicios y características BLE.
+ *
+ * Además de los anuncios de siempre (31 bytes, los que hace Bluefruit) puede
+ * emitir anuncios extendidos de BLE 5 (emitirAnuncioExtendido()): hasta 251
+ * bytes de carga en un canal secundario, a 1M, 2M o Coded. Bluefruit no los
+ * sabe hacer, así que van directamente con sd_ble_gap_adv_*() sobre el mismo
+ * conjunto de anuncio. Si la SoftDevice no los admite, se sigue con los de
+ * siempre.
+ *
+ * Al conectarse un teléfono, pide un enlace rápido según un PerfilEnlace
+ * (intervalo de conexión corto, MTU grande, PDUs de 251 bytes y el PHY de
+ * 2M) para que las descargas no tarden minutos, y apunta por conexión lo
+ * que se ha acordado de verdad (enlace()). El MTU y la longitud de evento
+ * se reservan en la SoftDevice al encender, así que el perfil se cambia
+ * antes de encenderEmisora().
  * 
  * @see ServicioEnEmisora.h
  * @see https://learn.adafruit.com/introduction-to-bluetooth-low-energy/gap
@@ -21,6 +35,9 @@
 
 
 #include "ServicioEnEmisora.h" 
+#include "TramaAnuncio.h"
+#include "Instrumentacion.h"
+#include "Energia.h"
 
 // ----------------------------------------------------------
 // ----------------------------------------------------------
@@ -34,7 +51,299 @@ private:
 
   const char* nombreEmisora;   ///< Nombre de la emisora BLE.
   const uint16_t fabricanteID;  ///< Identificador del fabricante.
-  const int8_t txPower;        ///< Potencia de transmisión.
+  int8_t txPower;              ///< Potencia de transmisión (dBm).
+
+  TramaAnuncio laTrama;        ///< Anuncio construido una vez: sólo se le cambia la carga.
+  bool anuncioConfigurado;     ///< Si ya se han puesto nombre, potencia, intervalo...
+  uint16_t intervaloAnuncio;   ///< En unidades de 0.625 ms.
+  bool hayConjuntoAnuncio;     ///< Si Bluefruit ya ha creado el conjunto de anuncio.
+
+  TramaAnuncioExtendida laTramaExtendida;
+  bool anunciandoExtendido;    ///< Si está en el aire un anuncio extendido (no lo sabe Bluefruit).
+  bool extendidoDisponible;    ///< false en cuanto la SoftDevice rechaza uno.
+  uint8_t phyExtendido;        ///< PHY secundario de los extendidos.
+
+  uint32_t inicioAire;         ///< millis() de la última vez que se contabilizó el aire.
+  uint32_t restoAire;          ///< us que no llegaron a un evento entero.
+
+  /**
+   * Manejador del conjunto de anuncio. La SoftDevice S140 sólo tiene uno y
+   * Bluefruit se queda con el 0 la primera vez que empieza a anunciar.
+   */
+  static const uint8_t MANEJADOR_ANUNCIO = 0;
+
+public:
+
+  static const uint16_t INTERVALO_ANUNCIO = 100;  ///< Intervalo por defecto, en unidades de 0.625 ms.
+
+  static const uint8_t TAMANYO_MAX_CARGA_EXTENDIDA = TramaAnuncioExtendida::TAMANYO_MAX_CARGA;
+
+  //
+  // perfil del enlace por defecto
+  //
+  static const uint16_t INTERVALO_CONEXION = 12;     ///< 15 ms (lo menos que acepta iOS), en unidades de 1.25 ms.
+  static const uint16_t SUPERVISION_CONEXION = 400;  ///< 4 s, en unidades de 10 ms.
+  static const uint16_t MTU_ENLACE = 247;            ///< BLEGATT_ATT_MTU_MAX.
+  static const uint16_t LONGITUD_DATOS = 251;        ///< Carga de cada PDU: una notificación de 244 bytes, en uno.
+  static const uint8_t COLA_NOTIFICACIONES = 3;      ///< Notificaciones que caben en la cola de la SoftDevice.
+
+  static const uint8_t ENLACES = 1;  ///< Conexiones a la vez: las de Bluefruit.begin().
+
+  /**
+   * @struct PerfilEnlace
+   * @brief Lo que se pide al conectarse un teléfono.
+   */
+  struct PerfilEnlace {
+    uint16_t intervalo;       ///< Intervalo de conexión, en unidades de 1.25 ms.
+    uint16_t latencia;        ///< Eventos que el periférico se puede saltar.
+    uint16_t supervision;     ///< En unidades de 10 ms.
+    uint16_t mtu;             ///< ATT MTU (23 a 247).
+    uint16_t longitudDatos;   ///< Carga de cada PDU (27 a 251).
+    uint8_t phy;              ///< BLE_GAP_PHY_1MBPS, _2MBPS o _CODED.
+    uint16_t longitudEvento;  ///< Radio reservada por evento de conexión, en unidades de 1.25 ms.
+  };
+
+  /**
+   * @enum PeticionEnlace
+   * @brief Cada cosa que se pide (bits de Enlace::pendientes).
+   */
+  enum PeticionEnlace {
+    PIDE_MTU = 0x01,
+    PIDE_LONGITUD_DATOS = 0x02,
+    PIDE_PHY = 0x04,
+    PIDE_PARAMETROS = 0x08,
+    PIDE_TODO = 0x0F
+  };
+
+  /**
+   * @struct Enlace
+   * @brief Una conexión y lo acordado con el teléfono (al día en cada enlace()).
+   */
+  struct Enlace {
+    uint16_t conexion;       ///< BLE_CONN_HANDLE_INVALID: hueco libre.
+    uint8_t pendientes;      ///< Peticiones que la SoftDevice no ha aceptado aún (PIDE_*).
+    uint16_t intervalo;      ///< En unidades de 1.25 ms.
+    uint16_t latencia;
+    uint16_t supervision;    ///< En unidades de 10 ms.
+    uint16_t mtu;
+    uint16_t longitudDatos;
+    uint8_t phy;
+  };
+
+private:
+
+  PerfilEnlace elPerfil;
+  Enlace losEnlaces[ENLACES];
+
+  void (*alConectarse)(uint16_t connHandle);  ///< El de quien usa la emisora, o NULL.
+  void (*alDesconectarse)(uint16_t connHandle, uint8_t reason);
+
+  // .........................................................
+  // la emisora encendida, para los callbacks de Bluefruit
+  // .........................................................
+  static EmisoraBLE*& laEncendida() {
+    static EmisoraBLE* e = NULL;
+    return e;
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  Enlace* buscarEnlace(uint16_t conexion) {
+    for (uint8_t i = 0; i < ENLACES; i++) {
+      if ((*this).losEnlaces[i].conexion == conexion) {
+        return &(*this).losEnlaces[i];
+      }
+    }
+    return NULL;
+  }  // ()
+
+  // .........................................................
+  // (tarea de Bluefruit) sólo anota la conexión y avisa: el perfil
+  // lo pide ajustarEnlace(), desde la tarea de quien usa la emisora
+  // .........................................................
+  static void alConectar(uint16_t conexion) {
+    EmisoraBLE* e = laEncendida();
+    Enlace* enlace = e->buscarEnlace(BLE_CONN_HANDLE_INVALID);
+    if (enlace != NULL) {
+      enlace->pendientes = PIDE_TODO;
+      enlace->conexion = conexion;
+    }
+    if (e->alConectarse != NULL) {
+      e->alConectarse(conexion);
+    }
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  static void alDesconectar(uint16_t conexion, uint8_t razon) {
+    EmisoraBLE* e = laEncendida();
+    Enlace* enlace = e->buscarEnlace(conexion);
+    if (enlace != NULL) {
+      enlace->conexion = BLE_CONN_HANDLE_INVALID;
+    }
+    if (e->alDesconectarse != NULL) {
+      e->alDesconectarse(conexion, razon);
+    }
+  }  // ()
+
+  /**
+   * @brief Lo que no cambia de un anuncio a otro: se hace sólo la primera vez.
+   */
+  void configurarAnuncio() {
+    if ((*this).anuncioConfigurado) {
+      return;
+    }
+
+    Bluefruit.setTxPower((*this).txPower);
+    Bluefruit.setName((*this).nombreEmisora);
+
+    Bluefruit.ScanResponse.clearData();
+    Bluefruit.ScanResponse.addName();  // para que envíe el nombre de emisora (?!)
+    (*this).laTrama.ponerRespuestaEscaneo(Bluefruit.ScanResponse.getData(),
+                                          Bluefruit.ScanResponse.count());
+
+    //
+    // ? qué valores poner aquí
+    //
+    Bluefruit.Advertising.restartOnDisconnect(true);  // no hace falta, pero lo pongo
+    Bluefruit.Advertising.setInterval((*this).intervaloAnuncio, (*this).intervaloAnuncio);  // in unit of 0.625 ms
+
+    (*this).anuncioConfigurado = true;
+  }  // ()
+
+  /**
+   * @brief Pone en el aire la trama tal como está.
+   *
+   * Si ya se está anunciando, cambia los datos en marcha (una copia y una
+   * llamada a la SoftDevice) sin parar el anuncio. Si no, lo empieza.
+   */
+  void emitirTrama() {
+    GASTO_CPU(Energia::EMISORA);
+
+    (*this).contabilizarAire();
+    (*this).configurarAnuncio();
+
+    (*this).pararExtendido();  // si estaba el extendido, vuelve el de siempre
+
+    bool anunciando = Bluefruit.Advertising.isRunning();
+
+    if (anunciando && !(*this).laTrama.haCambiado()) {
+      return;  // ya está en el aire
+    }
+
+    //
+    // copia para Bluefruit: la usará si tiene que volver a empezar
+    // el anuncio (p.ej. tras una desconexión)
+    //
+    Bluefruit.Advertising.setData((*this).laTrama.plantillaActual(), TramaAnuncio::TAMANYO);
+
+    if (anunciando) {
+      ble_gap_adv_data_t datos;
+      (*this).laTrama.prepararEnvio(datos);
+
+      uint8_t manejador = MANEJADOR_ANUNCIO;
+      if (sd_ble_gap_adv_set_configure(&manejador, &datos, NULL) == NRF_SUCCESS) {
+        return;
+      }
+
+      // no ha querido: como antes, parar y volver a empezar
+      Bluefruit.Advertising.stop();
+    }
+
+    //
+    // empieza el anuncio, 0 = tiempo indefinido (ya lo pararán)
+    //
+    Bluefruit.Advertising.start(0);
+    (*this).laTrama.marcarEnviada();
+    (*this).hayConjuntoAnuncio = true;
+  }  // ()
+
+  /**
+   * @brief Parámetros de los anuncios extendidos: no conectables ni
+   * escaneables, con los datos en el canal secundario.
+   *
+   * Con Coded también el primario va en Coded (largo alcance); si no, en 1M.
+   */
+  void prepararParametrosExtendido(ble_gap_adv_params_t& parametros) const {
+    memset(&parametros, 0, sizeof(parametros));
+    parametros.properties.type = BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+    parametros.interval = (*this).intervaloAnuncio;
+    parametros.duration = BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED;
+    parametros.filter_policy = BLE_GAP_ADV_FP_ANY;
+    parametros.primary_phy = ((*this).phyExtendido == BLE_GAP_PHY_CODED
+                                ? BLE_GAP_PHY_CODED
+                                : BLE_GAP_PHY_1MBPS);
+    parametros.secondary_phy = (*this).phyExtendido;
+  }  // ()
+
+  /**
+   * @brief Configura el conjunto de anuncio como extendido y lo arranca.
+   * Tiene que estar parado.
+   */
+  bool arrancarExtendido() {
+    ble_gap_adv_data_t datos;
+    (*this).laTramaExtendida.prepararEnvio(datos);
+
+    ble_gap_adv_params_t parametros;
+    (*this).prepararParametrosExtendido(parametros);
+
+    uint8_t manejador = MANEJADOR_ANUNCIO;
+    if (sd_ble_gap_adv_set_configure(&manejador, &datos, &parametros) != NRF_SUCCESS
+        || sd_ble_gap_adv_start(manejador, BLE_CONN_CFG_TAG_DEFAULT) != NRF_SUCCESS) {
+      return false;
+    }
+    (*this).anunciandoExtendido = true;
+    return true;
+  }  // ()
+
+  /**
+   * @brief Para el anuncio extendido, si está en marcha.
+   */
+  void pararExtendido() {
+    if (!(*this).anunciandoExtendido) {
+      return;
+    }
+    sd_ble_gap_adv_stop(MANEJADOR_ANUNCIO);
+    (*this).anunciandoExtendido = false;
+  }  // ()
+
+  /**
+   * @brief Lo que tarda un paquete en el aire.
+   * @param phy BLE_GAP_PHY_1MBPS, _2MBPS o _CODED.
+   * @param bytesPdu Cabecera (2) y carga del PDU.
+   */
+  static uint32_t duracionPaqueteUs(uint8_t phy, uint16_t bytesPdu) {
+    if (phy == BLE_GAP_PHY_2MBPS) {
+      return (2 + 4 + bytesPdu + 3) * 4;
+    }
+    if (phy == BLE_GAP_PHY_CODED) {
+      return 80 + 256 + 16 + 24 + (bytesPdu + 3) * 64 + 24;
+    }
+    return (1 + 4 + bytesPdu + 3) * 8;
+  }  // ()
+
+  /**
+   * @brief Radio encendida en cada evento de anuncio, con la rampa de cada paquete.
+   *
+   * De siempre: el paquete por los canales 37, 38 y 39 a 1M. Extendido: el
+   * ADV_EXT_IND por los tres primarios y un AUX_ADV_IND con los datos (si
+   * no caben en uno, el AUX_CHAIN_IND se queda sin contar).
+   *
+   * @return us; 0 si no hay nada en el aire.
+   */
+  uint32_t radioPorEvento() {
+    if ((*this).anunciandoExtendido) {
+      uint8_t primario = ((*this).phyExtendido == BLE_GAP_PHY_CODED ? BLE_GAP_PHY_CODED : BLE_GAP_PHY_1MBPS);
+      return 3 * (duracionPaqueteUs(primario, 2 + 7) + Energia::ARRANQUE_RADIO_US)
+             + duracionPaqueteUs((*this).phyExtendido, 2 + 10 + (*this).laTramaExtendida.tamanyo())
+             + Energia::ARRANQUE_RADIO_US;
+    }
+    if (Bluefruit.Advertising.isRunning()) {
+      return 3 * (duracionPaqueteUs(BLE_GAP_PHY_1MBPS, 2 + 6 + TramaAnuncio::TAMANYO)
+                  + Energia::ARRANQUE_RADIO_US);
+    }
+    return 0;
+  }  // ()
 
 public:
 
@@ -66,7 +375,30 @@ public:
              const int8_t txPower_)
     : nombreEmisora(nombreEmisora_),
       fabricanteID(fabricanteID_),
-      txPower(txPower_) {
+      txPower(txPower_),
+      laTrama(fabricanteID_),
+      anuncioConfigurado(false),
+      intervaloAnuncio(INTERVALO_ANUNCIO),
+      hayConjuntoAnuncio(false),
+      laTramaExtendida(fabricanteID_),
+      anunciandoExtendido(false),
+      extendidoDisponible(true),
+      phyExtendido(BLE_GAP_PHY_2MBPS),
+      inicioAire(0),
+      restoAire(0),
+      losEnlaces(),
+      alConectarse(NULL),
+      alDesconectarse(NULL) {
+    (*this).elPerfil.intervalo = INTERVALO_CONEXION;
+    (*this).elPerfil.latencia = 0;
+    (*this).elPerfil.supervision = SUPERVISION_CONEXION;
+    (*this).elPerfil.mtu = MTU_ENLACE;
+    (*this).elPerfil.longitudDatos = LONGITUD_DATOS;
+    (*this).elPerfil.phy = BLE_GAP_PHY_2MBPS;
+    (*this).elPerfil.longitudEvento = INTERVALO_CONEXION;  // todo el evento, si hay que enviar
+    for (uint8_t i = 0; i < ENLACES; i++) {
+      (*this).losEnlaces[i].conexion = BLE_CONN_HANDLE_INVALID;
+    }
     // no encender ahora la emisora, tal vez sea por el println()
     // que hace que todo falle si lo llamo en el contructor
     // ( = antes que configuremos Serial )
@@ -96,11 +428,19 @@ public:
    * @brief Enciende la emisora BLE.
    * 
    * Este método inicializa la emisora BLE y detiene cualquier anuncio existente.
+   * Antes reserva en la SoftDevice lo que pide el perfil del enlace, y
+   * desde aquí cada conexión se ajusta a él.
    */
   void encenderEmisora() {
+    Bluefruit.configPrphConn((*this).elPerfil.mtu, (*this).elPerfil.longitudEvento,
+                             COLA_NOTIFICACIONES, 1);
     // Serial.println ( "Bluefruit.begin() " );
     Bluefruit.begin();
 
+    laEncendida() = this;
+    Bluefruit.Periph.setConnectCallback(alConectar);
+    Bluefruit.Periph.setDisconnectCallback(alDesconectar);
+
     // por si acaso:
     (*this).detenerAnuncio();
   }  // ()
@@ -125,14 +465,46 @@ public:
    * @brief Detiene cualquier anuncio BLE activo.
    */
   void detenerAnuncio() {
+    MEDIR_TRAMO("detenerAnuncio");
+    GASTO_CPU(Energia::EMISORA);
 
-    if ((*this).estaAnunciando()) {
+    (*this).contabilizarAire();
+    (*this).pararExtendido();
+
+    if (Bluefruit.Advertising.isRunning()) {
       // Serial.println ( "Bluefruit.Advertising.stop() " );
       Bluefruit.Advertising.stop();
     }
 
   }  // ()
 
+  /**
+   * @brief Anota en Energia la radio desde la última vez, con lo que hay en el aire.
+   *
+   * Se llama antes de cambiar lo que se anuncia (así cada trozo se cuenta
+   * con lo que tenía) y antes de volcar las cuentas. Los eventos salen cada
+   * intervalo + 5 ms (advDelay, de 0 a 10 ms); lo que no llega a un evento
+   * se guarda para la vez siguiente.
+   */
+  void contabilizarAire() {
+    uint32_t ahora = millis();
+    uint64_t transcurrido = (uint64_t)(ahora - (*this).inicioAire) * 1000 + (*this).restoAire;
+    (*this).inicioAire = ahora;
+    (*this).restoAire = 0;
+
+    uint32_t porEvento = (*this).radioPorEvento();
+    if (porEvento == 0) {
+      return;
+    }
+    uint32_t periodo = (uint32_t)(*this).intervaloAnuncio * 625 + 5000;
+    uint64_t eventos = transcurrido / periodo;
+    (*this).restoAire = (uint32_t)(transcurrido % periodo);
+    if (eventos > 0) {
+      Energia::anotarNs(Energia::EMISORA, eventos * porEvento * 1000,
+                        Energia::corrienteRadioUA((*this).txPower));
+    }
+  }  // ()
+
   // .........................................................
   // estaAnunciando() -> Boleano
   // .........................................................
@@ -142,53 +514,114 @@ public:
    * @return `true` si la emisora está anunciando, de lo contrario `false`.
    */
   bool estaAnunciando() {
-    return Bluefruit.Advertising.isRunning();
+    return (*this).anunciandoExtendido || Bluefruit.Advertising.isRunning();
+  }  // ()
+
+  /**
+   * @brief Cambia el intervalo del anuncio.
+   *
+   * La SoftDevice no cambia el intervalo de un anuncio en marcha: si se está
+   * anunciando, se para y se vuelve a empezar con los mismos datos. Si el
+   * intervalo no cambia, no se hace nada.
+   *
+   * @param intervalo En unidades de 0.625 ms (de 32 = 20 ms a 16384 = 10.24 s).
+   */
+  void cambiarIntervalo(uint16_t intervalo) {
+    GASTO_CPU(Energia::EMISORA);
+
+    (*this).configurarAnuncio();
+
+    if (intervalo == (*this).intervaloAnuncio) {
+      return;
+    }
+    (*this).contabilizarAire();
+    (*this).intervaloAnuncio = intervalo;
+
+    if ((*this).anunciandoExtendido) {
+      Bluefruit.Advertising.setInterval(intervalo, intervalo);
+      (*this).rearrancarExtendido();
+      return;
+    }
+
+    if (!Bluefruit.Advertising.isRunning()) {
+      Bluefruit.Advertising.setInterval(intervalo, intervalo);
+      return;
+    }
+
+    Bluefruit.Advertising.stop();
+    Bluefruit.Advertising.setInterval(intervalo, intervalo);
+    Bluefruit.Advertising.start(0);
+  }  // ()
+
+  /**
+   * @brief Si la radio admite esa potencia (nRF52840).
+   * @param dBm -40, -20, -16, -12, -8, -4, 0, o de +2 a +8.
+   */
+  static bool potenciaValida(int8_t dBm) {
+    switch (dBm) {
+    case -40: case -20: case -16: case -12: case -8: case -4: case 0:
+    case 2: case 3: case 4: case 5: case 6: case 7: case 8:
+      return true;
+    default:
+      return false;
+    }
+  }  // ()
+
+  /**
+   * @brief Cambia la potencia de transmisión.
+   *
+   * Bluefruit.setTxPower() la cambia también en el anuncio que esté en
+   * marcha (y en las conexiones): no hace falta pararlo.
+   *
+   * @param dBm Una que cumpla potenciaValida(); si no, no se hace nada.
+   * @return false si no es válida.
+   */
+  bool cambiarPotencia(int8_t dBm) {
+    if (!potenciaValida(dBm)) {
+      return false;
+    }
+    if (dBm == (*this).txPower) {
+      return true;
+    }
+    (*this).contabilizarAire();  // lo de hasta ahora, con la potencia de antes
+    (*this).txPower = dBm;
+    if ((*this).anuncioConfigurado) {
+      Bluefruit.setTxPower(dBm);
+    }
+    return true;
+  }  // ()
+
+  /**
+   * @brief La potencia de transmisión, en dBm.
+   */
+  int8_t potencia() const {
+    return (*this).txPower;
+  }  // ()
+
+  /**
+   * @brief El intervalo del anuncio, en unidades de 0.625 ms.
+   */
+  uint16_t intervalo() const {
+    return (*this).intervaloAnuncio;
   }  // ()
 
   /**
    * @brief Emite un anuncio iBeacon con los parámetros dados.
+   *
+   * El anuncio se construye una sola vez; después sólo se cambian uuid,
+   * major, minor y rssi, sin parar el anuncio si ya estaba en marcha.
    * 
    * @param beaconUUID UUID del beacon.
    * @param major Valor mayor del beacon.
    * @param minor Valor menor del beacon.
    * @param rssi Valor RSSI (Received Signal Strength Indicator).
    */
-  void emitirAnuncioIBeacon(uint8_t* beaconUUID, int16_t major, int16_t minor, uint8_t rssi) {
-
-    //
-    //
-    //
-    (*this).detenerAnuncio();
-
-    //
-    // creo el beacon
-    //
-    BLEBeacon elBeacon(beaconUUID, major, minor, rssi);
-    elBeacon.setManufacturer((*this).fabricanteID);
-
-    //
-    // parece que esto debe ponerse todo aquí
-    //
+  void emitirAnuncioIBeacon(const uint8_t* beaconUUID, int16_t major, int16_t minor, uint8_t rssi) {
+    MEDIR_TRAMO("emitirAnuncioIBeacon");
 
-    Bluefruit.setTxPower((*this).txPower);
-    Bluefruit.setName((*this).nombreEmisora);
-    Bluefruit.ScanResponse.addName();  // para que envíe el nombre de emisora (?!)
+    (*this).laTrama.ponerIBeacon(beaconUUID, major, minor, rssi);
 
-    //
-    // pongo el beacon
-    //
-    Bluefruit.Advertising.setBeacon(elBeacon);
-
-    //
-    // ? qué valorers poner aquí
-    //
-    Bluefruit.Advertising.restartOnDisconnect(true);  // no hace falta, pero lo pongo
-    Bluefruit.Advertising.setInterval(100, 100);      // in unit of 0.625 ms
-
-    //
-    // empieza el anuncio, 0 = tiempo indefinido (ya lo pararán)
-    //
-    Bluefruit.Advertising.start(0);
+    (*this).emitirTrama();
 
   }  // ()
 
@@ -242,86 +675,141 @@ public:
 	const uint8_t tamanyoCarga = strlen( carga );
   */
 
-   /**
-   * @brief Emite un anuncio iBeacon con una carga personalizada.
-   * 
-   * @param carga Datos a emitir en la carga del beacon.
-   * @param tamanyoCarga Tamaño de la carga a emitir.
+  /**
+   * @brief Elige el PHY de los anuncios extendidos.
+   *
+   * 2M (por defecto): la mitad de tiempo en el aire que 1M. Coded: cuatro
+   * veces más alcance, ocho veces más tiempo en el aire. Si hay uno en
+   * marcha, se para y se vuelve a empezar con el nuevo.
+   *
+   * @param phy BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS o BLE_GAP_PHY_CODED.
    */
-  void emitirAnuncioIBeaconLibre(const char* carga, const uint8_t tamanyoCarga) {
+  void elegirPhyExtendido(uint8_t phy) {
+    if (phy == (*this).phyExtendido) {
+      return;
+    }
+    (*this).contabilizarAire();
+    (*this).phyExtendido = phy;
+    if ((*this).anunciandoExtendido) {
+      (*this).rearrancarExtendido();
+    }
+  }  // ()
 
-    (*this).detenerAnuncio();
+  /**
+   * @brief Para el extendido que hay en el aire y lo vuelve a empezar (otro intervalo o PHY).
+   *
+   * Si la SoftDevice no lo quiere, se hace como en emitirAnuncioExtendido():
+   * no se vuelve a intentar y sale la última trama de las de siempre, para
+   * no quedarse sin nada en el aire.
+   */
+  void rearrancarExtendido() {
+    (*this).pararExtendido();
+    if ((*this).arrancarExtendido()) {
+      return;
+    }
+    (*this).extendidoDisponible = false;
+    Globales::elPuerto.escribir<NIVEL_AVISO>(" anuncio extendido no admitido: sigo con iBeacon \n");
+    (*this).emitirTrama();
+  }  // ()
 
-    Bluefruit.Advertising.clearData();
-    Bluefruit.ScanResponse.clearData();  // hace falta?
+  /**
+   * @brief Si se puede intentar un anuncio extendido (la SoftDevice no ha rechazado ninguno).
+   */
+  bool admiteExtendido() const {
+    return (*this).extendidoDisponible;
+  }  // ()
 
-    // Bluefruit.setTxPower( (*this).txPower ); creo que no lo pongo porque es uno de los bytes de la parte de carga que utilizo
-    Bluefruit.setName((*this).nombreEmisora);
-    Bluefruit.ScanResponse.addName();
+  /**
+   * @brief Emite un anuncio extendido (BLE 5) con la carga como datos del fabricante.
+   *
+   * Si ya hay uno extendido en el aire, sólo le cambia los datos. Si lo que
+   * hay es uno de los de siempre, lo para. El conjunto de anuncio lo crea
+   * Bluefruit la primera vez que anuncia y lo necesita después para volver a
+   * los de siempre: si aún no existe, se le deja crearlo con un anuncio que
+   * se para enseguida.
+   *
+   * @param carga Datos a emitir.
+   * @param tamanyoCarga Bytes de carga (hasta TAMANYO_MAX_CARGA_EXTENDIDA).
+   * @return false si la SoftDevice no lo admite: no queda nada en el aire y
+   *         hay que emitir con los de siempre (y no se vuelve a intentar).
+   */
+  bool emitirAnuncioExtendido(const uint8_t* carga, uint8_t tamanyoCarga) {
+    MEDIR_TRAMO("emitirAnuncioExtendido");
+    GASTO_CPU(Energia::EMISORA);
 
-    Bluefruit.Advertising.addFlags(BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE);
+    if (!(*this).extendidoDisponible) {
+      return false;
+    }
 
-    // con este parece que no va  !
-    // Bluefruit.Advertising.addFlags(BLE_GAP_ADV_FLAG_LE_GENERAL_DISC_MODE);
+    (*this).contabilizarAire();
 
-    //
-    // hasta ahora habrá, supongo, ya puestos los 5 primeros bytes. Efectivamente.
-    // Falta poner 4 bytes fijos (company ID, beacon type, longitud) y 21 de carga
-    //
-    uint8_t restoPrefijoYCarga[4 + 21] = {
-      0x4c, 0x00,  // companyID 2
-      0x02,        // ibeacon type 1byte
-      21,          // ibeacon length 1byte (dec=21)  longitud del resto // 0x15 // ibeacon length 1byte (dec=21)  longitud del resto
-      '-', '-', '-', '-',
-      '-', '-', '-', '-',
-      '-', '-', '-', '-',
-      '-', '-', '-', '-',
-      '-', '-', '-', '-',
-      '-'
-    };
+    (*this).laTramaExtendida.ponerCarga(carga, tamanyoCarga);
 
-    //
-    // addData() hay que usarlo sólo una vez. Por eso copio la carga
-    // en el anterior array, donde he dejado 21 sitios libres
-    //
-    memcpy(&restoPrefijoYCarga[4], &carga[0], (tamanyoCarga > 21 ? 21 : tamanyoCarga));
+    if ((*this).anunciandoExtendido) {
+      ble_gap_adv_data_t datos;
+      (*this).laTramaExtendida.prepararEnvio(datos);
 
-    //
-    // copio la carga para emitir
-    //
-    Bluefruit.Advertising.addData(BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA,
-                                  &restoPrefijoYCarga[0],
-                                  4 + 21);
+      uint8_t manejador = MANEJADOR_ANUNCIO;
+      if (sd_ble_gap_adv_set_configure(&manejador, &datos, NULL) == NRF_SUCCESS) {
+        return true;
+      }
 
-    //
-    // ? qué valores poner aquí ?
-    //
-    Bluefruit.Advertising.restartOnDisconnect(true);
-    Bluefruit.Advertising.setInterval(100, 100);  // in unit of 0.625 ms
+      // no ha querido: parar y volver a empezar
+      (*this).pararExtendido();
+    }
+
+    (*this).configurarAnuncio();
+    if (!(*this).hayConjuntoAnuncio) {
+      Bluefruit.Advertising.start(0);
+      (*this).hayConjuntoAnuncio = true;
+    }
+    if (Bluefruit.Advertising.isRunning()) {
+      Bluefruit.Advertising.stop();
+    }
+
+    if (!(*this).arrancarExtendido()) {
+      (*this).extendidoDisponible = false;
+      Globales::elPuerto.escribir<NIVEL_AVISO>(" anuncio extendido no admitido: sigo con iBeacon \n");
+      return false;
+    }
+    return true;
+  }  // ()
+
+   /**
+   * @brief Emite un anuncio iBeacon con una carga personalizada.
+   * 
+   * @param carga Datos a emitir en la carga del beacon.
+   * @param tamanyoCarga Tamaño de la carga a emitir.
+   */
+  void emitirAnuncioIBeaconLibre(const char* carga, const uint8_t tamanyoCarga) {
 
-    Bluefruit.Advertising.setFastTimeout(1);  // number of seconds in fast mode
     //
-    // empieza el anuncio, 0 = tiempo indefinido (ya lo pararán)
+    // el prefijo (flags, company ID, beacon type, longitud) ya está
+    // en la trama: sólo copio los 21 bytes de carga
     //
-    Bluefruit.Advertising.start(0);
+    (*this).laTrama.ponerCarga((const uint8_t*)&carga[0], tamanyoCarga);
 
-    Globales::elPuerto.escribir("emitiriBeacon libre  Bluefruit.Advertising.start( 0 );  \n");
+    (*this).emitirTrama();
+
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>("emitiriBeacon libre: carga en el anuncio \n");
   }  // ()
 
 /**
    * @brief Añade un servicio a la emisora BLE.
    * 
+   * @tparam S ServicioEnEmisora o ServicioEnEmisoraFijo<N>.
    * @param servicio Servicio BLE que se va a añadir.
    * @return `true` si el servicio fue añadido con éxito, de lo contrario `false`.
    */
-  bool anyadirServicio(ServicioEnEmisora& servicio) {
+  template<typename S>
+  bool anyadirServicio(S& servicio) {
 
-    Globales::elPuerto.escribir(" Bluefruit.Advertising.addService( servicio ); \n");
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>(" Bluefruit.Advertising.addService( servicio ); \n");
 
     bool r = Bluefruit.Advertising.addService(servicio);
 
     if (!r) {
-      Serial.println(" SERVICION NO AÑADIDO \n");
+      Globales::elPuerto.escribir<NIVEL_AVISO>(" SERVICION NO AÑADIDO \n");
     }
 
 
@@ -335,10 +823,12 @@ public:
   /**
    * @brief Añade un servicio BLE con sus características a la emisora.
    * 
+   * @tparam S ServicioEnEmisora o ServicioEnEmisoraFijo<N>.
    * @param servicio Servicio BLE que se va a añadir.
    * @return `true` si el servicio fue añadido con éxito, de lo contrario `false`.
    */
-  bool anyadirServicioConSusCaracteristicas(ServicioEnEmisora& servicio) {
+  template<typename S>
+  bool anyadirServicioConSusCaracteristicas(S& servicio) {
     return (*this).anyadirServicio(servicio);
   }  //
 
@@ -347,17 +837,40 @@ public:
    * 
    * Este método permite añadir un servicio junto con un número variable de características.
    * 
+   * @tparam S ServicioEnEmisora o ServicioEnEmisoraFijo<N>.
    * @tparam T Tipos de las características.
    * @param servicio Servicio BLE que se va a añadir.
    * @param caracteristica Primera característica a añadir.
    * @param restoCaracteristicas Resto de características.
    * @return `true` si el servicio y las características fueron añadidos con éxito.
    */
-  template<typename... T>
-  bool anyadirServicioConSusCaracteristicas(ServicioEnEmisora& servicio,
+  template<typename S, typename... T>
+  bool anyadirServicioConSusCaracteristicas(S& servicio,
+                                            ServicioEnEmisora::Caracteristica& caracteristica,
+                                            T&... restoCaracteristicas) {
+
+    servicio.anyadirCaracteristica(caracteristica);
+
+    return anyadirServicioConSusCaracteristicas(servicio, restoCaracteristicas...);
+
+  }  // ()
+
+  /**
+   * @brief Como la anterior, para un servicio de tamaño fijo: comprueba al
+   * compilar que caben todas las características.
+   *
+   * @tparam N Capacidad del servicio.
+   * @tparam TAM Tamaño máximo del valor de cada característica.
+   * @tparam T Tipos de las características.
+   */
+  template<size_t N, size_t TAM, typename... T>
+  bool anyadirServicioConSusCaracteristicas(ServicioEnEmisoraFijo<N, TAM>& servicio,
                                             ServicioEnEmisora::Caracteristica& caracteristica,
                                             T&... restoCaracteristicas) {
 
+    static_assert(sizeof...(T) + 1 <= N,
+                  "hay más características que sitio en el servicio");
+
     servicio.anyadirCaracteristica(caracteristica);
 
     return anyadirServicioConSusCaracteristicas(servicio, restoCaracteristicas...);
@@ -367,13 +880,14 @@ public:
     /**
    * @brief Añade un servicio y sus características y lo activa.
    * 
+   * @tparam S ServicioEnEmisora o ServicioEnEmisoraFijo<N>.
    * @tparam T Tipos de las características.
    * @param servicio Servicio BLE que se va a añadir.
    * @param restoCaracteristicas Características a añadir.
    * @return `true` si el servicio fue añadido y activado con éxito.
    */
-  template<typename... T>
-  bool anyadirServicioConSusCaracteristicasYActivar(ServicioEnEmisora& servicio,
+  template<typename S, typename... T>
+  bool anyadirServicioConSusCaracteristicasYActivar(S& servicio,
                                                     // ServicioEnEmisora::Caracteristica & caracteristica,
                                                     T&... restoCaracteristicas) {
 
@@ -392,7 +906,7 @@ public:
    * @param cb Función callback para manejar la conexión.
    */
   void instalarCallbackConexionEstablecida(CallbackConexionEstablecida cb) {
-    Bluefruit.Periph.setConnectCallback(cb);
+    (*this).alConectarse = cb;  // lo llama alConectar(), en la tarea de Bluefruit
   }  // ()
 
    /**
@@ -401,7 +915,7 @@ public:
    * @param cb Función callback para manejar la desconexión.
    */
   void instalarCallbackConexionTerminada(CallbackConexionTerminada cb) {
-    Bluefruit.Periph.setDisconnectCallback(cb);
+    (*this).alDesconectarse = cb;
   }  // ()
 
    /**
@@ -414,6 +928,81 @@ public:
     return Bluefruit.Connection(connHandle);
   }  // ()
 
+  /**
+   * @brief Cambia el perfil del enlace. El MTU y la longitud de evento sólo
+   * cuentan si se hace antes de encenderEmisora(); lo demás, en las
+   * conexiones siguientes.
+   */
+  void ponerPerfilEnlace(const PerfilEnlace& perfil) {
+    (*this).elPerfil = perfil;
+  }  // ()
+
+  /**
+   * @brief El perfil del enlace en uso.
+   */
+  const PerfilEnlace& perfilEnlace() const {
+    return (*this).elPerfil;
+  }  // ()
+
+  /**
+   * @brief Pide a una conexión lo que aún no ha aceptado la SoftDevice del perfil.
+   *
+   * Hay que llamarlo después de conectarse (avisa el callback de
+   * instalarCallbackConexionEstablecida()), desde la tarea que usa la
+   * emisora, no desde el callback. Si la SoftDevice estaba ocupada con otro
+   * procedimiento, se puede volver a llamar (p.ej. al empezar una descarga).
+   * Lo que responde el teléfono llega después y se ve con enlace().
+   *
+   * @param conexion Manejador de la conexión.
+   * @return true si ya no queda nada por pedir.
+   */
+  bool ajustarEnlace(uint16_t conexion) {
+    Enlace* e = (*this).buscarEnlace(conexion);
+    BLEConnection* c = Bluefruit.Connection(conexion);
+    if (e == NULL || c == NULL || !c->connected()) {
+      return false;
+    }
+    const PerfilEnlace& p = (*this).elPerfil;
+
+    if ((e->pendientes & PIDE_MTU) && c->requestMtuExchange(p.mtu)) {
+      e->pendientes &= ~PIDE_MTU;
+    }
+    if (e->pendientes & PIDE_LONGITUD_DATOS) {
+      ble_gap_data_length_params_t dl = { p.longitudDatos, p.longitudDatos,
+                                          BLE_GAP_DATA_LENGTH_AUTO, BLE_GAP_DATA_LENGTH_AUTO };
+      if (c->requestDataLengthUpdate(&dl)) {
+        e->pendientes &= ~PIDE_LONGITUD_DATOS;
+      }
+    }
+    if ((e->pendientes & PIDE_PHY) && c->requestPHY(p.phy)) {
+      e->pendientes &= ~PIDE_PHY;
+    }
+    if ((e->pendientes & PIDE_PARAMETROS)
+        && c->requestConnectionParameter(p.intervalo, p.latencia, p.supervision)) {
+      e->pendientes &= ~PIDE_PARAMETROS;
+    }
+    return e->pendientes == 0;
+  }  // ()
+
+  /**
+   * @brief Una de las conexiones, con lo acordado puesto al día.
+   * @param i De 0 a ENLACES - 1.
+   * @return Su conexion es BLE_CONN_HANDLE_INVALID si no hay nadie.
+   */
+  const Enlace& enlace(uint8_t i) {
+    Enlace& e = (*this).losEnlaces[i];
+    BLEConnection* c = Bluefruit.Connection(e.conexion);
+    if (e.conexion != BLE_CONN_HANDLE_INVALID && c != NULL) {
+      e.intervalo = c->getConnectionInterval();
+      e.latencia = c->getSlaveLatency();
+      e.supervision = c->getSupervisionTimeout();
+      e.mtu = c->getMtu();
+      e.longitudDatos = c->getDataLength();
+      e.phy = c->getPHY();
+    }
+    return e;
+  }  // ()
+
 };  // class
 
 #endif
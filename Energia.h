@@ -0,0 +1,306 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Energia.h
+ * @brief Cuánta carga gasta cada subsistema y cuánto duraría la batería así.
+ * @author Sento Marcos Ibarra
+ *
+ * Cada subsistema (Medidor, EmisoraBLE, PuertoSerie, LED) anota el tiempo
+ * que tiene algo encendido y con qué corriente:
+ *
+ *  - la CPU, con GASTO_CPU( Energia::EMISORA ) al principio de un bloque:
+ *    al salir del ámbito se anota lo que ha tardado (ciclos del DWT en la
+ *    placa, como Instrumentacion.h; en el ordenador, el tiempo de verdad del
+ *    ordenador, que se queda corto)
+ *  - los periféricos, con anotar(): el tiempo lo estima quien los usa
+ *    (radio, SAADC, UART, el LED)
+ *
+ * Lo que no es de nadie se pone aparte: el suelo (System ON dormido, con
+ * el RTC) durante todo el tiempo y lo que cuesta cada despertar.
+ *
+ * Las corrientes son las de la hoja de datos del nRF52840 a 3 V con el
+ * DC/DC, redondeadas; las del LED y el SAADC dependen de la placa y hay que
+ * ajustarlas con un amperímetro. Las cuentas no piden memoria y son enteras:
+ * tiempo en ns y carga en fC (uA x ns).
+ *
+ * Se anota desde varias tareas (Tareas.h): cada anotación es una sección
+ * crítica. Un TramoCPU que otra tarea interrumpe se queda también con el
+ * tiempo de la otra.
+ */
+
+#ifndef ENERGIA_H_INCLUIDO
+#define ENERGIA_H_INCLUIDO
+
+#include "RelojCPU.h"
+
+namespace Energia {
+
+  /**
+   * @enum Subsistema
+   * @brief A quién se le apunta el gasto.
+   */
+  enum Subsistema {
+    MEDIDOR = 0,
+    EMISORA,
+    PUERTO,
+    LED,
+    NUM_SUBSISTEMAS
+  };
+
+  //
+  // corrientes, en uA
+  //
+  const uint32_t CORRIENTE_CPU_UA = 3300;     ///< CPU a 64 MHz ejecutando desde flash.
+  const uint32_t CORRIENTE_DORMIDO_UA = 3;    ///< System ON, RTC y RAM retenida.
+  const uint32_t ARRANQUE_RADIO_US = 40;      ///< Rampa antes de cada paquete, con la misma corriente.
+  const uint32_t CORRIENTE_SAADC_UA = 700;    ///< SAADC convirtiendo, con el HFCLK.
+  const uint32_t CORRIENTE_UART_UA = 500;     ///< UARTE enviando, con el HFCLK.
+  const uint32_t CORRIENTE_LED_UA = 2000;     ///< Depende de la resistencia.
+  const uint32_t DESPERTAR_US = 30;           ///< Cada despertar, a CORRIENTE_CPU_UA.
+
+  const uint32_t CAPACIDAD_BATERIA_MAH = 850;  ///< La de la placa.
+
+  /**
+   * @brief Corriente de la radio emitiendo a una potencia (nRF52840, DC/DC,
+   * 3 V): los puntos de la hoja de datos y, entre ellos, en línea recta.
+   * @param dBm Una de las que admite la radio (de -40 a +8).
+   * @return uA.
+   */
+  inline uint32_t corrienteRadioUA(int8_t dBm) {
+    static const int8_t POTENCIAS[] = { -40, -20, -16, -12, -8, -4, 0, 4, 8 };
+    static const uint16_t CORRIENTES[] = { 2300, 3000, 3100, 3300, 3600, 4000, 4800, 9600, 14800 };
+    const uint8_t n = sizeof(POTENCIAS);
+    if (dBm <= POTENCIAS[0]) {
+      return CORRIENTES[0];
+    }
+    for (uint8_t i = 1; i < n; i++) {
+      if (dBm <= POTENCIAS[i]) {
+        return CORRIENTES[i - 1]
+               + (uint32_t)(CORRIENTES[i] - CORRIENTES[i - 1]) * (dBm - POTENCIAS[i - 1])
+                   / (POTENCIAS[i] - POTENCIAS[i - 1]);
+      }
+    }
+    return CORRIENTES[n - 1];
+  }  // ()
+
+  /**
+   * @struct Cuenta
+   * @brief Lo que lleva gastado un subsistema.
+   */
+  struct Cuenta {
+    uint64_t activoNs;  ///< Tiempo con algo encendido.
+    uint64_t cargaFc;   ///< uA x ns.
+    uint32_t veces;     ///< Anotaciones.
+  };
+
+  // .........................................................
+  // lo anotado: estáticas de funciones inline, para que haya una
+  // sola copia aunque este fichero se incluya en varias unidades
+  // .........................................................
+  inline Cuenta* lasCuentas() {
+    static Cuenta c[NUM_SUBSISTEMAS] = {};
+    return &c[0];
+  }  // ()
+
+  inline uint32_t& losDespertares() {
+    static uint32_t n = 0;
+    return n;
+  }  // ()
+
+  // millis() al reiniciar()
+  inline uint32_t& desdeMs() {
+    static uint32_t ms = 0;
+    return ms;
+  }  // ()
+
+  // .........................................................
+  // reloj de la CPU: el de RelojCPU.h, que también usa Instrumentacion.h
+  // .........................................................
+  using RelojCPU::iniciar;
+  using RelojCPU::tics;
+
+  inline uint64_t ticsANs(uint32_t t) {
+    return (uint64_t)t * RelojCPU::NANOSEGUNDOS_POR_MIL_TICS / 1000;
+  }  // ()
+
+  /**
+   * @brief Anota un tiempo activo.
+   * @param s Subsistema.
+   * @param ns Nanosegundos.
+   * @param corrienteUa Lo que consume mientras tanto.
+   */
+  inline void anotarNs(Subsistema s, uint64_t ns, uint32_t corrienteUa) {
+    taskENTER_CRITICAL();
+    Cuenta& c = lasCuentas()[s];
+    c.activoNs += ns;
+    c.cargaFc += ns * corrienteUa;
+    c.veces++;
+    taskEXIT_CRITICAL();
+  }  // ()
+
+  /**
+   * @brief Como anotarNs(), en microsegundos.
+   */
+  inline void anotar(Subsistema s, uint32_t us, uint32_t corrienteUa) {
+    anotarNs(s, (uint64_t)us * 1000, corrienteUa);
+  }  // ()
+
+  /**
+   * @brief La CPU se ha despertado (una vuelta de loop()).
+   */
+  inline void anotarDespertar() {
+    taskENTER_CRITICAL();
+    losDespertares()++;
+    taskEXIT_CRITICAL();
+  }  // ()
+
+  /**
+   * @brief Pone a cero las cuentas.
+   * @param ahora millis(): desde cuándo se cuenta.
+   */
+  inline void reiniciar(uint32_t ahora) {
+    memset(lasCuentas(), 0, NUM_SUBSISTEMAS * sizeof(Cuenta));
+    losDespertares() = 0;
+    desdeMs() = ahora;
+  }  // ()
+
+  /**
+   * @brief Carga de todo lo que no es de un subsistema: el suelo y los despertares.
+   * @param transcurridoMs Desde reiniciar().
+   * @return fC.
+   */
+  inline uint64_t cargaFijaFc(uint32_t transcurridoMs) {
+    return (uint64_t)transcurridoMs * 1000000 * CORRIENTE_DORMIDO_UA
+      + (uint64_t)losDespertares() * DESPERTAR_US * 1000 * CORRIENTE_CPU_UA;
+  }  // ()
+
+  /**
+   * @brief Corriente media desde reiniciar(), con todo.
+   * @return nA (0 si no ha pasado tiempo).
+   */
+  inline uint32_t corrienteMediaNa(uint32_t ahora) {
+    uint32_t transcurridoMs = ahora - desdeMs();
+    if (transcurridoMs == 0) {
+      return 0;
+    }
+    uint64_t total = cargaFijaFc(transcurridoMs);
+    for (uint8_t i = 0; i < NUM_SUBSISTEMAS; i++) {
+      total += lasCuentas()[i].cargaFc;
+    }
+    return (uint32_t)(total / transcurridoMs / 1000);  // fC / ms = pA
+  }  // ()
+
+  /**
+   * @brief Lo que duraría la batería con la corriente media de ahora.
+   * @return Horas.
+   */
+  inline uint32_t horasBateria(uint32_t ahora) {
+    uint32_t media = corrienteMediaNa(ahora);
+    return media == 0 ? 0xFFFFFFFF
+                      : (uint32_t)((uint64_t)CAPACIDAD_BATERIA_MAH * 1000000 / media);
+  }  // ()
+
+  // .........................................................
+  // x / total en tanto por ciento con un decimal
+  // .........................................................
+  template<typename S>
+  void escribirPorCiento(S& salida, uint64_t x, uint64_t total) {
+    uint32_t pormil = (uint32_t)(x * 1000 / total);
+    salida.escribir(" %=");
+    salida.escribir((unsigned long)(pormil / 10));
+    salida.escribir(".");
+    salida.escribir((unsigned long)(pormil % 10));
+  }  // ()
+
+  /**
+   * @brief Escribe el gasto por subsistema y la duración de la batería.
+   *
+   * Una línea por subsistema: anotaciones, tiempo activo (ms), carga (uC) y
+   * qué parte del total es. Luego el suelo y los despertares, la corriente
+   * media y los días que daría la batería de CAPACIDAD_BATERIA_MAH.
+   *
+   * @param salida Algo con escribir(): PuertoSerie, por ejemplo.
+   * @param ahora millis().
+   */
+  template<typename S>
+  void volcar(S& salida, uint32_t ahora) {
+    static const char* const nombres[NUM_SUBSISTEMAS] = {
+      "medidor", "emisora", "puerto", "led"
+    };
+
+    uint32_t transcurridoMs = ahora - desdeMs();
+    uint64_t fija = cargaFijaFc(transcurridoMs);
+    uint64_t total = fija;
+    for (uint8_t i = 0; i < NUM_SUBSISTEMAS; i++) {
+      total += lasCuentas()[i].cargaFc;
+    }
+    if (total == 0) {
+      total = 1;
+    }
+
+    salida.escribir("---- energia (ms = ");
+    salida.escribir((unsigned long)transcurridoMs);
+    salida.escribir(")\n");
+
+    for (uint8_t i = 0; i < NUM_SUBSISTEMAS; i++) {
+      const Cuenta& c = lasCuentas()[i];
+      salida.escribir(nombres[i]);
+      salida.escribir(" n=");
+      salida.escribir((unsigned long)c.veces);
+      salida.escribir(" activo(ms)=");
+      salida.escribir((unsigned long)(c.activoNs / 1000000));
+      salida.escribir(" carga(uC)=");
+      salida.escribir((unsigned long)(c.cargaFc / 1000000000));
+      escribirPorCiento(salida, c.cargaFc, total);
+      salida.escribir("\n");
+    }  // for
+
+    salida.escribir("dormido+despertares n=");
+    salida.escribir((unsigned long)losDespertares());
+    salida.escribir(" carga(uC)=");
+    salida.escribir((unsigned long)(fija / 1000000000));
+    escribirPorCiento(salida, fija, total);
+    salida.escribir("\n");
+
+    uint32_t media = corrienteMediaNa(ahora);
+    salida.escribir("media(nA)=");
+    salida.escribir((unsigned long)media);
+    salida.escribir(" bateria ");
+    salida.escribir((unsigned long)CAPACIDAD_BATERIA_MAH);
+    salida.escribir(" mAh (dias)=");
+    salida.escribir((unsigned long)(horasBateria(ahora) / 24));
+    salida.escribir("\n");
+  }  // ()
+
+  /**
+   * @class TramoCPU
+   * @brief Anota a un subsistema la CPU desde que se construye hasta que se destruye.
+   */
+  class TramoCPU {
+  private:
+    Subsistema elSubsistema;
+    uint32_t inicio;
+
+  public:
+    TramoCPU(Subsistema s)
+      : elSubsistema(s), inicio(tics()) {
+    }  // ()
+
+    ~TramoCPU() {
+      anotarNs(elSubsistema, ticsANs(tics() - inicio), CORRIENTE_CPU_UA);
+    }  // ()
+  };   // class
+
+};  // namespace
+
+#define GASTO_CPU_CONCATENAR2(a, b) a##b
+#define GASTO_CPU_CONCATENAR(a, b) GASTO_CPU_CONCATENAR2(a, b)
+
+#define GASTO_CPU(subsistema) \
+  Energia::TramoCPU GASTO_CPU_CONCATENAR(elTramoCPU_, __LINE__)(subsistema)
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
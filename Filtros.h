@@ -0,0 +1,324 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Filtros.h
+ * @brief Filtros para las muestras del sensor, por bloques: media móvil, EMA, mediana y biquad.
+ * @author Sento Marcos Ibarra
+ *
+ * Todo trabaja sobre bloques de int16_t de un solo canal, en su sitio:
+ *
+ *   laMediana.procesar( muestras, n );
+ *   elPasoBajo.procesar( muestras, n );
+ *
+ * En el Cortex-M4 (__ARM_FEATURE_DSP) las operaciones que van de dos en dos
+ * usan las instrucciones SIMD de CMSIS:
+ *  - sumar(): __SMLAD con (1, 1), dos muestras por instrucción
+ *  - restar(): __QSUB16, dos restas con saturación por instrucción
+ *  - Biquad: __SMLAD, tres instrucciones por muestra en vez de cinco productos
+ * En el ordenador (o sin DSP) hay una versión escalar que da lo mismo, bit a bit.
+ *
+ * El primer bloque de cada filtro lo inicia con su primera muestra, como si
+ * la señal hubiera estado siempre ahí (sin transitorio desde 0).
+ */
+
+#ifndef FILTROS_H_INCLUIDO
+#define FILTROS_H_INCLUIDO
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_FEATURE_DSP) && !defined(ANFITRION)
+#define FILTROS_SIMD 1
+#endif
+
+namespace Filtros {
+
+  // .........................................................
+  // dos int16 seguidos en un uint32 (x[0] en la mitad baja)
+  // .........................................................
+  inline uint32_t leerPar(const int16_t* x) {
+    uint32_t par;
+    memcpy(&par, x, sizeof(par));  // un LDR
+    return par;
+  }  // ()
+
+  inline void escribirPar(int16_t* x, uint32_t par) {
+    memcpy(x, &par, sizeof(par));
+  }  // ()
+
+  inline uint32_t juntar(int16_t bajo, int16_t alto) {
+    return (uint16_t)bajo | ((uint32_t)(uint16_t)alto << 16);
+  }  // ()
+
+  inline int16_t saturar16(int32_t v) {
+    return (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+  }  // ()
+
+  /**
+   * @function sumar
+   * @brief Suma de un bloque.
+   */
+  inline int32_t sumar(const int16_t* x, uint16_t n) {
+    int32_t suma = 0;
+    uint16_t i = 0;
+#ifdef FILTROS_SIMD
+    for (; i + 2 <= n; i += 2) {
+      suma = __SMLAD(leerPar(&x[i]), 0x00010001, suma);
+    }
+#endif
+    for (; i < n; i++) {
+      suma += x[i];
+    }
+    return suma;
+  }  // ()
+
+  /**
+   * @function restar
+   * @brief r = a - b, muestra a muestra, saturando a int16 (r puede ser a).
+   */
+  inline void restar(const int16_t* a, const int16_t* b, int16_t* r, uint16_t n) {
+    uint16_t i = 0;
+#ifdef FILTROS_SIMD
+    for (; i + 2 <= n; i += 2) {
+      escribirPar(&r[i], __QSUB16(leerPar(&a[i]), leerPar(&b[i])));
+    }
+#endif
+    for (; i < n; i++) {
+      r[i] = saturar16((int32_t)a[i] - b[i]);
+    }
+  }  // ()
+
+  /**
+   * @function desentrelazar
+   * @brief Saca un canal de un bloque entrelazado (c0 c1 c2 c0 c1 c2 ...).
+   * @param entrada Bloque entrelazado.
+   * @param canales Canales del bloque.
+   * @param canal El que se saca.
+   * @param salida n muestras.
+   * @param n Escaneos.
+   */
+  inline void desentrelazar(const int16_t* entrada, uint8_t canales, uint8_t canal,
+                            int16_t* salida, uint16_t n) {
+    const int16_t* p = entrada + canal;
+    for (uint16_t i = 0; i < n; i++, p += canales) {
+      salida[i] = *p;
+    }
+  }  // ()
+
+  /**
+   * @class MediaMovil
+   * @brief Media de las N últimas muestras (suma que se va actualizando).
+   */
+  template<uint8_t N>
+  class MediaMovil {
+  private:
+    static_assert(N > 0, "N > 0");
+
+    int16_t ventana[N];
+    uint8_t pos;
+    int32_t suma;
+    bool iniciado;
+
+  public:
+    MediaMovil()
+      : ventana(), pos(0), suma(0), iniciado(false) {
+    }  // ()
+
+    void procesar(int16_t* x, uint16_t n) {
+      if (!(*this).iniciado && n > 0) {
+        for (uint8_t k = 0; k < N; k++) {
+          (*this).ventana[k] = x[0];
+        }
+        (*this).suma = (int32_t)x[0] * N;
+        (*this).iniciado = true;
+      }
+      for (uint16_t i = 0; i < n; i++) {
+        (*this).suma += x[i] - (*this).ventana[(*this).pos];
+        (*this).ventana[(*this).pos] = x[i];
+        (*this).pos = ((*this).pos + 1 == N ? 0 : (*this).pos + 1);
+        x[i] = (int16_t)((*this).suma / N);
+      }
+    }  // ()
+  };   // class
+
+  /**
+   * @class EMA
+   * @brief Media móvil exponencial: y += (x - y) / 2^K. El estado lleva 8 bits de fracción.
+   */
+  template<uint8_t K>
+  class EMA {
+  private:
+    static_assert(K > 0 && K < 16, "0 < K < 16");
+
+    int32_t estadoQ8;
+    bool iniciado;
+
+  public:
+    EMA()
+      : estadoQ8(0), iniciado(false) {
+    }  // ()
+
+    void procesar(int16_t* x, uint16_t n) {
+      if (!(*this).iniciado && n > 0) {
+        (*this).estadoQ8 = (int32_t)x[0] * 256;
+        (*this).iniciado = true;
+      }
+      for (uint16_t i = 0; i < n; i++) {
+        (*this).estadoQ8 += ((int32_t)x[i] * 256 - (*this).estadoQ8) >> K;
+        x[i] = (int16_t)(((*this).estadoQ8 + 128) >> 8);
+      }
+    }  // ()
+  };   // class
+
+  /**
+   * @class Mediana
+   * @brief Mediana de las N últimas muestras (N impar y pequeño): quita los picos sueltos.
+   */
+  template<uint8_t N>
+  class Mediana {
+  private:
+    static_assert(N % 2 == 1 && N <= 15, "N impar y pequeño");
+
+    int16_t ventana[N];  ///< En orden de llegada.
+    int16_t ordenada[N];
+    uint8_t pos;
+    bool iniciado;
+
+  public:
+    Mediana()
+      : ventana(), ordenada(), pos(0), iniciado(false) {
+    }  // ()
+
+    void procesar(int16_t* x, uint16_t n) {
+      if (!(*this).iniciado && n > 0) {
+        for (uint8_t k = 0; k < N; k++) {
+          (*this).ventana[k] = x[0];
+          (*this).ordenada[k] = x[0];
+        }
+        (*this).iniciado = true;
+      }
+      for (uint16_t i = 0; i < n; i++) {
+        //
+        // sale la más vieja de la ordenada y entra la nueva en su sitio
+        //
+        int16_t sale = (*this).ventana[(*this).pos];
+        (*this).ventana[(*this).pos] = x[i];
+        (*this).pos = ((*this).pos + 1 == N ? 0 : (*this).pos + 1);
+
+        uint8_t k = 0;
+        while ((*this).ordenada[k] != sale) {
+          k++;
+        }
+        // hueco en k: se mueve hacia donde toque la nueva
+        while (k > 0 && (*this).ordenada[k - 1] > x[i]) {
+          (*this).ordenada[k] = (*this).ordenada[k - 1];
+          k--;
+        }
+        while (k + 1 < N && (*this).ordenada[k + 1] < x[i]) {
+          (*this).ordenada[k] = (*this).ordenada[k + 1];
+          k++;
+        }
+        (*this).ordenada[k] = x[i];
+
+        x[i] = (*this).ordenada[N / 2];
+      }
+    }  // ()
+  };   // class
+
+  /**
+   * @class Biquad
+   * @brief Filtro IIR de segundo orden (forma directa I), coeficientes en Q14.
+   *
+   *   y = b0 x + b1 x1 + b2 x2 - a1 y1 - a2 y2
+   */
+  class Biquad {
+  private:
+    int16_t b0, b1, b2, menosA1, menosA2;  ///< Q14.
+    int16_t x1, x2, y1, y2;
+    bool iniciado;
+
+  public:
+
+    /**
+     * @brief Constructor.
+     * @param b0_ @param b1_ @param b2_ @param a1_ @param a2_ Coeficientes en Q14 (a0 = 1).
+     */
+    Biquad(int16_t b0_, int16_t b1_, int16_t b2_, int16_t a1_, int16_t a2_)
+      : b0(b0_), b1(b1_), b2(b2_), menosA1(saturar16(-(int32_t)a1_)), menosA2(saturar16(-(int32_t)a2_)),
+        x1(0), x2(0), y1(0), y2(0), iniciado(false) {
+    }  // ()
+
+    /**
+     * Cortes con los que los coeficientes caben en Q14 y la salida se
+     * queda a menos de un 2 % del fondo de la del filtro en double
+     * (host/pruebaFiltros.cpp). Cuanto más bajo el corte, más amplifica la
+     * realimentación el redondeo de y, y a1 se acerca a -2 (-a1 no cabe en
+     * int16) mientras b0 se queda en 0; por arriba, b1 = 2 b0 se acerca a 2.
+     */
+    static constexpr double CORTE_MINIMO = 0.02;
+    static constexpr double CORTE_MAXIMO = 0.45;
+
+    /**
+     * @function pasoBajo
+     * @brief Butterworth paso bajo (transformada bilineal). Con float: sólo al arrancar.
+     * @param corte Frecuencia de corte dividida por la de muestreo (se
+     * lleva a [CORTE_MINIMO, CORTE_MAXIMO]).
+     */
+    static Biquad pasoBajo(double corte) {
+      corte = (corte < CORTE_MINIMO ? CORTE_MINIMO : corte > CORTE_MAXIMO ? CORTE_MAXIMO : corte);
+      double k = tan(3.14159265358979 * corte);
+      double norma = 1 / (1 + 1.41421356237310 * k + k * k);
+      double b0 = k * k * norma;
+      double a1 = 2 * (k * k - 1) * norma;
+      double a2 = (1 - 1.41421356237310 * k + k * k) * norma;
+      return Biquad(q14(b0), q14(2 * b0), q14(b0), q14(a1), q14(a2));
+    }  // ()
+
+    static int16_t q14(double v) {
+      double q = (v < 0 ? v * 16384 - 0.5 : v * 16384 + 0.5);
+      return (int16_t)(q > 32767 ? 32767 : q < -32767 ? -32767 : q);
+    }  // ()
+
+    void procesar(int16_t* x, uint16_t n) {
+      if (!(*this).iniciado && n > 0) {
+        // en reposo con la primera muestra (ganancia 1 en continua)
+        (*this).x1 = (*this).x2 = (*this).y1 = (*this).y2 = x[0];
+        (*this).iniciado = true;
+      }
+
+#ifdef FILTROS_SIMD
+      const uint32_t b0b1 = juntar((*this).b0, (*this).b1);
+      const uint32_t b2a1 = juntar((*this).b2, (*this).menosA1);
+#endif
+
+      for (uint16_t i = 0; i < n; i++) {
+        int16_t x0 = x[i];
+        int32_t acc = 1 << 13;  // redondeo
+#ifdef FILTROS_SIMD
+        acc = __SMLAD(juntar(x0, (*this).x1), b0b1, acc);
+        acc = __SMLAD(juntar((*this).x2, (*this).y1), b2a1, acc);
+        acc += (int32_t)(*this).menosA2 * (*this).y2;
+#else
+        acc += (int32_t)(*this).b0 * x0 + (int32_t)(*this).b1 * (*this).x1;
+        acc += (int32_t)(*this).b2 * (*this).x2 + (int32_t)(*this).menosA1 * (*this).y1;
+        acc += (int32_t)(*this).menosA2 * (*this).y2;
+#endif
+        int16_t y0 = saturar16(acc >> 14);
+
+        (*this).x2 = (*this).x1;
+        (*this).x1 = x0;
+        (*this).y2 = (*this).y1;
+        (*this).y1 = y0;
+        x[i] = y0;
+      }
+    }  // ()
+  };   // class
+
+};  // namespace
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,98 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file FuenteMuestras.h
+ * @brief De dónde le llegan al Medidor las muestras del ADC: bloques completos, no muestra a muestra.
+ * @author Sento Marcos Ibarra
+ *
+ * Una fuente rellena bloques de muestras por su cuenta (en la placa, el SAADC
+ * con EasyDMA; en el ordenador, un fichero) y avisa cuando hay uno completo.
+ * Quien la usa lo lee con bloqueListo() y lo devuelve con liberarBloque().
+ *
+ * Las muestras de un bloque van entrelazadas por canal, como las deja el
+ * SAADC en modo scan:
+ *
+ *   canal0 canal1 canal2 canal0 canal1 canal2 ...
+ *
+ * Implementaciones: FuenteSAADC.h (placa) y host/FuenteFichero.h (ordenador).
+ */
+
+#ifndef FUENTE_MUESTRAS_H_INCLUIDO
+#define FUENTE_MUESTRAS_H_INCLUIDO
+
+#include <stdint.h>
+
+/**
+ * @class FuenteMuestras
+ * @brief Interfaz de una fuente de bloques de muestras.
+ */
+class FuenteMuestras {
+
+public:
+
+  /**
+   * @function empezar
+   * @brief Empieza a adquirir.
+   * @return false si no se puede (entonces el Medidor sigue sin ella).
+   */
+  virtual bool empezar() = 0;
+
+  /**
+   * @function parar
+   * @brief Deja de adquirir.
+   */
+  virtual void parar() = 0;
+
+  /**
+   * @function canales
+   * @brief Canales de cada escaneo.
+   */
+  virtual uint8_t canales() const = 0;
+
+  /**
+   * @function periodoBloque
+   * @brief Cada cuántos ms se completa un bloque: cada cuánto hay que mirar.
+   */
+  virtual uint32_t periodoBloque() const = 0;
+
+  /**
+   * @function bloqueListo
+   * @brief El bloque completo más antiguo que no se ha leído.
+   * @param muestras Se apunta a las muestras, entrelazadas por canal.
+   * @return Número de muestras (de todos los canales); 0 si no hay ninguno.
+   */
+  virtual uint16_t bloqueListo(const int16_t*& muestras) = 0;
+
+  /**
+   * @function liberarBloque
+   * @brief Devuelve el bloque de bloqueListo(): la fuente ya puede volver a llenarlo.
+   */
+  virtual void liberarBloque() = 0;
+
+  /**
+   * @function bloquesPerdidos
+   * @brief Bloques que se han vuelto a llenar antes de que nadie los leyera.
+   */
+  virtual uint32_t bloquesPerdidos() const = 0;
+
+  /**
+   * @function tiempoConversionBloque
+   * @brief Cuánto ha estado convirtiendo el ADC para llenar un bloque (para Energia.h).
+   * @return us; 0 si no se sabe.
+   */
+  virtual uint32_t tiempoConversionBloque() const {
+    return 0;
+  }  // ()
+
+protected:
+
+  ~FuenteMuestras() {
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,262 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file FuenteSAADC.h
+ * @brief Adquisición con el SAADC del nRF52: modo scan, sobremuestreo y EasyDMA en doble buffer.
+ * @author Sento Marcos Ibarra
+ *
+ * Nadie toca el ADC muestra a muestra:
+ *
+ *   TIMER4 (COMPARE0, cada 1/frecuencia s) --PPI--> SAADC TASKS_SAMPLE
+ *   SAADC EVENTS_END (buffer lleno)        --PPI--> SAADC TASKS_START
+ *
+ * Cada SAMPLE es un escaneo de los CANALES canales. Con BURST, cada canal
+ * hace las 2^OVERSAMPLE conversiones seguidas y deja sólo la media, que es
+ * lo que permite sobremuestrear en modo scan.
+ *
+ * EasyDMA escribe los resultados en uno de los dos buffers. RESULT.PTR está
+ * duplicado en el SAADC: el START que lanza el PPI al acabar un buffer ya
+ * usa el otro. La única interrupción es EVENTS_END, una por buffer: marca
+ * el buffer lleno como listo y lo deja como siguiente destino.
+ *
+ * La SoftDevice es la dueña del PPI: los canales se piden con sd_ppi_*,
+ * así que empezar() va después de Bluefruit.begin().
+ *
+ * Sólo para la placa; en el ordenador está host/FuenteFichero.h.
+ */
+
+#ifndef FUENTE_SAADC_H_INCLUIDO
+#define FUENTE_SAADC_H_INCLUIDO
+
+#include "FuenteMuestras.h"
+
+/**
+ * @class FuenteSAADC
+ * @brief FuenteMuestras con el SAADC, TIMER4 y dos canales PPI.
+ */
+class FuenteSAADC : public FuenteMuestras {
+
+public:
+
+  /**
+   * @brief Tamaños y recursos.
+   */
+  enum {
+    CANALES = 3,                    ///< Gas, referencia y temperatura del ULPSM.
+    ESCANEOS_POR_BLOQUE = 50,       ///< Un bloque (una interrupción) cada 50 escaneos.
+    MUESTRAS_POR_BLOQUE = CANALES * ESCANEOS_POR_BLOQUE,
+    CANAL_PPI_MUESTREO = 10,        ///< TIMER4 -> SAMPLE.
+    CANAL_PPI_REARME = 11,          ///< END -> START.
+    CONVERSIONES_POR_MUESTRA = 16,  ///< OVERSAMPLE 16x.
+    US_POR_CONVERSION = 40 + 2      ///< TACQ y TCONV (para Energia.h).
+  };
+
+  static FuenteSAADC* laActiva;  ///< La que atiende SAADC_IRQHandler().
+
+private:
+
+  uint8_t entradas[CANALES];  ///< AIN0..AIN7 de cada canal.
+  uint16_t frecuencia;        ///< Escaneos por segundo.
+
+  int16_t buffers[2][MUESTRAS_POR_BLOQUE];
+  volatile uint8_t enCurso;   ///< Buffer que está llenando EasyDMA.
+  volatile uint8_t listo;     ///< Buffer lleno para leer.
+  volatile bool hayListo;
+  volatile uint32_t perdidos;
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param ainGas Entrada analógica (0 = AIN0 ... 7 = AIN7) de Vgas.
+   * @param ainReferencia Entrada analógica de Vref.
+   * @param ainTemperatura Entrada analógica de Vtemp.
+   * @param frecuencia_ Escaneos por segundo.
+   */
+  FuenteSAADC(uint8_t ainGas, uint8_t ainReferencia, uint8_t ainTemperatura,
+              uint16_t frecuencia_)
+    : frecuencia(frecuencia_), enCurso(0), listo(0), hayListo(false), perdidos(0) {
+    (*this).entradas[0] = ainGas;
+    (*this).entradas[1] = ainReferencia;
+    (*this).entradas[2] = ainTemperatura;
+  }  // ()
+
+  /**
+   * @function empezar
+   * @brief Configura SAADC, TIMER4 y PPI y arranca. Después de Bluefruit.begin().
+   */
+  bool empezar() {
+
+    //
+    // SAADC: 12 bits, 16 conversiones por muestra, un canal por entrada
+    //
+    NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled << SAADC_ENABLE_ENABLE_Pos;
+    NRF_SAADC->RESOLUTION = SAADC_RESOLUTION_VAL_12bit;
+    NRF_SAADC->OVERSAMPLE = SAADC_OVERSAMPLE_OVERSAMPLE_Over16x;
+
+    for (uint8_t i = 0; i < 8; i++) {
+      NRF_SAADC->CH[i].PSELP = SAADC_CH_PSELP_PSELP_NC;
+      NRF_SAADC->CH[i].PSELN = SAADC_CH_PSELN_PSELN_NC;
+    }
+
+    for (uint8_t i = 0; i < CANALES; i++) {
+      NRF_SAADC->CH[i].CONFIG =
+        (SAADC_CH_CONFIG_RESP_Bypass << SAADC_CH_CONFIG_RESP_Pos)
+        | (SAADC_CH_CONFIG_RESN_Bypass << SAADC_CH_CONFIG_RESN_Pos)
+        | (SAADC_CH_CONFIG_GAIN_Gain1_6 << SAADC_CH_CONFIG_GAIN_Pos)      // fondo de escala 3.6 V
+        | (SAADC_CH_CONFIG_REFSEL_Internal << SAADC_CH_CONFIG_REFSEL_Pos) // 0.6 V
+        | (SAADC_CH_CONFIG_TACQ_40us << SAADC_CH_CONFIG_TACQ_Pos)         // salidas de alta impedancia
+        | (SAADC_CH_CONFIG_MODE_SE << SAADC_CH_CONFIG_MODE_Pos)
+        | (SAADC_CH_CONFIG_BURST_Enabled << SAADC_CH_CONFIG_BURST_Pos);
+      NRF_SAADC->CH[i].PSELP = SAADC_CH_PSELP_PSELP_AnalogInput0 + (*this).entradas[i];
+    }
+
+    NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Enabled << SAADC_ENABLE_ENABLE_Pos;
+
+    //
+    // calibración del offset, una vez
+    //
+    NRF_SAADC->EVENTS_CALIBRATEDONE = 0;
+    NRF_SAADC->TASKS_CALIBRATEOFFSET = 1;
+    while (NRF_SAADC->EVENTS_CALIBRATEDONE == 0) {
+    }
+    NRF_SAADC->EVENTS_CALIBRATEDONE = 0;
+
+    //
+    // doble buffer: START con el 0 y, en cuanto lo ha cogido, PTR al 1
+    //
+    (*this).enCurso = 0;
+    (*this).hayListo = false;
+    NRF_SAADC->RESULT.PTR = (uint32_t)&(*this).buffers[0][0];
+    NRF_SAADC->RESULT.MAXCNT = MUESTRAS_POR_BLOQUE;
+
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->EVENTS_END = 0;
+    NRF_SAADC->TASKS_START = 1;
+    while (NRF_SAADC->EVENTS_STARTED == 0) {
+    }
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->RESULT.PTR = (uint32_t)&(*this).buffers[1][0];
+
+    //
+    // sólo interrumpe END (buffer lleno)
+    //
+    laActiva = this;
+    NRF_SAADC->INTENCLR = 0xFFFFFFFF;
+    NRF_SAADC->INTENSET = SAADC_INTENSET_END_Msk;
+    NVIC_SetPriority(SAADC_IRQn, 6);  // de las que deja libres la SoftDevice
+    NVIC_ClearPendingIRQ(SAADC_IRQn);
+    NVIC_EnableIRQ(SAADC_IRQn);
+
+    //
+    // TIMER4 a 1 MHz: COMPARE0 cada escaneo
+    //
+    NRF_TIMER4->TASKS_STOP = 1;
+    NRF_TIMER4->MODE = TIMER_MODE_MODE_Timer;
+    NRF_TIMER4->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+    NRF_TIMER4->PRESCALER = 4;  // 16 MHz / 2^4
+    NRF_TIMER4->CC[0] = 1000000UL / (*this).frecuencia;
+    NRF_TIMER4->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+    NRF_TIMER4->TASKS_CLEAR = 1;
+
+    //
+    // PPI (a través de la SoftDevice)
+    //
+    if (sd_ppi_channel_assign(CANAL_PPI_MUESTREO,
+                              &NRF_TIMER4->EVENTS_COMPARE[0],
+                              &NRF_SAADC->TASKS_SAMPLE)
+          != NRF_SUCCESS
+        || sd_ppi_channel_assign(CANAL_PPI_REARME,
+                                 &NRF_SAADC->EVENTS_END,
+                                 &NRF_SAADC->TASKS_START)
+             != NRF_SUCCESS
+        || sd_ppi_channel_enable_set((1UL << CANAL_PPI_MUESTREO) | (1UL << CANAL_PPI_REARME))
+             != NRF_SUCCESS) {
+      (*this).parar();
+      return false;
+    }
+
+    NRF_TIMER4->TASKS_START = 1;
+    return true;
+  }  // ()
+
+  /**
+   * @function parar
+   */
+  void parar() {
+    NRF_TIMER4->TASKS_STOP = 1;
+    sd_ppi_channel_enable_clr((1UL << CANAL_PPI_MUESTREO) | (1UL << CANAL_PPI_REARME));
+    NVIC_DisableIRQ(SAADC_IRQn);
+    NRF_SAADC->TASKS_STOP = 1;
+    NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled << SAADC_ENABLE_ENABLE_Pos;
+    laActiva = NULL;
+  }  // ()
+
+  uint8_t canales() const {
+    return CANALES;
+  }  // ()
+
+  uint32_t periodoBloque() const {
+    return (1000UL * ESCANEOS_POR_BLOQUE) / (*this).frecuencia;
+  }  // ()
+
+  uint16_t bloqueListo(const int16_t*& muestras) {
+    if (!(*this).hayListo) {
+      return 0;
+    }
+    muestras = &(*this).buffers[(*this).listo][0];
+    return MUESTRAS_POR_BLOQUE;
+  }  // ()
+
+  void liberarBloque() {
+    (*this).hayListo = false;
+  }  // ()
+
+  uint32_t bloquesPerdidos() const {
+    return (*this).perdidos;
+  }  // ()
+
+  uint32_t tiempoConversionBloque() const {
+    return (uint32_t)MUESTRAS_POR_BLOQUE * CONVERSIONES_POR_MUESTRA * US_POR_CONVERSION;
+  }  // ()
+
+  /**
+   * @function alAcabarBloque
+   * @brief Desde la interrupción: el buffer en curso está lleno.
+   *
+   * El PPI ya ha lanzado START con el otro buffer; el lleno queda listo
+   * para leer y como destino del START siguiente.
+   */
+  void alAcabarBloque() {
+    uint8_t lleno = (*this).enCurso;
+    (*this).enCurso = lleno ^ 1;
+    NRF_SAADC->RESULT.PTR = (uint32_t)&(*this).buffers[lleno][0];
+
+    if ((*this).hayListo) {
+      (*this).perdidos++;  // el anterior no se leyó: EasyDMA ya lo está pisando
+    }
+    (*this).listo = lleno;
+    (*this).hayListo = true;
+  }  // ()
+
+};  // class
+
+FuenteSAADC* FuenteSAADC::laActiva = NULL;
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+extern "C" void SAADC_IRQHandler(void) {
+  if (NRF_SAADC->EVENTS_END != 0) {
+    NRF_SAADC->EVENTS_END = 0;
+    (void)NRF_SAADC->EVENTS_END;  // que se borre antes de salir
+    if (FuenteSAADC::laActiva != NULL) {
+      FuenteSAADC::laActiva->alAcabarBloque();
+    }
+  }
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -18,10 +18,20 @@
 #undef min // vaya tela, están definidos en bluefruit.h y  !
 #undef max // colisionan con los de la biblioteca estándar
 
+// --------------------------------------------------------------
+// descomentar para medir cuánto tardan los tramos con MEDIR_TRAMO
+// (Instrumentacion.h); mandando una 't' por el puerto serie se vuelcan
+// (con una 'e', lo gastado por subsistema: Energia.h)
+// --------------------------------------------------------------
+// #define INSTRUMENTACION_ACTIVA
+
 // --------------------------------------------------------------
 // --------------------------------------------------------------
 #include "LED.h"
 #include "PuertoSerie.h"
+#include "Planificador.h"
+#include "Tareas.h"
+#include "ColaSPSC.h"
 
 // --------------------------------------------------------------
 // --------------------------------------------------------------
@@ -31,6 +41,8 @@ namespace Globales {
 
   PuertoSerie elPuerto ( /* velocidad = */ 115200 ); // 115200 o 9600 o ...
 
+  Planificador< /* tareas como mucho = */ 8 > elPlanificador;
+
   // Serial1 en el ejemplo de Curro creo que es la conexión placa-sensor 
 };
 
@@ -39,15 +51,128 @@ namespace Globales {
 #include "EmisoraBLE.h"
 #include "Publicador.h"
 #include "Medidor.h"
-
+#include "Sensores.h"
+#include "RegistroMedicion.h"
+#include "AlmacenFlash.h"
+#include "DescargaRegistros.h"
+#include "Configuracion.h"
+
+#ifdef ANFITRION
+#include "FuenteFichero.h" // en host/: muestras grabadas
+#else
+#include "FuenteSAADC.h"
+#endif
 
 // --------------------------------------------------------------
 // --------------------------------------------------------------
 namespace Globales {
 
-  Publicador elPublicador;
+  // 
+  // los sensores: de esta lista salen lo que se mide, la trama empaquetada
+  // y la secuencia de iBeacon de una medición (RegistroSensores.h)
+  // 
+  typedef RegistroSensores< SensorCO2, SensorTemperatura, SensorRuido > Sensores;
+
+  Publicador< Sensores > elPublicador;
+
+#ifdef ANFITRION
+  FuenteFichero laFuente ( "muestras.txt", Medidor::NUM_CANALES,
+						   /* escaneos por bloque = */ 50, /* por segundo = */ 100 );
+#else
+  FuenteSAADC laFuente ( /* AIN de Vgas, Vref, Vtemp = */ 0, 1, 2,
+						 /* escaneos por segundo = */ 100 );
+#endif
+
+  // 
+  // los de la etiqueta de un sensor (ULPSM-O3 968-046): la tabla sale
+  // de ellos al compilar, y setup() la rehace con los de esta placa si
+  // están grabados en DIRECCION_CALIBRACION (Calibracion.h)
+  // 
+  constexpr CoeficientesSensor COEFICIENTES_SENSOR = {
+	/* sensibilidad (nA/ppm) = */ -20.0,
+	/* ganancia (kV/A) = */ 499.0,
+	/* cero (mV) = */ 0.0,
+	/* deriva del cero (mV/ºC) = */ 0.05,
+	/* span lineal (1/ºC) = */ 0.003,
+	/* span cuadrático (1/ºC^2) = */ -0.00002,
+	/* alimentación (mV) = */ 3300.0,
+	/* mV por cuenta = */ (double)Medidor::MILIVOLTIOS_FONDO_ESCALA / Medidor::CUENTAS_FONDO_ESCALA
+  };
+
+  const uint32_t DIRECCION_CALIBRACION = 0xD3000; // debajo de la de los ajustes
+
+  TablaCalibracion laCalibracion ( COEFICIENTES_SENSOR );
+
+  Medidor elMedidor ( laFuente, laCalibracion );
+
+  Sensores losSensores { SensorCO2( elMedidor ), SensorTemperatura( elMedidor ), SensorRuido() };
+
+  // 
+  // las mediciones, también en flash, para descargarlas luego:
+  // 24 páginas (96 KiB, 408 registros por página) justo por debajo
+  // de InternalFS (0xED000); un ciclo cada 4 s da para ~11 h
+  // 
+  AlmacenFlash< RegistroMedicion::TAMANYO, /* páginas = */ 24 > elAlmacen ( /* dirección = */ 0xD5000 );
+
+  ServicioEnEmisoraFijo< 1, DescargaRegistros< decltype( elAlmacen ) >::TAMANYO_VALOR >
+	elServicioDescarga ( "GTI-3A-DESCARGA" );
+
+  ServicioEnEmisora::Caracteristica laCaracteristicaRegistros (
+	"GTI-3A-REGISTROS",
+	CHR_PROPS_READ | CHR_PROPS_WRITE | CHR_PROPS_NOTIFY,
+	SECMODE_OPEN, SECMODE_OPEN,
+	DescargaRegistros< decltype( elAlmacen ) >::TAMANYO_VALOR );
+
+  DescargaRegistros< decltype( elAlmacen ) > laDescarga ( elAlmacen, laCaracteristicaRegistros );
+
+  // los ajustes que se cambian sin grabar (Configuracion.h): se escriben
+  // en TLV y se leen los que hay en uso
+  ServicioEnEmisoraFijo< 1, Configuracion::TAMANYO_TLV > elServicioConfiguracion ( "GTI-3A-CONFIG" );
+
+  ServicioEnEmisora::Caracteristica laCaracteristicaAjustes (
+	"GTI-3A-AJUSTES",
+	CHR_PROPS_READ | CHR_PROPS_WRITE,
+	SECMODE_OPEN, SECMODE_OPEN,
+	Configuracion::TAMANYO_TLV );
+
+  // despierta a loop() cuando toca (Loop::MODO_EVENTOS)
+  SoftwareTimer elDespertador;
+
+  // 
+  // con Loop::MODO_TAREAS el muestreo, la publicación y el puerto serie
+  // son tres tareas de FreeRTOS que sólo se hablan por estas colas.
+  // Las mediciones tienen un solo productor (el muestreo) y un solo
+  // consumidor (la publicación): van por una ColaSPSC, sin cerrojos, y
+  // el muestreo despierta a la publicación con una notificación. Los
+  // avisos los mandan las dos: cola de FreeRTOS
+  // 
+  struct Medicion {
+	uint32_t secuencia; // número de ciclo
+	uint32_t instante; // millis() al medir
+	int16_t valores[ Sensores::NUM ]; // en el orden de la lista
+  };
+
+  // lo que hay que escribir por el puerto, sin formatear
+  enum TipoAviso {
+	AVISO_EMPIEZA_CICLO = 0,
+	AVISO_ACABA_CICLO
+  };
+
+  struct Aviso {
+	uint8_t tipo;
+	uint32_t valor;
+  };
+
+  const uint16_t MEDICIONES_EN_COLA = 4; // potencia de 2
+  ColaSPSC< Medicion, MEDICIONES_EN_COLA > laColaMediciones;
+  ColaEstatica< Aviso, /* elementos = */ 16 > laColaAvisos;
+
+  TareaEstatica< /* palabras de pila = */ 512 > laTareaMuestreo;
+  TareaEstatica< /* palabras de pila = */ 1024 > laTareaPublicacion;
+  TareaEstatica< /* palabras de pila = */ 512 > laTareaRegistro;
 
-  Medidor elMedidor;
+  // cuánto se retrasa la recogida de cada bloque del Medidor (en los dos modos)
+  Puntualidad laPuntualidadMuestreo;
 
 }; // namespace
 
@@ -59,6 +184,659 @@ void inicializarPlaquita () {
 
 } // ()
 
+// --------------------------------------------------------------
+// el LED: una tarea que le da el tic cuando le toca, nada de esperar()
+// --------------------------------------------------------------
+namespace Luces {
+  bool tareaEnMarcha = false;
+  int8_t idTarea = -1;
+};
+
+// ..............................................................
+// ..............................................................
+void tareaLED() {
+  uint32_t falta = Globales::elLED.tic( millis() );
+
+  if ( falta == LED::NADA_QUE_HACER ) {
+	Luces::tareaEnMarcha = false;
+	return; // acabado: no se repite
+  }
+
+  Globales::elPlanificador.repetirEn( falta );
+} // ()
+
+// ..............................................................
+// ..............................................................
+void ponerPatronLED( const PatronLED & patron ) {
+  Globales::elLED.reproducir( patron );
+
+  if ( Luces::tareaEnMarcha ) {
+	// ya estaba: que se despierte cuando acabe el primer paso del nuevo
+	Globales::elPlanificador.reprogramarTarea( Luces::idTarea, patron.duraciones[0] );
+	return;
+  }
+
+  Luces::idTarea = Globales::elPlanificador.anyadirTareaUnaVez( tareaLED, patron.duraciones[0] );
+  Luces::tareaEnMarcha = ( Luces::idTarea >= 0 );
+} // ()
+
+// --------------------------------------------------------------
+// --------------------------------------------------------------
+namespace Loop {
+  // número de ciclo: es la secuencia de los anuncios de cada ciclo
+  // (32 bits: no da la vuelta; en el aire van sus bits bajos)
+  uint32_t cont = 0;
+
+  // la última medición, la que se publica
+  Globales::Medicion laMedicion = { };
+
+  // true: muestreo, publicación y puerto serie en tres tareas de FreeRTOS
+  // (la de más prioridad, el muestreo: nada de lo demás lo retrasa)
+  // false: todo en loop(), con el planificador, como antes
+  const bool MODO_TAREAS = true;
+  const UBaseType_t PRIORIDAD_MUESTREO = TASK_PRIO_HIGH;
+  const UBaseType_t PRIORIDAD_PUBLICACION = TASK_PRIO_NORMAL;
+  const UBaseType_t PRIORIDAD_REGISTRO = TASK_PRIO_LOW; // la de loop()
+
+  // true: el anuncio no se para; la trama sólo cambia si cambian las
+  // mediciones y el intervalo se adapta (Publicador::publicarSiCambia())
+  // false: un anuncio por ciclo, como dicen PUBLICAR_EMPAQUETADO y DURACION_*
+  const bool PUBLICAR_ADAPTATIVO = true;
+
+  // true: cada medición va a una trama con las últimas (TramaMuestras.h),
+  // en un anuncio extendido de BLE 5 (Publicador::publicarEnLote()).
+  // Los escáneres de iBeacon no los ven: si la SoftDevice no puede, o para
+  // los teléfonos que no escanean extendidos, PUBLICAR_ADAPTATIVO
+  const bool PUBLICAR_EXTENDIDO = false;
+
+  // true: todas las mediciones en un solo anuncio (TramaMediciones.h)
+  // false: un iBeacon por sensor (major = tipo y contador, minor = valor)
+  const bool PUBLICAR_EMPAQUETADO = true;
+
+  // lo que duran los anuncios de un ciclo (700 por sensor + 1500)
+  // más un margen
+  const uint32_t PERIODO_CICLO = 4000;
+
+  // publicación: paso actual y cuánto dura cada anuncio
+  enum PasoPublicacion {
+	PARADA = 0,
+	PASO_SENSOR, // uno por sensor de la lista
+	PASO_LIBRE,
+	PASO_EMPAQUETADO,
+	PASO_FIN
+  };
+  uint8_t pasoPublicacion = PARADA;
+  uint8_t sensorPublicado = 0; // en PASO_SENSOR, el que toca
+  const uint16_t DURACION_SENSOR = 700;
+  const uint16_t DURACION_LIBRE = 1500;
+  const uint16_t DURACION_EMPAQUETADO = 2000;
+
+  static_assert( Globales::Sensores::NUM * DURACION_SENSOR + DURACION_LIBRE < PERIODO_CICLO,
+				 "los iBeacon de una medición no caben en un ciclo" );
+
+  // PERIODO_CICLO, los intervalos y la potencia son los de fábrica: por
+  // la característica GTI-3A-AJUSTES se cambian sin grabar y se guardan
+  // en la página de flash de debajo del almacén. El periodo, como poco
+  // lo que duran los anuncios de un ciclo (en MODO_TAREAS se redondea
+  // hacia abajo a bloques del Medidor)
+  const uint32_t PERIODO_CICLO_MINIMO = ( PUBLICAR_ADAPTATIVO || PUBLICAR_EXTENDIDO )
+	? 1000
+	: Globales::Sensores::NUM * DURACION_SENSOR + DURACION_LIBRE + 1;
+
+  static_assert( PERIODO_CICLO_MINIMO <= PERIODO_CICLO, "PERIODO_CICLO es demasiado corto" );
+
+  // no 0: no se publica cada medición sino, por ventanas de VENTANA ms,
+  // el mínimo, el máximo, la media, la varianza y cuántas de cada sensor
+  // (Agregador.h, Publicador::publicarResumenes()); en flash se guarda
+  // todo igual. 0: como dicen PUBLICAR_*
+  const uint32_t VENTANA = 60000;
+
+  static_assert( VENTANA == 0 || VENTANA >= Globales::Sensores::NUM * PERIODO_CICLO,
+				 "en una ventana tiene que haber al menos un ciclo por sensor" );
+
+  Agregador< Globales::Sensores::NUM > elAgregador ( VENTANA != 0 ? VENTANA : PERIODO_CICLO );
+
+  Configuracion laConfiguracion (
+	Configuracion::Ajustes {
+	  PERIODO_CICLO,
+	  Publicador< Globales::Sensores >::INTERVALO_REPOSO,
+	  Publicador< Globales::Sensores >::INTERVALO_MAXIMO,
+	  Publicador< Globales::Sensores >::INTERVALO_EXTENDIDO,
+	  Publicador< Globales::Sensores >::POTENCIA,
+	  VENTANA
+	},
+	PERIODO_CICLO_MINIMO,
+	/* ciclos por ventana = */ Globales::Sensores::NUM,
+	/* dirección = */ 0xD4000 );
+
+  // el periodo en uso: lo cambia la publicación y lo lee el muestreo
+  volatile uint32_t periodoCiclo = PERIODO_CICLO;
+  int8_t idTareaCiclo = -1; // sin MODO_TAREAS
+
+  // descarga de lo guardado: cada cuánto se mira si la han pedido y,
+  // mientras dura, cada cuánto se sigue enviando
+  const uint32_t PERIODO_DESCARGA = 1000;
+  const uint32_t PASO_DESCARGA = 1;
+
+  // la conexión a la que hay que pedir el enlace rápido: la anotan los
+  // callbacks de conexión y de registros (tarea de Bluefruit) y la toma
+  // tareaDescarga(), que es quien lo pide
+  volatile uint16_t conexionPorAjustar = BLE_CONN_HANDLE_INVALID;
+
+  // cada cuánto se mira si han mandado algo por el puerto serie y,
+  // si queda texto por sacar, cuánto se espera como mucho
+  const uint32_t PERIODO_ORDENES = 1000;
+  const uint32_t ESPERA_PUERTO_PENDIENTE = 5;
+
+  // true: entre plazo y plazo loop() se suspende (suspendLoop()) y lo
+  // despierta un SoftwareTimer (RTC) justo en el siguiente: la CPU
+  // duerme en System ON sin volver a loop() para nada
+  // false: delay() hasta el siguiente plazo, como mucho 1 s
+  const bool MODO_EVENTOS = true;
+  const uint32_t ESPERA_MAXIMA_DORMIDO = 60000;
+};
+
+// ..............................................................
+// lo que escriben las tareas con plazos: lo formatea quien escribe
+// ..............................................................
+void escribirAviso( const Globales::Aviso & aviso ) {
+
+  using namespace Globales;
+
+  switch ( aviso.tipo ) {
+  case AVISO_EMPIEZA_CICLO:
+	elPuerto.escribir( "\n---- ciclo: empieza " );
+	elPuerto.escribir( (unsigned long) aviso.valor );
+	elPuerto.escribir( "\n" );
+	break;
+
+  case AVISO_ACABA_CICLO:
+	elPuerto.escribir( "---- ciclo: acaba **** " );
+	elPuerto.escribir( (unsigned long) aviso.valor );
+	elPuerto.escribir( "\n" );
+	break;
+  } // switch
+} // ()
+
+// ..............................................................
+// con Loop::MODO_TAREAS, a la tarea de registro (si la cola está
+// llena, se pierde); si no, se escribe ya
+// ..............................................................
+void avisar( uint8_t tipo, uint32_t valor ) {
+  Globales::Aviso aviso = { tipo, valor };
+
+  if ( Loop::MODO_TAREAS ) {
+	Globales::laColaAvisos.enviar( aviso );
+	return;
+  }
+
+  escribirAviso( aviso );
+} // ()
+
+// ..............................................................
+// un anuncio por paso; el anunciante es uno solo, así que
+// los anuncios van seguidos, pero sin bloquear a nadie
+// ..............................................................
+void tareaPublicar() {
+
+  using namespace Loop;
+  using namespace Globales;
+
+  switch ( pasoPublicacion ) {
+
+  case PASO_SENSOR:
+	elPublicador.empezarPublicacionSensor( sensorPublicado, laMedicion.valores[ sensorPublicado ],
+										   laMedicion.secuencia );
+	elPlanificador.repetirEn( DURACION_SENSOR );
+	sensorPublicado++;
+	if ( sensorPublicado >= Sensores::NUM ) {
+	  pasoPublicacion = PASO_LIBRE;
+	}
+	break;
+
+  case PASO_LIBRE:
+	// 
+	// prueba para emitir un iBeacon y poner
+	// en la carga (21 bytes = uuid 16 major 2 minor 2 txPower 1 )
+	// lo que queramos (sin seguir dicho formato)
+	// 
+	// Al terminar la prueba hay que hacer Publicador::laEmisora privado
+	// 
+	elPublicador.laEmisora.emitirAnuncioIBeaconLibre ( "MolaMolaMolaMolaMolaM", 21 );
+	elPlanificador.repetirEn( DURACION_LIBRE );
+	pasoPublicacion = PASO_FIN;
+	break;
+
+  case PASO_EMPAQUETADO:
+	elPublicador.empezarPublicacionMediciones( laMedicion.valores, laMedicion.secuencia,
+											   laMedicion.instante );
+	elPlanificador.repetirEn( DURACION_EMPAQUETADO );
+	pasoPublicacion = PASO_FIN;
+	break;
+
+  default:
+	elPublicador.terminarPublicacion();
+
+	avisar( AVISO_ACABA_CICLO, laMedicion.secuencia );
+
+	pasoPublicacion = PARADA;
+	break; // acabado: no se repite
+  } // switch
+
+} // ()
+
+// ..............................................................
+// el Medidor recoge los bloques que ha llenado el ADC (uno por periodo)
+// ..............................................................
+void tareaMedidor() {
+  Globales::laPuntualidadMuestreo.anotar( ( millis() - Globales::elPlanificador.plazoEnCurso() ) * 1000 );
+  Globales::elMedidor.atender();
+} // ()
+
+// ..............................................................
+// publicación adaptativa: fin de la ráfaga de anuncios rápidos
+// ..............................................................
+void tareaFinRafaga() {
+  Globales::elPublicador.acabarRafaga( millis() );
+} // ()
+
+// ..............................................................
+// los ajustes en uso (Loop::laConfiguracion), a todo lo que los usa;
+// y en la característica, para quien los quiera leer
+// ..............................................................
+void aplicarAjustes() {
+
+  using namespace Globales;
+
+  const Configuracion::Ajustes & a = Loop::laConfiguracion.actuales();
+
+  elPublicador.cambiarIntervalos( a.intervaloReposo, a.intervaloMaximo, a.intervaloExtendido );
+  elPublicador.laEmisora.cambiarPotencia( a.potencia );
+  if ( a.ventana != 0 ) {
+	Loop::elAgregador.cambiarDuracion( a.ventana );
+  }
+
+  // el ciclo en curso acaba como iba: el nuevo periodo, desde su plazo
+  Loop::periodoCiclo = a.periodoCiclo;
+  elPlanificador.cambiarPeriodo( Loop::idTareaCiclo, a.periodoCiclo );
+
+  uint8_t tlv[ Configuracion::TAMANYO_TLV ];
+  laCaracteristicaAjustes.escribirDatos( tlv, Loop::laConfiguracion.codificar( tlv ) );
+} // ()
+
+// ..............................................................
+// cada PERIODO_CICLO: mido y numero. Es lo único del ciclo con
+// plazo; lo demás, alMedir()
+// ..............................................................
+Globales::Medicion medirCiclo() {
+
+  using namespace Globales;
+
+  Loop::cont++;
+
+  avisar( AVISO_EMPIEZA_CICLO, Loop::cont );
+
+  Medicion medicion;
+  medicion.secuencia = Loop::cont;
+  losSensores.medir( medicion.valores );
+  medicion.instante = millis();
+
+  return medicion;
+} // ()
+
+// ..............................................................
+// con cada medición: la guardo y lanzo lucecitas y publicación
+// ..............................................................
+void alMedir( const Globales::Medicion & medicion ) {
+
+  using namespace Loop;
+  using namespace Globales;
+
+  // 
+  // empieza un ciclo: si han cambiado los ajustes, ahora, todos juntos
+  // 
+  if ( laConfiguracion.tomarPendiente() ) {
+	aplicarAjustes();
+	laConfiguracion.guardar();
+	elPuerto.escribir( "---- ajustes cambiados\n" );
+  }
+
+  laMedicion = medicion;
+  const int16_t * valores = laMedicion.valores;
+
+  // 
+  // guardo, por si no hay nadie escuchando
+  // 
+  RegistroMedicion registro;
+  registro.marcaTiempo = laMedicion.instante;
+  for ( uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++ ) {
+	registro.valores[ k ] = ( k < Sensores::NUM ? valores[ k ] : 0 );
+  }
+  uint8_t bytesRegistro[ RegistroMedicion::TAMANYO ];
+  registro.empaquetar( bytesRegistro );
+  elAlmacen.anyadir( bytesRegistro );
+
+  // 
+  // y lanzo lo demás, si no sigue en marcha lo del ciclo anterior
+  // 
+  if ( ! elLED.reproduciendo() ) {
+	ponerPatronLED( PatronesLED::LUCECITAS );
+  }
+
+  if ( laConfiguracion.actuales().ventana != 0 ) {
+	elAgregador.anyadir( valores, laMedicion.instante );
+	elPublicador.publicarResumenes( elAgregador, laMedicion.instante );
+  } else if ( PUBLICAR_EXTENDIDO || PUBLICAR_ADAPTATIVO ) {
+	bool rafaga = PUBLICAR_EXTENDIDO
+	  ? elPublicador.publicarEnLote( valores, laMedicion.instante )
+	  : elPublicador.publicarSiCambia( valores, laMedicion.instante );
+	if ( rafaga ) {
+	  elPlanificador.anyadirTareaUnaVez( tareaFinRafaga, Publicador< Sensores >::DURACION_RAFAGA );
+	}
+  } else if ( pasoPublicacion == PARADA ) {
+	pasoPublicacion = PUBLICAR_EMPAQUETADO ? PASO_EMPAQUETADO : PASO_SENSOR;
+	sensorPublicado = 0;
+	elPlanificador.anyadirTareaUnaVez( tareaPublicar );
+  }
+} // ()
+
+// ..............................................................
+// sin tareas: todo el ciclo en loop()
+// ..............................................................
+void tareaCiclo() {
+  alMedir( medirCiclo() );
+} // ()
+
+// ..............................................................
+// se ha conectado un teléfono (tarea de Bluefruit: sólo se anota;
+// el enlace rápido lo pide tareaDescarga())
+// ..............................................................
+void alConectarse( uint16_t conexion ) {
+  Loop::conexionPorAjustar = conexion;
+} // ()
+
+// ..............................................................
+// el teléfono ha escrito en la característica de registros
+// (tarea de Bluefruit: sólo se anota; el enlace rápido, por si la
+// SoftDevice no lo aceptó al conectarse, lo pide tareaDescarga())
+// ..............................................................
+void alEscribirRegistros( uint16_t conexion, BLECharacteristic * /* chr */,
+						  uint8_t * datos, uint16_t tam ) {
+  Loop::conexionPorAjustar = conexion;
+  Globales::laDescarga.pedir( conexion, datos, tam );
+} // ()
+
+// ..............................................................
+// el teléfono ha escrito en la característica de ajustes
+// (tarea de Bluefruit: sólo se comprueba y se anota)
+// ..............................................................
+void alEscribirAjustes( uint16_t /* conexion */, BLECharacteristic * /* chr */,
+						uint8_t * datos, uint16_t tam ) {
+  Loop::laConfiguracion.pedir( datos, tam );
+} // ()
+
+// ..............................................................
+// descarga de registros: mientras quede algo, otra vez enseguida
+// ..............................................................
+void tareaDescarga() {
+  // se toma y se deja libre de una vez: un callback no puede anotar
+  // otra conexión entre medias y perderse
+  taskENTER_CRITICAL();
+  uint16_t conexion = Loop::conexionPorAjustar;
+  Loop::conexionPorAjustar = BLE_CONN_HANDLE_INVALID;
+  taskEXIT_CRITICAL();
+  if ( conexion != BLE_CONN_HANDLE_INVALID ) {
+	Globales::elPublicador.laEmisora.ajustarEnlace( conexion );
+  }
+  if ( Globales::laDescarga.atender() ) {
+	Globales::elPlanificador.repetirEn( Loop::PASO_DESCARGA );
+  }
+} // ()
+
+// ..............................................................
+// lo gastado hasta ahora, con la radio al día; con las demás
+// tareas paradas, que la emisora es de la de publicación
+// ..............................................................
+void volcarEnergia() {
+  vTaskSuspendAll();
+  Globales::elPublicador.laEmisora.contabilizarAire();
+  Energia::volcar( Globales::elPuerto, millis() );
+  xTaskResumeAll();
+} // ()
+
+// ..............................................................
+// lo que se ha retrasado el muestreo y lo que se ha perdido
+// ..............................................................
+void volcarPuntualidad() {
+
+  using namespace Globales;
+
+  elPuerto.escribir( "---- muestreo: " );
+  laPuntualidadMuestreo.volcar( elPuerto );
+  elPuerto.escribir( "bloques perdidos=" );
+  elPuerto.escribir( (unsigned long) elMedidor.bloquesPerdidos() );
+  elPuerto.escribir( " mediciones perdidas=" );
+  elPuerto.escribir( (unsigned long) laColaMediciones.perdidas() );
+  elPuerto.escribir( " avisos perdidos=" );
+  elPuerto.escribir( (unsigned long) laColaAvisos.perdidas() );
+  elPuerto.escribir( "\n" );
+} // ()
+
+// ..............................................................
+// los ajustes en uso
+// ..............................................................
+void volcarAjustes() {
+
+  using namespace Globales;
+
+  const Configuracion::Ajustes & a = Loop::laConfiguracion.actuales();
+
+  elPuerto.escribir( "---- ajustes: ciclo(ms)=" );
+  elPuerto.escribir( (unsigned long) a.periodoCiclo );
+  elPuerto.escribir( " reposo=" );
+  elPuerto.escribir( (unsigned int) a.intervaloReposo );
+  elPuerto.escribir( " maximo=" );
+  elPuerto.escribir( (unsigned int) a.intervaloMaximo );
+  elPuerto.escribir( " extendido=" );
+  elPuerto.escribir( (unsigned int) a.intervaloExtendido );
+  elPuerto.escribir( " (x0.625 ms) potencia(dBm)=" );
+  elPuerto.escribir( (int) a.potencia );
+  elPuerto.escribir( " ventana(ms)=" );
+  elPuerto.escribir( (unsigned long) a.ventana );
+  elPuerto.escribir( " rechazados=" );
+  elPuerto.escribir( (unsigned long) Loop::laConfiguracion.peticionesRechazadas() );
+  elPuerto.escribir( "\n" );
+} // ()
+
+// ..............................................................
+// lo acordado con cada teléfono conectado
+// ..............................................................
+void volcarEnlaces() {
+
+  using namespace Globales;
+
+  for ( uint8_t i = 0; i < EmisoraBLE::ENLACES; i++ ) {
+	const EmisoraBLE::Enlace & e = elPublicador.laEmisora.enlace( i );
+	if ( e.conexion == BLE_CONN_HANDLE_INVALID ) {
+	  continue;
+	}
+	elPuerto.escribir( "---- enlace " );
+	elPuerto.escribir( (unsigned int) e.conexion );
+	elPuerto.escribir( ": intervalo=" );
+	elPuerto.escribir( (unsigned int) e.intervalo );
+	elPuerto.escribir( " (x1.25 ms) latencia=" );
+	elPuerto.escribir( (unsigned int) e.latencia );
+	elPuerto.escribir( " supervision(ms)=" );
+	elPuerto.escribir( (unsigned long) e.supervision * 10 );
+	elPuerto.escribir( " mtu=" );
+	elPuerto.escribir( (unsigned int) e.mtu );
+	elPuerto.escribir( " pdu=" );
+	elPuerto.escribir( (unsigned int) e.longitudDatos );
+	elPuerto.escribir( " phy=" );
+	elPuerto.escribir( (unsigned int) e.phy );
+	elPuerto.escribir( " sin pedir=" );
+	elPuerto.escribir( (unsigned int) e.pendientes );
+	elPuerto.escribir( "\n" );
+  }
+} // ()
+
+// ..............................................................
+// órdenes por el puerto serie: 't' vuelca los tramos medidos
+// (si INSTRUMENTACION_ACTIVA), 'e', lo gastado, 'p', la
+// puntualidad del muestreo, 'c', los ajustes y 'l', el enlace
+// ..............................................................
+void tareaOrdenes() {
+  while ( Serial.available() > 0 ) {
+	switch ( Serial.read() ) {
+#ifdef INSTRUMENTACION_ACTIVA
+	case 't':
+	  Instrumentacion::volcar( Globales::elPuerto );
+	  break;
+#endif
+	case 'e':
+	  volcarEnergia();
+	  break;
+	case 'p':
+	  volcarPuntualidad();
+	  break;
+	case 'c':
+	  volcarAjustes();
+	  break;
+	case 'l':
+	  volcarEnlaces();
+	  break;
+	}
+  }
+} // ()
+
+// ..............................................................
+// el SoftwareTimer de Loop::MODO_EVENTOS ha vencido
+// (tarea de los temporizadores: sólo despierta a loop())
+// ..............................................................
+void alDespertar( TimerHandle_t ) {
+  resumeLoop();
+} // ()
+
+// --------------------------------------------------------------
+// Loop::MODO_TAREAS: las tres tareas
+// --------------------------------------------------------------
+
+// ..............................................................
+// muestreo: recoge cada bloque del Medidor a su hora y, cada
+// Loop::periodoCiclo, mide y se lo pasa a la publicación. No escribe
+// ni espera a nadie
+// ..............................................................
+void tareaMuestreo( void * ) {
+
+  using namespace Globales;
+
+  bool conFuente = elMedidor.periodoAtencion() > 0;
+  uint32_t periodo = conFuente ? elMedidor.periodoAtencion() : Loop::periodoCiclo;
+  uint32_t bloquesPorCiclo = conFuente ? Loop::periodoCiclo / periodo : 1;
+  uint32_t bloque = bloquesPorCiclo - 1; // el primer ciclo, con el primer bloque
+
+  TickType_t plazo = xTaskGetTickCount();
+
+  for ( ;; ) {
+	vTaskDelayUntil( & plazo, msATics( periodo ) );
+	Energia::anotarDespertar();
+	laPuntualidadMuestreo.anotar( ticsAUs( xTaskGetTickCount() - plazo ) );
+
+	elMedidor.atender();
+
+	bloque++;
+	if ( bloque >= bloquesPorCiclo ) {
+	  bloque = 0;
+	  if ( laColaMediciones.meter( medirCiclo() ) ) {
+		xTaskNotifyGive( laTareaPublicacion.manejador() );
+	  }
+
+	  // si la publicación ha cambiado el periodo (aplicarAjustes()), vale
+	  // desde aquí: un ciclo después que sin MODO_TAREAS
+	  if ( conFuente ) {
+		bloquesPorCiclo = Loop::periodoCiclo / periodo > 0 ? Loop::periodoCiclo / periodo : 1;
+	  } else {
+		periodo = Loop::periodoCiclo;
+	  }
+	}
+  } // for
+} // ()
+
+// ..............................................................
+// publicación: radio, LED y flash, con el planificador de siempre;
+// entre plazo y plazo, esperando la siguiente medición
+// ..............................................................
+void tareaPublicacion( void * ) {
+
+  using namespace Globales;
+
+  for ( ;; ) {
+	uint32_t espera = elPlanificador.tiempoHastaSiguiente( millis(), Loop::ESPERA_MAXIMA_DORMIDO );
+
+	ulTaskNotifyTake( pdTRUE, msATics( espera ) );
+	Energia::anotarDespertar();
+
+	// todas las que haya: la notificación no dice cuántas
+	Medicion mediciones[ MEDICIONES_EN_COLA ];
+	uint16_t n = laColaMediciones.sacar( & mediciones[ 0 ], MEDICIONES_EN_COLA );
+	for ( uint16_t i = 0; i < n; i++ ) {
+	  alMedir( mediciones[ i ] );
+	}
+
+	elPlanificador.ejecutarPendientes( millis() );
+  } // for
+} // ()
+
+// ..............................................................
+// registro: escribe los avisos de las otras, saca lo que quepa
+// por el puerto y atiende las órdenes
+// ..............................................................
+void tareaRegistro( void * ) {
+
+  using namespace Globales;
+
+  uint32_t plazoOrdenes = millis() + Loop::PERIODO_ORDENES;
+
+  for ( ;; ) {
+	int32_t falta = (int32_t) ( plazoOrdenes - millis() );
+	uint32_t espera = falta > 0 ? falta : 0;
+	if ( elPuerto.hayPendiente() && espera > Loop::ESPERA_PUERTO_PENDIENTE ) {
+	  espera = Loop::ESPERA_PUERTO_PENDIENTE;
+	}
+
+	Aviso aviso;
+	bool hayAviso = laColaAvisos.recibir( aviso, msATics( espera ) );
+	Energia::anotarDespertar();
+
+	while ( hayAviso ) {
+	  escribirAviso( aviso );
+	  hayAviso = laColaAvisos.recibir( aviso, 0 );
+	}
+
+	if ( (int32_t) ( millis() - plazoOrdenes ) >= 0 ) {
+	  plazoOrdenes += Loop::PERIODO_ORDENES;
+	  tareaOrdenes();
+	}
+
+	elPuerto.vaciar();
+  } // for
+} // ()
+
+// ..............................................................
+// las colas, y las tareas de menos a más prioridad: cada una
+// empieza en cuanto se crea
+// ..............................................................
+void crearTareas() {
+
+  using namespace Globales;
+
+  laColaAvisos.crear();
+
+  laTareaRegistro.crear( tareaRegistro, "registro", Loop::PRIORIDAD_REGISTRO );
+  laTareaPublicacion.crear( tareaPublicacion, "publicacion", Loop::PRIORIDAD_PUBLICACION );
+  laTareaMuestreo.crear( tareaMuestreo, "muestreo", Loop::PRIORIDAD_MUESTREO );
+} // ()
+
 // --------------------------------------------------------------
 // setup()
 // --------------------------------------------------------------
@@ -71,118 +849,138 @@ void setup() {
   // 
   inicializarPlaquita();
 
-  // Suspend Loop() to save power
-  // suspendLoop();
+  Energia::iniciar();
+
+  // 
+  // los coeficientes de esta placa, si están grabados (antes de medir)
+  // 
+  CoeficientesSensor coeficientes = Globales::COEFICIENTES_SENSOR;
+  if ( CalibracionEnFlash::cargar( Globales::DIRECCION_CALIBRACION, coeficientes ) ) {
+	Globales::laCalibracion = TablaCalibracion( coeficientes );
+	Globales::elPuerto.escribir( "---- calibración de la placa\n" );
+  }
+
+  // loop() se suspende él solo entre plazo y plazo (Loop::MODO_EVENTOS)
+  Globales::elDespertador.begin( 1000, alDespertar );
 
   // 
   // 
   // 
   Globales::elPublicador.encenderEmisora();
+  Globales::elPublicador.laEmisora.instalarCallbackConexionEstablecida( alConectarse );
 
-  // Globales::elPublicador.laEmisora.pruebaEmision();
-  
   // 
+  // el almacén sigue donde lo dejó; su descarga, por GATT
   // 
+  Globales::elAlmacen.montar();
+
+  Globales::laCaracteristicaRegistros.instalarCallbackCaracteristicaEscrita( alEscribirRegistros );
+  Globales::elPublicador.laEmisora.anyadirServicioConSusCaracteristicasYActivar(
+	Globales::elServicioDescarga, Globales::laCaracteristicaRegistros );
+
   // 
-  Globales::elMedidor.iniciarMedidor();
+  // los ajustes: los guardados, si los hay; y por GATT, para cambiarlos
+  // 
+  if ( Loop::laConfiguracion.cargar() ) {
+	Globales::elPuerto.escribir( "---- ajustes guardados\n" );
+  }
+
+  Globales::laCaracteristicaAjustes.instalarCallbackCaracteristicaEscrita( alEscribirAjustes );
+  Globales::elPublicador.laEmisora.anyadirServicioConSusCaracteristicasYActivar(
+	Globales::elServicioConfiguracion, Globales::laCaracteristicaAjustes );
+
+  aplicarAjustes();
 
   // 
   // 
   // 
   esperar( 1000 );
 
-  Globales::elPuerto.escribir( "---- setup(): fin ---- \n " );
+  // 
+  // el ADC empieza justo antes que las tareas: si no, se llenan
+  // bloques que nadie recoge
+  // 
+  Globales::elMedidor.iniciarMedidor();
 
-} // setup ()
+  // 
+  // a partir de aquí todo son tareas del planificador
+  // (con Loop::MODO_TAREAS, el muestreo y el puerto van aparte)
+  // 
+  if ( ! Loop::MODO_TAREAS ) {
+	if ( Globales::elMedidor.periodoAtencion() > 0 ) {
+	  Globales::elPlanificador.anyadirTareaPeriodica( tareaMedidor,
+													 Globales::elMedidor.periodoAtencion() );
+	}
 
-// --------------------------------------------------------------
-// --------------------------------------------------------------
-inline void lucecitas() {
-  using namespace Globales;
+	// (el primer ciclo, cuando ya haya un bloque de muestras)
+	Loop::idTareaCiclo = Globales::elPlanificador.anyadirTareaPeriodica( tareaCiclo, Loop::periodoCiclo,
+																		Globales::elMedidor.periodoAtencion() );
 
-  elLED.brillar( 100 ); // 100 encendido
-  esperar ( 400 ); //  100 apagado
-  elLED.brillar( 100 ); // 100 encendido
-  esperar ( 400 ); //  100 apagado
-  Globales::elLED.brillar( 100 ); // 100 encendido
-  esperar ( 400 ); //  100 apagado
-  Globales::elLED.brillar( 1000 ); // 1000 encendido
-  esperar ( 1000 ); //  100 apagado
-} // ()
+	Globales::elPlanificador.anyadirTareaPeriodica( tareaOrdenes, Loop::PERIODO_ORDENES );
+  }
+
+  Globales::elPlanificador.anyadirTareaPeriodica( tareaDescarga, Loop::PERIODO_DESCARGA );
+
+  // lo gastado, desde aquí
+  Energia::reiniciar( millis() );
+
+  Globales::elPuerto.escribir( "---- setup(): fin ---- \n " );
+
+  if ( Loop::MODO_TAREAS ) {
+	crearTareas(); // lo último: empiezan ya
+  }
+
+} // setup ()
 
 // --------------------------------------------------------------
 // loop ()
 // --------------------------------------------------------------
-namespace Loop {
-  uint8_t cont = 0;
-};
-
-// ..............................................................
-// ..............................................................
 void loop () {
 
-  using namespace Loop;
   using namespace Globales;
 
-  cont++;
-
-  elPuerto.escribir( "\n---- loop(): empieza " );
-  elPuerto.escribir( cont );
-  elPuerto.escribir( "\n" );
+  if ( Loop::MODO_TAREAS ) {
+	// todo va en las tareas: ésta, la de loop(), no tiene nada que hacer
+	suspendLoop();
+	return;
+  }
 
+  Energia::anotarDespertar();
 
-  lucecitas();
+  elPlanificador.ejecutarPendientes( millis() );
 
   // 
-  // mido y publico
-  // 
-  int valorCO2 = elMedidor.medirCO2();
-  
-  elPublicador.publicarCO2( valorCO2,
-							cont,
-							1000 // intervalo de emisión
-							);
-  
-  // 
-  // mido y publico
+  // lo que hayan escrito las tareas sale ahora, sin esperar al puerto
   // 
-  int valorTemperatura = elMedidor.medirTemperatura();
-  
-  elPublicador.publicarTemperatura( valorTemperatura, 
-									cont,
-									1000 // intervalo de emisión
-									);
+  elPuerto.vaciar();
 
   // 
-  // prueba para emitir un iBeacon y poner
-  // en la carga (21 bytes = uuid 16 major 2 minor 2 txPower 1 )
-  // lo que queramos (sin seguir dicho formato)
-  // 
-  // Al terminar la prueba hay que hacer Publicador::laEmisora privado
+  // nada que hacer hasta el siguiente plazo. delay() en el núcleo
+  // de Adafruit es vTaskDelay(): la CPU duerme mientras tanto.
+  // Si queda texto por sacar, sólo un poco
   // 
-  char datos[21] = {
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H'
-  };
+  uint32_t espera = elPlanificador.tiempoHastaSiguiente( millis(),
+														  Loop::MODO_EVENTOS ? Loop::ESPERA_MAXIMA_DORMIDO : 1000 );
+  if ( elPuerto.hayPendiente() && espera > Loop::ESPERA_PUERTO_PENDIENTE ) {
+	espera = Loop::ESPERA_PUERTO_PENDIENTE;
+  }
 
-  // elPublicador.laEmisora.emitirAnuncioIBeaconLibre ( &datos[0], 21 );
-  elPublicador.laEmisora.emitirAnuncioIBeaconLibre ( "MolaMolaMolaMolaMolaM", 21 );
+  if ( ! Loop::MODO_EVENTOS ) {
+	delay( espera );
+	return;
+  }
 
-  esperar( 2000 );
+  if ( espera == 0 ) {
+	return; // ya hay algo vencido: otra vuelta
+  }
 
-  elPublicador.laEmisora.detenerAnuncio();
-  
   // 
+  // el temporizador despierta a loop() al vencer. Se repite: si vence
+  // antes de suspender (y el resumeLoop() se pierde), lo hará otra vez
   // 
-  // 
-  elPuerto.escribir( "---- loop(): acaba **** " );
-  elPuerto.escribir( cont );
-  elPuerto.escribir( "\n" );
-  
+  elDespertador.setPeriod( espera );
+  suspendLoop();
+
 } // loop ()
 // --------------------------------------------------------------
 // --------------------------------------------------------------
@@ -0,0 +1,240 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Instrumentacion.h
+ * @brief Cuánto tardan los trozos de código que importan: histogramas de latencia por tramo.
+ * @author Sento Marcos Ibarra
+ *
+ * Al principio de un trozo de código se pone
+ *
+ *   MEDIR_TRAMO( "emitirAnuncioIBeacon" );
+ *
+ * y, al salir del ámbito, lo que ha tardado se anota en el histograma de ese
+ * tramo. Los tiempos van en "tics": ciclos de reloj en la placa (contador
+ * DWT->CYCCNT del Cortex-M4) y nanosegundos en el ordenador (RelojCPU.h).
+ *
+ * Las cubetas del histograma son fijas y van por potencias de 2: la cubeta k
+ * cuenta las duraciones entre 2^k y 2^(k+1)-1 tics.
+ *
+ * Sólo existe si se define INSTRUMENTACION_ACTIVA antes de incluir esto;
+ * si no, MEDIR_TRAMO no genera nada.
+ */
+
+#ifndef INSTRUMENTACION_H_INCLUIDO
+#define INSTRUMENTACION_H_INCLUIDO
+
+#ifndef INSTRUMENTACION_ACTIVA
+
+#define MEDIR_TRAMO(nombre)
+
+#else
+
+#include "RelojCPU.h"
+
+#ifndef MAX_TRAMOS_MEDIDOS
+#define MAX_TRAMOS_MEDIDOS 16
+#endif
+
+namespace Instrumentacion {
+
+  const uint8_t NUM_CUBETAS = 32;
+
+  // .........................................................
+  // reloj: el de RelojCPU.h, que también usa Energia.h
+  // .........................................................
+  const uint32_t NANOSEGUNDOS_POR_MIL_TICS = RelojCPU::NANOSEGUNDOS_POR_MIL_TICS;
+
+  using RelojCPU::tics;
+
+  class Tramo;
+
+  // .........................................................
+  // los tramos que se han usado alguna vez: estáticas de funciones
+  // inline, una sola copia aunque esto se incluya en varias unidades
+  // .........................................................
+  inline Tramo** losTramos() {
+    static Tramo* t[MAX_TRAMOS_MEDIDOS];
+    return &t[0];
+  }  // ()
+
+  inline uint8_t& numTramos() {
+    static uint8_t n = 0;
+    return n;
+  }  // ()
+
+  /**
+   * @class Tramo
+   * @brief Estadísticas e histograma de un trozo de código.
+   */
+  class Tramo {
+  public:
+    const char* nombre;
+    uint32_t cuenta;
+    uint32_t minimo;
+    uint32_t maximo;
+    uint64_t total;
+    uint32_t cubetas[NUM_CUBETAS];
+
+    /**
+     * @brief Constructor: se apunta en losTramos (si cabe).
+     */
+    Tramo(const char* nombre_)
+      : nombre(nombre_), cuenta(0), minimo(0xFFFFFFFF), maximo(0), total(0), cubetas() {
+      if (numTramos() == 0) {
+        RelojCPU::iniciar();
+      }
+      if (numTramos() < MAX_TRAMOS_MEDIDOS) {
+        losTramos()[numTramos()++] = this;
+      }
+    }  // ()
+
+    /**
+     * @brief Anota una duración.
+     * @param duracion En tics.
+     */
+    void anotar(uint32_t duracion) {
+      (*this).cuenta++;
+      (*this).total += duracion;
+      if (duracion < (*this).minimo) {
+        (*this).minimo = duracion;
+      }
+      if (duracion > (*this).maximo) {
+        (*this).maximo = duracion;
+      }
+      uint8_t k = (duracion == 0 ? 0 : 31 - __builtin_clz(duracion));
+      (*this).cubetas[k]++;
+    }  // ()
+
+    /**
+     * @brief Pone a cero las estadísticas.
+     */
+    void reiniciar() {
+      (*this).cuenta = 0;
+      (*this).minimo = 0xFFFFFFFF;
+      (*this).maximo = 0;
+      (*this).total = 0;
+      memset(&(*this).cubetas[0], 0, sizeof((*this).cubetas));
+    }  // ()
+  };   // class
+
+  /**
+   * @class Temporizador
+   * @brief Mide desde que se construye hasta que se destruye.
+   */
+  class Temporizador {
+  private:
+    Tramo& elTramo;
+    uint32_t inicio;
+
+  public:
+    Temporizador(Tramo& t)
+      : elTramo(t), inicio(tics()) {
+    }  // ()
+
+    ~Temporizador() {
+      elTramo.anotar(tics() - inicio);
+    }  // ()
+  };   // class
+
+  /**
+   * @brief Escribe las estadísticas de todos los tramos.
+   *
+   * Una línea por tramo: nombre, cuenta, mínimo, media, máximo (en tics)
+   * y las cubetas desde la primera hasta la última que no están vacías.
+   *
+   * @param salida Algo con escribir(): PuertoSerie, por ejemplo.
+   */
+  template<typename S>
+  void volcar(S& salida) {
+    salida.escribir("---- tramos (ns por 1000 tics = ");
+    salida.escribir((unsigned long)NANOSEGUNDOS_POR_MIL_TICS);
+    salida.escribir(")\n");
+
+    for (uint8_t i = 0; i < numTramos(); i++) {
+      const Tramo& t = *losTramos()[i];
+      salida.escribir(t.nombre);
+      salida.escribir(" n=");
+      salida.escribir((unsigned long)t.cuenta);
+      if (t.cuenta == 0) {
+        salida.escribir("\n");
+        continue;
+      }
+      salida.escribir(" min=");
+      salida.escribir((unsigned long)t.minimo);
+      salida.escribir(" media=");
+      salida.escribir((unsigned long)(t.total / t.cuenta));
+      salida.escribir(" max=");
+      salida.escribir((unsigned long)t.maximo);
+
+      uint8_t desde = 0;
+      uint8_t hasta = NUM_CUBETAS - 1;
+      while (t.cubetas[desde] == 0) {
+        desde++;
+      }
+      while (t.cubetas[hasta] == 0) {
+        hasta--;
+      }
+      salida.escribir(" 2^");
+      salida.escribir((unsigned int)desde);
+      salida.escribir(":");
+      for (uint8_t k = desde; k <= hasta; k++) {
+        salida.escribir(" ");
+        salida.escribir((unsigned long)t.cubetas[k]);
+      }
+      salida.escribir("\n");
+    }  // for
+  }    // ()
+
+  /**
+   * @brief Un tramo en binario, para enviarlo por una característica GATT.
+   *
+   * cuenta, mínimo, máximo y media (uint32 little-endian) y las cubetas
+   * (uint16, saturadas), en total 16 + 2 * NUM_CUBETAS bytes.
+   *
+   * @param i Número de tramo.
+   * @param destino Donde se escribe.
+   * @return Bytes escritos (0 si no hay tramo i).
+   */
+  inline uint16_t empaquetarTramo(uint8_t i, uint8_t* destino) {
+    if (i >= numTramos()) {
+      return 0;
+    }
+    const Tramo& t = *losTramos()[i];
+    uint32_t cabecera[4] = {
+      t.cuenta, t.minimo, t.maximo, (uint32_t)(t.cuenta ? t.total / t.cuenta : 0)
+    };
+    memcpy(destino, &cabecera[0], sizeof(cabecera));  // el Cortex-M4 es little-endian
+    for (uint8_t k = 0; k < NUM_CUBETAS; k++) {
+      uint16_t c = (t.cubetas[k] > 0xFFFF ? 0xFFFF : t.cubetas[k]);
+      destino[16 + 2 * k] = c & 0xFF;
+      destino[16 + 2 * k + 1] = c >> 8;
+    }
+    return 16 + 2 * NUM_CUBETAS;
+  }  // ()
+
+  /**
+   * @brief Pone a cero todos los tramos.
+   */
+  inline void reiniciar() {
+    for (uint8_t i = 0; i < numTramos(); i++) {
+      losTramos()[i]->reiniciar();
+    }
+  }  // ()
+
+};  // namespace
+
+#define MEDIR_TRAMO_CONCATENAR2(a, b) a##b
+#define MEDIR_TRAMO_CONCATENAR(a, b) MEDIR_TRAMO_CONCATENAR2(a, b)
+
+#define MEDIR_TRAMO(nombre) \
+  static Instrumentacion::Tramo MEDIR_TRAMO_CONCATENAR(elTramo_, __LINE__)(nombre); \
+  Instrumentacion::Temporizador MEDIR_TRAMO_CONCATENAR(elTemporizador_, __LINE__)( \
+    MEDIR_TRAMO_CONCATENAR(elTramo_, __LINE__))
+
+#endif  // INSTRUMENTACION_ACTIVA
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
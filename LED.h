@@ -9,6 +9,8 @@
 #ifndef LED_H_INCLUIDO
 #define LED_H_INCLUIDO
 
+#include "Energia.h"
+
 /**
  * @function esperar
  * @brief Espera un tiempo dado en milisegundos.
@@ -18,9 +20,46 @@ void esperar(long tiempo) {
   delay(tiempo);
 }
 
+/**
+ * @struct PatronLED
+ * @brief Secuencia de parpadeo: duraciones en ms, alternando encendido y apagado
+ * (el primer paso, encendido).
+ */
+struct PatronLED {
+  const uint16_t* duraciones;  ///< ms de cada paso.
+  uint8_t numPasos;            ///< Cuántos pasos.
+  bool repetir;                ///< Al acabar, vuelve a empezar.
+};
+
+namespace PatronesLED {
+
+  const uint16_t pasosLucecitas[] = { 100, 400, 100, 400, 100, 400, 1000, 1000 };
+  const uint16_t pasosAnunciando[] = { 50, 1950 };
+  const uint16_t pasosConectado[] = { 1000 };  // sólo "encendido": se queda encendido
+  const uint16_t pasosFallo[] = { 100, 100 };
+
+  /// Tres destellos cortos y uno largo (el de siempre).
+  const PatronLED LUCECITAS = { pasosLucecitas, 8, false };
+
+  /// Un destello breve cada 2 s mientras se anuncia.
+  const PatronLED ANUNCIANDO = { pasosAnunciando, 2, true };
+
+  /// Encendido fijo mientras hay un teléfono conectado.
+  const PatronLED CONECTADO = { pasosConectado, 1, true };
+
+  /// Parpadeo rápido: algo ha fallado.
+  const PatronLED FALLO = { pasosFallo, 2, true };
+
+};  // namespace
+
 /**
  * @class LED
  * @brief Clase para manejar LEDs.
+ *
+ * Además de encender y apagar, reproduce patrones (PatronLED) sin esperar:
+ * reproducir() lo empieza y tic() avanza los pasos que toquen. Quien lleve
+ * el tiempo (una tarea del planificador) llama a tic() cuando le diga el
+ * propio tic().
  */
 class LED {
   /**
@@ -34,14 +73,35 @@ class LED {
 private:
   int numeroLED;
   bool encendido;
+  uint32_t instanteEncendido;  ///< millis() al encender: lo que ha lucido va a Energia al apagar.
+
+  const PatronLED* patron;  ///< El que se está reproduciendo, o nullptr.
+  uint8_t paso;             ///< Paso actual del patrón.
+  uint32_t finPaso;         ///< millis() en que acaba el paso actual.
+
+  // .........................................................
+  // los pasos pares encienden, los impares apagan
+  // .........................................................
+  void empezarPaso(uint32_t desde) {
+    if ((*this).paso % 2 == 0) {
+      (*this).encender();
+    } else {
+      (*this).apagar();
+    }
+    (*this).finPaso = desde + (*this).patron->duraciones[(*this).paso];
+  }  // ()
+
 public:
 
+  static const uint32_t NADA_QUE_HACER = 0xFFFFFFFF;  ///< Lo que devuelve tic() sin patrón.
+
   /**
    * @brief Constructor de la clase LED.
    * @param numero Número del pin del LED.
    */
   LED(int numero)
-    : numeroLED(numero), encendido(false) {
+    : numeroLED(numero), encendido(false), instanteEncendido(0),
+      patron(nullptr), paso(0), finPaso(0) {
     pinMode(numeroLED, OUTPUT);
     apagar();
   }
@@ -52,6 +112,9 @@ public:
    */
   void encender() {
     digitalWrite(numeroLED, HIGH);
+    if (!encendido) {
+      instanteEncendido = millis();
+    }
     encendido = true;
   }
 
@@ -61,6 +124,10 @@ public:
    */
   void apagar() {
     digitalWrite(numeroLED, LOW);
+    if (encendido) {
+      Energia::anotarNs(Energia::LED, (uint64_t)(millis() - instanteEncendido) * 1000000,
+                        Energia::CORRIENTE_LED_UA);
+    }
     encendido = false;
   }
 
@@ -80,12 +147,70 @@ public:
    * @function brillar
    * @brief Enciende el LED durante un tiempo dado.
    * @param tiempo Tiempo en milisegundos.
+   * @note Bloquea tiempo ms: mejor reproducir() un patrón.
    */
   void brillar(long tiempo) {
     encender();
     esperar(tiempo);
     apagar();
   }
+
+  /**
+   * @function reproducir
+   * @brief Empieza un patrón (sustituye al que hubiera). No espera.
+   * @param p Patrón; tiene que seguir existiendo mientras se reproduce.
+   */
+  void reproducir(const PatronLED& p) {
+    (*this).patron = &p;
+    (*this).paso = 0;
+    (*this).empezarPaso(millis());
+  }  // ()
+
+  /**
+   * @function parar
+   * @brief Deja de reproducir y apaga.
+   */
+  void parar() {
+    (*this).patron = nullptr;
+    (*this).apagar();
+  }  // ()
+
+  /**
+   * @function reproduciendo
+   * @brief Si hay un patrón en marcha.
+   */
+  bool reproduciendo() const {
+    return (*this).patron != nullptr;
+  }  // ()
+
+  /**
+   * @function tic
+   * @brief Avanza el patrón hasta ahora.
+   * @param ahora millis().
+   * @return ms hasta el siguiente cambio, o NADA_QUE_HACER si no hay patrón.
+   */
+  uint32_t tic(uint32_t ahora) {
+    if ((*this).patron == nullptr) {
+      return NADA_QUE_HACER;
+    }
+
+    // por si se ha llegado tarde y hay que saltar varios pasos
+    while ((int32_t)(ahora - (*this).finPaso) >= 0) {
+      uint32_t fin = (*this).finPaso;
+      (*this).paso++;
+      if ((*this).paso >= (*this).patron->numPasos) {
+        if (!(*this).patron->repetir) {
+          (*this).parar();
+          return NADA_QUE_HACER;
+        }
+        (*this).paso = 0;
+      }
+      (*this).empezarPaso(fin);
+    }  // while
+
+    return (*this).finPaso - ahora;
+  }  // ()
+
 };  // class
 
 // ----------------------------------------------------------
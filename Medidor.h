@@ -4,56 +4,222 @@
  * @file Medidor.h
  * @brief Controlador para medir la concentración de CO2 y la temperatura.
  * @author Sento Marcos Ibarra
+ *
+ * Las muestras del sensor (ULPSM: Vgas, Vref y Vtemp) llegan en bloques de
+ * una FuenteMuestras. atender() filtra cada bloque completo (Filtros.h) y lo
+ * suma; medirCO2() / medirTemperatura() calibran (Calibracion.h, en coma
+ * fija) la media de lo sumado desde la medición anterior:
+ *
+ *   Vgas - Vref -> mediana de 5 (picos) -> paso bajo Butterworth (fs / 20)
+ *   Vtemp       -> media móvil de 8 -> EMA (1/8)
+ * Sin fuente (o si no arranca) devuelve los valores fijos de prueba.
  */
 
 #ifndef MEDIDOR_H_INCLUIDO
 #define MEDIDOR_H_INCLUIDO
 
+#include "FuenteMuestras.h"
+#include "Calibracion.h"
+#include "Filtros.h"
+#include "Instrumentacion.h"
+#include "Energia.h"
+
 /**
  * @class Medidor
  * @brief Clase para medir la concentración de CO2 y la temperatura.
  */
 class Medidor {
 
+public:
+
+  /**
+   * @brief Canales de la fuente, en el orden del escaneo.
+   */
+  enum {
+    CANAL_GAS = 0,
+    CANAL_REFERENCIA = 1,
+    CANAL_TEMPERATURA = 2,
+    NUM_CANALES = 3
+  };
+
+  static const int32_t MILIVOLTIOS_FONDO_ESCALA = 3600;  ///< SAADC con ganancia 1/6 y referencia de 0.6 V.
+  static const int32_t CUENTAS_FONDO_ESCALA = 4096;      ///< 12 bits.
+
+  static const uint16_t MAX_ESCANEOS_TROZO = 64;  ///< Los bloques se filtran en trozos de esto.
+
   // .....................................................
   // .....................................................
 private:
 
+  FuenteMuestras* laFuente;
+  const TablaCalibracion* laCalibracion;  ///< La de esta placa (Calibracion.h).
+
+  //
+  // lo que se suma: la señal del gas (Vgas - Vref) y la temperatura, filtradas
+  //
+  enum {
+    SENYAL_GAS = 0,
+    SENYAL_TEMPERATURA = 1,
+    NUM_SENYALES = 2
+  };
+
+  int32_t suma[NUM_SENYALES];     ///< Desde la última medición.
+  uint32_t cuenta[NUM_SENYALES];
+  int32_t ultimaMediaQ4[NUM_SENYALES];
+
+  Filtros::Mediana<5> laMedianaGas;
+  Filtros::Biquad elPasoBajoGas;
+  Filtros::MediaMovil<8> laMediaTemperatura;
+  Filtros::EMA<3> laEMATemperatura;
+
+  // .....................................................
+  // media (Q4) de lo sumado en una señal, y a cero;
+  // si no se ha sumado nada, la anterior
+  // .....................................................
+  int32_t tomarMediaQ4(uint8_t senyal) {
+    if ((*this).cuenta[senyal] > 0) {
+      (*this).ultimaMediaQ4[senyal] = (*this).suma[senyal] * 16 / (int32_t)(*this).cuenta[senyal];
+      (*this).suma[senyal] = 0;
+      (*this).cuenta[senyal] = 0;
+    }
+    return (*this).ultimaMediaQ4[senyal];
+  }  // ()
+
+  // .....................................................
+  // filtra y suma m escaneos (m <= MAX_ESCANEOS_TROZO)
+  // .....................................................
+  void procesarTrozo(const int16_t* escaneos, uint16_t m) {
+    int16_t gas[MAX_ESCANEOS_TROZO];
+    int16_t otro[MAX_ESCANEOS_TROZO];
+
+    Filtros::desentrelazar(escaneos, NUM_CANALES, CANAL_GAS, &gas[0], m);
+    Filtros::desentrelazar(escaneos, NUM_CANALES, CANAL_REFERENCIA, &otro[0], m);
+    Filtros::restar(&gas[0], &otro[0], &gas[0], m);
+    (*this).laMedianaGas.procesar(&gas[0], m);
+    (*this).elPasoBajoGas.procesar(&gas[0], m);
+    (*this).suma[SENYAL_GAS] += Filtros::sumar(&gas[0], m);
+    (*this).cuenta[SENYAL_GAS] += m;
+
+    Filtros::desentrelazar(escaneos, NUM_CANALES, CANAL_TEMPERATURA, &otro[0], m);
+    (*this).laMediaTemperatura.procesar(&otro[0], m);
+    (*this).laEMATemperatura.procesar(&otro[0], m);
+    (*this).suma[SENYAL_TEMPERATURA] += Filtros::sumar(&otro[0], m);
+    (*this).cuenta[SENYAL_TEMPERATURA] += m;
+  }  // ()
+
 public:
 
+  /**
+   * @brief Constructor de la clase Medidor, sin fuente: valores fijos.
+   */
+  Medidor()
+    : laFuente(NULL), laCalibracion(NULL), suma(), cuenta(), ultimaMediaQ4(),
+      elPasoBajoGas(Filtros::Biquad::pasoBajo(0.05)) {
+  }  // ()
+
   /**
    * @brief Constructor de la clase Medidor.
+   * @param fuente De donde salen las muestras (NUM_CANALES canales).
+   * @param calibracion La del sensor (un constexpr: se queda en flash).
    */
-  Medidor() {
+  Medidor(FuenteMuestras& fuente, const TablaCalibracion& calibracion)
+    : laFuente(&fuente), laCalibracion(&calibracion), suma(), cuenta(), ultimaMediaQ4(),
+      elPasoBajoGas(Filtros::Biquad::pasoBajo(0.05)) {  // corte en fs / 20: 5 Hz a 100 escaneos/s
   }  // ()
 
   /**
    * @function iniciarMedidor
-   * @brief Inicializa el medidor.
+   * @brief Inicializa el medidor: arranca la fuente (después de Bluefruit.begin()).
    */
   void iniciarMedidor() {
-    // las cosas que no se puedan hacer en el constructor, if any
+    if ((*this).laFuente == NULL) {
+      return;
+    }
+    if ((*this).laFuente->canales() != NUM_CANALES || !(*this).laFuente->empezar()) {
+      Globales::elPuerto.escribir<NIVEL_AVISO>("Medidor: sin fuente de muestras, valores fijos\n");
+      (*this).laFuente = NULL;
+    }
+  }  // ()
+
+  /**
+   * @function periodoAtencion
+   * @brief Cada cuántos ms hay que llamar a atender() (0 si no hay fuente).
+   */
+  uint32_t periodoAtencion() const {
+    return (*this).laFuente == NULL ? 0 : (*this).laFuente->periodoBloque();
+  }  // ()
+
+  /**
+   * @function bloquesPerdidos
+   * @brief Bloques que la fuente ha llenado y atender() no ha recogido a tiempo.
+   */
+  uint32_t bloquesPerdidos() const {
+    return (*this).laFuente == NULL ? 0 : (*this).laFuente->bloquesPerdidos();
+  }  // ()
+
+  /**
+   * @function atender
+   * @brief Filtra y suma los bloques completos que haya y los devuelve a la fuente.
+   * @return Bloques atendidos.
+   */
+  uint16_t atender() {
+    if ((*this).laFuente == NULL) {
+      return 0;
+    }
+
+    GASTO_CPU(Energia::MEDIDOR);
+
+    uint16_t bloques = 0;
+    const int16_t* muestras;
+    uint16_t n;
+    while ((n = (*this).laFuente->bloqueListo(muestras)) != 0) {
+      uint16_t escaneos = n / NUM_CANALES;
+      for (uint16_t desde = 0; desde < escaneos; desde += MAX_ESCANEOS_TROZO) {
+        uint16_t m = escaneos - desde;
+        if (m > MAX_ESCANEOS_TROZO) {
+          m = MAX_ESCANEOS_TROZO;
+        }
+        (*this).procesarTrozo(&muestras[desde * NUM_CANALES], m);
+      }
+      (*this).laFuente->liberarBloque();
+      Energia::anotar(Energia::MEDIDOR, (*this).laFuente->tiempoConversionBloque(),
+                      Energia::CORRIENTE_SAADC_UA);
+      bloques++;
+    }
+    return bloques;
   }  // ()
 
   /**
    * @function medirCO2
-   * @brief Mide la concentración de CO2.
-   * @return Concentración de CO2 en ppm.
-   * @note Este método devuelve un valor fijo para pruebas.
+   * @brief Mide la concentración de gas (el sensor es de ozono; el nombre se queda).
+   * @return ppb, media desde la medición anterior, compensada en temperatura.
+   * @note Sin fuente, devuelve un valor fijo para pruebas.
    */
   int medirCO2() {
-    return 235;
+    MEDIR_TRAMO("medirCO2");
+    if ((*this).laFuente == NULL) {
+      return 40;  // ppb: 0.04 ppm, lo normal de ozono en la calle
+    }
+    (*this).atender();
+    int32_t diferenciaQ4 = (*this).tomarMediaQ4(SENYAL_GAS);
+    int32_t temperaturaQ8 = (*this).laCalibracion->temperaturaQ8((*this).tomarMediaQ4(SENYAL_TEMPERATURA));
+    return (*this).laCalibracion->ppb(diferenciaQ4, temperaturaQ8);
   }  // ()
 
   /**
    * @function medirTemperatura
    * @brief Mide la temperatura.
-   * @return Temperatura en grados Celsius.
-   * @note Este método devuelve un valor fijo para pruebas.
+   * @return Temperatura en grados Celsius (redondeada), la misma media que usa medirCO2().
+   * @note Sin fuente, devuelve un valor fijo para pruebas.
    */
   int medirTemperatura() {
-    return -12;  // qué frío !
-  }              // ()
+    if ((*this).laFuente == NULL) {
+      return -12;  // qué frío !
+    }
+    (*this).atender();
+    int32_t temperaturaQ8 = (*this).laCalibracion->temperaturaQ8((*this).tomarMediaQ4(SENYAL_TEMPERATURA));
+    return (int)((temperaturaQ8 + 128) >> 8);
+  }  // ()
 
 };  // class
 
@@ -0,0 +1,167 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file NotificadorEnLotes.h
+ * @brief Muestras binarias encoladas y notificadas de muchas en muchas, hasta llenar el MTU.
+ * @author Sento Marcos Ibarra
+ *
+ * Notificar cada muestra por separado gasta un paquete (y casi siempre un
+ * evento de conexión) por muestra. Aquí las muestras se encolan con
+ * notificar() y enviar() las junta en notificaciones de hasta MTU - 3 bytes
+ * (lo que cabe en una ATT Handle Value Notification con el MTU negociado).
+ *
+ * Todas las muestras tienen TAM_MUESTRA bytes y nunca se parten entre
+ * notificaciones, así que quien recibe sólo tiene que cortar cada
+ * notificación en trozos de TAM_MUESTRA.
+ *
+ * Contrapresión:
+ *  - notificar() devuelve false si la cola está llena (la muestra se pierde
+ *    y se cuenta en muestrasPerdidas()).
+ *  - si la SoftDevice no acepta una notificación (su cola de envío está
+ *    llena), enviar() para y las muestras se quedan para la siguiente vez;
+ *    saturado() lo dice.
+ */
+
+#ifndef NOTIFICADOR_EN_LOTES_H_INCLUIDO
+#define NOTIFICADOR_EN_LOTES_H_INCLUIDO
+
+#include "ServicioEnEmisora.h"
+
+/**
+ * @class NotificadorEnLotes
+ * @brief Cola de muestras de tamaño fijo que se notifican juntas en una característica.
+ * @tparam TAM_MUESTRA Bytes de cada muestra (como mucho 20, lo que cabe con el MTU mínimo).
+ * @tparam CAPACIDAD Muestras que caben en la cola.
+ */
+template<uint8_t TAM_MUESTRA, uint16_t CAPACIDAD = 64>
+class NotificadorEnLotes {
+
+public:
+
+  static const uint16_t MTU_MAXIMO = 247;  ///< BLEGATT_ATT_MTU_MAX del núcleo de Adafruit.
+
+private:
+
+  static_assert(TAM_MUESTRA > 0 && TAM_MUESTRA <= 20, "la muestra tiene que caber con el MTU mínimo (23)");
+  static_assert(CAPACIDAD > 0, "la cola no puede estar vacía");
+
+  ServicioEnEmisora::Caracteristica& laCaracteristica;
+
+  uint8_t lasMuestras[CAPACIDAD][TAM_MUESTRA];
+  uint16_t primera;  ///< Siguiente muestra a enviar.
+  uint16_t cuantas;  ///< Muestras en la cola.
+
+  bool estaSaturado;
+  uint32_t perdidas;
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param car Característica (con CHR_PROPS_NOTIFY) por la que se envía.
+   */
+  NotificadorEnLotes(ServicioEnEmisora::Caracteristica& car)
+    : laCaracteristica(car), primera(0), cuantas(0), estaSaturado(false), perdidas(0) {
+  }  // ()
+
+  /**
+   * @function notificar
+   * @brief Encola una muestra. No envía nada: eso lo hace enviar().
+   * @param muestra TAM_MUESTRA bytes.
+   * @return false si la cola está llena (la muestra se pierde).
+   */
+  bool notificar(const uint8_t* muestra) {
+    if ((*this).cuantas == CAPACIDAD) {
+      (*this).perdidas++;
+      return false;
+    }
+    uint16_t i = ((*this).primera + (*this).cuantas) % CAPACIDAD;
+    memcpy(&(*this).lasMuestras[i][0], muestra, TAM_MUESTRA);
+    (*this).cuantas++;
+    return true;
+  }  // ()
+
+  /**
+   * @function enviar
+   * @brief Notifica lo encolado a una conexión, tantas muestras por notificación como quepan.
+   *
+   * Se para cuando la cola se vacía o la SoftDevice no acepta más.
+   *
+   * @param conexion Manejador de la conexión.
+   * @return Notificaciones enviadas.
+   */
+  uint16_t enviar(uint16_t conexion) {
+    BLEConnection* laConexion = Bluefruit.Connection(conexion);
+    if (laConexion == NULL || !laConexion->connected()) {
+      return 0;
+    }
+
+    uint16_t carga = laConexion->getMtu() - 3;
+    if (carga > MTU_MAXIMO - 3) {
+      carga = MTU_MAXIMO - 3;
+    }
+    uint16_t porPaquete = carga / TAM_MUESTRA;
+
+    uint8_t paquete[MTU_MAXIMO - 3];
+    uint16_t enviadas = 0;
+    (*this).estaSaturado = false;
+
+    while ((*this).cuantas > 0) {
+      uint16_t n = ((*this).cuantas < porPaquete ? (*this).cuantas : porPaquete);
+      for (uint16_t k = 0; k < n; k++) {
+        memcpy(&paquete[k * TAM_MUESTRA],
+               &(*this).lasMuestras[((*this).primera + k) % CAPACIDAD][0],
+               TAM_MUESTRA);
+      }
+
+      if (!(*this).laCaracteristica.notificarDatos(conexion, &paquete[0], n * TAM_MUESTRA)) {
+        // cola de envío llena: se reintenta en el siguiente enviar()
+        (*this).estaSaturado = true;
+        break;
+      }
+
+      (*this).primera = ((*this).primera + n) % CAPACIDAD;
+      (*this).cuantas -= n;
+      enviadas++;
+    }  // while
+
+    return enviadas;
+  }  // ()
+
+  /**
+   * @brief Muestras que esperan en la cola.
+   */
+  uint16_t pendientes() const {
+    return (*this).cuantas;
+  }  // ()
+
+  /**
+   * @brief Si el último enviar() se paró porque la SoftDevice no aceptaba más.
+   */
+  bool saturado() const {
+    return (*this).estaSaturado;
+  }  // ()
+
+  /**
+   * @brief Muestras que no cabían en la cola y se han perdido.
+   */
+  uint32_t muestrasPerdidas() const {
+    return (*this).perdidas;
+  }  // ()
+
+  /**
+   * @brief Tira lo encolado (p.ej. al desconectarse el teléfono).
+   */
+  void vaciar() {
+    (*this).primera = 0;
+    (*this).cuantas = 0;
+    (*this).estaSaturado = false;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,297 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Planificador.h
+ * @brief Planificador cooperativo por plazos: ejecuta tareas periódicas o de una vez sin delay().
+ * @author Sento Marcos Ibarra
+ *
+ * Cada tarea es una función sin parámetros con su próximo plazo (en ms de
+ * millis()). ejecutarPendientes() lanza las que han vencido, de la más
+ * atrasada a la menos. Una tarea no debe bloquear: si tiene que esperar,
+ * pide volver a ejecutarse más tarde con repetirEn().
+ *
+ * Las tareas están en un array fijo (sin memoria dinámica) y los plazos se
+ * comparan con resta con signo, así que el desbordamiento de millis()
+ * (cada 49 días) no afecta.
+ */
+
+#ifndef PLANIFICADOR_H_INCLUIDO
+#define PLANIFICADOR_H_INCLUIDO
+
+/**
+ * @class Planificador
+ * @brief Cola de plazos de tamaño fijo.
+ * @tparam N Número máximo de tareas.
+ */
+template<uint8_t N>
+class Planificador {
+
+  static_assert(N <= 32, "una tarea por bit de porEjecutar");
+
+public:
+
+  /**
+   * @typedef FuncionTarea
+   * @brief Función que hace el trabajo de una tarea. No debe bloquear.
+   */
+  using FuncionTarea = void();
+
+  static const int8_t NINGUNA = -1;  ///< Identificador de "ninguna tarea".
+
+private:
+
+  /**
+   * @struct Tarea
+   * @brief Una entrada de la cola.
+   */
+  struct Tarea {
+    FuncionTarea* funcion;  ///< nullptr = hueco libre.
+    uint32_t periodo;       ///< 0 = de una vez.
+    uint32_t plazo;         ///< millis() en que toca ejecutarla.
+  };
+
+  Tarea lasTareas[N];
+
+  int8_t tareaEnCurso;         ///< La que se está ejecutando ahora, o NINGUNA.
+  bool repetirTareaEnCurso;    ///< Si la tarea en curso ha llamado a repetirEn().
+  uint32_t plazoTareaEnCurso;  ///< Plazo pedido con repetirEn().
+  uint32_t plazoVencido;       ///< Aquel para el que se está ejecutando la tarea en curso.
+  uint32_t porEjecutar;        ///< En ejecutarPendientes(): bit i, la i venció antes de entrar y aún no ha ido.
+
+  // .........................................................
+  // .........................................................
+  static bool haVencido(uint32_t plazo, uint32_t ahora) {
+    return (int32_t)(ahora - plazo) >= 0;
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  int8_t anyadirTarea(FuncionTarea* f, uint32_t periodo, uint32_t retardo) {
+    for (int8_t i = 0; i < N; i++) {
+      if ((*this).lasTareas[i].funcion == nullptr) {
+        (*this).lasTareas[i].funcion = f;
+        (*this).lasTareas[i].periodo = periodo;
+        (*this).lasTareas[i].plazo = millis() + retardo;
+        (*this).porEjecutar &= ~(1UL << i);  // nueva: no venció antes de entrar
+        return i;
+      }
+    }  // for
+    return NINGUNA;
+  }  // ()
+
+  // .........................................................
+  // de las de porEjecutar, la que tiene el plazo vencido más
+  // antiguo, o NINGUNA
+  // .........................................................
+  int8_t masAtrasada(uint32_t ahora) const {
+    int8_t elegida = NINGUNA;
+    for (int8_t i = 0; i < N; i++) {
+      const Tarea& t = (*this).lasTareas[i];
+      if (!((*this).porEjecutar & (1UL << i))
+          || t.funcion == nullptr || !haVencido(t.plazo, ahora)) {
+        continue;
+      }
+      if (elegida == NINGUNA
+          || (int32_t)(t.plazo - (*this).lasTareas[elegida].plazo) < 0) {
+        elegida = i;
+      }
+    }  // for
+    return elegida;
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor: cola vacía.
+   */
+  Planificador()
+    : lasTareas(), tareaEnCurso(NINGUNA),
+      repetirTareaEnCurso(false), plazoTareaEnCurso(0), plazoVencido(0), porEjecutar(0) {
+  }  // ()
+
+  /**
+   * @function anyadirTareaPeriodica
+   * @brief Añade una tarea que se ejecuta cada periodo ms.
+   * @param f Función de la tarea.
+   * @param periodo Periodo en ms.
+   * @param retardo Tiempo hasta la primera ejecución, en ms.
+   * @return Identificador de la tarea, o NINGUNA si la cola está llena.
+   */
+  int8_t anyadirTareaPeriodica(FuncionTarea* f, uint32_t periodo, uint32_t retardo = 0) {
+    return (*this).anyadirTarea(f, periodo, retardo);
+  }  // ()
+
+  /**
+   * @function anyadirTareaUnaVez
+   * @brief Añade una tarea que se ejecuta una sola vez.
+   * @param f Función de la tarea.
+   * @param retardo Tiempo hasta la ejecución, en ms.
+   * @return Identificador de la tarea, o NINGUNA si la cola está llena.
+   */
+  int8_t anyadirTareaUnaVez(FuncionTarea* f, uint32_t retardo = 0) {
+    return (*this).anyadirTarea(f, 0, retardo);
+  }  // ()
+
+  /**
+   * @function cancelarTarea
+   * @brief Quita una tarea de la cola.
+   * @param id Identificador devuelto al añadirla.
+   */
+  void cancelarTarea(int8_t id) {
+    if (id >= 0 && id < N) {
+      (*this).lasTareas[id].funcion = nullptr;
+    }
+    if (id == (*this).tareaEnCurso) {
+      (*this).repetirTareaEnCurso = false;
+    }
+  }  // ()
+
+  /**
+   * @function reprogramarTarea
+   * @brief Cambia el próximo plazo de una tarea.
+   * @param id Identificador de la tarea.
+   * @param retardo Tiempo desde ahora, en ms.
+   */
+  void reprogramarTarea(int8_t id, uint32_t retardo) {
+    if (id >= 0 && id < N && (*this).lasTareas[id].funcion != nullptr) {
+      (*this).lasTareas[id].plazo = millis() + retardo;
+    }
+  }  // ()
+
+  /**
+   * @function cambiarPeriodo
+   * @brief Cambia el periodo de una tarea periódica.
+   *
+   * El plazo que ya tiene no cambia: el nuevo periodo cuenta desde él. Desde
+   * dentro de la propia tarea, el siguiente plazo ya es el anterior más el
+   * nuevo periodo.
+   *
+   * @param id Identificador de la tarea.
+   * @param periodo Periodo en ms (no 0: eso la haría de una vez).
+   */
+  void cambiarPeriodo(int8_t id, uint32_t periodo) {
+    if (id >= 0 && id < N && (*this).lasTareas[id].funcion != nullptr
+        && (*this).lasTareas[id].periodo != 0 && periodo != 0) {
+      (*this).lasTareas[id].periodo = periodo;
+    }
+  }  // ()
+
+  /**
+   * @function repetirEn
+   * @brief Desde dentro de una tarea: vuelve a ejecutarla dentro de retardo ms.
+   *
+   * Sirve para partir un trabajo con esperas en pasos, sin bloquear.
+   * En una tarea periódica sustituye al siguiente periodo sólo esta vez.
+   *
+   * @param retardo Tiempo desde ahora, en ms.
+   */
+  void repetirEn(uint32_t retardo) {
+    (*this).repetirTareaEnCurso = true;
+    (*this).plazoTareaEnCurso = millis() + retardo;
+  }  // ()
+
+  /**
+   * @function plazoEnCurso
+   * @brief Desde dentro de una tarea: el plazo para el que se ejecuta.
+   *
+   * millis() - plazoEnCurso() es lo que se ha retrasado.
+   */
+  uint32_t plazoEnCurso() const {
+    return (*this).plazoVencido;
+  }  // ()
+
+  /**
+   * @function ejecutarPendientes
+   * @brief Ejecuta las tareas cuyo plazo había vencido al llamarla.
+   *
+   * Cada una, una vez como mucho: la que se repite en 0 ms (repetirEn(0))
+   * o se añade desde otra tarea vuelve en la llamada siguiente, así que no
+   * deja sin turno a las demás.
+   *
+   * @param ahora Tiempo actual (millis()).
+   * @return Cuántas tareas se han ejecutado.
+   */
+  uint8_t ejecutarPendientes(uint32_t ahora) {
+    uint8_t ejecutadas = 0;
+
+    (*this).porEjecutar = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      const Tarea& t = (*this).lasTareas[i];
+      if (t.funcion != nullptr && haVencido(t.plazo, ahora)) {
+        (*this).porEjecutar |= (1UL << i);
+      }
+    }  // for
+
+    for (uint8_t vuelta = 0; vuelta < N; vuelta++) {
+      int8_t i = (*this).masAtrasada(ahora);
+      if (i == NINGUNA) {
+        break;
+      }
+      (*this).porEjecutar &= ~(1UL << i);
+
+      Tarea& t = (*this).lasTareas[i];
+      FuncionTarea* f = t.funcion;
+      uint32_t plazoAnterior = t.plazo;
+
+      // la marco como hecha antes de ejecutarla
+      t.plazo = ahora + 0x7FFFFFFF;
+
+      (*this).tareaEnCurso = i;
+      (*this).repetirTareaEnCurso = false;
+      (*this).plazoVencido = plazoAnterior;
+      f();
+      (*this).tareaEnCurso = NINGUNA;
+      ejecutadas++;
+
+      if (t.funcion != f) {
+        continue;  // se ha cancelado (o reutilizado el hueco) desde dentro
+      }
+
+      if ((*this).repetirTareaEnCurso) {
+        t.plazo = (*this).plazoTareaEnCurso;
+      } else if (t.periodo != 0) {
+        // sin deriva: siguiente = anterior + periodo, salvo que
+        // vayamos tan atrasados que ya haya vencido otra vez
+        t.plazo = plazoAnterior + t.periodo;
+        if (haVencido(t.plazo, ahora)) {
+          t.plazo = ahora + t.periodo;
+        }
+      } else {
+        t.funcion = nullptr;  // era de una vez
+      }
+    }  // for
+
+    return ejecutadas;
+  }  // ()
+
+  /**
+   * @function tiempoHastaSiguiente
+   * @brief Cuánto falta para el plazo más cercano.
+   * @param ahora Tiempo actual (millis()).
+   * @param maximo Lo que se devuelve si no hay tareas.
+   * @return ms hasta el siguiente plazo (0 si ya hay alguno vencido).
+   */
+  uint32_t tiempoHastaSiguiente(uint32_t ahora, uint32_t maximo = 1000) const {
+    uint32_t falta = maximo;
+    for (int8_t i = 0; i < N; i++) {
+      const Tarea& t = (*this).lasTareas[i];
+      if (t.funcion == nullptr) {
+        continue;
+      }
+      if (haVencido(t.plazo, ahora)) {
+        return 0;
+      }
+      if (t.plazo - ahora < falta) {
+        falta = t.plazo - ahora;
+      }
+    }  // for
+    return falta;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
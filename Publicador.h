@@ -2,34 +2,73 @@
 
 /**
  * @file Publicador.h
- * @brief Controlador para publicar mediciones de CO2, temperatura y ruido a través de BLE.
+ * @brief Controlador para publicar las mediciones de una lista de sensores a través de BLE.
  * @author Sento Marcos Ibarra
+ *
+ * Qué se publica lo dice la lista de sensores (RegistroSensores.h): las
+ * mediciones llegan como un array en el orden de la lista, la trama
+ * empaquetada lleva el valor k en POS_VALORES + 2k y el paso k de la
+ * publicación de una medición por iBeacon es el sensor k. Nada de esto se
+ * decide al ejecutar.
+ *
+ * Publicación adaptativa (publicarSiCambia()): la trama empaquetada sólo se
+ * cambia cuando alguna medición se aleja de la última publicada más que su
+ * banda muerta, o cuando lleva SILENCIO_MAXIMO sin cambiar (latido). El
+ * anuncio no se para nunca; lo que cambia es su intervalo:
+ *
+ *  - al cambiar un valor, ráfaga: INTERVALO_RAFAGA durante DURACION_RAFAGA
+ *  - luego INTERVALO_REPOSO, que se dobla en cada ciclo sin cambios
+ *    hasta INTERVALO_MAXIMO
+ *
+ * Publicación en lote (publicarEnLote()): cada medición se añade a una
+ * TramaMuestras que va en un anuncio extendido de BLE 5, con las
+ * MAX_MUESTRAS últimas. Como cada una sale en muchas tramas, el intervalo
+ * puede ser largo (INTERVALO_EXTENDIDO). Si la emisora no puede emitir
+ * extendidos, se publica como en publicarSiCambia().
+ *
+ * Publicación de resúmenes (publicarResumenes()): sólo sale lo de cada
+ * ventana cerrada de un Agregador, una trama de resumen por sensor
+ * (TramaMediciones.h, versión 2), repartidas a lo largo de la ventana
+ * siguiente y siempre al intervalo máximo.
+ *
+ * INTERVALO_REPOSO, INTERVALO_MAXIMO e INTERVALO_EXTENDIDO son los de
+ * fábrica: cambiarIntervalos() los cambia al ejecutar (Configuracion.h).
  */
 
 #ifndef PUBLICADOR_H_INCLUIDO
 #define PUBLICADOR_H_INCLUIDO
 
+#include "TramaMediciones.h"
+#include "TramaMuestras.h"
+#include "Uuid128.h"
+#include "RegistroSensores.h"
+#include "Agregador.h"
+
 /**
- * @brief Clase para publicar mediciones de CO2, temperatura y ruido a través de BLE.
+ * @brief Clase para publicar las mediciones de una lista de sensores a través de BLE.
+ * @tparam R Un RegistroSensores.
  */
+template<typename R>
 class Publicador {
 
+  static_assert(R::NUM > 0 && (int)R::NUM <= (int)TramaMediciones::MAX_VALORES,
+                "en la trama empaquetada caben de 1 a MAX_VALORES sensores");
+
   /**
    * @var beaconUUID
-   * @brief UUID del beacon.
+   * @brief UUID del beacon, en el orden en que se emite. Se calcula al compilar.
    * @example "EPSG-GTI-PROY-3D"
    */
 private:
 
-  uint8_t beaconUUID[16] = {
-    'E', 'P', 'S', 'G', '-', 'G', 'T', 'I',
-    '-', 'P', 'R', 'O', 'Y', '-', '3', 'D'
-  };
+  static constexpr Uuid128 beaconUUID = TramaMediciones::uuidBeacon();
 
   // ............................................................
   // ............................................................
 public:
 
+  static const int8_t POTENCIA = 4;  ///< dBm, la de fábrica (laEmisora.cambiarPotencia() la cambia).
+
   /**
    * @var laEmisora
    * @brief Emisora BLE.
@@ -37,32 +76,55 @@ public:
   EmisoraBLE laEmisora{
     "GTI-3A",  //  nombre emisora
     0x004c,    // fabricanteID (Apple)
-    4          // txPower
+    POTENCIA   // txPower
   };
 
 
   const int RSSI = -53;  ///< Valor RSSI (Received Signal Strength Indicator).
 
   // ............................................................
+  // publicación adaptativa (la banda muerta, la de cada sensor)
   // ............................................................
-public:
+  static const uint32_t SILENCIO_MAXIMO = 60000;  ///< ms sin publicar como mucho (latido).
 
-  /**
-   * @brief Enumeración para identificar las mediciones.
-   * @param CO2 Identificador de la medición de CO2.
-   * @param TEMPERATURA Identificador de la medición de temperatura.
-   * @param RUIDO Identificador de la medición de ruido.
-   */
-  enum MedicionesID {
-    CO2 = 11,
-    TEMPERATURA = 12,
-    RUIDO = 13
-  };
+  static const uint16_t INTERVALO_RAFAGA = 32;    ///< 20 ms (en unidades de 0.625 ms).
+  static const uint16_t INTERVALO_REPOSO = 160;   ///< 100 ms.
+  static const uint16_t INTERVALO_MAXIMO = 4096;  ///< 2.56 s.
+  static const uint32_t DURACION_RAFAGA = 1000;   ///< ms.
+
+  static const uint16_t INTERVALO_EXTENDIDO = 1600;  ///< 1 s: cada medición sale en MAX_MUESTRAS ciclos.
+
+private:
+
+  bool hayPublicado;
+  int16_t ultimos[R::NUM];  ///< Lo último publicado de cada sensor.
+  uint32_t instanteUltimaPublicacion;
+  uint32_t finRafaga;
+  uint16_t intervaloActual;
+  uint16_t intervaloReposo;     ///< Los que se usan: al principio, los de fábrica.
+  uint16_t intervaloMaximo;
+  uint16_t intervaloExtendido;
+  uint32_t secuenciaPublicada;  ///< En el aire sólo van sus bits bajos (TramaMediciones.h).
+
+  TramaMuestras lasMuestras;  ///< Las últimas, para publicarEnLote().
+
+  uint32_t ventanaPublicada;  ///< La de publicarResumenes(), por ventanasCerradas().
+  uint8_t resumenPublicado;   ///< El sensor cuyo resumen está en el aire.
+
+  // ............................................................
+  // ............................................................
+public:
 
  /**
   * @brief Constructor de la clase Publicador.
   */
-  Publicador() {
+  Publicador()
+    : hayPublicado(false), ultimos(),
+      instanteUltimaPublicacion(0), finRafaga(0),
+      intervaloActual(EmisoraBLE::INTERVALO_ANUNCIO), intervaloReposo(INTERVALO_REPOSO),
+      intervaloMaximo(INTERVALO_MAXIMO), intervaloExtendido(INTERVALO_EXTENDIDO),
+      secuenciaPublicada(0), ventanaPublicada(0), resumenPublicado(0) {
+    (*this).lasMuestras.presentes = R::PRESENTES | TramaMediciones::HAY_MARCA_TIEMPO;
     // ATENCION: no hacerlo aquí. (*this).laEmisora.encenderEmisora();
     // Pondremos un método para llamarlo desde el setup() más tarde
   }  // ()
@@ -76,35 +138,264 @@ public:
   }  // ()
 
   /**
-   * @function publicarCO2
-   * @brief Publica una medición de CO2.
-   * @param valorCO2 Valor de CO2 en ppm.
-   * @param contador Contador de la medición.
+   * @function empezarPublicacionSensor
+   * @brief Empieza a anunciar la medición de un sensor en un iBeacon y vuelve sin esperar.
+   *
+   * El anuncio sigue hasta que se llame a terminarPublicacion() o se
+   * empiece otra publicación.
+   *
+   * @param k Posición del sensor en la lista (de 0 a R::NUM - 1).
+   * @param valor Su medición (en el minor).
+   * @param secuencia Número de secuencia (en el major van sus 8 bits bajos).
    */
-  void publicarCO2(int16_t valorCO2, uint8_t contador,
-                   long tiempoEspera) {
+  void empezarPublicacionSensor(uint8_t k, int16_t valor, uint32_t secuencia) {
 
     /**
      * @var major
      * @brief Valor mayor del beacon.
      * @example 0x0B01
      */
-    uint16_t major = (MedicionesID::CO2 << 8) + contador;
-    (*this).laEmisora.emitirAnuncioIBeacon((*this).beaconUUID,
+    uint16_t major = TramaMediciones::codificarMajor(R::id(k), (uint8_t)secuencia);
+    (*this).laEmisora.emitirAnuncioIBeacon((*this).beaconUUID.bytes,
                                            major,
-                                           valorCO2,     // minor
+                                           valor,        // minor
                                            (*this).RSSI  // rssi
     );
+  }  // ()
 
-    /*
-	Globales::elPuerto.escribir( "   publicarCO2(): valor=" );
-	Globales::elPuerto.escribir( valorCO2 );
-	Globales::elPuerto.escribir( "   contador=" );
-	Globales::elPuerto.escribir( contador );
-	Globales::elPuerto.escribir( "   todo="  );
-	Globales::elPuerto.escribir( major );
-	Globales::elPuerto.escribir( "\n" );
-	*/
+  /**
+   * @function empezarPublicacionMediciones
+   * @brief Empieza a anunciar todas las mediciones juntas, en una trama empaquetada.
+   *
+   * Un solo anuncio (iBeacon libre) en vez de uno por medición.
+   *
+   * @param valores Las mediciones, en el orden de la lista (R::NUM).
+   * @param secuencia Número de secuencia de la trama (en el aire van sus 16 bits bajos).
+   * @param marcaTiempo Momento de la medición (ms desde el arranque).
+   * @see TramaMediciones.h para la distribución de los bytes
+   */
+  void empezarPublicacionMediciones(const int16_t* valores, uint32_t secuencia,
+                                    uint32_t marcaTiempo) {
+
+    uint8_t carga[TramaMediciones::TAMANYO];
+    TramaMediciones::empaquetarCabecera(&carga[0],
+                                        R::PRESENTES | TramaMediciones::HAY_MARCA_TIEMPO,
+                                        (uint16_t)secuencia, marcaTiempo);
+    R::empaquetar(&carga[TramaMediciones::POS_VALORES], valores);
+
+    (*this).laEmisora.emitirAnuncioIBeaconLibre((const char*)&carga[0],
+                                                TramaMediciones::TAMANYO);
+  }  // ()
+
+  /**
+   * @function publicarSiCambia
+   * @brief Publicación adaptativa: cambia la trama sólo si hace falta y ajusta el intervalo.
+   *
+   * Pensado para llamarlo una vez por ciclo de medición. El anuncio queda
+   * en marcha. El número de secuencia cuenta las tramas publicadas, así que
+   * un hueco en el receptor es una trama perdida, no un ciclo sin cambios.
+   *
+   * @param valores Las mediciones, en el orden de la lista (R::NUM).
+   * @param ahora millis() de la medición (va como marca de tiempo).
+   * @return true si ha empezado una ráfaga: hay que llamar a acabarRafaga()
+   *         dentro de DURACION_RAFAGA ms.
+   */
+  bool publicarSiCambia(const int16_t* valores, uint32_t ahora) {
+
+    bool cambio = !(*this).hayPublicado
+                  || R::fueraDeBanda(valores, &(*this).ultimos[0]);
+
+    bool latido = (*this).hayPublicado
+                  && ahora - (*this).instanteUltimaPublicacion >= SILENCIO_MAXIMO;
+
+    //
+    // intervalo: ráfaga si hay cambio; si no, cada vez más despacio
+    //
+    if (cambio) {
+      (*this).intervaloActual = INTERVALO_RAFAGA;
+      (*this).finRafaga = ahora + DURACION_RAFAGA;
+    } else if ((int32_t)(ahora - (*this).finRafaga) >= 0) {
+      if ((*this).intervaloActual < (*this).intervaloReposo) {
+        (*this).intervaloActual = (*this).intervaloReposo;
+      } else if ((*this).intervaloActual < (*this).intervaloMaximo / 2) {
+        (*this).intervaloActual *= 2;
+      } else {
+        (*this).intervaloActual = (*this).intervaloMaximo;
+      }
+    }
+    (*this).laEmisora.cambiarIntervalo((*this).intervaloActual);
+
+    if (cambio || latido) {
+      (*this).hayPublicado = true;
+      memcpy(&(*this).ultimos[0], valores, sizeof((*this).ultimos));
+      (*this).instanteUltimaPublicacion = ahora;
+      (*this).secuenciaPublicada++;
+
+      (*this).empezarPublicacionMediciones(valores, (*this).secuenciaPublicada, ahora);
+    }
+
+    return cambio;
+  }  // ()
+
+  /**
+   * @function publicarEnLote
+   * @brief Añade la medición a la trama de muestras y la emite en un anuncio extendido.
+   *
+   * Se publica cada medición (no hay bandas muertas: lo que cuesta es el
+   * evento de anuncio, no su tamaño). El número de secuencia cuenta
+   * mediciones, como el de publicarSiCambia() cuenta tramas: en las dos
+   * un hueco es algo perdido.
+   *
+   * Cada muestra lleva los R::NUM valores, en el orden de la lista, como
+   * la trama empaquetada.
+   *
+   * @param valores Las mediciones, en el orden de la lista (R::NUM).
+   * @param ahora millis() de la medición (va como marca de tiempo).
+   * @return Lo que devuelva publicarSiCambia() si la emisora no admite
+   *         anuncios extendidos; false si no.
+   */
+  bool publicarEnLote(const int16_t* valores, uint32_t ahora) {
+
+    if (!(*this).laEmisora.admiteExtendido()) {
+      return (*this).publicarSiCambia(valores, ahora);
+    }
+
+    //
+    // la medición se añade a una copia: si no llega a salir, no se queda
+    // en el lote con un número que luego llevaría otra trama
+    //
+    TramaMuestras conEsta = (*this).lasMuestras;
+    conEsta.anyadir(valores, R::NUM, ahora, (*this).secuenciaPublicada + 1);
+
+    uint8_t carga[TramaMuestras::TAMANYO_MAX];
+    uint8_t tam = conEsta.empaquetar(&carga[0]);
+
+    (*this).laEmisora.cambiarIntervalo((*this).intervaloExtendido);
+
+    if (!(*this).laEmisora.emitirAnuncioExtendido(&carga[0], tam)) {
+      // la primera vez que no puede: esta medición ya va por el otro camino,
+      // que numera ella
+      return (*this).publicarSiCambia(valores, ahora);
+    }
+
+    (*this).lasMuestras = conEsta;
+    (*this).secuenciaPublicada++;
+    return false;
+  }  // ()
+
+  /**
+   * @function publicarResumenes
+   * @brief Publica, de uno en uno, los resúmenes de la última ventana cerrada.
+   *
+   * Pensado para llamarlo una vez por ciclo, después de añadir la medición
+   * al agregador. La ventana abierta se reparte a partes iguales entre
+   * los sensores: el resumen del k sale a partir de k / R::NUM de ella,
+   * contado desde que empezó (Agregador::inicioAbierto(); si ha cambiado la
+   * duración, la que se abrió entonces y con la duración nueva), y
+   * como mucho se pasa al siguiente en cada llamada, así que ninguno se
+   * salta (si en una ventana hay menos de R::NUM ciclos, los últimos no
+   * llegan a salir). El anuncio sólo cambia al pasar de uno a otro, y
+   * siempre al intervalo máximo. Hasta que se cierra la primera ventana no
+   * se publica nada.
+   *
+   * La secuencia cuenta tramas de resumen: un hueco es una trama perdida.
+   *
+   * @param agregador El que lleva las ventanas de estos sensores.
+   * @param ahora millis() de la medición.
+   */
+  void publicarResumenes(const Agregador<R::NUM>& agregador, uint32_t ahora) {
+
+    uint32_t ventana = agregador.ventanasCerradas();
+    if (ventana == 0) {
+      return;
+    }
+
+    uint8_t k = 0;
+    if (ventana == (*this).ventanaPublicada) {
+      uint32_t desdeApertura = ahora - agregador.inicioAbierto();
+      uint64_t toca = (uint64_t)desdeApertura * R::NUM / agregador.duracion();
+      if (toca <= (*this).resumenPublicado || (*this).resumenPublicado + 1 >= R::NUM) {
+        return;  // sigue el que está
+      }
+      k = (*this).resumenPublicado + 1;
+    }
+
+    const Acumulador& a = agregador.cerrado(k);
+    TramaMediciones::Resumen r;
+    r.presente = (uint8_t)(1 << k);
+    r.cuantas = a.cuantas();
+    r.minimo = a.minimo();
+    r.maximo = a.maximo();
+    r.media = a.media();
+    r.varianza = a.varianza();
+    r.secuencia = (uint16_t)++(*this).secuenciaPublicada;
+    r.inicio = agregador.inicioCerrado();
+
+    uint8_t carga[TramaMediciones::TAMANYO];
+    TramaMediciones::empaquetarResumen(&carga[0], r);
+
+    (*this).laEmisora.cambiarIntervalo((*this).intervaloMaximo);
+    (*this).laEmisora.emitirAnuncioIBeaconLibre((const char*)&carga[0], TramaMediciones::TAMANYO);
+
+    (*this).ventanaPublicada = ventana;
+    (*this).resumenPublicado = k;
+  }  // ()
+
+  /**
+   * @function acabarRafaga
+   * @brief Vuelve al intervalo de reposo si la ráfaga ya ha durado DURACION_RAFAGA.
+   *
+   * Si entretanto ha empezado otra ráfaga, no hace nada.
+   *
+   * @param ahora millis().
+   */
+  void acabarRafaga(uint32_t ahora) {
+    if ((*this).intervaloActual != INTERVALO_RAFAGA
+        || (int32_t)(ahora - (*this).finRafaga) < 0) {
+      return;
+    }
+    (*this).intervaloActual = (*this).intervaloReposo;
+    (*this).laEmisora.cambiarIntervalo((*this).intervaloActual);
+  }  // ()
+
+  /**
+   * @function cambiarIntervalos
+   * @brief Cambia los intervalos de la publicación adaptativa y de la extendida.
+   *
+   * Valen desde la siguiente publicación; una ráfaga en marcha acaba como
+   * estaba.
+   *
+   * @param reposo Sin cambios, se empieza por este (en unidades de 0.625 ms)...
+   * @param maximo ...y se dobla hasta este (reposo <= maximo).
+   * @param extendido El de publicarEnLote().
+   */
+  void cambiarIntervalos(uint16_t reposo, uint16_t maximo, uint16_t extendido) {
+    (*this).intervaloReposo = reposo;
+    (*this).intervaloMaximo = maximo;
+    (*this).intervaloExtendido = extendido;
+  }  // ()
+
+  /**
+   * @function terminarPublicacion
+   * @brief Para el anuncio en curso, si lo hay.
+   */
+  void terminarPublicacion() {
+    (*this).laEmisora.detenerAnuncio();
+  }  // ()
+
+  /**
+   * @function publicarSensor
+   * @brief Publica la medición de un sensor (bloquea tiempoEspera ms).
+   * @param k Posición del sensor en la lista.
+   * @param valor Su medición.
+   * @param secuencia Número de secuencia de la medición.
+   * @param tiempoEspera Tiempo que dura el anuncio, en ms.
+   * @see empezarPublicacionSensor() para no bloquear
+   */
+  void publicarSensor(uint8_t k, int16_t valor, uint32_t secuencia,
+                      long tiempoEspera) {
+
+    (*this).empezarPublicacionSensor(k, valor, secuencia);
 
     //
     // 2. esperamos el tiempo que nos digan
@@ -114,32 +405,32 @@ public:
     //
     // 3. paramos anuncio
     //
-    
-    (*this).laEmisora.detenerAnuncio();
+    (*this).terminarPublicacion();
   }  // ()
 
   /**
-   * @function publicarTemperatura
-   * @brief Publica una medición de temperatura.
-   * @param valorTemperatura Valor de temperatura en grados Celsius.
-   * @param contador Contador de la medición.
+   * @function publicarMediciones
+   * @brief Publica todas las mediciones en una trama empaquetada (bloquea tiempoEspera ms).
+   * @param valores Las mediciones, en el orden de la lista.
+   * @param secuencia Número de secuencia de la trama.
+   * @param tiempoEspera Tiempo que dura el anuncio, en ms.
+   * @see empezarPublicacionMediciones() para no bloquear
    */
-  void publicarTemperatura(int16_t valorTemperatura,
-                           uint8_t contador, long tiempoEspera) {
+  void publicarMediciones(const int16_t* valores, uint32_t secuencia,
+                          long tiempoEspera) {
+
+    (*this).empezarPublicacionMediciones(valores, secuencia, millis());
 
-    uint16_t major = (MedicionesID::TEMPERATURA << 8) + contador;
-    (*this).laEmisora.emitirAnuncioIBeacon((*this).beaconUUID,
-                                           major,
-                                           valorTemperatura,  // minor
-                                           (*this).RSSI       // rssi
-    );
     esperar(tiempoEspera);
 
-    (*this).laEmisora.detenerAnuncio();
+    (*this).terminarPublicacion();
   }  // ()
 
 };  // class
 
+template<typename R>
+constexpr Uuid128 Publicador<R>::beaconUUID;  // hace falta en C++11 porque se usa su dirección
+
 // --------------------------------------------------------------
 // --------------------------------------------------------------
 // --------------------------------------------------------------
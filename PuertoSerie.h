@@ -1,26 +1,294 @@
-
 // -*- mode: c++ -*-
 
 /**
  * @file PuertoSerie.h
  * @brief Controlador para manejar un puerto serie.
  * @author Sento Marcos Ibarra
+ *
+ * escribir() no espera al puerto: junta el texto en la línea de la tarea
+ * que escribe y, al llegar el '\n', la deja entera en una cola circular;
+ * vaciar() la va sacando cuando el puerto tiene sitio. Si la línea no cabe
+ * en la cola, se pierde entera y se cuenta en lineasPerdidas(): nunca sale
+ * una línea con un trozo de menos. Lo que no acaba en '\n' espera en su
+ * línea a que llegue.
+ *
+ * Con varias tareas (Tareas.h), escribir() se puede llamar desde cualquiera:
+ * cada tarea tiene su línea (TAREAS_PUERTO_SERIE huecos, se coge uno la
+ * primera vez que escribe) y sólo la toca ella; lo único compartido es la
+ * cola, y cada línea entra en ella, o se cuenta como perdida, en una
+ * sección crítica corta. Una línea de más de TAMANYO_LINEA_PUERTO_SERIE
+ * bytes va a la cola a trozos de ese tamaño y, si uno no cabe, se corta
+ * ahí (con su '\n'). vaciar(), sólo desde una tarea.
+ *
+ * Cada mensaje tiene un nivel; los que están por debajo de
+ * NIVEL_REGISTRO_MINIMO desaparecen al compilar:
+ *
+ *   elPuerto.escribir<NIVEL_DEPURACION>( " detalle \n" ); // nada si el mínimo es NIVEL_INFO
+ *
+ * Modo diferido: registrar( ID, a, b, ... ) no formatea nada; encola un
+ * registro binario con el identificador del formato y los argumentos:
+ *
+ *   0x00  id  n  arg1 (int32, little-endian) ... argn
+ *
+ * El texto nunca lleva 0x00, así que quien lee el puerto puede separar los
+ * registros binarios del texto y formatearlos allí.
  */
 #ifndef PUERTO_SERIE_H_INCLUIDO
 #define PUERTO_SERIE_H_INCLUIDO
 
+#include "Energia.h"
+
+/**
+ * @enum NivelRegistro
+ * @brief Importancia de un mensaje.
+ */
+enum NivelRegistro {
+  NIVEL_DEPURACION = 0,
+  NIVEL_INFO = 1,
+  NIVEL_AVISO = 2,
+  NIVEL_ERROR = 3,
+  NIVEL_NADA = 4
+};
+
+#ifndef NIVEL_REGISTRO_MINIMO
+#define NIVEL_REGISTRO_MINIMO NIVEL_INFO
+#endif
+
+#ifndef TAMANYO_COLA_PUERTO_SERIE
+#define TAMANYO_COLA_PUERTO_SERIE 1024  // potencia de 2
+#endif
+
+#ifndef TAREAS_PUERTO_SERIE
+#define TAREAS_PUERTO_SERIE 6  // loop(), las del .ino y la de Bluefruit
+#endif
+
+#ifndef TAMANYO_LINEA_PUERTO_SERIE
+#define TAMANYO_LINEA_PUERTO_SERIE 128
+#endif
+
 /**
  * @class PuertoSerie
  * @brief Clase para manejar un puerto serie.
  */
 class PuertoSerie {
 
+public:
+
+  static const uint16_t TAMANYO_COLA = TAMANYO_COLA_PUERTO_SERIE;
+
+  static const uint8_t MARCA_REGISTRO = 0x00;  ///< Empieza un registro binario.
+
+  static const uint8_t TAREAS = TAREAS_PUERTO_SERIE;
+  static const uint8_t TAMANYO_LINEA = TAMANYO_LINEA_PUERTO_SERIE;
+
+private:
+
+  static_assert((TAMANYO_COLA & (TAMANYO_COLA - 1)) == 0, "TAMANYO_COLA tiene que ser potencia de 2");
+  static_assert(TAMANYO_LINEA <= TAMANYO_COLA, "una línea tiene que caber en la cola");
+
+  /**
+   * @struct Linea
+   * @brief La línea a medias de una tarea: sólo la toca esa tarea.
+   */
+  struct Linea {
+    TaskHandle_t tarea;
+    bool usada;      ///< El hueco es de tarea.
+    bool empezada;   ///< Algún trozo ya está en la cola: falta su '\n'.
+    bool cortada;    ///< Un trozo no ha cabido: lo demás, hasta el '\n', se tira.
+    uint8_t n;
+    char texto[TAMANYO_LINEA];
+  };
+
+  uint8_t laCola[TAMANYO_COLA];
+  // los dos cambian en secciones críticas (ultimo al encolar, primero en
+  // vaciar()); volatile, para que quien no está en una los lea de verdad
+  volatile uint16_t primero;  ///< Siguiente byte a sacar (sin dar la vuelta: se usa & (TAMANYO_COLA - 1)).
+  volatile uint16_t ultimo;   ///< Siguiente hueco donde meter.
+
+  Linea lasLineas[TAREAS];
+
+  uint32_t perdidas;  ///< Líneas y registros que no cabían.
+
+  uint32_t nsPorByte;  ///< Lo que tarda un byte en salir (10 bits): para Energia.
+
+  // .........................................................
+  // .........................................................
+  uint16_t libre() const {
+    return TAMANYO_COLA - (uint16_t)((*this).ultimo - (*this).primero);
+  }  // ()
+
+  // .........................................................
+  // mete n bytes o ninguno (y entonces, si contar, lo cuenta)
+  // .........................................................
+  bool encolar(const uint8_t* p, uint16_t n, bool contar = true) {
+    taskENTER_CRITICAL();
+    bool cabe = (n <= (*this).libre());
+    if (cabe) {
+      for (uint16_t i = 0; i < n; i++) {
+        (*this).laCola[((*this).ultimo + i) & (TAMANYO_COLA - 1)] = p[i];
+      }
+      (*this).ultimo += n;
+    } else if (contar) {
+      (*this).perdidas++;
+    }
+    taskEXIT_CRITICAL();
+    return cabe;
+  }  // ()
+
+  // .........................................................
+  // la línea de la tarea que escribe (la primera vez coge un
+  // hueco); NULL si ya no quedan
+  // .........................................................
+  Linea* miLinea() {
+    TaskHandle_t yo = xTaskGetCurrentTaskHandle();
+    Linea* la = NULL;
+    taskENTER_CRITICAL();
+    for (uint8_t i = 0; i < TAREAS && la == NULL; i++) {
+      Linea& l = (*this).lasLineas[i];
+      if (!l.usada) {  // se cogen en orden: no está en ninguno
+        l.usada = true;
+        l.tarea = yo;
+      }
+      if (l.tarea == yo) {
+        la = &l;
+      }
+    }
+    taskEXIT_CRITICAL();
+    return la;
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  void encolarTexto(const char* p, uint16_t n) {
+    Linea* l = (*this).miLinea();
+    if (l == NULL) {  // más tareas que huecos: tal cual
+      (*this).encolar((const uint8_t*)p, n);
+      return;
+    }
+    for (uint16_t i = 0; i < n; i++) {
+      char c = p[i];
+      if (l->cortada) {
+        if (c == '\n') {
+          if (l->empezada) {  // lo que salió, acabado
+            (*this).encolar((const uint8_t*)"\n", 1, false);
+          }
+          l->cortada = false;
+          l->empezada = false;
+        }
+        continue;
+      }
+      l->texto[l->n++] = c;
+      if (c == '\n') {
+        if (!(*this).encolar((const uint8_t*)&l->texto[0], l->n) && l->empezada) {
+          (*this).encolar((const uint8_t*)"\n", 1, false);
+        }
+        l->n = 0;
+        l->empezada = false;
+      } else if (l->n == TAMANYO_LINEA) {  // línea larga: sale un trozo
+        if ((*this).encolar((const uint8_t*)&l->texto[0], l->n)) {
+          l->empezada = true;
+        } else {
+          l->cortada = true;
+        }
+        l->n = 0;
+      }
+    }  // for
+  }  // ()
+
+  // .........................................................
+  // .........................................................
+  void encolarNumero(unsigned long n, bool negativo) {
+    char buf[12];
+    uint8_t i = sizeof(buf);
+    do {
+      buf[--i] = '0' + (n % 10);
+      n /= 10;
+    } while (n != 0);
+    if (negativo) {
+      buf[--i] = '-';
+    }
+    (*this).encolarTexto(&buf[i], sizeof(buf) - i);
+  }  // ()
+
+  // .........................................................
+  // formateo de cada tipo
+  // .........................................................
+  void poner(const char* s) {
+    (*this).encolarTexto(s, strlen(s));
+  }  // ()
+
+  void poner(char c) {
+    (*this).encolarTexto(&c, 1);
+  }  // ()
+
+  void poner(long n) {
+    (*this).encolarNumero(n < 0 ? 0UL - (unsigned long)n : (unsigned long)n, n < 0);
+  }  // ()
+
+  void poner(unsigned long n) {
+    (*this).encolarNumero(n, false);
+  }  // ()
+
+  void poner(int n) {
+    (*this).poner((long)n);
+  }  // ()
+
+  void poner(unsigned int n) {
+    (*this).poner((unsigned long)n);
+  }  // ()
+
+  void poner(short n) {
+    (*this).poner((long)n);
+  }  // ()
+
+  void poner(unsigned short n) {
+    (*this).poner((unsigned long)n);
+  }  // ()
+
+  void poner(unsigned char n) {  // como Serial.print(): un número
+    (*this).poner((unsigned long)n);
+  }  // ()
+
+  void poner(double d) {  // con 2 decimales, como Serial.print()
+    if (d < 0) {
+      (*this).poner('-');
+      d = -d;
+    }
+    unsigned long entera = (unsigned long)d;
+    unsigned long centesimas = (unsigned long)((d - entera) * 100 + 0.5);
+    if (centesimas >= 100) {
+      entera++;
+      centesimas -= 100;
+    }
+    (*this).poner(entera);
+    (*this).poner(centesimas < 10 ? ".0" : ".");
+    (*this).poner(centesimas);
+  }  // ()
+
+  // .........................................................
+  // argumentos de un registro binario
+  // .........................................................
+  void ponerArgumentos(uint8_t*) {
+  }  // ()
+
+  template<typename A, typename... R>
+  void ponerArgumentos(uint8_t* p, A a, R... resto) {
+    int32_t v = (int32_t)a;
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    (*this).ponerArgumentos(p + 4, resto...);
+  }  // ()
+
 public:
   /**
    * @brief Constructor de la clase PuertoSerie.
    * @param baudios Velocidad de transmisión en baudios.
    */
-  PuertoSerie(long baudios) {
+  PuertoSerie(long baudios)
+    : primero(0), ultimo(0), lasLineas(), perdidas(0),
+      nsPorByte((uint32_t)(10000000000ULL / baudios)) {
     Serial.begin(baudios);
     // mejor no poner esto aquí: while ( !Serial ) delay(10);
   }  // ()
@@ -37,12 +305,107 @@ public:
   }  // ()
 
   /**
-   * @brief Escribe un mensaje en el puerto serie.
+   * @brief Escribe un mensaje en el puerto serie (nivel NIVEL_INFO).
+   *
+   * No espera: el mensaje se encola y sale con vaciar().
+   *
    * @param mensaje Mensaje a escribir.
    */
   template<typename T>
   void escribir(T mensaje) {
-    Serial.print(mensaje);
+    (*this).escribir<NIVEL_INFO>(mensaje);
+  }  // ()
+
+  /**
+   * @brief Escribe un mensaje con el nivel dado. Si está por debajo de
+   * NIVEL_REGISTRO_MINIMO no se genera código.
+   * @tparam NIVEL Nivel del mensaje.
+   * @param mensaje Mensaje a escribir.
+   */
+  template<NivelRegistro NIVEL, typename T>
+  void escribir(T mensaje) {
+    if (NIVEL < NIVEL_REGISTRO_MINIMO) {
+      return;
+    }
+    (*this).poner(mensaje);
+  }  // ()
+
+  /**
+   * @brief Encola un registro binario: identificador de formato y argumentos sin formatear.
+   * @tparam NIVEL Nivel del registro.
+   * @param idFormato Identificador del formato (lo conoce quien lee).
+   * @param args Enteros de hasta 32 bits (como mucho 8).
+   */
+  template<NivelRegistro NIVEL = NIVEL_INFO, typename... A>
+  void registrar(uint8_t idFormato, A... args) {
+    static_assert(sizeof...(A) <= 8, "como mucho 8 argumentos");
+    if (NIVEL < NIVEL_REGISTRO_MINIMO) {
+      return;
+    }
+    uint8_t registro[3 + 4 * sizeof...(A)];
+    registro[0] = MARCA_REGISTRO;
+    registro[1] = idFormato;
+    registro[2] = sizeof...(A);
+    (*this).ponerArgumentos(&registro[3], args...);
+    (*this).encolar(&registro[0], sizeof(registro));
+  }  // ()
+
+  /**
+   * @brief Saca por el puerto lo que quepa sin esperar.
+   *
+   * Sólo desde una tarea (la de registro, o loop() sin tareas): lo que hay
+   * entre primero y ultimo no lo toca nadie más hasta que primero avanza,
+   * así que se lee y se escribe al puerto fuera de la sección crítica.
+   *
+   * @return Bytes que quedan en la cola.
+   */
+  uint16_t vaciar() {
+    GASTO_CPU(Energia::PUERTO);
+    while ((*this).primero != (*this).ultimo) {
+      int sitio = Serial.availableForWrite();
+      if (sitio <= 0) {
+        break;
+      }
+      // trozo seguido (hasta el final del array o de lo pendiente)
+      uint16_t desde = (*this).primero & (TAMANYO_COLA - 1);
+      uint16_t n = (uint16_t)((*this).ultimo - (*this).primero);
+      if (n > TAMANYO_COLA - desde) {
+        n = TAMANYO_COLA - desde;
+      }
+      if (n > (uint16_t)sitio) {
+        n = sitio;
+      }
+      Serial.write(&(*this).laCola[desde], n);
+      Energia::anotarNs(Energia::PUERTO, (uint64_t)n * (*this).nsPorByte, Energia::CORRIENTE_UART_UA);
+      taskENTER_CRITICAL();  // lo que sale, libre para los que encolan
+      (*this).primero += n;
+      taskEXIT_CRITICAL();
+    }  // while
+    return (uint16_t)((*this).ultimo - (*this).primero);
+  }  // ()
+
+  /**
+   * @brief Saca todo lo pendiente, esperando si hace falta (p.ej. antes de dormir).
+   */
+  void vaciarTodo() {
+    while ((*this).vaciar() != 0) {
+      yield();
+    }
+    Serial.flush();
+  }  // ()
+
+  /**
+   * @brief Si queda algo por sacar.
+   */
+  bool hayPendiente() const {
+    return (*this).primero != (*this).ultimo;
+  }  // ()
+
+  /**
+   * @brief Líneas o registros que no cabían en la cola y se han perdido.
+   */
+  uint32_t lineasPerdidas() const {
+    return (*this).perdidas;
   }  // ()
 
 };  // class PuertoSerie
@@ -0,0 +1,67 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file RegistroMedicion.h
+ * @brief Una medición tal como se guarda en flash (AlmacenFlash.h) y se descarga.
+ * @author Sento Marcos Ibarra
+ *
+ * 10 bytes, big-endian como las tramas:
+ *
+ *   byte 0-3  marca de tiempo (uint32, ms desde el arranque)
+ *   byte 4-9  los valores (int16): el k en 4 + 2k, del sensor k de la lista
+ *             (RegistroSensores.h); si la lista es más corta, 0
+ *
+ * No lleva número de secuencia: lo da su sitio en el almacén (el cursor).
+ * No depende de Arduino, para poder usarlo también en el receptor.
+ */
+
+#ifndef REGISTRO_MEDICION_H_INCLUIDO
+#define REGISTRO_MEDICION_H_INCLUIDO
+
+#include "TramaMediciones.h"
+
+/**
+ * @struct RegistroMedicion
+ * @brief Campos de un registro y su codificación.
+ */
+struct RegistroMedicion {
+
+  enum {
+    POS_VALORES = 4,
+    TAMANYO = POS_VALORES + 2 * TramaMediciones::MAX_VALORES
+  };
+
+  uint32_t marcaTiempo;                           ///< ms desde el arranque.
+  int16_t valores[TramaMediciones::MAX_VALORES];  ///< En el orden de la lista de sensores.
+
+  /**
+   * @function empaquetar
+   * @param p Destino, TAMANYO bytes.
+   */
+  void empaquetar(uint8_t* p) const {
+    TramaMediciones::escribir32(&p[0], (*this).marcaTiempo);
+    for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+      TramaMediciones::escribir16(&p[POS_VALORES + 2 * k], (uint16_t)(*this).valores[k]);
+    }
+  }  // ()
+
+  /**
+   * @function desempaquetar
+   * @param p TAMANYO bytes.
+   */
+  static RegistroMedicion desempaquetar(const uint8_t* p) {
+    RegistroMedicion r;
+    r.marcaTiempo = TramaMediciones::leer32(&p[0]);
+    for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+      r.valores[k] = (int16_t)TramaMediciones::leer16(&p[POS_VALORES + 2 * k]);
+    }
+    return r;
+  }  // ()
+
+};  // struct
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
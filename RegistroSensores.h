@@ -0,0 +1,158 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file RegistroSensores.h
+ * @brief Lista de sensores fijada al compilar: medir, comparar y empaquetar sin llamadas virtuales.
+ * @author Sento Marcos Ibarra
+ *
+ *   typedef RegistroSensores< SensorCO2, SensorTemperatura, SensorRuido > Sensores;
+ *   Sensores losSensores { SensorCO2( elMedidor ), SensorTemperatura( elMedidor ), SensorRuido() };
+ *
+ *   int16_t valores[ Sensores::NUM ];
+ *   losSensores.medir( valores );
+ *
+ * Un sensor es cualquier clase con:
+ *
+ *   enum { ID = ..., BANDA = ... };  // tipo en el major de su iBeacon; banda muerta
+ *   int16_t medir();
+ *
+ * El registro es una lista recursiva: cada nivel guarda un sensor y el
+ * resto. Cada operación es una llamada por sensor que el compilador pone en
+ * línea, así que cuesta lo mismo que escribirlo a mano; no hay tabla de
+ * punteros ni clase base.
+ *
+ * La posición en la lista es la del sensor en todo lo que sale: sus 2 bytes
+ * en la carga (empaquetar()), su bit de "campos presentes" y su paso en la
+ * secuencia de iBeacon de una medición. Publicador.h lo saca todo de aquí.
+ *
+ * No depende de Arduino.
+ */
+
+#ifndef REGISTRO_SENSORES_H_INCLUIDO
+#define REGISTRO_SENSORES_H_INCLUIDO
+
+#include <stdint.h>
+#include <type_traits>
+
+template<typename... S>
+class RegistroSensores;
+
+/**
+ * @class RegistroSensores<>
+ * @brief El final de la lista: no hace nada.
+ */
+template<>
+class RegistroSensores<> {
+
+public:
+
+  enum {
+    NUM = 0,
+    TAMANYO = 0,
+    PRESENTES = 0
+  };
+
+  template<typename T>
+  static constexpr uint8_t posicion() {
+    return 0;
+  }  // ()
+
+  static constexpr uint8_t id(uint8_t) {
+    return 0;
+  }  // ()
+
+  void medir(int16_t*) {
+  }  // ()
+
+  static bool fueraDeBanda(const int16_t*, const int16_t*) {
+    return false;
+  }  // ()
+
+  static void empaquetar(uint8_t*, const int16_t*) {
+  }  // ()
+
+};  // class
+
+/**
+ * @class RegistroSensores
+ * @brief Un sensor y el resto de la lista.
+ * @tparam S El primero.
+ * @tparam R Los demás.
+ */
+template<typename S, typename... R>
+class RegistroSensores<S, R...> {
+
+  typedef RegistroSensores<R...> Resto;
+
+  S elSensor;
+  Resto elResto;
+
+public:
+
+  enum {
+    NUM = 1 + Resto::NUM,       ///< Sensores.
+    TAMANYO = 2 * NUM,          ///< Bytes de los valores empaquetados.
+    PRESENTES = (1 << NUM) - 1  ///< Bits de "campos presentes": el k, del sensor k.
+  };
+
+  /**
+   * @brief Constructor: los sensores, en el orden de la lista.
+   */
+  RegistroSensores(const S& s, const R&... resto)
+    : elSensor(s), elResto(resto...) {
+  }  // ()
+
+  /**
+   * @function posicion
+   * @brief Dónde está el sensor de tipo T (NUM si no está).
+   */
+  template<typename T>
+  static constexpr uint8_t posicion() {
+    return std::is_same<T, S>::value ? 0 : 1 + Resto::template posicion<T>();
+  }  // ()
+
+  /**
+   * @function id
+   * @brief Tipo de medición del sensor k (el byte alto del major de su iBeacon).
+   */
+  static constexpr uint8_t id(uint8_t k) {
+    return k == 0 ? (uint8_t)S::ID : Resto::id(k - 1);
+  }  // ()
+
+  /**
+   * @function medir
+   * @param valores Destino, NUM valores.
+   */
+  void medir(int16_t* valores) {
+    valores[0] = (*this).elSensor.medir();
+    (*this).elResto.medir(valores + 1);
+  }  // ()
+
+  /**
+   * @function fueraDeBanda
+   * @brief Si algún valor se aleja del publicado su BANDA o más.
+   */
+  static bool fueraDeBanda(const int16_t* valores, const int16_t* publicados) {
+    int32_t d = (int32_t)valores[0] - publicados[0];
+    return d >= S::BANDA || -d >= S::BANDA
+           || Resto::fueraDeBanda(valores + 1, publicados + 1);
+  }  // ()
+
+  /**
+   * @function empaquetar
+   * @brief Los valores seguidos, int16 big-endian.
+   * @param p Destino, TAMANYO bytes.
+   */
+  static void empaquetar(uint8_t* p, const int16_t* valores) {
+    p[0] = (uint8_t)((uint16_t)valores[0] >> 8);
+    p[1] = (uint8_t)((uint16_t)valores[0] & 0xFF);
+    Resto::empaquetar(p + 2, valores + 1);
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
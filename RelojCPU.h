@@ -0,0 +1,59 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file RelojCPU.h
+ * @brief El contador de ciclos de la CPU, compartido por Instrumentacion.h y Energia.h.
+ * @author Sento Marcos Ibarra
+ *
+ * En la placa es el DWT->CYCCNT del Cortex-M4 (64 MHz, da la vuelta cada
+ * 67 s); en el ordenador, nanosegundos de std::chrono.
+ *
+ * Lo usan a la vez varios medidores (MEDIR_TRAMO, GASTO_CPU) y cada uno
+ * guarda su instante de inicio: nadie pone el contador a cero, sólo se
+ * restan lecturas (en uint32_t, así que la vuelta no importa).
+ */
+
+#ifndef RELOJ_CPU_H_INCLUIDO
+#define RELOJ_CPU_H_INCLUIDO
+
+#ifdef ANFITRION
+#include <chrono>
+#endif
+
+namespace RelojCPU {
+
+#ifdef ANFITRION
+  const uint32_t NANOSEGUNDOS_POR_MIL_TICS = 1000000;
+
+  inline void iniciar() {
+  }  // ()
+
+  inline uint32_t tics() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+  }  // ()
+#else
+  const uint32_t NANOSEGUNDOS_POR_MIL_TICS = 1000000000UL / (64000000UL / 1000);  // 64 MHz
+
+  /**
+   * @brief Pone en marcha el contador, si no lo está. No lo pone a cero:
+   * se puede llamar las veces que se quiera.
+   */
+  inline void iniciar() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }  // ()
+
+  inline uint32_t tics() {
+    return DWT->CYCCNT;
+  }  // ()
+#endif
+
+};  // namespace
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
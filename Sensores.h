@@ -0,0 +1,88 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Sensores.h
+ * @brief Los sensores de la placa, para RegistroSensores.h.
+ * @author Sento Marcos Ibarra
+ *
+ * CO2 y temperatura salen del mismo ULPSM a través del Medidor (que filtra
+ * y calibra las muestras del ADC); el ruido, de momento, es un valor fijo.
+ *
+ * Para añadir un sensor: una clase como estas (ID, BANDA y medir()) y
+ * ponerla en la lista del .ino. Publicador y el paso de publicación de
+ * cada una salen solos de la lista.
+ */
+
+#ifndef SENSORES_H_INCLUIDO
+#define SENSORES_H_INCLUIDO
+
+#include "Medidor.h"
+#include "TramaMediciones.h"
+
+/**
+ * @class SensorCO2
+ * @brief Concentración de gas (ppb) del Medidor.
+ */
+class SensorCO2 {
+private:
+  Medidor* elMedidor;
+
+public:
+  enum {
+    ID = TramaMediciones::ID_CO2,
+    BANDA = 10  ///< ppb.
+  };
+
+  SensorCO2(Medidor& m)
+    : elMedidor(&m) {
+  }  // ()
+
+  int16_t medir() {
+    return (int16_t)(*this).elMedidor->medirCO2();
+  }  // ()
+};  // class
+
+/**
+ * @class SensorTemperatura
+ * @brief Temperatura (ºC) del Medidor.
+ */
+class SensorTemperatura {
+private:
+  Medidor* elMedidor;
+
+public:
+  enum {
+    ID = TramaMediciones::ID_TEMPERATURA,
+    BANDA = 1  ///< ºC.
+  };
+
+  SensorTemperatura(Medidor& m)
+    : elMedidor(&m) {
+  }  // ()
+
+  int16_t medir() {
+    return (int16_t)(*this).elMedidor->medirTemperatura();
+  }  // ()
+};  // class
+
+/**
+ * @class SensorRuido
+ * @brief Ruido (dB): un valor fijo para pruebas, hasta que haya micrófono.
+ */
+class SensorRuido {
+public:
+  enum {
+    ID = TramaMediciones::ID_RUIDO,
+    BANDA = 3  ///< dB.
+  };
+
+  int16_t medir() {
+    return 45;
+  }  // ()
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
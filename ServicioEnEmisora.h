@@ -12,6 +12,10 @@
 // ----------------------------------------------------
 // ----------------------------------------------------
 #include <vector>
+#include <array>
+
+#include "Uuid128.h"
+#include "Instrumentacion.h"
 
 // ----------------------------------------------------
 // alReves() utilidad
@@ -77,13 +81,7 @@ public:
      * @brief Característica BLE.
      */
   private:
-    uint8_t uuidCaracteristica[16] = {  // el uuid se copia aquí (al revés) a partir de un string-c
-      // least signficant byte, el primero
-      '0', '1', '2', '3',
-      '4', '5', '6', '7',
-      '8', '9', 'A', 'B',
-      'C', 'D', 'E', 'F'
-    };
+    Uuid128 uuidCaracteristica;  // el menos significativo, el primero
 
     //
     //
@@ -94,33 +92,31 @@ public:
 
     /**
      * @brief Constructor de la clase Caracteristica.
-     * @param nombreCaracteristica_ Nombre de la característica.
-     * @param props Propiedades de la característica.
-     * @param permisoRead Permisos de lectura.
-     * @param permisoWrite Permisos de escritura.
-     * @param tam Tamaño de los datos.
-     * @note Este constructor inicializa una característica BLE con los valores dados.
+     * @param uuidCaracteristica_ UUID de la característica: "6E400002-B5A3-F393-E0A9-E50E24DCCA9E"_uuid
+     *        o un nombre de hasta 16 caracteres.
+     * @note Con un literal o un constexpr, el UUID se calcula al compilar.
      */
-    Caracteristica(const char* nombreCaracteristica_)
-      : laCaracteristica(stringAUint8AlReves(nombreCaracteristica_, &uuidCaracteristica[0], 16)) {
+    Caracteristica(const Uuid128& uuidCaracteristica_)
+      : uuidCaracteristica(uuidCaracteristica_),
+        laCaracteristica(uuidCaracteristica.bytes) {
 
     }  // ()
 
     /**
      * @brief Constructor de la clase Caracteristica.
-     * @param nombreCaracteristica_ Nombre de la característica.
+     * @param uuidCaracteristica_ UUID de la característica.
      * @param props Propiedades de la característica.
      * @param permisoRead Permisos de lectura.
      * @param permisoWrite Permisos de escritura.
      * @param tam Tamaño de los datos.
      * @note Este constructor inicializa una característica BLE con los valores dados.
      */
-    Caracteristica(const char* nombreCaracteristica_,
+    Caracteristica(const Uuid128& uuidCaracteristica_,
                    uint8_t props,
                    SecureMode_t permisoRead,
                    SecureMode_t permisoWrite,
                    uint8_t tam)
-      : Caracteristica(nombreCaracteristica_)  // llamada al otro constructor
+      : Caracteristica(uuidCaracteristica_)  // llamada al otro constructor
     {
       (*this).asignarPropiedadesPermisosYTamanyoDatos(props, permisoRead, permisoWrite, tam);
     }  // ()
@@ -185,13 +181,17 @@ public:
      * @return Número de bytes escritos.
      */
     uint16_t escribirDatos(const char* str) {
-      // Serial.print( " return (*this).laCaracteristica.write( str  = " );
-      // Serial.println( str );
-      uint16_t r = (*this).laCaracteristica.write(str);
-
-      // Serial.print( ">>>Escritos " ); Serial.print( r ); Serial.println( " bytes con write() " );
+      return (*this).escribirDatos((const uint8_t*)str, strlen(str));
+    }  // ()
 
-      return r;
+    /**
+     * @brief Escribe datos binarios (pueden llevar ceros) en la característica.
+     * @param datos Datos a escribir.
+     * @param tam Bytes de datos.
+     * @return Número de bytes escritos.
+     */
+    uint16_t escribirDatos(const uint8_t* datos, uint16_t tam) {
+      return (*this).laCaracteristica.write(datos, tam);
     }  // ()
 
     /**
@@ -207,6 +207,17 @@ public:
       return r;
     }  //  ()
 
+    /**
+     * @brief Notifica datos binarios a una conexión.
+     * @param conexion Manejador de la conexión.
+     * @param datos Datos a notificar (como mucho MTU - 3 bytes).
+     * @param tam Bytes de datos.
+     * @return false si no se ha podido (p.ej. la cola de envío de la SoftDevice está llena).
+     */
+    bool notificarDatos(uint16_t conexion, const uint8_t* datos, uint16_t tam) {
+      return (*this).laCaracteristica.notify(conexion, datos, tam);
+    }  // ()
+
     /**
      * @function instalarCallbackCaracteristicaEscrita
      * @brief Instala un callback para manejar escrituras en la característica.
@@ -222,8 +233,9 @@ public:
      */
     void activar() {
       err_t error = (*this).laCaracteristica.begin();
-      Globales::elPuerto.escribir(" (*this).laCaracteristica.begin(); error = ");
-      Globales::elPuerto.escribir(error);
+      Globales::elPuerto.escribir<NIVEL_DEPURACION>(" (*this).laCaracteristica.begin(); error = ");
+      Globales::elPuerto.escribir<NIVEL_DEPURACION>(error);
+      Globales::elPuerto.escribir<NIVEL_DEPURACION>("\n");
     }  // ()
 
   };  // class Caracteristica
@@ -239,13 +251,7 @@ public:
    */
 private:
 
-  uint8_t uuidServicio[16] = {  // el uuid se copia aquí (al revés) a partir de un string-c
-    // least signficant byte, el primero
-    '0', '1', '2', '3',
-    '4', '5', '6', '7',
-    '8', '9', 'A', 'B',
-    'C', 'D', 'E', 'F'
-  };
+  Uuid128 uuidServicio;  // el menos significativo, el primero
 
   //
   //
@@ -261,26 +267,26 @@ public:
 
   /**
    * @brief Constructor de la clase ServicioEnEmisora.
-   * @param nombreServicio_ Nombre del servicio.
-   * @note Este constructor inicializa un servicio BLE con el nombre dado.
+   * @param uuidServicio_ UUID del servicio: "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"_uuid
+   *        o un nombre de hasta 16 caracteres.
+   * @note Con un literal o un constexpr, el UUID se calcula al compilar.
    */
-  ServicioEnEmisora(const char* nombreServicio_)
-    : elServicio(stringAUint8AlReves(nombreServicio_, &uuidServicio[0], 16)) {
+  ServicioEnEmisora(const Uuid128& uuidServicio_)
+    : uuidServicio(uuidServicio_),
+      elServicio(uuidServicio.bytes) {
 
   }  // ()
 
   /**
-   * @brief Constructor de la clase ServicioEnEmisora.
-   * @param nombreServicio_ Nombre del servicio.
-   * @param uuidServicio_ UUID del servicio.
-   * @note Este constructor inicializa un servicio BLE con el nombre y UUID dados.
+   * @function escribeUUID
+   * @brief Escribe el UUID del servicio por el puerto serie (byte a byte, como caracteres).
    */
   void escribeUUID() {
-    Serial.println("**********");
+    Globales::elPuerto.escribir("**********\n");
     for (int i = 0; i <= 15; i++) {
-      Serial.print((char)uuidServicio[i]);
+      Globales::elPuerto.escribir((char)uuidServicio.bytes[i]);
     }
-    Serial.println("\n**********");
+    Globales::elPuerto.escribir("\n**********\n");
   }  // ()
 
   /**
@@ -299,12 +305,14 @@ public:
    * @note Este método activa el servicio.
    */
   void activarServicio() {
+    MEDIR_TRAMO("activarServicio");
     // entiendo que al llegar aquí ya ha sido configurado
     // todo: características y servicio
 
     err_t error = (*this).elServicio.begin();
-    Serial.print(" (*this).elServicio.begin(); error = ");
-    Serial.println(error);
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>(" (*this).elServicio.begin(); error = ");
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>(error);
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>("\n");
 
     for (auto pCar : (*this).lasCaracteristicas) {
       (*pCar).activar();
@@ -318,6 +326,118 @@ public:
 
 };  // class
 
+// ----------------------------------------------------
+// Tabla de atributos de la SoftDevice
+// ----------------------------------------------------
+#ifdef CFG_SD_ATTR_TABLE_SIZE
+const size_t TAMANYO_TABLA_ATRIBUTOS = CFG_SD_ATTR_TABLE_SIZE;
+#else
+const size_t TAMANYO_TABLA_ATRIBUTOS = 0xC00;  // lo que reserva Bluefruit por defecto
+#endif
+
+// Lo que ocupa (por lo alto) cada atributo en la tabla, sin contar el valor
+const size_t BYTES_POR_ATRIBUTO = 16;
+
+/**
+ * @class ServicioEnEmisoraFijo
+ * @brief Como ServicioEnEmisora, pero con el número de características fijo y sin memoria dinámica.
+ *
+ * Las características se guardan en un std::array de N punteros en lugar de
+ * un std::vector. Al compilar se comprueba que el servicio cabe en la tabla
+ * de atributos: 1 atributo para el servicio y 3 por característica
+ * (declaración, valor y CCCD), cada valor de hasta TAM_DATOS bytes.
+ *
+ * Ocupación (estimada, Cortex-M4, punteros de 4 bytes):
+ *  - ServicioEnEmisora con 3 características: 12 bytes del vector más un
+ *    bloque en el montón de 4 x 4 + 8 de cabecera de malloc (tras crecer
+ *    1 -> 2 -> 4, con dos liberaciones por el camino); en flash, el código
+ *    de crecimiento del vector y sus excepciones.
+ *  - ServicioEnEmisoraFijo<3>: 3 x 4 + 1 bytes dentro del propio objeto,
+ *    nada en el montón y ningún código extra.
+ *
+ * @tparam N Número máximo de características.
+ * @tparam TAM_DATOS Tamaño máximo del valor de cada característica.
+ */
+template<size_t N, size_t TAM_DATOS = 20>
+class ServicioEnEmisoraFijo {
+
+public:
+
+  using Caracteristica = ServicioEnEmisora::Caracteristica;
+
+  static const size_t CAPACIDAD = N;  ///< Características como mucho.
+
+  /**
+   * @brief Lo que ocupará el servicio en la tabla de atributos, por lo alto.
+   */
+  static const size_t BYTES_TABLA = BYTES_POR_ATRIBUTO * (1 + 3 * N)
+                                    + 16                    // uuid del servicio
+                                    + N * (19 + TAM_DATOS + 2);  // declaración, valor, CCCD
+
+  static_assert(N > 0, "un servicio sin características no tiene sentido");
+  static_assert(BYTES_TABLA <= TAMANYO_TABLA_ATRIBUTOS,
+                "el servicio no cabe en la tabla de atributos de la SoftDevice");
+
+private:
+
+  Uuid128 uuidServicio;  // el menos significativo, el primero
+
+  BLEService elServicio;
+
+  std::array< Caracteristica*, N > lasCaracteristicas;
+
+  uint8_t cuantasCaracteristicas;
+
+public:
+
+  /**
+   * @brief Constructor de la clase ServicioEnEmisoraFijo.
+   * @param uuidServicio_ UUID del servicio.
+   */
+  ServicioEnEmisoraFijo(const Uuid128& uuidServicio_)
+    : uuidServicio(uuidServicio_),
+      elServicio(uuidServicio.bytes),
+      lasCaracteristicas(),
+      cuantasCaracteristicas(0) {
+  }  // ()
+
+  /**
+   * @function anyadirCaracteristica
+   * @brief Añade una característica al servicio.
+   * @param car Característica a añadir.
+   * @return false si ya había N.
+   */
+  bool anyadirCaracteristica(Caracteristica& car) {
+    if ((*this).cuantasCaracteristicas >= N) {
+      return false;
+    }
+    (*this).lasCaracteristicas[(*this).cuantasCaracteristicas++] = &car;
+    return true;
+  }  // ()
+
+  /**
+   * @function activarServicio
+   * @brief Activa el servicio y sus características.
+   */
+  void activarServicio() {
+    MEDIR_TRAMO("activarServicio");
+    err_t error = (*this).elServicio.begin();
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>(" (*this).elServicio.begin(); error = ");
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>(error);
+    Globales::elPuerto.escribir<NIVEL_DEPURACION>("\n");
+
+    for (uint8_t i = 0; i < (*this).cuantasCaracteristicas; i++) {
+      (*(*this).lasCaracteristicas[i]).activar();
+    }  // for
+  }  // ()
+
+  operator BLEService&() {
+    // "conversión de tipo": si pongo esta clase en un sitio donde necesitan un BLEService
+    return elServicio;
+  }  // ()
+
+};  // class
+
 #endif
 
 // ----------------------------------------------------------
@@ -0,0 +1,272 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Tareas.h
+ * @brief Tareas y colas de FreeRTOS sin memoria dinámica, y lo puntual que es una tarea periódica.
+ * @author Sento Marcos Ibarra
+ *
+ * El núcleo de Adafruit ya corre FreeRTOS (loop() es una tarea más). Aquí
+ * la pila y el bloque de control de cada tarea, y el almacén de cada cola,
+ * son miembros: van en .bss y se ven en el mapa de memoria al compilar.
+ * Hace falta configSUPPORT_STATIC_ALLOCATION = 1 en FreeRTOSConfig.h.
+ *
+ *   TareaEstatica< 512 > elMuestreo;                // palabras de pila
+ *   ColaEstatica< Medicion, 4 > laCola;
+ *
+ *   laCola.crear();
+ *   elMuestreo.crear( tareaMuestreo, "muestreo", TASK_PRIO_HIGH );
+ *
+ * Las colas copian los elementos (xQueueSend()): T tiene que poder copiarse
+ * byte a byte.
+ *
+ * En el ordenador, host/FreeRTOS.h hace lo mismo con hilos POSIX sobre el
+ * reloj virtual.
+ */
+
+#ifndef TAREAS_H_INCLUIDO
+#define TAREAS_H_INCLUIDO
+
+#include <type_traits>
+
+/**
+ * @function msATics
+ * @brief ms a tics de FreeRTOS, redondeando hacia arriba: despertar antes
+ * de un plazo sería una vuelta para nada.
+ */
+inline TickType_t msATics(uint32_t ms) {
+  return (TickType_t)(((uint64_t)ms * configTICK_RATE_HZ + 999) / 1000);
+}  // ()
+
+/**
+ * @function ticsAUs
+ * @brief tics de FreeRTOS a us.
+ */
+inline uint32_t ticsAUs(TickType_t tics) {
+  return (uint32_t)((uint64_t)tics * 1000000 / configTICK_RATE_HZ);
+}  // ()
+
+/**
+ * @class TareaEstatica
+ * @brief Una tarea de FreeRTOS con su pila dentro.
+ * @tparam PALABRAS_PILA Tamaño de la pila, en palabras de 32 bits.
+ */
+template<uint16_t PALABRAS_PILA>
+class TareaEstatica {
+
+private:
+
+  StackType_t laPila[PALABRAS_PILA];
+  StaticTask_t elBloque;
+  TaskHandle_t elManejador;
+
+public:
+
+  /**
+   * @brief Constructor: todavía no existe (crear()).
+   */
+  TareaEstatica()
+    : elManejador(NULL) {
+  }  // ()
+
+  /**
+   * @function crear
+   * @brief Crea la tarea. Si tiene más prioridad que quien la crea, empieza ya.
+   * @param funcion Cuerpo de la tarea: no vuelve nunca.
+   * @param nombre Para el depurador.
+   * @param prioridad TASK_PRIO_LOW (la de loop()), TASK_PRIO_NORMAL, TASK_PRIO_HIGH...
+   * @param parametro Lo que recibe funcion.
+   * @return false si no se ha podido crear.
+   */
+  bool crear(TaskFunction_t funcion, const char* nombre, UBaseType_t prioridad,
+             void* parametro = NULL) {
+    (*this).elManejador = xTaskCreateStatic(funcion, nombre, PALABRAS_PILA, parametro, prioridad,
+                                            &(*this).laPila[0], &(*this).elBloque);
+    return (*this).elManejador != NULL;
+  }  // ()
+
+  /**
+   * @function manejador
+   * @brief Para la API de FreeRTOS (NULL si no se ha creado).
+   */
+  TaskHandle_t manejador() const {
+    return (*this).elManejador;
+  }  // ()
+
+};  // class
+
+/**
+ * @class ColaEstatica
+ * @brief Una cola de FreeRTOS de N elementos de tipo T, con su almacén dentro.
+ *
+ * enviar() no espera nunca: si la cola está llena, el elemento se pierde y
+ * se cuenta. Así quien produce (la tarea con plazos) no depende de lo que
+ * tarde quien consume.
+ */
+template<typename T, uint16_t N>
+class ColaEstatica {
+
+private:
+
+  static_assert(std::is_trivially_copyable<T>::value, "la cola copia los elementos byte a byte");
+
+  uint8_t elAlmacen[N * sizeof(T)];
+  StaticQueue_t laEstructura;
+  QueueHandle_t elManejador;
+  volatile uint32_t perdidos;
+
+public:
+
+  /**
+   * @brief Constructor: todavía no existe (crear()).
+   */
+  ColaEstatica()
+    : elManejador(NULL), perdidos(0) {
+  }  // ()
+
+  /**
+   * @function crear
+   * @brief Crea la cola (antes que las tareas que la usan).
+   */
+  bool crear() {
+    (*this).elManejador = xQueueCreateStatic(N, sizeof(T), &(*this).elAlmacen[0],
+                                             &(*this).laEstructura);
+    return (*this).elManejador != NULL;
+  }  // ()
+
+  /**
+   * @function enviar
+   * @brief Copia x al final de la cola, sin esperar.
+   * @return false si estaba llena (se cuenta en perdidas()).
+   */
+  bool enviar(const T& x) {
+    if (xQueueSend((*this).elManejador, &x, 0) != pdTRUE) {
+      (*this).perdidos++;
+      return false;
+    }
+    return true;
+  }  // ()
+
+  /**
+   * @function recibir
+   * @brief Saca el primero, esperando como mucho espera tics (portMAX_DELAY: lo que haga falta).
+   * @return false si no ha llegado nada.
+   */
+  bool recibir(T& x, TickType_t espera) {
+    return xQueueReceive((*this).elManejador, &x, espera) == pdTRUE;
+  }  // ()
+
+  /**
+   * @function perdidas
+   * @brief Elementos que no cabían.
+   */
+  uint32_t perdidas() const {
+    return (*this).perdidos;
+  }  // ()
+
+};  // class
+
+/**
+ * @class Puntualidad
+ * @brief Cuánto se retrasa una tarea periódica respecto a su plazo: media,
+ * máximo e histograma por potencias de 2 (en us).
+ *
+ * La cubeta k cuenta los retrasos entre 2^k y 2^(k+1)-1 us; la 0, también
+ * los de 0. La resolución es la del reloj con el que se mide el plazo: un
+ * ms con millis(), un tic (~1 ms) con FreeRTOS.
+ */
+class Puntualidad {
+
+public:
+
+  static const uint8_t NUM_CUBETAS = 24;  ///< Hasta 2^24 us: 16 s.
+
+private:
+
+  uint32_t cuenta;
+  uint32_t maximo;
+  uint64_t total;
+  uint32_t cubetas[NUM_CUBETAS];
+
+public:
+
+  /**
+   * @brief Constructor: a cero.
+   */
+  Puntualidad()
+    : cuenta(0), maximo(0), total(0), cubetas() {
+  }  // ()
+
+  /**
+   * @function anotar
+   * @param retrasoUs Desde el plazo hasta que la tarea se ha puesto en marcha.
+   */
+  void anotar(uint32_t retrasoUs) {
+    (*this).cuenta++;
+    (*this).total += retrasoUs;
+    if (retrasoUs > (*this).maximo) {
+      (*this).maximo = retrasoUs;
+    }
+    uint8_t k = (retrasoUs == 0 ? 0 : 31 - __builtin_clz(retrasoUs));
+    (*this).cubetas[k < NUM_CUBETAS ? k : NUM_CUBETAS - 1]++;
+  }  // ()
+
+  /**
+   * @function reiniciar
+   */
+  void reiniciar() {
+    (*this).cuenta = 0;
+    (*this).maximo = 0;
+    (*this).total = 0;
+    memset(&(*this).cubetas[0], 0, sizeof((*this).cubetas));
+  }  // ()
+
+  /**
+   * @function maximoUs
+   */
+  uint32_t maximoUs() const {
+    return (*this).maximo;
+  }  // ()
+
+  /**
+   * @function volcar
+   * @brief Una línea: cuenta, media y máximo (us) y las cubetas desde la primera a la última no vacías.
+   * @param salida Algo con escribir(): PuertoSerie, por ejemplo.
+   */
+  template<typename S>
+  void volcar(S& salida) const {
+    salida.escribir("n=");
+    salida.escribir((unsigned long)(*this).cuenta);
+    if ((*this).cuenta == 0) {
+      salida.escribir("\n");
+      return;
+    }
+    salida.escribir(" retraso(us) media=");
+    salida.escribir((unsigned long)((*this).total / (*this).cuenta));
+    salida.escribir(" max=");
+    salida.escribir((unsigned long)(*this).maximo);
+
+    uint8_t desde = 0;
+    uint8_t hasta = NUM_CUBETAS - 1;
+    while ((*this).cubetas[desde] == 0) {
+      desde++;
+    }
+    while ((*this).cubetas[hasta] == 0) {
+      hasta--;
+    }
+    salida.escribir(" 2^");
+    salida.escribir((unsigned int)desde);
+    salida.escribir(":");
+    for (uint8_t k = desde; k <= hasta; k++) {
+      salida.escribir(" ");
+      salida.escribir((unsigned long)(*this).cubetas[k]);
+    }
+    salida.escribir("\n");
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
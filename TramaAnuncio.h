@@ -0,0 +1,265 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file TramaAnuncio.h
+ * @brief Anuncio iBeacon construido una sola vez; luego sólo se cambian los 21 bytes de carga.
+ * @author Sento Marcos Ibarra
+ *
+ * Un iBeacon son 30 bytes de los que sólo cambian los 21 últimos (uuid-16
+ * major-2 minor-2 txPower-1, o nuestra carga libre):
+ *
+ *   0x02 0x01 0x06            flags
+ *   0x1A 0xFF                 longitud y tipo (datos del fabricante)
+ *   0x4C 0x00 0x02 0x15       companyID, tipo iBeacon, longitud (21)
+ *   [21 bytes de carga]       <- lo único que se cambia
+ *
+ * La SoftDevice permite cambiar los datos de un anuncio en marcha, pero hay
+ * que darle un buffer distinto del que está usando. Por eso hay dos buffers
+ * que se alternan: prepararEnvio() copia la plantilla en el que está libre.
+ *
+ * TramaAnuncioExtendida es lo mismo para los anuncios extendidos de BLE 5:
+ * hasta 255 bytes, que son una sola estructura de datos del fabricante.
+ *
+ * @see EmisoraBLE.h
+ */
+
+#ifndef TRAMA_ANUNCIO_H_INCLUIDO
+#define TRAMA_ANUNCIO_H_INCLUIDO
+
+/**
+ * @class TramaAnuncio
+ * @brief Plantilla de anuncio iBeacon con la carga modificable, y doble buffer para la SoftDevice.
+ */
+class TramaAnuncio {
+
+public:
+
+  /**
+   * @brief Tamaños y posiciones.
+   */
+  enum {
+    TAMANYO = 30,        ///< Bytes del anuncio completo.
+    POS_CARGA = 9,       ///< Donde empiezan los 21 bytes de carga.
+    TAMANYO_CARGA = 21,  ///< uuid-16 major-2 minor-2 txPower-1.
+    POS_MAJOR = POS_CARGA + 16,
+    POS_MINOR = POS_CARGA + 18,
+    POS_RSSI = POS_CARGA + 20,
+    TAMANYO_MAX = 31  ///< BLE_GAP_ADV_SET_DATA_SIZE_MAX.
+  };
+
+private:
+
+  uint8_t plantilla[TAMANYO];           ///< La trama que se está preparando.
+  uint8_t buffers[2][TAMANYO];          ///< Los que se entregan a la SoftDevice.
+  uint8_t respuestaEscaneo[2][TAMANYO_MAX];
+  uint8_t tamanyoRespuestaEscaneo;
+  uint8_t enUso;                        ///< Cuál de los dos buffers tiene la SoftDevice.
+  bool enviadoAlgunaVez;
+
+public:
+
+  /**
+   * @brief Constructor: prefijo iBeacon y carga a '-'.
+   * @param fabricanteID Identificador del fabricante (0x004C = Apple).
+   */
+  TramaAnuncio(uint16_t fabricanteID = 0x004C)
+    : tamanyoRespuestaEscaneo(0), enUso(1), enviadoAlgunaVez(false) {
+
+    const uint8_t prefijo[POS_CARGA] = {
+      0x02, 0x01, BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE,  // flags
+      0x1A, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA,         // 26 bytes, fabricante
+      (uint8_t)(fabricanteID & 0xFF), (uint8_t)(fabricanteID >> 8),
+      0x02,  // ibeacon type
+      21     // ibeacon length
+    };
+
+    memcpy(&(*this).plantilla[0], &prefijo[0], POS_CARGA);
+    memset(&(*this).plantilla[POS_CARGA], '-', TAMANYO_CARGA);
+    memset(&(*this).buffers[0][0], 0, sizeof((*this).buffers));
+    memset(&(*this).respuestaEscaneo[0][0], 0, sizeof((*this).respuestaEscaneo));
+  }  // ()
+
+  /**
+   * @function ponerCarga
+   * @brief Cambia los 21 bytes de carga (lo que sobre se queda como estaba).
+   * @param carga Datos.
+   * @param tam Bytes de datos.
+   */
+  void ponerCarga(const uint8_t* carga, uint8_t tam) {
+    memcpy(&(*this).plantilla[POS_CARGA], carga, (tam > TAMANYO_CARGA ? (uint8_t)TAMANYO_CARGA : tam));
+  }  // ()
+
+  /**
+   * @function ponerIBeacon
+   * @brief Pone la carga de un iBeacon normal.
+   * @param uuid UUID del beacon (16 bytes, en el orden en que se emiten).
+   * @param major Valor mayor.
+   * @param minor Valor menor.
+   * @param rssi RSSI a 1 m.
+   */
+  void ponerIBeacon(const uint8_t* uuid, uint16_t major, uint16_t minor, int8_t rssi) {
+    memcpy(&(*this).plantilla[POS_CARGA], uuid, 16);
+    (*this).ponerMajorMinor(major, minor);
+    (*this).plantilla[POS_RSSI] = (uint8_t)rssi;
+  }  // ()
+
+  /**
+   * @function ponerMajorMinor
+   * @brief Cambia sólo major y minor (big-endian, como en un iBeacon).
+   */
+  void ponerMajorMinor(uint16_t major, uint16_t minor) {
+    (*this).plantilla[POS_MAJOR] = major >> 8;
+    (*this).plantilla[POS_MAJOR + 1] = major & 0xFF;
+    (*this).plantilla[POS_MINOR] = minor >> 8;
+    (*this).plantilla[POS_MINOR + 1] = minor & 0xFF;
+  }  // ()
+
+  /**
+   * @function ponerRespuestaEscaneo
+   * @brief Guarda la respuesta de escaneo (se copia a los dos buffers, una vez).
+   */
+  void ponerRespuestaEscaneo(const uint8_t* datos, uint8_t tam) {
+    (*this).tamanyoRespuestaEscaneo = (tam > TAMANYO_MAX ? (uint8_t)TAMANYO_MAX : tam);
+    memcpy(&(*this).respuestaEscaneo[0][0], datos, (*this).tamanyoRespuestaEscaneo);
+    memcpy(&(*this).respuestaEscaneo[1][0], datos, (*this).tamanyoRespuestaEscaneo);
+  }  // ()
+
+  /**
+   * @function plantillaActual
+   * @brief La trama tal como está ahora (TAMANYO bytes).
+   */
+  const uint8_t* plantillaActual() const {
+    return &(*this).plantilla[0];
+  }  // ()
+
+  /**
+   * @function haCambiado
+   * @brief Dice si la plantilla es distinta de lo último que se entregó.
+   */
+  bool haCambiado() const {
+    return !(*this).enviadoAlgunaVez
+           || memcmp(&(*this).plantilla[0], &(*this).buffers[(*this).enUso][0], TAMANYO) != 0;
+  }  // ()
+
+  /**
+   * @function prepararEnvio
+   * @brief Copia la plantilla en el buffer libre y lo da como el que está en uso.
+   * @param datos Se rellena con los buffers para sd_ble_gap_adv_set_configure().
+   */
+  void prepararEnvio(ble_gap_adv_data_t& datos) {
+    (*this).enUso ^= 1;
+    memcpy(&(*this).buffers[(*this).enUso][0], &(*this).plantilla[0], TAMANYO);
+    (*this).enviadoAlgunaVez = true;
+
+    datos.adv_data.p_data = &(*this).buffers[(*this).enUso][0];
+    datos.adv_data.len = TAMANYO;
+    datos.scan_rsp_data.p_data = &(*this).respuestaEscaneo[(*this).enUso][0];
+    datos.scan_rsp_data.len = (*this).tamanyoRespuestaEscaneo;
+  }  // ()
+
+  /**
+   * @function marcarEnviada
+   * @brief Anota que la plantilla actual ya está en el aire (la ha puesto Bluefruit).
+   */
+  void marcarEnviada() {
+    (*this).enUso ^= 1;
+    memcpy(&(*this).buffers[(*this).enUso][0], &(*this).plantilla[0], TAMANYO);
+    (*this).enviadoAlgunaVez = true;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+/**
+ * @class TramaAnuncioExtendida
+ * @brief Anuncio extendido: datos del fabricante con carga libre, en doble buffer para la SoftDevice.
+ *
+ *   longitud, 0xFF, companyID (2, little-endian)
+ *   [hasta TAMANYO_MAX_CARGA bytes de carga]
+ *
+ * No hay plantilla aparte: la carga se escribe directamente en el buffer
+ * que no tiene la SoftDevice (255 bytes menos de RAM).
+ */
+class TramaAnuncioExtendida {
+
+public:
+
+  /**
+   * @brief Tamaños.
+   */
+  enum {
+    TAMANYO_MAX = 255,  ///< BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED.
+    POS_CARGA = 4,      ///< Longitud, tipo y companyID.
+    TAMANYO_MAX_CARGA = TAMANYO_MAX - POS_CARGA
+  };
+
+private:
+
+  uint8_t buffers[2][TAMANYO_MAX];
+  uint8_t tamanyos[2];
+  uint8_t enUso;      ///< Cuál de los dos buffers tiene la SoftDevice.
+  bool hayNueva;      ///< Si el otro tiene una carga que aún no se ha entregado.
+  uint16_t fabricante;
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param fabricanteID Identificador del fabricante.
+   */
+  TramaAnuncioExtendida(uint16_t fabricanteID = 0x004C)
+    : enUso(1), hayNueva(false), fabricante(fabricanteID) {
+    memset(&(*this).buffers[0][0], 0, sizeof((*this).buffers));
+    (*this).tamanyos[0] = (*this).tamanyos[1] = 0;
+  }  // ()
+
+  /**
+   * @function ponerCarga
+   * @brief Escribe la carga en el buffer libre; prepararEnvio() lo entregará.
+   * @param carga Datos.
+   * @param tam Bytes de datos (lo que pase de TAMANYO_MAX_CARGA se pierde).
+   */
+  void ponerCarga(const uint8_t* carga, uint8_t tam) {
+    if (tam > TAMANYO_MAX_CARGA) {
+      tam = TAMANYO_MAX_CARGA;
+    }
+    uint8_t* p = &(*this).buffers[(*this).enUso ^ 1][0];
+    p[0] = tam + 3;
+    p[1] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+    p[2] = (uint8_t)((*this).fabricante & 0xFF);
+    p[3] = (uint8_t)((*this).fabricante >> 8);
+    memcpy(&p[POS_CARGA], carga, tam);
+    (*this).tamanyos[(*this).enUso ^ 1] = POS_CARGA + tam;
+    (*this).hayNueva = true;
+  }  // ()
+
+  /**
+   * @function prepararEnvio
+   * @brief Da el buffer con la última carga (si hay una nueva, pasa a ser el que está en uso).
+   * @param datos Se rellena para sd_ble_gap_adv_set_configure(); sin respuesta de escaneo.
+   */
+  void prepararEnvio(ble_gap_adv_data_t& datos) {
+    if ((*this).hayNueva) {
+      (*this).enUso ^= 1;
+      (*this).hayNueva = false;
+    }
+    datos.adv_data.p_data = &(*this).buffers[(*this).enUso][0];
+    datos.adv_data.len = (*this).tamanyos[(*this).enUso];
+    datos.scan_rsp_data.p_data = NULL;
+    datos.scan_rsp_data.len = 0;
+  }  // ()
+
+  /**
+   * @function tamanyo
+   * @brief Bytes de la trama que tiene la SoftDevice.
+   */
+  uint8_t tamanyo() const {
+    return (*this).tamanyos[(*this).enUso];
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,315 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file TramaMediciones.h
+ * @brief Formato de la trama empaquetada: varias mediciones en los 21 bytes de un iBeacon libre.
+ * @author Sento Marcos Ibarra
+ *
+ * Una sola trama lleva CO2, temperatura, ruido, número de secuencia y
+ * marca de tiempo. Va en la carga de EmisoraBLE::emitirAnuncioIBeaconLibre()
+ * (donde un iBeacon normal lleva uuid-16 major-2 minor-2 txPower-1).
+ *
+ * Distribución fija, enteros en big-endian (como major y minor de un iBeacon):
+ *
+ *   byte  0-1  firma '3' 'D'
+ *   byte  2    versión (4 bits altos) | campos presentes (4 bits bajos)
+ *   byte  3-4  CO2 (int16, ppb: el sensor es de ozono, Medidor::medirCO2())
+ *   byte  5-6  temperatura (int16, ºC)
+ *   byte  7-8  ruido (int16, dB)
+ *   byte  9-10 número de secuencia (sus 16 bits bajos)
+ *   byte 11-14 marca de tiempo (uint32, ms desde el arranque)
+ *   byte 15-20 reservados (a 0)
+ *
+ * Los valores son los de los sensores del emisor, en el orden de su lista
+ * (RegistroSensores.h), y el bit k de "presentes" dice si está el k: el
+ * firmware empaqueta los valores con el registro y el resto con
+ * empaquetarCabecera().
+ *
+ * Versión 2, resumen de una ventana de un sensor (Agregador.h), con la
+ * firma, la secuencia y la marca de tiempo en el mismo sitio:
+ *
+ *   byte  2    versión 2 (4 bits altos) | el bit del sensor (4 bits bajos)
+ *   byte  3-4  mediciones en la ventana (uint16)
+ *   byte  5-6  mínimo (int16)
+ *   byte  7-8  máximo (int16)
+ *   byte  9-10 número de secuencia (sus 16 bits bajos)
+ *   byte 11-14 principio de la ventana (uint32, ms desde el arranque)
+ *   byte 15-16 media (int16, redondeada)
+ *   byte 17-20 varianza (uint32, muestral, redondeada)
+ *
+ * Un receptor de la versión 1 no las confunde con las suyas.
+ *
+ * Aquí está también la codificación de los iBeacon de una sola medición
+ * (Publicador::empezarPublicacionSensor()):
+ *
+ *   uuid   "EPSG-GTI-PROY-3D" (uuidBeacon())
+ *   major  (tipo de medición << 8) + contador (ID_CO2, ID_TEMPERATURA, ID_RUIDO)
+ *   minor  valor (int16)
+ *
+ * Los números de secuencia son de 32 bits en el emisor: no dan la vuelta en
+ * la vida de un nodo. En el aire van sólo sus bits bajos (16 en las tramas,
+ * 8 en el contador del major) y el receptor recupera los 32 con
+ * extenderSecuencia(), mientras no se pierda media vuelta seguida.
+ *
+ * No depende de Arduino ni de Bluefruit, para poder usarlo también en el
+ * receptor (receptor/Decodificador.h).
+ */
+
+#ifndef TRAMA_MEDICIONES_H_INCLUIDO
+#define TRAMA_MEDICIONES_H_INCLUIDO
+
+#include <stdint.h>
+
+#include "Uuid128.h"
+
+/**
+ * @struct TramaMediciones
+ * @brief Contenido de una trama empaquetada y su codificación.
+ */
+struct TramaMediciones {
+
+  /**
+   * @brief Constantes del formato.
+   */
+  enum {
+    TAMANYO = 21,  ///< Bytes de carga de un iBeacon libre.
+    VERSION = 1,
+    VERSION_RESUMEN = 2,
+
+    FIRMA_0 = '3',
+    FIRMA_1 = 'D',
+
+    // bits de "campos presentes"
+    HAY_CO2 = 0x01,
+    HAY_TEMPERATURA = 0x02,
+    HAY_RUIDO = 0x04,
+    HAY_MARCA_TIEMPO = 0x08,
+    HAY_TODO = 0x0F,
+
+    // posición de cada campo
+    POS_CABECERA = 2,
+    POS_VALORES = 3,  ///< Los valores seguidos, 2 bytes cada uno.
+    MAX_VALORES = 3,  ///< Hasta POS_SECUENCIA; y en "presentes" el bit 3 es HAY_MARCA_TIEMPO.
+    POS_CO2 = 3,
+    POS_TEMPERATURA = 5,
+    POS_RUIDO = 7,
+    POS_SECUENCIA = 9,
+    POS_MARCA_TIEMPO = 11,
+    POS_RESERVADO = 15,
+
+    // posición de cada campo de un resumen
+    POS_CUANTAS = 3,
+    POS_MINIMO = 5,
+    POS_MAXIMO = 7,
+    POS_MEDIA = 15,
+    POS_VARIANZA = 17,
+
+    // bits de la secuencia que van en el aire
+    BITS_SECUENCIA = 16,
+    BITS_CONTADOR_MAJOR = 8
+  };
+
+  /**
+   * @brief Tipo de medición, en el byte alto del major de los iBeacon de una medición.
+   */
+  enum {
+    ID_CO2 = 11,
+    ID_TEMPERATURA = 12,
+    ID_RUIDO = 13
+  };
+
+  /**
+   * @struct Resumen
+   * @brief Contenido de una trama de resumen (versión 2).
+   */
+  struct Resumen {
+    uint8_t presente;      ///< El bit HAY_* del sensor.
+    uint16_t cuantas;
+    int16_t minimo;
+    int16_t maximo;
+    int16_t media;
+    uint32_t varianza;
+    uint16_t secuencia;
+    uint32_t inicio;       ///< Principio de la ventana (ms desde el arranque).
+  };
+
+  uint8_t presentes;     ///< Bits HAY_*.
+  int16_t co2;           ///< ppb.
+  int16_t temperatura;   ///< ºC.
+  int16_t ruido;         ///< dB.
+  uint16_t secuencia;    ///< Número de secuencia (los 16 bits bajos del de 32).
+  uint32_t marcaTiempo;  ///< ms desde el arranque.
+
+  // .........................................................
+  // .........................................................
+  static void escribir16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+  }  // ()
+
+  static uint16_t leer16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+  }  // ()
+
+  static void escribir32(uint8_t* p, uint32_t v) {
+    escribir16(p, v >> 16);
+    escribir16(p + 2, v & 0xFFFF);
+  }  // ()
+
+  static uint32_t leer32(const uint8_t* p) {
+    return ((uint32_t)leer16(p) << 16) | leer16(p + 2);
+  }  // ()
+
+  /**
+   * @function uuidBeacon
+   * @brief UUID de los iBeacon de una medición, en el orden en que se emite.
+   */
+  static constexpr Uuid128 uuidBeacon() {
+    return Uuid128("EPSG-GTI-PROY-3D").alReves();
+  }  // ()
+
+  /**
+   * @function codificarMajor
+   * @brief major de un iBeacon de una medición.
+   * @param id ID_CO2, ID_TEMPERATURA o ID_RUIDO.
+   * @param contador Contador del ciclo (sólo su byte bajo).
+   */
+  static constexpr uint16_t codificarMajor(uint8_t id, uint8_t contador) {
+    return (uint16_t)((id << 8) + contador);
+  }  // ()
+
+  static constexpr uint8_t idDeMajor(uint16_t major) {
+    return (uint8_t)(major >> 8);
+  }  // ()
+
+  static constexpr uint8_t contadorDeMajor(uint16_t major) {
+    return (uint8_t)(major & 0xFF);
+  }  // ()
+
+  /**
+   * @function extenderSecuencia
+   * @brief De los bits bajos que van en el aire a la secuencia de 32 bits.
+   *
+   * Da la secuencia que tiene esos bits bajos y está más cerca de la
+   * referencia (hacia delante o hacia atrás, media vuelta como mucho).
+   *
+   * @param referencia Una secuencia de 32 bits reciente del mismo emisor.
+   * @param enAire Lo recibido.
+   * @param bits Bits de enAire (BITS_SECUENCIA, BITS_CONTADOR_MAJOR o 32).
+   */
+  static uint32_t extenderSecuencia(uint32_t referencia, uint32_t enAire, uint8_t bits) {
+    uint32_t mascara = (bits >= 32 ? 0xFFFFFFFFUL : (1UL << bits) - 1);
+    uint32_t adelante = (enAire - referencia) & mascara;
+    return adelante <= (mascara >> 1)
+             ? referencia + adelante
+             : referencia + adelante - mascara - 1;
+  }  // ()
+
+  /**
+   * @function empaquetar
+   * @brief Escribe la trama en carga.
+   * @param carga Destino, TAMANYO bytes.
+   */
+  void empaquetar(uint8_t* carga) const {
+    empaquetarCabecera(carga, (*this).presentes, (*this).secuencia, (*this).marcaTiempo);
+    escribir16(&carga[POS_CO2], (uint16_t)(*this).co2);
+    escribir16(&carga[POS_TEMPERATURA], (uint16_t)(*this).temperatura);
+    escribir16(&carga[POS_RUIDO], (uint16_t)(*this).ruido);
+  }  // ()
+
+  /**
+   * @function empaquetarCabecera
+   * @brief Escribe todo menos los valores (que quedan a 0).
+   * @param carga Destino, TAMANYO bytes.
+   * @param presentes_ Bits HAY_*.
+   * @param secuencia_ Sus 16 bits bajos.
+   * @param marcaTiempo_ ms desde el arranque.
+   */
+  static void empaquetarCabecera(uint8_t* carga, uint8_t presentes_,
+                                 uint16_t secuencia_, uint32_t marcaTiempo_) {
+    for (uint8_t i = 0; i < TAMANYO; i++) {
+      carga[i] = 0;
+    }
+    carga[0] = FIRMA_0;
+    carga[1] = FIRMA_1;
+    carga[POS_CABECERA] = (VERSION << 4) | (presentes_ & 0x0F);
+    escribir16(&carga[POS_SECUENCIA], secuencia_);
+    escribir32(&carga[POS_MARCA_TIEMPO], marcaTiempo_);
+  }  // ()
+
+  /**
+   * @function esTramaMediciones
+   * @brief Dice si carga parece una trama empaquetada de esta versión.
+   * @param carga Carga libre de un iBeacon.
+   * @param tam Bytes de carga.
+   */
+  static bool esTramaMediciones(const uint8_t* carga, uint8_t tam) {
+    return tam >= TAMANYO
+           && carga[0] == FIRMA_0 && carga[1] == FIRMA_1
+           && (carga[POS_CABECERA] >> 4) == VERSION;
+  }  // ()
+
+  /**
+   * @function desempaquetar
+   * @brief Lee una trama.
+   * @param carga Carga libre de un iBeacon.
+   * @param tam Bytes de carga.
+   * @param trama Donde se deja el resultado.
+   * @return false si carga no es una trama empaquetada.
+   */
+  static bool desempaquetar(const uint8_t* carga, uint8_t tam, TramaMediciones& trama) {
+    if (!esTramaMediciones(carga, tam)) {
+      return false;
+    }
+    trama.presentes = carga[POS_CABECERA] & 0x0F;
+    trama.co2 = (int16_t)leer16(&carga[POS_CO2]);
+    trama.temperatura = (int16_t)leer16(&carga[POS_TEMPERATURA]);
+    trama.ruido = (int16_t)leer16(&carga[POS_RUIDO]);
+    trama.secuencia = leer16(&carga[POS_SECUENCIA]);
+    trama.marcaTiempo = leer32(&carga[POS_MARCA_TIEMPO]);
+    return true;
+  }  // ()
+
+  /**
+   * @function empaquetarResumen
+   * @brief Escribe una trama de resumen en carga.
+   * @param carga Destino, TAMANYO bytes.
+   */
+  static void empaquetarResumen(uint8_t* carga, const Resumen& r) {
+    empaquetarCabecera(carga, r.presente, r.secuencia, r.inicio);
+    carga[POS_CABECERA] = (VERSION_RESUMEN << 4) | (r.presente & 0x0F);
+    escribir16(&carga[POS_CUANTAS], r.cuantas);
+    escribir16(&carga[POS_MINIMO], (uint16_t)r.minimo);
+    escribir16(&carga[POS_MAXIMO], (uint16_t)r.maximo);
+    escribir16(&carga[POS_MEDIA], (uint16_t)r.media);
+    escribir32(&carga[POS_VARIANZA], r.varianza);
+  }  // ()
+
+  /**
+   * @function desempaquetarResumen
+   * @brief Lee una trama de resumen.
+   * @return false si carga no es una trama de resumen.
+   */
+  static bool desempaquetarResumen(const uint8_t* carga, uint8_t tam, Resumen& r) {
+    if (tam < TAMANYO || carga[0] != FIRMA_0 || carga[1] != FIRMA_1
+        || (carga[POS_CABECERA] >> 4) != VERSION_RESUMEN) {
+      return false;
+    }
+    r.presente = carga[POS_CABECERA] & 0x0F;
+    r.cuantas = leer16(&carga[POS_CUANTAS]);
+    r.minimo = (int16_t)leer16(&carga[POS_MINIMO]);
+    r.maximo = (int16_t)leer16(&carga[POS_MAXIMO]);
+    r.media = (int16_t)leer16(&carga[POS_MEDIA]);
+    r.varianza = leer32(&carga[POS_VARIANZA]);
+    r.secuencia = leer16(&carga[POS_SECUENCIA]);
+    r.inicio = leer32(&carga[POS_MARCA_TIEMPO]);
+    return true;
+  }  // ()
+
+};  // struct
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
@@ -0,0 +1,213 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file TramaMuestras.h
+ * @brief Trama para anuncios extendidos: las últimas mediciones, cada una con su marca de tiempo.
+ * @author Sento Marcos Ibarra
+ *
+ * En los 21 bytes de un iBeacon libre sólo cabe una TramaMediciones. En un
+ * anuncio extendido (hasta 251 bytes de carga) caben las MAX_MUESTRAS
+ * últimas: cada medición sale en varias tramas seguidas y el receptor que se
+ * pierda unas cuantas no pierde mediciones.
+ *
+ * Enteros en big-endian, como en TramaMediciones:
+ *
+ *   byte 0-1  firma '3' 'D'
+ *   byte 2    versión (4 bits altos, VERSION = 2) | campos presentes (4 bits bajos)
+ *   byte 3    número de muestras (n)
+ *   byte 4-5  número de secuencia de la más reciente (sus 16 bits bajos)
+ *   byte 6-9  marca de tiempo de la más reciente (uint32, ms desde el arranque)
+ *   n x 8 bytes, de la más reciente a la más antigua:
+ *     0-5  los valores (int16): el k en 2k, como en TramaMediciones (el
+ *          sensor k de la lista del emisor, si está el bit k de "presentes";
+ *          si no, 0)
+ *     6-7  antigüedad respecto a la más reciente (uint16, en UNIDAD_ANTIGUEDAD ms)
+ *
+ * La muestra i tiene secuencia (secuencia - i): las secuencias van seguidas.
+ * Las que son más antiguas de lo que cabe en la antigüedad no se envían.
+ *
+ * No depende de Arduino ni de Bluefruit, para poder usarlo también en el receptor.
+ */
+
+#ifndef TRAMA_MUESTRAS_H_INCLUIDO
+#define TRAMA_MUESTRAS_H_INCLUIDO
+
+#include "TramaMediciones.h"
+
+/**
+ * @class TramaMuestras
+ * @brief Las últimas mediciones (en anillo) y su codificación.
+ */
+class TramaMuestras {
+
+public:
+
+  /**
+   * @brief Constantes del formato.
+   */
+  enum {
+    VERSION = 2,
+
+    POS_CABECERA = 2,
+    POS_CUENTA = 3,
+    POS_SECUENCIA = 4,
+    POS_MARCA_TIEMPO = 6,
+    POS_MUESTRAS = 10,
+
+    TAMANYO_MUESTRA = 2 * TramaMediciones::MAX_VALORES + 2,
+    POS_ANTIGUEDAD = 2 * TramaMediciones::MAX_VALORES,  ///< Dentro de cada muestra.
+    MAX_MUESTRAS = 30,  ///< Las que caben en 251 bytes.
+    TAMANYO_MAX = POS_MUESTRAS + MAX_MUESTRAS * TAMANYO_MUESTRA,
+
+    UNIDAD_ANTIGUEDAD = 10  ///< ms: hasta 655 s.
+  };
+
+  /**
+   * @struct Muestra
+   * @brief Una medición.
+   */
+  struct Muestra {
+    int16_t valores[TramaMediciones::MAX_VALORES];  ///< El k, del sensor k de la lista.
+    uint32_t marcaTiempo;                           ///< ms desde el arranque.
+  };
+
+private:
+
+  Muestra lasMuestras[MAX_MUESTRAS];  ///< En anillo.
+  uint8_t cuenta;
+  uint8_t siguiente;       ///< Donde irá la próxima.
+  uint32_t secuencia;      ///< De la más reciente.
+
+public:
+
+  uint8_t presentes;  ///< Bits TramaMediciones::HAY_*.
+
+  /**
+   * @brief Constructor: vacía.
+   */
+  TramaMuestras()
+    : lasMuestras(), cuenta(0), siguiente(0), secuencia(0),
+      presentes(TramaMediciones::HAY_TODO) {
+  }  // ()
+
+  /**
+   * @function anyadir
+   * @brief Añade una medición; si ya hay MAX_MUESTRAS, se olvida la más antigua.
+   * @param valores Los de la medición, en el orden de la lista de sensores.
+   * @param n Cuántos (como mucho TramaMediciones::MAX_VALORES; los demás, a 0).
+   * @param marcaTiempo ms desde el arranque.
+   * @param secuencia_ Número de secuencia de esta medición (el de la anterior + 1).
+   */
+  void anyadir(const int16_t* valores, uint8_t n, uint32_t marcaTiempo, uint32_t secuencia_) {
+    Muestra& m = (*this).lasMuestras[(*this).siguiente];
+    for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+      m.valores[k] = (k < n ? valores[k] : 0);
+    }
+    m.marcaTiempo = marcaTiempo;
+    (*this).siguiente = ((*this).siguiente + 1 == MAX_MUESTRAS ? 0 : (*this).siguiente + 1);
+    if ((*this).cuenta < MAX_MUESTRAS) {
+      (*this).cuenta++;
+    }
+    (*this).secuencia = secuencia_;
+  }  // ()
+
+  /**
+   * @function muestras
+   * @brief Cuántas hay guardadas.
+   */
+  uint8_t muestras() const {
+    return (*this).cuenta;
+  }  // ()
+
+  /**
+   * @function empaquetar
+   * @brief Escribe la trama en carga.
+   * @param carga Destino, TAMANYO_MAX bytes.
+   * @return Bytes escritos (0 si no hay ninguna muestra).
+   */
+  uint8_t empaquetar(uint8_t* carga) const {
+    if ((*this).cuenta == 0) {
+      return 0;
+    }
+
+    uint8_t ultima = ((*this).siguiente == 0 ? MAX_MUESTRAS - 1 : (*this).siguiente - 1);
+    uint32_t marca = (*this).lasMuestras[ultima].marcaTiempo;
+
+    carga[0] = TramaMediciones::FIRMA_0;
+    carga[1] = TramaMediciones::FIRMA_1;
+    carga[POS_CABECERA] = (VERSION << 4) | ((*this).presentes & 0x0F);
+    TramaMediciones::escribir16(&carga[POS_SECUENCIA], (uint16_t)(*this).secuencia);
+    TramaMediciones::escribir32(&carga[POS_MARCA_TIEMPO], marca);
+
+    uint8_t n = 0;
+    uint8_t i = ultima;
+    uint8_t* p = &carga[POS_MUESTRAS];
+    while (n < (*this).cuenta) {
+      const Muestra& m = (*this).lasMuestras[i];
+      uint32_t antiguedad = (marca - m.marcaTiempo) / UNIDAD_ANTIGUEDAD;
+      if (antiguedad > 0xFFFF) {
+        break;  // y las de antes, más aún
+      }
+      for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+        TramaMediciones::escribir16(&p[2 * k], (uint16_t)m.valores[k]);
+      }
+      TramaMediciones::escribir16(&p[POS_ANTIGUEDAD], (uint16_t)antiguedad);
+      p += TAMANYO_MUESTRA;
+      n++;
+      i = (i == 0 ? MAX_MUESTRAS - 1 : i - 1);
+    }
+    carga[POS_CUENTA] = n;
+
+    return POS_MUESTRAS + n * TAMANYO_MUESTRA;
+  }  // ()
+
+  /**
+   * @function esTramaMuestras
+   * @brief Dice si carga parece una trama de muestras de esta versión (y completa).
+   * @param carga Datos del fabricante de un anuncio extendido.
+   * @param tam Bytes de carga.
+   */
+  static bool esTramaMuestras(const uint8_t* carga, uint8_t tam) {
+    return tam >= POS_MUESTRAS
+           && carga[0] == TramaMediciones::FIRMA_0 && carga[1] == TramaMediciones::FIRMA_1
+           && (carga[POS_CABECERA] >> 4) == VERSION
+           && carga[POS_CUENTA] <= MAX_MUESTRAS
+           && tam >= POS_MUESTRAS + carga[POS_CUENTA] * TAMANYO_MUESTRA;
+  }  // ()
+
+  /**
+   * @function desempaquetar
+   * @brief Lee las muestras de una trama.
+   * @param carga Datos del fabricante de un anuncio extendido.
+   * @param tam Bytes de carga.
+   * @param secuenciaUltima Los 16 bits bajos de la secuencia de la más reciente (la muestra i es secuenciaUltima - i).
+   * @param destino Donde se dejan, de la más reciente a la más antigua.
+   * @param maximo Sitio en destino.
+   * @return Muestras leídas; 0 si carga no es una trama de muestras.
+   */
+  static uint8_t desempaquetar(const uint8_t* carga, uint8_t tam, uint16_t& secuenciaUltima,
+                               Muestra* destino, uint8_t maximo) {
+    if (!esTramaMuestras(carga, tam)) {
+      return 0;
+    }
+    secuenciaUltima = TramaMediciones::leer16(&carga[POS_SECUENCIA]);
+    uint32_t marca = TramaMediciones::leer32(&carga[POS_MARCA_TIEMPO]);
+
+    uint8_t n = (carga[POS_CUENTA] < maximo ? carga[POS_CUENTA] : maximo);
+    const uint8_t* p = &carga[POS_MUESTRAS];
+    for (uint8_t i = 0; i < n; i++, p += TAMANYO_MUESTRA) {
+      for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+        destino[i].valores[k] = (int16_t)TramaMediciones::leer16(&p[2 * k]);
+      }
+      destino[i].marcaTiempo = marca - (uint32_t)TramaMediciones::leer16(&p[POS_ANTIGUEDAD]) * UNIDAD_ANTIGUEDAD;
+    }
+    return n;
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
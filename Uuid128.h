@@ -0,0 +1,148 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Uuid128.h
+ * @brief UUID de 128 bits calculado al compilar a partir de un texto.
+ * @author Sento Marcos Ibarra
+ *
+ * Acepta dos formas:
+ *  - canónica, 36 caracteres: "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"
+ *  - un nombre de hasta 16 caracteres, como "EPSG-GTI-PROY-3D", cuyos bytes
+ *    se usan tal cual (lo que hacía stringAUint8AlReves())
+ *
+ * Los bytes se guardan como los quiere BLEUuid: el menos significativo
+ * primero. Con un constexpr (o el literal _uuid en un constexpr) todo se
+ * resuelve al compilar y un texto mal escrito es un error de compilación:
+ *
+ *   constexpr Uuid128 UUID_SERVICIO = "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"_uuid;
+ *
+ * BLEUuid se queda con un puntero a los bytes, no con una copia: el Uuid128
+ * tiene que vivir tanto como el servicio o la característica.
+ *
+ * Escrito en C++11 (es lo que usa el núcleo nRF52 de Adafruit), sin excepciones.
+ */
+
+#ifndef UUID128_H_INCLUIDO
+#define UUID128_H_INCLUIDO
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Se llama cuando el texto no es un UUID. Como no es constexpr, si
+ * pasa al compilar da error; si pasa al ejecutar, el byte queda a 0.
+ */
+inline uint8_t errorFormatoUuid() {
+  return 0;
+}  // ()
+
+/**
+ * @class Uuid128
+ * @brief 16 bytes de un UUID, el menos significativo primero.
+ */
+class Uuid128 {
+
+public:
+
+  uint8_t bytes[16];  ///< El byte menos significativo, el primero.
+
+private:
+
+  // .........................................................
+  // un dígito hexadecimal
+  // .........................................................
+  static constexpr uint8_t nibble(char c) {
+    return (c >= '0' && c <= '9')   ? (uint8_t)(c - '0')
+           : (c >= 'a' && c <= 'f') ? (uint8_t)(c - 'a' + 10)
+           : (c >= 'A' && c <= 'F') ? (uint8_t)(c - 'A' + 10)
+                                    : errorFormatoUuid();
+  }  // ()
+
+  // .........................................................
+  // dónde empieza, en la forma canónica, el byte k (k = 0 el más significativo)
+  // 8-4-4-4-12: hay un guión detrás de los bytes 3, 5, 7 y 9
+  // .........................................................
+  static constexpr size_t posicion(size_t k) {
+    return 2 * k + (k >= 4) + (k >= 6) + (k >= 8) + (k >= 10);
+  }  // ()
+
+  static constexpr bool guionesBien(const char* s) {
+    return s[8] == '-' && s[13] == '-' && s[18] == '-' && s[23] == '-';
+  }  // ()
+
+  // .........................................................
+  // byte i (i = 0 el menos significativo)
+  // .........................................................
+  static constexpr uint8_t byteAlReves(const char* s, size_t longitud, size_t i) {
+    return longitud == 36
+             ? (guionesBien(s)
+                  ? (uint8_t)((nibble(s[posicion(15 - i)]) << 4) | nibble(s[posicion(15 - i) + 1]))
+                  : errorFormatoUuid())
+           : longitud <= 16
+             // como stringAUint8AlReves(): el nombre, al revés, al final;
+             // delante, lo que había antes de copiarlo
+             ? (i >= 16 - longitud ? (uint8_t)s[15 - i] : (uint8_t)"0123456789ABCDEF"[i])
+             : errorFormatoUuid();
+  }  // ()
+
+  struct AlReves {};
+
+  // .........................................................
+  // .........................................................
+  constexpr Uuid128(const Uuid128& o, AlReves)
+    : bytes{ o.bytes[15], o.bytes[14], o.bytes[13], o.bytes[12],
+             o.bytes[11], o.bytes[10], o.bytes[9], o.bytes[8],
+             o.bytes[7], o.bytes[6], o.bytes[5], o.bytes[4],
+             o.bytes[3], o.bytes[2], o.bytes[1], o.bytes[0] } {
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor a partir de un texto y su longitud.
+   * @param s UUID canónico (36 caracteres) o nombre de hasta 16.
+   * @param longitud Caracteres de s.
+   */
+  constexpr Uuid128(const char* s, size_t longitud)
+    : bytes{ byteAlReves(s, longitud, 0), byteAlReves(s, longitud, 1),
+             byteAlReves(s, longitud, 2), byteAlReves(s, longitud, 3),
+             byteAlReves(s, longitud, 4), byteAlReves(s, longitud, 5),
+             byteAlReves(s, longitud, 6), byteAlReves(s, longitud, 7),
+             byteAlReves(s, longitud, 8), byteAlReves(s, longitud, 9),
+             byteAlReves(s, longitud, 10), byteAlReves(s, longitud, 11),
+             byteAlReves(s, longitud, 12), byteAlReves(s, longitud, 13),
+             byteAlReves(s, longitud, 14), byteAlReves(s, longitud, 15) } {
+  }  // ()
+
+  /**
+   * @brief Constructor a partir de un literal: Uuid128 u = "EPSG-GTI-PROY-3D";
+   */
+  template<size_t L>
+  constexpr Uuid128(const char (&s)[L])
+    : Uuid128(s, L - 1) {
+  }  // ()
+
+  /**
+   * @function alReves
+   * @brief Los mismos bytes en el orden en que se escribe el UUID (el más significativo primero).
+   *
+   * Es el orden del UUID de un iBeacon.
+   */
+  constexpr Uuid128 alReves() const {
+    return Uuid128(*this, AlReves());
+  }  // ()
+
+};  // class
+
+/**
+ * @brief Literal de UUID: "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"_uuid
+ */
+constexpr Uuid128 operator"" _uuid(const char* s, size_t longitud) {
+  return Uuid128(s, longitud);
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
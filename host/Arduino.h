@@ -0,0 +1,531 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Arduino.h
+ * @brief Sustituto para el ordenador (host) del núcleo Arduino: reloj virtual, pines y Serial.
+ * @author Sento Marcos Ibarra
+ *
+ * Permite compilar el sketch en Linux sin la placa. delay() no duerme: avanza
+ * un reloj virtual. Todo lo que hace el sketch queda anotado en
+ * Anfitrion::contadores para poder medirlo.
+ *
+ * suspendLoop() tampoco duerme: deja a loop() sin volver a llamarse hasta
+ * que alguien haga resumeLoop(). Anfitrion::unaVuelta() hace lo que haría
+ * el núcleo: corre una tarea de FreeRTOS lista (FreeRTOS.h), o llama a
+ * loop() o, si está suspendido, adelanta el reloj hasta el primer plazo (de
+ * una tarea o de un SoftwareTimer) y lo atiende.
+ *
+ * Igual que el IDE de Arduino, se pensó para una sola unidad de traducción:
+ * el programa anfitrión hace #include del .ino.
+ *
+ * @see bluefruit.h
+ */
+
+#ifndef ANFITRION_ARDUINO_H_INCLUIDO
+#define ANFITRION_ARDUINO_H_INCLUIDO
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ANFITRION 1
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+typedef uint32_t err_t;
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+namespace Anfitrion {
+
+  /**
+   * @enum Llamada
+   * @brief Llamadas a la API de la placa que se cuentan.
+   */
+  enum Llamada {
+    BLUEFRUIT_BEGIN,
+    BLUEFRUIT_SET_TX_POWER,
+    BLUEFRUIT_SET_NAME,
+    ADV_START,
+    ADV_STOP,
+    ADV_IS_RUNNING,
+    ADV_SET_BEACON,
+    ADV_ADD_DATA,
+    ADV_ADD_FLAGS,
+    ADV_ADD_NAME,
+    ADV_ADD_SERVICE,
+    ADV_CLEAR_DATA,
+    ADV_SET_DATA,
+    ADV_SET_INTERVAL,
+    ADV_SET_FAST_TIMEOUT,
+    ADV_RESTART_ON_DISCONNECT,
+    SCAN_RESPONSE,
+    BEACON_CREAR,
+    SERVICIO_BEGIN,
+    CARACTERISTICA_BEGIN,
+    CARACTERISTICA_CONFIGURAR,
+    CARACTERISTICA_WRITE,
+    CARACTERISTICA_NOTIFY,
+    PERIPH_CALLBACK,
+    BLUEFRUIT_CONFIGURAR,
+    CONEXION_PETICION,
+    SD_ADV_SET_CONFIGURE,
+    SD_ADV_START,
+    SD_ADV_STOP,
+    SERIE_ESCRITURA,
+    PIN_ESCRITURA,
+    DELAY,
+    NUM_LLAMADAS
+  };
+
+  /**
+   * @brief Nombre legible de una llamada.
+   */
+  const char* nombreLlamada(int i) {
+    static const char* const nombres[NUM_LLAMADAS] = {
+      "Bluefruit.begin", "Bluefruit.setTxPower", "Bluefruit.setName",
+      "Advertising.start", "Advertising.stop", "Advertising.isRunning",
+      "Advertising.setBeacon", "Advertising.addData", "Advertising.addFlags",
+      "Advertising.addName", "Advertising.addService", "Advertising.clearData",
+      "Advertising.setData", "Advertising.setInterval", "Advertising.setFastTimeout",
+      "Advertising.restartOnDisconnect", "ScanResponse.*", "BLEBeacon()",
+      "BLEService.begin", "BLECharacteristic.begin", "BLECharacteristic.set*",
+      "BLECharacteristic.write", "BLECharacteristic.notify", "Periph.set*Callback",
+      "Bluefruit.config*", "BLEConnection.request*",
+      "sd_ble_gap_adv_set_configure", "sd_ble_gap_adv_start", "sd_ble_gap_adv_stop",
+      "Serial.print/write", "digitalWrite", "delay"
+    };
+    return (i >= 0 && i < NUM_LLAMADAS) ? nombres[i] : "?";
+  }  // ()
+
+  /**
+   * @struct Contadores
+   * @brief Lo que ha costado (en llamadas, bytes y tiempo virtual) lo ejecutado.
+   */
+  struct Contadores {
+    uint32_t llamadas[NUM_LLAMADAS];  ///< Veces que se ha llamado a cada función.
+    uint32_t bytesAnuncio;            ///< Bytes de carga entregados al anunciante.
+    uint32_t bytesAire;               ///< Bytes emitidos (carga x eventos de anuncio).
+    uint32_t eventosAnuncio;          ///< Eventos de anuncio emitidos.
+    uint32_t paquetesAire;            ///< Paquetes emitidos (cada uno con su arranque de la radio).
+    uint32_t bytesNotificados;        ///< Bytes enviados con write()/notify().
+    uint32_t bytesSerie;              ///< Bytes escritos en Serial.
+    uint32_t paginasFlashBorradas;    ///< Páginas de flash borradas (flash/flash_nrf5x.h).
+    uint32_t bytesFlashEscritos;      ///< Bytes de flash programados.
+    uint64_t tiempoRadioUs;           ///< Tiempo con el anunciante encendido.
+    uint64_t tiempoTransmisionUs;     ///< Tiempo emitiendo de verdad (todos los paquetes, a su PHY).
+    uint64_t tiempoEsperaUs;          ///< Tiempo pasado dentro de delay().
+    uint64_t tiempoSuspendidoUs;      ///< Tiempo con loop() suspendido y ninguna tarea lista.
+    uint64_t tiempoFlashUs;           ///< Tiempo bloqueado borrando y programando flash.
+    uint32_t disparosTemporizador;    ///< Callbacks de SoftwareTimer llamados.
+
+    /**
+     * @brief Pone todo a cero.
+     */
+    void reiniciar() {
+      memset(this, 0, sizeof(*this));
+    }  // ()
+
+    /**
+     * @brief Carga gastada por la radio al emitir: CORRIENTE_TX_MA durante
+     * cada paquete y su arranque.
+     * @return uC.
+     */
+    double cargaRadioUc() const;
+
+    /**
+     * @brief Total de llamadas a la API (sin contar delay()).
+     */
+    uint32_t totalLlamadas() const {
+      uint32_t t = 0;
+      for (int i = 0; i < NUM_LLAMADAS; i++) {
+        if (i != DELAY) {
+          t += llamadas[i];
+        }
+      }
+      return t;
+    }  // ()
+  };   // struct
+
+  Contadores contadores = {};  ///< Contadores globales del sustituto.
+
+  //
+  // consumo de la radio del nRF52840 (hoja de datos, con el DC/DC)
+  //
+  const double CORRIENTE_TX_MA = 9.6;     ///< Emitiendo a +4 dBm (el txPower de la emisora).
+  const uint32_t ARRANQUE_RADIO_US = 40;  ///< Rampa antes de cada paquete, con la misma corriente.
+
+  double Contadores::cargaRadioUc() const {
+    return (tiempoTransmisionUs + (uint64_t)paquetesAire * ARRANQUE_RADIO_US) * CORRIENTE_TX_MA / 1000.0;
+  }  // ()
+
+  uint64_t relojUs = 0;  ///< Reloj virtual en microsegundos.
+
+  bool ecoSerie = true;  ///< Si se copia a stdout lo que se escribe en Serial.
+
+  const char* entradaSerie = "";  ///< Lo que leerá Serial.read(), como si lo hubieran tecleado.
+
+  /**
+   * @brief Anota una llamada.
+   */
+  inline void anotar(Llamada ll) {
+    contadores.llamadas[ll]++;
+  }  // ()
+
+  /**
+   * @brief Avanza el reloj virtual.
+   * @param us Microsegundos.
+   */
+  inline void avanzarReloj(uint64_t us) {
+    relojUs += us;
+  }  // ()
+
+  /**
+   * @brief Escribe en f un resumen de los contadores.
+   * @param f Fichero destino (stdout, por ejemplo).
+   */
+  void volcarContadores(FILE* f) {
+    for (int i = 0; i < NUM_LLAMADAS; i++) {
+      if (contadores.llamadas[i] != 0) {
+        fprintf(f, "  %-34s %8u\n", nombreLlamada(i), (unsigned)contadores.llamadas[i]);
+      }
+    }
+    fprintf(f, "  %-34s %8u\n", "llamadas (total)", (unsigned)contadores.totalLlamadas());
+    fprintf(f, "  %-34s %8u\n", "bytes anuncio", (unsigned)contadores.bytesAnuncio);
+    fprintf(f, "  %-34s %8u\n", "eventos anuncio", (unsigned)contadores.eventosAnuncio);
+    fprintf(f, "  %-34s %8u\n", "bytes en el aire", (unsigned)contadores.bytesAire);
+    fprintf(f, "  %-34s %8u\n", "bytes notificados", (unsigned)contadores.bytesNotificados);
+    fprintf(f, "  %-34s %8u\n", "bytes serie", (unsigned)contadores.bytesSerie);
+    fprintf(f, "  %-34s %8u\n", "borrados de flash (paginas)", (unsigned)contadores.paginasFlashBorradas);
+    fprintf(f, "  %-34s %8u\n", "bytes escritos en flash", (unsigned)contadores.bytesFlashEscritos);
+    fprintf(f, "  %-34s %8.3f\n", "radio encendida (ms)", contadores.tiempoRadioUs / 1000.0);
+    fprintf(f, "  %-34s %8u\n", "paquetes en el aire", (unsigned)contadores.paquetesAire);
+    fprintf(f, "  %-34s %8.3f\n", "transmitiendo (ms)", contadores.tiempoTransmisionUs / 1000.0);
+    fprintf(f, "  %-34s %8.3f\n", "carga radio (uC)", contadores.cargaRadioUc());
+    fprintf(f, "  %-34s %8.3f\n", "en delay() (ms)", contadores.tiempoEsperaUs / 1000.0);
+    fprintf(f, "  %-34s %8.3f\n", "loop() suspendido (ms)", contadores.tiempoSuspendidoUs / 1000.0);
+    fprintf(f, "  %-34s %8u\n", "disparos de SoftwareTimer", (unsigned)contadores.disparosTemporizador);
+    fprintf(f, "  %-34s %8.3f\n", "bloqueado en la flash (ms)", contadores.tiempoFlashUs / 1000.0);
+  }  // ()
+
+};  // namespace
+
+#include "FreeRTOS.h"
+
+// ----------------------------------------------------------
+// tiempo
+// ----------------------------------------------------------
+inline unsigned long millis() {
+  return (unsigned long)(Anfitrion::relojUs / 1000);
+}  // ()
+
+inline unsigned long micros() {
+  return (unsigned long)Anfitrion::relojUs;
+}  // ()
+
+/**
+ * @brief En el hilo principal avanza el reloj; en una tarea, como en la
+ * placa, es vTaskDelay(): se bloquea y las demás siguen.
+ */
+inline void delay(unsigned long ms) {
+  Anfitrion::anotar(Anfitrion::DELAY);
+  Anfitrion::contadores.tiempoEsperaUs += (uint64_t)ms * 1000;
+  Anfitrion::bloquear((uint64_t)ms * 1000);
+}  // ()
+
+inline void delayMicroseconds(unsigned int us) {
+  Anfitrion::contadores.tiempoEsperaUs += us;
+  Anfitrion::avanzarReloj(us);
+}  // ()
+
+inline void yield() {
+}  // ()
+
+// ----------------------------------------------------------
+// loop() suspendido y temporizadores (FreeRTOS en la placa)
+// ----------------------------------------------------------
+typedef void* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+class SoftwareTimer;
+
+namespace Anfitrion {
+  bool loopSuspendido = false;
+
+  const int MAX_TEMPORIZADORES = 8;
+  SoftwareTimer* losTemporizadores[MAX_TEMPORIZADORES];  ///< Los que han hecho begin().
+  int numTemporizadores = 0;
+};
+
+inline void suspendLoop() {
+  Anfitrion::loopSuspendido = true;
+}  // ()
+
+inline void resumeLoop() {
+  Anfitrion::loopSuspendido = false;
+}  // ()
+
+/**
+ * @class SoftwareTimer
+ * @brief Imitación del de Adafruit: llama al callback cuando vence, en el reloj virtual.
+ *
+ * Como xTimerChangePeriod(), setPeriod() también lo pone en marcha.
+ */
+class SoftwareTimer {
+private:
+  TimerCallbackFunction_t callback;
+  void* id;
+  uint64_t periodoUs;
+  bool repetir;
+
+public:
+  bool activo;
+  uint64_t venceUs;  ///< Cuándo (reloj virtual) toca llamar al callback.
+
+  SoftwareTimer()
+    : callback(NULL), id(NULL), periodoUs(0), repetir(false), activo(false), venceUs(0) {
+  }  // ()
+
+  void begin(uint32_t ms, TimerCallbackFunction_t cb, void* timerID = NULL, bool repeating = true) {
+    (*this).callback = cb;
+    (*this).id = timerID;
+    (*this).periodoUs = (uint64_t)ms * 1000;
+    (*this).repetir = repeating;
+    if (Anfitrion::numTemporizadores < Anfitrion::MAX_TEMPORIZADORES) {
+      Anfitrion::losTemporizadores[Anfitrion::numTemporizadores++] = this;
+    }
+  }  // ()
+
+  TimerHandle_t getHandle() {
+    return this;
+  }  // ()
+
+  void* getID() {
+    return (*this).id;
+  }  // ()
+
+  void start() {
+    (*this).activo = true;
+    (*this).venceUs = Anfitrion::relojUs + (*this).periodoUs;
+  }  // ()
+
+  void stop() {
+    (*this).activo = false;
+  }  // ()
+
+  void reset() {
+    (*this).start();
+  }  // ()
+
+  void setPeriod(uint32_t ms) {
+    (*this).periodoUs = (uint64_t)ms * 1000;
+    (*this).start();
+  }  // ()
+
+  /**
+   * @brief Ha vencido: llama al callback y, si repite, vuelve a empezar.
+   */
+  void disparar() {
+    if ((*this).repetir) {
+      (*this).venceUs += (*this).periodoUs;
+    } else {
+      (*this).activo = false;
+    }
+    Anfitrion::contadores.disparosTemporizador++;
+    if ((*this).callback != NULL) {
+      (*this).callback(this);
+    }
+  }  // ()
+};  // class
+
+void loop();
+
+namespace Anfitrion {
+
+  /**
+   * @brief Lo que hace el núcleo una vez: correr una tarea lista hasta que
+   * se bloquee o llamar a loop(). Si no hay nada que hacer, dormir hasta el
+   * siguiente plazo: despertar a la tarea o disparar el SoftwareTimer.
+   * @return false si no hay nada listo ni ningún plazo: no se despertaría nunca.
+   */
+  inline bool unaVuelta() {
+    if (ejecutarTareaLista()) {
+      return true;
+    }
+
+    if (!loopSuspendido) {
+      loop();
+      return true;
+    }
+
+    SoftwareTimer* siguiente = NULL;
+    for (int i = 0; i < numTemporizadores; i++) {
+      SoftwareTimer* t = losTemporizadores[i];
+      if (t->activo && (siguiente == NULL || t->venceUs < siguiente->venceUs)) {
+        siguiente = t;
+      }
+    }
+    TareaRTOS* tarea = siguientePlazo();
+    if (siguiente == NULL && tarea == NULL) {
+      return false;
+    }
+
+    uint64_t cuando = (siguiente == NULL || (tarea != NULL && tarea->despiertaUs < siguiente->venceUs))
+                      ? tarea->despiertaUs
+                      : siguiente->venceUs;
+    if (cuando > relojUs) {
+      contadores.tiempoSuspendidoUs += cuando - relojUs;
+      relojUs = cuando;
+    }
+    if (siguiente != NULL && siguiente->venceUs <= relojUs) {
+      siguiente->disparar();
+    }
+    return true;  // las tareas que han llegado a su plazo, en la siguiente vuelta
+  }  // ()
+
+};  // namespace
+
+// ----------------------------------------------------------
+// pines
+// ----------------------------------------------------------
+namespace Anfitrion {
+  uint8_t pines[64] = {};  ///< Último valor escrito en cada pin.
+};
+
+inline void pinMode(uint32_t, uint32_t) {
+}  // ()
+
+inline void digitalWrite(uint32_t pin, uint32_t valor) {
+  Anfitrion::anotar(Anfitrion::PIN_ESCRITURA);
+  Anfitrion::pines[pin & 63] = (uint8_t)valor;
+}  // ()
+
+inline int digitalRead(uint32_t pin) {
+  return Anfitrion::pines[pin & 63];
+}  // ()
+
+// ----------------------------------------------------------
+// Serial
+// ----------------------------------------------------------
+
+/**
+ * @class SerieAnfitrion
+ * @brief Imitación de Serial: cuenta bytes y, si Anfitrion::ecoSerie, los saca por stdout.
+ */
+class SerieAnfitrion {
+private:
+
+  size_t escribirBytes(const char* p, size_t n) {
+    Anfitrion::anotar(Anfitrion::SERIE_ESCRITURA);
+    Anfitrion::contadores.bytesSerie += n;
+    if (Anfitrion::ecoSerie) {
+      fwrite(p, 1, n, stdout);
+    }
+    return n;
+  }  // ()
+
+public:
+
+  void begin(unsigned long) {
+  }  // ()
+
+  operator bool() const {
+    return true;
+  }  // ()
+
+  int availableForWrite() {
+    return 64;
+  }  // ()
+
+  int available() {
+    return (int)strlen(Anfitrion::entradaSerie);
+  }  // ()
+
+  int read() {
+    if (*Anfitrion::entradaSerie == '\0') {
+      return -1;
+    }
+    return *Anfitrion::entradaSerie++;
+  }  // ()
+
+  void flush() {
+  }  // ()
+
+  size_t write(uint8_t c) {
+    return escribirBytes((const char*)&c, 1);
+  }  // ()
+
+  size_t write(const uint8_t* p, size_t n) {
+    return escribirBytes((const char*)p, n);
+  }  // ()
+
+  size_t print(const char* s) {
+    return escribirBytes(s, strlen(s));
+  }  // ()
+
+  size_t print(char c) {
+    return escribirBytes(&c, 1);
+  }  // ()
+
+  size_t print(long n) {
+    char buf[24];
+    int l = snprintf(buf, sizeof(buf), "%ld", n);
+    return escribirBytes(buf, l);
+  }  // ()
+
+  size_t print(unsigned long n) {
+    char buf[24];
+    int l = snprintf(buf, sizeof(buf), "%lu", n);
+    return escribirBytes(buf, l);
+  }  // ()
+
+  size_t print(int n) {
+    return print((long)n);
+  }  // ()
+
+  size_t print(unsigned int n) {
+    return print((unsigned long)n);
+  }  // ()
+
+  size_t print(unsigned char n) {
+    return print((unsigned long)n);
+  }  // ()
+
+  size_t print(short n) {
+    return print((long)n);
+  }  // ()
+
+  size_t print(unsigned short n) {
+    return print((unsigned long)n);
+  }  // ()
+
+  size_t print(double d) {
+    char buf[32];
+    int l = snprintf(buf, sizeof(buf), "%.2f", d);
+    return escribirBytes(buf, l);
+  }  // ()
+
+  template<typename T>
+  size_t println(T v) {
+    size_t n = print(v);
+    return n + escribirBytes("\r\n", 2);
+  }  // ()
+
+  size_t println() {
+    return escribirBytes("\r\n", 2);
+  }  // ()
+
+};  // class
+
+SerieAnfitrion Serial;
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
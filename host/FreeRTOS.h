@@ -0,0 +1,497 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file FreeRTOS.h
+ * @brief Sustituto para el ordenador (host) de las tareas, colas y notificaciones de FreeRTOS, con hilos POSIX.
+ * @author Sento Marcos Ibarra
+ *
+ * Cada tarea (xTaskCreateStatic()) es un hilo, pero sólo corre uno a la
+ * vez, como en la CPU de la placa: el que tiene el turno. Una tarea lo
+ * devuelve al bloquearse (vTaskDelayUntil(), vTaskDelay() o delay(), una
+ * cola vacía o llena, ulTaskNotifyTake() sin notificaciones) y Anfitrion::unaVuelta() se lo da a la tarea lista
+ * de más prioridad (entre iguales, a la que lleva más tiempo lista). Si no
+ * hay ninguna ni loop() tiene nada que hacer, adelanta el reloj virtual
+ * hasta el primer plazo: de una tarea o de un SoftwareTimer.
+ *
+ * Lo que no imita:
+ *
+ *  - el código no gasta tiempo virtual. Una tarea sólo se retrasa si el
+ *    hilo principal (setup() y loop(), la tarea de loop() en la placa) se
+ *    queda en delay() o en Anfitrion::bloquear(): eso adelanta el reloj con
+ *    todo parado
+ *  - no hay más expropiación que la de enviar a una cola o notificar: si
+ *    despierta a una tarea de más prioridad, la que envía le cede el turno
+ *    enseguida
+ *  - las tareas listas van antes que loop(), tengan la prioridad que tengan
+ *  - taskENTER_CRITICAL() y vTaskSuspendAll() no hacen nada: no hace falta
+ *
+ * El tic es de 1/1024 s, el configTICK_RATE_HZ del núcleo de Adafruit.
+ *
+ * Hay que compilar con -pthread.
+ *
+ * @see Arduino.h
+ */
+
+#ifndef ANFITRION_FREERTOS_H_INCLUIDO
+#define ANFITRION_FREERTOS_H_INCLUIDO
+
+#include <pthread.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t StackType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+#define configTICK_RATE_HZ 1024
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000))
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+/**
+ * @brief Las del núcleo de Adafruit (rtos.h): loop() va en TASK_PRIO_LOW.
+ */
+enum {
+  TASK_PRIO_LOWEST = 0,
+  TASK_PRIO_LOW = 1,
+  TASK_PRIO_NORMAL = 2,
+  TASK_PRIO_HIGH = 3,
+  TASK_PRIO_HIGHEST = 4
+};
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+namespace Anfitrion {
+
+  /**
+   * @struct TareaRTOS
+   * @brief Lo que en FreeRTOS es el TCB: aquí, el hilo y su estado.
+   */
+  struct TareaRTOS {
+    enum Estado {
+      LISTA,
+      CORRIENDO,
+      DORMIDA,     ///< Hasta despiertaUs.
+      ESPERANDO,   ///< A que cambie cola (o, si es ella misma, a una notificación; y, si conPlazo, como mucho hasta despiertaUs).
+      ACABADA
+    };
+
+    pthread_t hilo;
+    TaskFunction_t funcion;
+    void* parametro;
+    const char* nombre;
+    UBaseType_t prioridad;
+    Estado estado;
+    bool conPlazo;
+    uint64_t despiertaUs;
+    const void* cola;
+    uint32_t notificaciones;  ///< Las de xTaskNotifyGive() que no ha recogido.
+    uint32_t ordenLista;  ///< Cuándo se quedó lista: entre iguales, la primera.
+    uint32_t turnos;      ///< Veces que ha corrido.
+  };
+
+  /**
+   * @struct ColaRTOS
+   * @brief Una cola circular de elementos de tamanyo bytes, en el almacén del usuario.
+   */
+  struct ColaRTOS {
+    uint8_t* almacen;
+    UBaseType_t longitud;
+    UBaseType_t tamanyo;
+    UBaseType_t primero;
+    UBaseType_t cuantos;
+  };
+
+};  // namespace
+
+typedef Anfitrion::TareaRTOS StaticTask_t;
+typedef Anfitrion::TareaRTOS* TaskHandle_t;
+typedef Anfitrion::ColaRTOS StaticQueue_t;
+typedef Anfitrion::ColaRTOS* QueueHandle_t;
+
+namespace Anfitrion {
+
+  pthread_mutex_t elNucleo = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cambioTurno = PTHREAD_COND_INITIALIZER;
+
+  TareaRTOS* elTurno = NULL;  ///< La tarea que corre; NULL, el hilo principal.
+
+  const int MAX_TAREAS_RTOS = 8;
+  TareaRTOS* lasTareasRTOS[MAX_TAREAS_RTOS];
+  int numTareasRTOS = 0;
+  uint32_t siguienteOrdenLista = 0;
+
+  /**
+   * @brief La tarea que está corriendo, o NULL en el hilo principal.
+   */
+  inline TareaRTOS* tareaEnCurso() {
+    return elTurno;
+  }  // ()
+
+  // .........................................................
+  // tics: los de FreeRTOS, sobre el reloj virtual
+  // .........................................................
+  inline uint64_t ticActual() {
+    return relojUs * configTICK_RATE_HZ / 1000000;
+  }  // ()
+
+  inline uint64_t usDeTic(uint64_t tic) {
+    return (tic * 1000000 + configTICK_RATE_HZ - 1) / configTICK_RATE_HZ;
+  }  // ()
+
+  // .........................................................
+  // el turno (con elNucleo cogido)
+  // .........................................................
+  inline void darTurno(TareaRTOS* t) {
+    elTurno = t;
+    pthread_cond_broadcast(&cambioTurno);
+  }  // ()
+
+  inline void esperarTurno(TareaRTOS* yo) {
+    while (elTurno != yo) {
+      pthread_cond_wait(&cambioTurno, &elNucleo);
+    }
+  }  // ()
+
+  inline void ponerLista(TareaRTOS* t) {
+    t->estado = TareaRTOS::LISTA;
+    t->ordenLista = siguienteOrdenLista++;
+  }  // ()
+
+  /**
+   * @brief En una tarea, con el estado ya puesto: devuelve el turno al hilo
+   * principal y espera a que se lo vuelvan a dar.
+   */
+  inline void soltarCPU(TareaRTOS* yo) {
+    pthread_mutex_lock(&elNucleo);
+    darTurno(NULL);
+    esperarTurno(yo);
+    yo->estado = TareaRTOS::CORRIENDO;
+    pthread_mutex_unlock(&elNucleo);
+  }  // ()
+
+  /**
+   * @brief La lista de más prioridad, o NULL.
+   */
+  inline TareaRTOS* siguienteLista() {
+    TareaRTOS* elegida = NULL;
+    for (int i = 0; i < numTareasRTOS; i++) {
+      TareaRTOS* t = lasTareasRTOS[i];
+      if (t->estado != TareaRTOS::LISTA) {
+        continue;
+      }
+      if (elegida == NULL || t->prioridad > elegida->prioridad
+          || (t->prioridad == elegida->prioridad && (int32_t)(t->ordenLista - elegida->ordenLista) < 0)) {
+        elegida = t;
+      }
+    }
+    return elegida;
+  }  // ()
+
+  /**
+   * @brief La bloqueada con el plazo más cercano, o NULL.
+   */
+  inline TareaRTOS* siguientePlazo() {
+    TareaRTOS* elegida = NULL;
+    for (int i = 0; i < numTareasRTOS; i++) {
+      TareaRTOS* t = lasTareasRTOS[i];
+      if ((t->estado == TareaRTOS::DORMIDA || t->estado == TareaRTOS::ESPERANDO) && t->conPlazo
+          && (elegida == NULL || t->despiertaUs < elegida->despiertaUs)) {
+        elegida = t;
+      }
+    }
+    return elegida;
+  }  // ()
+
+  /**
+   * @brief Pone listas las que han llegado a su plazo.
+   */
+  inline void despertarVencidas() {
+    for (int i = 0; i < numTareasRTOS; i++) {
+      TareaRTOS* t = lasTareasRTOS[i];
+      if ((t->estado == TareaRTOS::DORMIDA || t->estado == TareaRTOS::ESPERANDO) && t->conPlazo
+          && t->despiertaUs <= relojUs) {
+        ponerLista(t);
+      }
+    }
+  }  // ()
+
+  /**
+   * @brief Pone listas las que esperan a la cola c (a que llegue algo o a que haya sitio).
+   */
+  inline void despertarCola(const void* c) {
+    for (int i = 0; i < numTareasRTOS; i++) {
+      TareaRTOS* t = lasTareasRTOS[i];
+      if (t->estado == TareaRTOS::ESPERANDO && t->cola == c) {
+        ponerLista(t);
+      }
+    }
+  }  // ()
+
+  /**
+   * @brief En una tarea: si hay otra lista de más prioridad, le cede el turno.
+   */
+  inline void cederSiHayOtraMejor() {
+    TareaRTOS* yo = tareaEnCurso();
+    if (yo == NULL) {
+      return;
+    }
+    TareaRTOS* otra = siguienteLista();
+    if (otra != NULL && otra->prioridad > yo->prioridad) {
+      ponerLista(yo);
+      soltarCPU(yo);
+    }
+  }  // ()
+
+  /**
+   * @brief En una tarea: se duerme hasta us (reloj virtual). En el hilo
+   * principal: adelanta el reloj hasta ahí.
+   */
+  inline void dormirHasta(uint64_t us) {
+    TareaRTOS* yo = tareaEnCurso();
+    if (yo == NULL) {
+      if (us > relojUs) {
+        relojUs = us;
+      }
+      return;
+    }
+    yo->estado = TareaRTOS::DORMIDA;
+    yo->conPlazo = true;
+    yo->despiertaUs = us;
+    yo->cola = NULL;
+    soltarCPU(yo);
+  }  // ()
+
+  /**
+   * @brief Una operación lenta de un periférico, que no usa la CPU (borrar
+   * flash, p.ej.): la tarea que llama se queda bloqueada us y las demás
+   * siguen. En el hilo principal, como delay(): se para todo.
+   */
+  inline void bloquear(uint64_t us) {
+    dormirHasta(relojUs + us);
+  }  // ()
+
+  // .........................................................
+  // el hilo de una tarea
+  // .........................................................
+  inline void* arrancarTarea(void* p) {
+    TareaRTOS* yo = (TareaRTOS*)p;
+
+    pthread_mutex_lock(&elNucleo);
+    esperarTurno(yo);
+    yo->estado = TareaRTOS::CORRIENDO;
+    pthread_mutex_unlock(&elNucleo);
+
+    yo->funcion(yo->parametro);
+
+    // en FreeRTOS una tarea no puede volver; aquí se queda acabada
+    pthread_mutex_lock(&elNucleo);
+    yo->estado = TareaRTOS::ACABADA;
+    darTurno(NULL);
+    pthread_mutex_unlock(&elNucleo);
+    return NULL;
+  }  // ()
+
+  /**
+   * @brief En el hilo principal: si hay una tarea lista, la corre hasta que
+   * se bloquee.
+   * @return false si no había ninguna.
+   */
+  inline bool ejecutarTareaLista() {
+    despertarVencidas();
+    TareaRTOS* t = siguienteLista();
+    if (t == NULL) {
+      return false;
+    }
+    t->turnos++;
+    pthread_mutex_lock(&elNucleo);
+    darTurno(t);
+    esperarTurno(NULL);
+    pthread_mutex_unlock(&elNucleo);
+    return true;
+  }  // ()
+
+  /**
+   * @brief Escribe en f los turnos de cada tarea.
+   */
+  void volcarTareas(FILE* f) {
+    for (int i = 0; i < numTareasRTOS; i++) {
+      fprintf(f, "  tarea %-28s %8u\n", lasTareasRTOS[i]->nombre, (unsigned)lasTareasRTOS[i]->turnos);
+    }
+  }  // ()
+
+};  // namespace
+
+// ----------------------------------------------------------
+// tareas
+// ----------------------------------------------------------
+inline TaskHandle_t xTaskCreateStatic(TaskFunction_t funcion, const char* nombre,
+                                      uint32_t /* palabras de pila */, void* parametro,
+                                      UBaseType_t prioridad, StackType_t* /* pila */,
+                                      StaticTask_t* tcb) {
+  using namespace Anfitrion;
+  if (numTareasRTOS >= MAX_TAREAS_RTOS) {
+    return NULL;
+  }
+  tcb->funcion = funcion;
+  tcb->parametro = parametro;
+  tcb->nombre = nombre;
+  tcb->prioridad = prioridad;
+  tcb->conPlazo = false;
+  tcb->despiertaUs = 0;
+  tcb->cola = NULL;
+  tcb->notificaciones = 0;
+  tcb->turnos = 0;
+  ponerLista(tcb);
+  if (pthread_create(&tcb->hilo, NULL, arrancarTarea, tcb) != 0) {
+    return NULL;
+  }
+  lasTareasRTOS[numTareasRTOS++] = tcb;
+  return tcb;
+}  // ()
+
+/**
+ * @brief La tarea que está corriendo; NULL en el hilo principal.
+ */
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return Anfitrion::tareaEnCurso();
+}  // ()
+
+inline TickType_t xTaskGetTickCount() {
+  return (TickType_t)Anfitrion::ticActual();
+}  // ()
+
+inline void vTaskDelay(TickType_t tics) {
+  Anfitrion::dormirHasta(Anfitrion::usDeTic(Anfitrion::ticActual() + tics));
+}  // ()
+
+/**
+ * @brief Como en FreeRTOS: si el plazo ya ha pasado, vuelve sin bloquearse.
+ */
+inline void vTaskDelayUntil(TickType_t* anterior, TickType_t incremento) {
+  uint64_t ahora = Anfitrion::ticActual();
+  *anterior += incremento;
+  int32_t falta = (int32_t)(*anterior - (TickType_t)ahora);
+  if (falta > 0) {
+    Anfitrion::dormirHasta(Anfitrion::usDeTic(ahora + falta));
+  }
+}  // ()
+
+inline void vTaskSuspendAll() {
+}  // ()
+
+inline BaseType_t xTaskResumeAll() {
+  return pdFALSE;
+}  // ()
+
+// ----------------------------------------------------------
+// colas
+// ----------------------------------------------------------
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t longitud, UBaseType_t tamanyo,
+                                        uint8_t* almacen, StaticQueue_t* cola) {
+  cola->almacen = almacen;
+  cola->longitud = longitud;
+  cola->tamanyo = tamanyo;
+  cola->primero = 0;
+  cola->cuantos = 0;
+  return cola;
+}  // ()
+
+namespace Anfitrion {
+
+  /**
+   * @brief En una tarea: espera a que cambie la cola c o, si espera no es
+   * portMAX_DELAY, a limiteUs.
+   * @return false si ya no se puede esperar más (espera 0, hilo principal o plazo cumplido).
+   */
+  inline bool esperarCola(const void* c, TickType_t espera, uint64_t limiteUs) {
+    TareaRTOS* yo = tareaEnCurso();
+    if (espera == 0 || yo == NULL || (espera != portMAX_DELAY && relojUs >= limiteUs)) {
+      return false;
+    }
+    yo->estado = TareaRTOS::ESPERANDO;
+    yo->cola = c;
+    yo->conPlazo = (espera != portMAX_DELAY);
+    yo->despiertaUs = limiteUs;
+    soltarCPU(yo);
+    return true;
+  }  // ()
+
+};  // namespace
+
+inline BaseType_t xQueueSend(QueueHandle_t c, const void* elemento, TickType_t espera) {
+  using namespace Anfitrion;
+  uint64_t limite = usDeTic(ticActual() + espera);
+  while (c->cuantos >= c->longitud) {
+    if (!esperarCola(c, espera, limite)) {
+      return pdFALSE;  // errQUEUE_FULL
+    }
+  }
+  memcpy(c->almacen + ((c->primero + c->cuantos) % c->longitud) * c->tamanyo, elemento, c->tamanyo);
+  c->cuantos++;
+  despertarCola(c);
+  cederSiHayOtraMejor();
+  return pdTRUE;
+}  // ()
+
+inline BaseType_t xQueueReceive(QueueHandle_t c, void* elemento, TickType_t espera) {
+  using namespace Anfitrion;
+  uint64_t limite = usDeTic(ticActual() + espera);
+  while (c->cuantos == 0) {
+    if (!esperarCola(c, espera, limite)) {
+      return pdFALSE;
+    }
+  }
+  memcpy(elemento, c->almacen + c->primero * c->tamanyo, c->tamanyo);
+  c->primero = (c->primero + 1) % c->longitud;
+  c->cuantos--;
+  despertarCola(c);
+  cederSiHayOtraMejor();
+  return pdTRUE;
+}  // ()
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t c) {
+  return c->cuantos;
+}  // ()
+
+// ----------------------------------------------------------
+// notificaciones (como semáforo contador: Give / Take)
+// ----------------------------------------------------------
+inline BaseType_t xTaskNotifyGive(TaskHandle_t t) {
+  using namespace Anfitrion;
+  t->notificaciones++;
+  despertarCola(t);  // la que espera notificaciones, espera a su propio TCB
+  cederSiHayOtraMejor();
+  return pdPASS;
+}  // ()
+
+inline uint32_t ulTaskNotifyTake(BaseType_t aCero, TickType_t espera) {
+  using namespace Anfitrion;
+  TareaRTOS* yo = tareaEnCurso();
+  if (yo == NULL) {
+    return 0;
+  }
+  uint64_t limite = usDeTic(ticActual() + espera);
+  while (yo->notificaciones == 0) {
+    if (!esperarCola(yo, espera, limite)) {
+      return 0;
+    }
+  }
+  uint32_t habia = yo->notificaciones;
+  yo->notificaciones = (aCero == pdTRUE ? 0 : habia - 1);
+  return habia;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
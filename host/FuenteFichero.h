@@ -0,0 +1,169 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file FuenteFichero.h
+ * @brief FuenteMuestras para el ordenador: reproduce muestras grabadas en un fichero.
+ * @author Sento Marcos Ibarra
+ *
+ * El fichero es texto: enteros separados por espacios o saltos de línea,
+ * entrelazados por canal (un escaneo por línea, por ejemplo). Los bloques
+ * se completan siguiendo el reloj virtual de Arduino.h, al mismo ritmo que
+ * el SAADC en la placa. Al acabarse el fichero vuelve a empezar.
+ *
+ * Si el fichero no se puede abrir, empezar() devuelve false.
+ */
+
+#ifndef ANFITRION_FUENTE_FICHERO_H_INCLUIDO
+#define ANFITRION_FUENTE_FICHERO_H_INCLUIDO
+
+#include <stdio.h>
+
+#include "../FuenteMuestras.h"
+
+/**
+ * @class FuenteFichero
+ * @brief Bloques de muestras leídos de un fichero de texto.
+ */
+class FuenteFichero : public FuenteMuestras {
+
+public:
+
+  static const uint16_t MAX_MUESTRAS_POR_BLOQUE = 1024;
+
+private:
+
+  const char* nombre;
+  uint8_t numCanales;
+  uint16_t escaneosPorBloque;
+  uint16_t frecuencia;
+
+  FILE* elFichero;
+  int16_t elBloque[MAX_MUESTRAS_POR_BLOQUE];
+  uint64_t siguienteBloqueUs;  ///< Cuándo (reloj virtual) se completa el siguiente bloque.
+  bool hayListo;
+  uint32_t perdidos;
+
+  // .........................................................
+  // .........................................................
+  uint16_t muestrasPorBloque() const {
+    return (*this).numCanales * (*this).escaneosPorBloque;
+  }  // ()
+
+  uint64_t periodoBloqueUs() const {
+    return 1000000ULL * (*this).escaneosPorBloque / (*this).frecuencia;
+  }  // ()
+
+  // .........................................................
+  // una muestra; al acabarse el fichero, vuelve a empezar
+  // .........................................................
+  int16_t leerMuestra() {
+    int v;
+    if (fscanf((*this).elFichero, "%d", &v) != 1) {
+      rewind((*this).elFichero);
+      if (fscanf((*this).elFichero, "%d", &v) != 1) {
+        return 0;  // vacío
+      }
+    }
+    return (int16_t)v;
+  }  // ()
+
+public:
+
+  /**
+   * @brief Constructor.
+   * @param nombre_ Fichero de muestras.
+   * @param canales_ Canales de cada escaneo.
+   * @param escaneosPorBloque_ Escaneos de cada bloque.
+   * @param frecuencia_ Escaneos por segundo.
+   */
+  FuenteFichero(const char* nombre_, uint8_t canales_,
+                uint16_t escaneosPorBloque_, uint16_t frecuencia_)
+    : nombre(nombre_), numCanales(canales_), escaneosPorBloque(escaneosPorBloque_),
+      frecuencia(frecuencia_), elFichero(NULL), siguienteBloqueUs(0),
+      hayListo(false), perdidos(0) {
+  }  // ()
+
+  bool empezar() {
+    if ((*this).muestrasPorBloque() > MAX_MUESTRAS_POR_BLOQUE) {
+      return false;
+    }
+    (*this).elFichero = fopen((*this).nombre, "r");
+    if ((*this).elFichero == NULL) {
+      return false;
+    }
+    (*this).siguienteBloqueUs = Anfitrion::relojUs + (*this).periodoBloqueUs();
+    (*this).hayListo = false;
+    return true;
+  }  // ()
+
+  void parar() {
+    if ((*this).elFichero != NULL) {
+      fclose((*this).elFichero);
+      (*this).elFichero = NULL;
+    }
+  }  // ()
+
+  uint8_t canales() const {
+    return (*this).numCanales;
+  }  // ()
+
+  uint32_t periodoBloque() const {
+    return (uint32_t)((*this).periodoBloqueUs() / 1000);
+  }  // ()
+
+  /**
+   * @brief Si ya "ha pasado" el tiempo de un bloque, lo lee del fichero.
+   * Los bloques que se han completado sin que nadie los pidiera, como en
+   * el SAADC, se pierden (y se cuentan).
+   */
+  uint16_t bloqueListo(const int16_t*& muestras) {
+    if ((*this).elFichero == NULL) {
+      return 0;
+    }
+
+    if (!(*this).hayListo && Anfitrion::relojUs >= (*this).siguienteBloqueUs) {
+      // en la placa, los que se han quedado sin leer ya estarían pisados
+      while (Anfitrion::relojUs >= (*this).siguienteBloqueUs + (*this).periodoBloqueUs()) {
+        for (uint16_t i = 0; i < (*this).muestrasPorBloque(); i++) {
+          (*this).leerMuestra();
+        }
+        (*this).siguienteBloqueUs += (*this).periodoBloqueUs();
+        (*this).perdidos++;
+      }
+      for (uint16_t i = 0; i < (*this).muestrasPorBloque(); i++) {
+        (*this).elBloque[i] = (*this).leerMuestra();
+      }
+      (*this).siguienteBloqueUs += (*this).periodoBloqueUs();
+      (*this).hayListo = true;
+    }
+
+    if (!(*this).hayListo) {
+      return 0;
+    }
+    muestras = &(*this).elBloque[0];
+    return (*this).muestrasPorBloque();
+  }  // ()
+
+  void liberarBloque() {
+    (*this).hayListo = false;
+  }  // ()
+
+  uint32_t bloquesPerdidos() const {
+    return (*this).perdidos;
+  }  // ()
+
+  /**
+   * @brief Lo que tardaría el SAADC de FuenteSAADC.h (16 conversiones de
+   * 40 + 2 us por muestra).
+   */
+  uint32_t tiempoConversionBloque() const {
+    return (uint32_t)(*this).muestrasPorBloque() * 16 * (40 + 2);
+  }  // ()
+
+};  // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
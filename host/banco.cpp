@@ -0,0 +1,84 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file banco.cpp
+ * @brief Banco de pruebas en el ordenador: lo que cuesta un ciclo de publicación.
+ * @author Sento Marcos Ibarra
+ *
+ * Publica las mismas mediciones de las dos maneras que tiene el Publicador
+ * (un iBeacon por sensor con publicarSensor(), o todas en una trama con
+ * publicarMediciones()) y escribe, por ciclo, las llamadas a la API de la
+ * placa, los bytes y el tiempo virtual (Anfitrion::contadores).
+ *
+ *   g++ -std=gnu++11 -I host -include Arduino.h -pthread host/banco.cpp -o banco
+ *   ./banco [ciclos]
+ */
+
+#include "../HolaMundoIBeacon.ino"
+
+// ..........................................................
+// ..........................................................
+const long TIEMPO_ANUNCIO = 1000;  ///< ms que dura cada anuncio.
+
+// ..........................................................
+// ..........................................................
+void volcarPorCiclo(const char* que, int ciclos, uint64_t desdeUs) {
+  const Anfitrion::Contadores& c = Anfitrion::contadores;
+  printf("---- %s: %d ciclos\n", que, ciclos);
+  Anfitrion::volcarContadores(stdout);
+  printf("  por ciclo: llamadas=%.1f bytes anuncio=%.1f bytes aire=%.1f"
+         " radio(ms)=%.3f tiempo(ms)=%.1f\n",
+         (double)c.totalLlamadas() / ciclos,
+         (double)c.bytesAnuncio / ciclos,
+         (double)c.bytesAire / ciclos,
+         c.tiempoRadioUs / 1000.0 / ciclos,
+         (Anfitrion::relojUs - desdeUs) / 1000.0 / ciclos);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+int main(int argc, char** argv) {
+  int ciclos = argc > 1 ? atoi(argv[1]) : 100;
+  if (ciclos <= 0) {
+    ciclos = 1;
+  }
+
+  Anfitrion::ecoSerie = false;
+  Publicador< Globales::Sensores >& elPublicador = Globales::elPublicador;
+  elPublicador.encenderEmisora();
+
+  int16_t valores[Globales::Sensores::NUM];
+
+  //
+  // un iBeacon por sensor (CO2 y temperatura, como el loop() de siempre)
+  //
+  Anfitrion::contadores.reiniciar();
+  uint64_t t0 = Anfitrion::relojUs;
+  for (int i = 0; i < ciclos; i++) {
+    valores[0] = (int16_t)(40 + i % 7);
+    valores[1] = -12;
+    elPublicador.publicarSensor(0, valores[0], i, TIEMPO_ANUNCIO);
+    elPublicador.publicarSensor(1, valores[1], i, TIEMPO_ANUNCIO);
+  }
+  volcarPorCiclo("iBeacon por sensor", ciclos, t0);
+
+  //
+  // todas juntas en una trama
+  //
+  Anfitrion::contadores.reiniciar();
+  t0 = Anfitrion::relojUs;
+  for (int i = 0; i < ciclos; i++) {
+    for (uint8_t k = 0; k < Globales::Sensores::NUM; k++) {
+      valores[k] = (int16_t)(k * 100 + i % 7);
+    }
+    elPublicador.publicarMediciones(&valores[0], i, TIEMPO_ANUNCIO);
+  }
+  volcarPorCiclo("trama de mediciones", ciclos, t0);
+
+  return 0;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
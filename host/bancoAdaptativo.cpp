@@ -0,0 +1,185 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file bancoAdaptativo.cpp
+ * @brief Banco de pruebas en el ordenador: publicación fija frente a adaptativa sobre una traza.
+ * @author Sento Marcos Ibarra
+ *
+ * Pasa la misma traza de mediciones (una línea por ciclo de 4 s: CO2,
+ * temperatura y ruido, enteros) por las dos maneras de publicar:
+ *
+ *  - fija: la trama de cada ciclo se anuncia 2 s al intervalo por defecto
+ *    de la emisora (62.5 ms), como antes
+ *  - adaptativa: Publicador::publicarSiCambia() y acabarRafaga()
+ *
+ * y escribe los eventos de anuncio, el tiempo transmitiendo y el retraso
+ * de las actualizaciones: desde que una medición sale de la banda muerta
+ * de lo que hay en el aire hasta el primer evento de anuncio que la lleva
+ * (el intervalo en ese momento, en el peor caso) y, en la adaptativa,
+ * los ciclos con un cambio que no ha salido por quedarse en la banda.
+ * "anunciando" es el tiempo con el anunciante en marcha; lo que gasta es
+ * "transmitiendo" (Anfitrion::contadores).
+ *
+ *   g++ -std=gnu++11 -I host -include Arduino.h -pthread host/bancoAdaptativo.cpp -o bancoAdaptativo
+ *   ./bancoAdaptativo [traza.txt]
+ *
+ * Sin traza usa una de 1 h parecida a las grabadas: CO2 400 con ruido de
+ * +-3 y un escalón de +50 cada 10 min, temperatura 21 y ruido 45 +-1.
+ */
+
+#include "../HolaMundoIBeacon.ino"
+
+// ..........................................................
+// ..........................................................
+const uint32_t CICLO = 4000;              ///< ms.
+const uint32_t ANUNCIO_FIJO = 2000;       ///< ms anunciando en cada ciclo, en la fija.
+const uint16_t INTERVALO_FIJO = EmisoraBLE::INTERVALO_ANUNCIO;
+const int MAX_CICLOS = 86400 / 4;         ///< Un día.
+
+int16_t laTraza[MAX_CICLOS][3];
+int ciclos = 0;
+
+// ..........................................................
+// ..........................................................
+void trazaSintetica() {
+  for (ciclos = 0; ciclos < 900; ciclos++) {
+    laTraza[ciclos][0] = (int16_t)(400 + 50 * ((ciclos / 150) % 2) + (ciclos * 7919) % 7 - 3);
+    laTraza[ciclos][1] = 21;
+    laTraza[ciclos][2] = (int16_t)(45 + ciclos % 3 - 1);
+  }
+}  // ()
+
+// ..........................................................
+// ..........................................................
+bool leerTraza(const char* nombre) {
+  FILE* f = fopen(nombre, "r");
+  if (f == NULL) {
+    return false;
+  }
+  int a, b, c;
+  ciclos = 0;
+  while (ciclos < MAX_CICLOS && fscanf(f, "%d %d %d", &a, &b, &c) == 3) {
+    laTraza[ciclos][0] = (int16_t)a;
+    laTraza[ciclos][1] = (int16_t)b;
+    laTraza[ciclos][2] = (int16_t)c;
+    ciclos++;
+  }
+  fclose(f);
+  return ciclos > 0;
+}  // ()
+
+// ..........................................................
+// ..........................................................
+struct Resultado {
+  uint32_t eventos;
+  double transmitiendoMs;
+  double anunciandoMs;
+  uint32_t actualizaciones;  ///< Ciclos que cambian lo que hay en el aire.
+  double retrasoTotalMs;
+  double retrasoMaximoMs;
+  uint32_t enBanda;          ///< Ciclos con algún valor distinto que no han salido.
+};
+
+// ..........................................................
+// ..........................................................
+void escribir(const char* que, const Resultado& r) {
+  printf("%-11s eventos=%6u transmitiendo(ms)=%8.1f anunciando(ms)=%9.0f"
+         " actualizaciones=%4u retraso(ms) medio=%6.1f max=%6.1f en banda=%u\n",
+         que, r.eventos, r.transmitiendoMs, r.anunciandoMs, r.actualizaciones,
+         r.actualizaciones ? r.retrasoTotalMs / r.actualizaciones : 0.0,
+         r.retrasoMaximoMs, r.enBanda);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void anotarRetraso(Resultado& r, uint16_t intervalo) {
+  double ms = intervalo * 0.625;
+  r.actualizaciones++;
+  r.retrasoTotalMs += ms;
+  if (ms > r.retrasoMaximoMs) {
+    r.retrasoMaximoMs = ms;
+  }
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void cerrar(Resultado& r) {
+  r.eventos = Anfitrion::contadores.eventosAnuncio;
+  r.transmitiendoMs = Anfitrion::contadores.tiempoTransmisionUs / 1000.0;
+  r.anunciandoMs = Anfitrion::contadores.tiempoRadioUs / 1000.0;
+}  // ()
+
+// ..........................................................
+// ..........................................................
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    if (!leerTraza(argv[1])) {
+      fprintf(stderr, "no se puede leer %s\n", argv[1]);
+      return 1;
+    }
+  } else {
+    trazaSintetica();
+  }
+
+  Anfitrion::ecoSerie = false;
+  Publicador< Globales::Sensores >& elPublicador = Globales::elPublicador;
+  elPublicador.encenderEmisora();
+
+  //
+  // fija
+  //
+  Resultado fija = {};
+  Anfitrion::contadores.reiniciar();
+  elPublicador.laEmisora.cambiarIntervalo(INTERVALO_FIJO);
+  for (int i = 0; i < ciclos; i++) {
+    elPublicador.empezarPublicacionMediciones(&laTraza[i][0], i, millis());
+    if (i == 0 || memcmp(&laTraza[i][0], &laTraza[i - 1][0], sizeof(laTraza[i])) != 0) {
+      anotarRetraso(fija, INTERVALO_FIJO);
+    }
+    delay(ANUNCIO_FIJO);
+    elPublicador.terminarPublicacion();
+    delay(CICLO - ANUNCIO_FIJO);
+  }
+  cerrar(fija);
+
+  //
+  // adaptativa
+  //
+  Resultado adaptativa = {};
+  Anfitrion::contadores.reiniciar();
+  int16_t enElAire[3] = { 0, 0, 0 };
+  uint32_t instanteEnElAire = 0;
+  for (int i = 0; i < ciclos; i++) {
+    uint32_t ahora = millis();
+    bool rafaga = elPublicador.publicarSiCambia(&laTraza[i][0], ahora);
+    if (rafaga || i == 0) {
+      anotarRetraso(adaptativa, elPublicador.laEmisora.intervalo());
+      memcpy(&enElAire[0], &laTraza[i][0], sizeof(enElAire));
+      instanteEnElAire = ahora;
+    } else if (ahora - instanteEnElAire >= Publicador< Globales::Sensores >::SILENCIO_MAXIMO) {
+      memcpy(&enElAire[0], &laTraza[i][0], sizeof(enElAire));  // latido: sale sin ráfaga
+      instanteEnElAire = ahora;
+    } else if (memcmp(&enElAire[0], &laTraza[i][0], sizeof(enElAire)) != 0) {
+      adaptativa.enBanda++;
+    }
+    if (rafaga) {
+      delay(Publicador< Globales::Sensores >::DURACION_RAFAGA);
+      elPublicador.acabarRafaga(millis());
+      delay(CICLO - Publicador< Globales::Sensores >::DURACION_RAFAGA);
+    } else {
+      delay(CICLO);
+    }
+  }
+  elPublicador.terminarPublicacion();
+  cerrar(adaptativa);
+
+  printf("traza: %d ciclos de %u ms\n", ciclos, CICLO);
+  escribir("fija", fija);
+  escribir("adaptativa", adaptativa);
+  return 0;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
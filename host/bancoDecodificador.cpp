@@ -0,0 +1,242 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file bancoDecodificador.cpp
+ * @brief Banco de pruebas en el ordenador: receptor/Decodificador.h, lo que da y lo que tarda.
+ * @author Sento Marcos Ibarra
+ *
+ * Primero comprueba, con anuncios hechos con las mismas cabeceras que el
+ * firmware, que cada formato (iBeacon de una medición, TramaMediciones,
+ * resumen y TramaMuestras) da las filas de lo que se empaquetó y que lo
+ * que no es nuestro (también un resumen sin un solo sensor) se cuenta como
+ * ajeno.
+ *
+ * Después decodifica, una y otra vez, un lote de 64 Ki anuncios como los
+ * de una pasarela con nodos que publican de las dos maneras: 3 de cada 4
+ * iBeacon de una medición y 1 de cada 4 TramaMediciones (1.5 filas por
+ * anuncio), con los datos en la caché, y escribe los anuncios por segundo.
+ *
+ *   g++ -std=gnu++11 -O2 host/bancoDecodificador.cpp -o bancoDecodificador
+ *   ./bancoDecodificador [vueltas]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "../receptor/Decodificador.h"
+
+using namespace Receptor;
+
+// ..........................................................
+// ..........................................................
+const uint32_t N = 1 << 16;     ///< Anuncios del lote.
+const uint8_t TAMANYO_IBEACON = 30;
+
+int fallos = 0;
+
+#define COMPROBAR(c)                                                 \
+  do {                                                               \
+    if (!(c)) {                                                      \
+      printf("FALLO %s:%d %s\n", __FILE__, __LINE__, #c);           \
+      fallos++;                                                      \
+    }                                                                \
+  } while (0)
+
+static Columnas<8192> lasColumnas;  // grande: mejor estática
+
+// ..........................................................
+// flags y la cabecera de un iBeacon; deja d apuntando a los 21 bytes
+// ..........................................................
+uint8_t* prefijoIBeacon(uint8_t* d) {
+  const uint8_t prefijo[9] = { 0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15 };
+  memcpy(d, prefijo, sizeof(prefijo));
+  return &d[sizeof(prefijo)];
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void iBeaconMedicion(uint8_t* d, uint8_t tipo, uint8_t contador, int16_t valor) {
+  uint8_t* carga = prefijoIBeacon(d);
+  Uuid128 uuid = TramaMediciones::uuidBeacon();
+  memcpy(carga, &uuid.bytes[0], 16);
+  uint16_t major = TramaMediciones::codificarMajor(tipo, contador);
+  carga[16] = major >> 8;
+  carga[17] = major & 0xFF;
+  carga[18] = (uint16_t)valor >> 8;
+  carga[19] = valor & 0xFF;
+  carga[20] = 0xCB;  // txPower
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void iBeaconTrama(uint8_t* d, const TramaMediciones& t) {
+  t.empaquetar(prefijoIBeacon(d));
+}  // ()
+
+// ..........................................................
+// ..........................................................
+InformeAnuncio informe(uint64_t direccion, uint32_t instante, uint8_t tamanyo, const uint8_t* d) {
+  InformeAnuncio inf = { direccion, instante, -60, tamanyo, d };
+  return inf;
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void comprobarFormatos() {
+  Decodificador elDecodificador;
+  uint8_t d[TAMANYO_IBEACON];
+
+  //
+  // iBeacon de una medición
+  //
+  iBeaconMedicion(d, TramaMediciones::ID_TEMPERATURA, 7, -12);
+  lasColumnas.vaciar();
+  COMPROBAR(elDecodificador.decodificarUno(informe(1, 100, TAMANYO_IBEACON, d), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 1);
+  COMPROBAR(lasColumnas.formato[0] == IBEACON_MEDICION);
+  COMPROBAR(lasColumnas.tipo[0] == TramaMediciones::ID_TEMPERATURA);
+  COMPROBAR(lasColumnas.valor[0] == -12 && lasColumnas.secuencia[0] == 7);
+  COMPROBAR(lasColumnas.nodo[0] == 1 && lasColumnas.instante[0] == 100);
+
+  //
+  // TramaMediciones: una fila por campo presente
+  //
+  TramaMediciones t = {};
+  t.presentes = TramaMediciones::HAY_CO2 | TramaMediciones::HAY_RUIDO | TramaMediciones::HAY_MARCA_TIEMPO;
+  t.co2 = 412;
+  t.ruido = 45;
+  t.secuencia = 300;
+  t.marcaTiempo = 123456;
+  iBeaconTrama(d, t);
+  lasColumnas.vaciar();
+  COMPROBAR(elDecodificador.decodificarUno(informe(2, 200, TAMANYO_IBEACON, d), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 2);
+  COMPROBAR(lasColumnas.tipo[0] == TramaMediciones::ID_CO2 && lasColumnas.valor[0] == 412);
+  COMPROBAR(lasColumnas.tipo[1] == TramaMediciones::ID_RUIDO && lasColumnas.valor[1] == 45);
+  COMPROBAR(lasColumnas.secuencia[1] == 300 && lasColumnas.marcaTiempo[1] == 123456);
+  COMPROBAR(lasColumnas.formato[0] == TRAMA_MEDICIONES);
+
+  //
+  // resumen
+  //
+  TramaMediciones::Resumen r = {};
+  r.presente = TramaMediciones::HAY_TEMPERATURA;
+  r.cuantas = 15;
+  r.minimo = 19;
+  r.maximo = 23;
+  r.media = 21;
+  r.varianza = 2;
+  r.secuencia = 9;
+  r.inicio = 60000;
+  TramaMediciones::empaquetarResumen(prefijoIBeacon(d), r);
+  lasColumnas.vaciar();
+  COMPROBAR(elDecodificador.decodificarUno(informe(3, 300, TAMANYO_IBEACON, d), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 1);
+  COMPROBAR(lasColumnas.formato[0] == TRAMA_RESUMEN);
+  COMPROBAR(lasColumnas.tipo[0] == TramaMediciones::ID_TEMPERATURA && lasColumnas.valor[0] == 21);
+  COMPROBAR(lasColumnas.cuantas[0] == 15 && lasColumnas.minimo[0] == 19 && lasColumnas.maximo[0] == 23);
+  COMPROBAR(lasColumnas.varianza[0] == 2 && lasColumnas.marcaTiempo[0] == 60000);
+
+  // con más de un sensor (o ninguno) en presente no es un resumen nuestro
+  r.presente = TramaMediciones::HAY_CO2 | TramaMediciones::HAY_RUIDO;
+  TramaMediciones::empaquetarResumen(prefijoIBeacon(d), r);
+  lasColumnas.vaciar();
+  COMPROBAR(!elDecodificador.decodificarUno(informe(3, 300, TAMANYO_IBEACON, d), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 0);
+
+  //
+  // TramaMuestras llena, en un extendido: la más reciente primero
+  //
+  TramaMuestras tm;
+  for (uint32_t j = 0; j < TramaMuestras::MAX_MUESTRAS; j++) {
+    int16_t v[3] = { (int16_t)j, 20, 40 };
+    tm.anyadir(&v[0], 3, j * 100, 500 + j);
+  }
+  uint8_t ext[4 + TramaMuestras::TAMANYO_MAX];
+  uint8_t tam = tm.empaquetar(&ext[4]);
+  ext[0] = tam + 3;
+  ext[1] = 0xFF;
+  ext[2] = 0x4C;
+  ext[3] = 0x00;
+  lasColumnas.vaciar();
+  COMPROBAR(elDecodificador.decodificarUno(informe(4, 400, (uint8_t)(tam + 4), ext), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 3 * TramaMuestras::MAX_MUESTRAS);
+  COMPROBAR(lasColumnas.formato[0] == TRAMA_MUESTRAS);
+  COMPROBAR(lasColumnas.secuencia[0] == 500 + TramaMuestras::MAX_MUESTRAS - 1);
+  COMPROBAR(lasColumnas.valor[0] == TramaMuestras::MAX_MUESTRAS - 1);
+  COMPROBAR(lasColumnas.secuencia[lasColumnas.filas - 1] == 500);
+
+  //
+  // ajeno: datos del fabricante de otro
+  //
+  const uint8_t ajeno[] = { 0x02, 0x01, 0x06, 0x05, 0xFF, 0x59, 0x00, 0x01, 0x02 };
+  lasColumnas.vaciar();
+  COMPROBAR(!elDecodificador.decodificarUno(informe(5, 500, sizeof(ajeno), ajeno), lasColumnas));
+  COMPROBAR(lasColumnas.filas == 0);
+
+  COMPROBAR(elDecodificador.informesDecodificados() == 4);
+  COMPROBAR(elDecodificador.informesAjenos() == 2);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+int main(int argc, char** argv) {
+  int vueltas = argc > 1 ? atoi(argv[1]) : 200;
+  if (vueltas <= 0) {
+    vueltas = 1;
+  }
+
+  comprobarFormatos();
+
+  //
+  // el lote: 8 nodos, 3 de cada 4 iBeacon de una medición
+  //
+  static uint8_t datos[N][TAMANYO_IBEACON];
+  static InformeAnuncio lote[N];
+  for (uint32_t i = 0; i < N; i++) {
+    if (i % 4 != 3) {
+      iBeaconMedicion(datos[i], (uint8_t)(TramaMediciones::ID_CO2 + i % 2), (uint8_t)i, (int16_t)(i * 7));
+    } else {
+      TramaMediciones t = {};
+      t.presentes = TramaMediciones::HAY_TODO;
+      t.co2 = (int16_t)i;
+      t.temperatura = 20;
+      t.ruido = 3;
+      t.secuencia = (uint16_t)i;
+      t.marcaTiempo = i * 1000;
+      iBeaconTrama(datos[i], t);
+    }
+    lote[i] = informe(0xC0FFEE000000ULL + (i & 7), i, TAMANYO_IBEACON, datos[i]);
+  }
+
+  Decodificador elDecodificador;
+  uint64_t filas = 0;
+  uint64_t suma = 0;  // para que no se quite nada
+  auto t0 = std::chrono::steady_clock::now();
+  for (int v = 0; v < vueltas; v++) {
+    uint32_t i = 0;
+    while (i < N) {
+      lasColumnas.vaciar();
+      i += elDecodificador.decodificar(&lote[i], N - i, lasColumnas);
+      filas += lasColumnas.filas;
+      suma += (uint16_t)lasColumnas.valor[lasColumnas.filas - 1];
+    }
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  double informes = (double)N * vueltas;
+
+  COMPROBAR(elDecodificador.informesDecodificados() == (uint32_t)informes);
+  COMPROBAR(elDecodificador.informesAjenos() == 0);
+  COMPROBAR(filas == (uint64_t)(N / 4 * 6) * vueltas);  // 3 + 3 por cada 4
+
+  printf("%.0f anuncios en %.3f s: %.1f M anuncios/s, %.2f filas por anuncio (%llu)\n",
+         informes, s, informes / s / 1e6, filas / informes, (unsigned long long)suma);
+  printf("fallos=%d\n", fallos);
+  return fallos == 0 ? 0 : 1;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
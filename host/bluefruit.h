@@ -0,0 +1,1029 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file bluefruit.h
+ * @brief Sustituto para el ordenador (host) de la biblioteca Bluefruit de Adafruit.
+ * @author Sento Marcos Ibarra
+ *
+ * Imita lo que usan EmisoraBLE, ServicioEnEmisora y Publicador:
+ * Bluefruit.Advertising / ScanResponse / Periph, BLEBeacon, BLEService
+ * y BLECharacteristic. No hay radio: cada llamada se anota en
+ * Anfitrion::contadores y el tiempo de radio encendida se calcula con el
+ * reloj virtual de Arduino.h.
+ *
+ * Compilación típica de un programa anfitrión que hace #include del sketch:
+ *
+ *   g++ -std=gnu++11 -I host -include Arduino.h programa.cpp
+ */
+
+#ifndef ANFITRION_BLUEFRUIT_H_INCLUIDO
+#define ANFITRION_BLUEFRUIT_H_INCLUIDO
+
+#include "Arduino.h"
+
+// ----------------------------------------------------------
+// constantes (mismos valores que la SoftDevice)
+// ----------------------------------------------------------
+#define BLE_GAP_AD_TYPE_FLAGS 0x01
+#define BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME 0x09
+#define BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE 0x07
+#define BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA 0xFF
+
+#define BLE_GAP_ADV_FLAG_LE_GENERAL_DISC_MODE 0x02
+#define BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED 0x04
+#define BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE 0x06
+
+#define BLE_GAP_ADV_SET_DATA_SIZE_MAX 31
+#define BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED 255
+#define BLE_GAP_ADV_SET_HANDLE_NOT_SET 0xFF
+
+#define BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED 0x01
+#define BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED 0x05
+#define BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED 0x0A
+
+#define BLE_GAP_ADV_FP_ANY 0x00
+#define BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED 0
+
+#define BLE_GAP_PHY_AUTO 0x00
+#define BLE_GAP_PHY_1MBPS 0x01
+#define BLE_GAP_PHY_2MBPS 0x02
+#define BLE_GAP_PHY_CODED 0x04
+
+#define BLE_CONN_CFG_TAG_DEFAULT 0
+
+#define CHR_PROPS_BROADCAST 0x01
+#define CHR_PROPS_READ 0x02
+#define CHR_PROPS_WRITE_WO_RESP 0x04
+#define CHR_PROPS_WRITE 0x08
+#define CHR_PROPS_NOTIFY 0x10
+#define CHR_PROPS_INDICATE 0x20
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+
+#define BLE_GATT_ATT_MTU_DEFAULT 23
+#define BLE_GAP_DATA_LENGTH_DEFAULT 27
+#define BLE_GAP_DATA_LENGTH_MAX 251
+#define BLE_GAP_DATA_LENGTH_AUTO 0
+#define BLE_GAP_EVENT_LENGTH_DEFAULT 3
+#define BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT 1
+
+#define NRF_SUCCESS 0
+#define NRF_ERROR_NOT_SUPPORTED 6
+#define NRF_ERROR_INVALID_PARAM 7
+#define NRF_ERROR_INVALID_STATE 8
+#define NRF_ERROR_INVALID_LENGTH 9
+
+/**
+ * @enum SecureMode_t
+ * @brief Permisos de lectura/escritura de una característica.
+ */
+enum SecureMode_t {
+  SECMODE_NO_ACCESS = 0x00,
+  SECMODE_OPEN = 0x11,
+  SECMODE_ENC_NO_MITM = 0x21,
+  SECMODE_ENC_WITH_MITM = 0x31
+};
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+
+/**
+ * @class BLEUuid
+ * @brief UUID de 16 o 128 bits (los de 128, byte menos significativo primero).
+ */
+class BLEUuid {
+public:
+  uint16_t uuid16;
+  uint8_t uuid128[16];
+  bool es128;
+
+  BLEUuid(uint16_t u)
+    : uuid16(u), uuid128(), es128(false) {
+  }  // ()
+
+  BLEUuid(uint8_t const u[16])
+    : uuid16(0), es128(true) {
+    memcpy(uuid128, u, 16);
+  }  // ()
+};   // class
+
+/**
+ * @class BLEBeacon
+ * @brief Beacon iBeacon: uuid, major, minor y rssi a 1 m.
+ */
+class BLEBeacon {
+public:
+  uint8_t uuid128[16];
+  uint16_t major;
+  uint16_t minor;
+  int8_t rssi;
+  uint16_t fabricante;
+
+  BLEBeacon(uint8_t const uuid[16], uint16_t major_, uint16_t minor_, int8_t rssi_)
+    : major(major_), minor(minor_), rssi(rssi_), fabricante(0x004C) {
+    Anfitrion::anotar(Anfitrion::BEACON_CREAR);
+    memcpy(uuid128, uuid, 16);
+  }  // ()
+
+  void setManufacturer(uint16_t id) {
+    fabricante = id;
+  }  // ()
+};   // class
+
+class BLEService;
+
+/**
+ * @class BLEAdvertisingData
+ * @brief Datos de un anuncio o de una respuesta de escaneo (31 bytes como mucho).
+ */
+class BLEAdvertisingData {
+protected:
+  uint8_t datos[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+  uint8_t cuenta;
+  Anfitrion::Llamada llamadaDatos;
+
+  /**
+   * @brief Añade una estructura AD sin anotar la llamada.
+   */
+  bool anyadir(uint8_t tipo, const void* p, uint8_t len) {
+    if (cuenta + len + 2 > BLE_GAP_ADV_SET_DATA_SIZE_MAX) {
+      return false;
+    }
+    datos[cuenta] = len + 1;
+    datos[cuenta + 1] = tipo;
+    memcpy(&datos[cuenta + 2], p, len);
+    cuenta += len + 2;
+    return true;
+  }  // ()
+
+  /**
+   * @brief Anota ll, o SCAN_RESPONSE si esto es la respuesta de escaneo.
+   */
+  void anotar(Anfitrion::Llamada ll) {
+    Anfitrion::anotar(llamadaDatos == Anfitrion::ADV_ADD_DATA ? ll : llamadaDatos);
+  }  // ()
+
+public:
+
+  BLEAdvertisingData(Anfitrion::Llamada ll = Anfitrion::ADV_ADD_DATA)
+    : datos(), cuenta(0), llamadaDatos(ll) {
+  }  // ()
+
+  bool addData(uint8_t tipo, const void* p, uint8_t len) {
+    anotar(Anfitrion::ADV_ADD_DATA);
+    return anyadir(tipo, p, len);
+  }  // ()
+
+  bool addFlags(uint8_t flags) {
+    anotar(Anfitrion::ADV_ADD_FLAGS);
+    return anyadir(BLE_GAP_AD_TYPE_FLAGS, &flags, 1);
+  }  // ()
+
+  bool addName();  // necesita Bluefruit: ver más abajo
+
+  bool addService(BLEService& servicio);
+
+  void clearData() {
+    anotar(Anfitrion::ADV_CLEAR_DATA);
+    cuenta = 0;
+  }  // ()
+
+  bool setData(const uint8_t* p, uint8_t len) {
+    anotar(Anfitrion::ADV_SET_DATA);
+    if (len > BLE_GAP_ADV_SET_DATA_SIZE_MAX) {
+      return false;
+    }
+    memcpy(datos, p, len);
+    cuenta = len;
+    return true;
+  }  // ()
+
+  uint8_t count() const {
+    return cuenta;
+  }  // ()
+
+  uint8_t* getData() {
+    return datos;
+  }  // ()
+};   // class
+
+// ----------------------------------------------------------
+// tiempo en el aire
+// ----------------------------------------------------------
+namespace Anfitrion {
+
+  /**
+   * @brief Lo que dura un paquete en el aire.
+   *
+   *  - 1M: preámbulo 1, dirección de acceso 4, PDU, CRC 3; 8 us por byte
+   *  - 2M: igual con preámbulo 2; 4 us por byte
+   *  - Coded (S=8): preámbulo 80 us, dirección de acceso 256, CI 16, TERM1 24;
+   *    luego PDU y CRC a 64 us por byte, y TERM2 24
+   *
+   * @param phy BLE_GAP_PHY_1MBPS, _2MBPS o _CODED.
+   * @param bytesPdu Cabecera (2) y carga del PDU.
+   */
+  inline uint32_t duracionPaqueteUs(uint8_t phy, uint16_t bytesPdu) {
+    if (phy == BLE_GAP_PHY_2MBPS) {
+      return (2 + 4 + bytesPdu + 3) * 4;
+    }
+    if (phy == BLE_GAP_PHY_CODED) {
+      return 80 + 256 + 16 + 24 + (bytesPdu + 3) * 64 + 24;
+    }
+    return (1 + 4 + bytesPdu + 3) * 8;
+  }  // ()
+
+  bool anuncioDirectoEnMarcha = false;  ///< Si el conjunto 0 lo ha arrancado sd_ble_gap_adv_start() (ver más abajo).
+
+};  // namespace
+
+/**
+ * @class BLEAdvertising
+ * @brief Anunciante. Al pararlo se suman los eventos y el tiempo de radio.
+ */
+class BLEAdvertising : public BLEAdvertisingData {
+private:
+  bool enMarcha;
+  uint64_t inicioUs;
+  uint16_t intervaloRapido;  // en unidades de 0.625 ms
+  uint16_t intervaloLento;
+  uint16_t tiempoRapidoS;
+
+  void contabilizar(uint64_t hastaUs) {
+    uint64_t duracion = hastaUs - inicioUs;
+    uint64_t rapido = (uint64_t)tiempoRapidoS * 1000000;
+    uint64_t enRapido = duracion < rapido ? duracion : rapido;
+    uint64_t enLento = duracion - enRapido;
+    uint32_t eventos = (uint32_t)(enRapido / (intervaloRapido * 625ULL))
+                       + (uint32_t)(enLento / (intervaloLento * 625ULL));
+    if (duracion > 0 && eventos == 0) {
+      eventos = 1;  // el primero sale al empezar
+    }
+    Anfitrion::contadores.eventosAnuncio += eventos;
+    Anfitrion::contadores.bytesAire += eventos * cuenta;
+    Anfitrion::contadores.paquetesAire += eventos * 3;
+    Anfitrion::contadores.tiempoRadioUs += duracion;
+    // cada evento: el paquete por los canales 37, 38 y 39 a 1 Mbps (PDU: cabecera 2, AdvA 6, carga)
+    Anfitrion::contadores.tiempoTransmisionUs +=
+      (uint64_t)eventos * 3 * Anfitrion::duracionPaqueteUs(BLE_GAP_PHY_1MBPS, 2 + 6 + cuenta);
+  }  // ()
+
+public:
+
+  BLEAdvertising()
+    : enMarcha(false), inicioUs(0),
+      intervaloRapido(32), intervaloLento(244), tiempoRapidoS(30) {
+  }  // ()
+
+  void setBeacon(BLEBeacon& b) {
+    Anfitrion::anotar(Anfitrion::ADV_SET_BEACON);
+    cuenta = 0;
+    uint8_t flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    uint8_t carga[25] = {
+      (uint8_t)(b.fabricante & 0xff), (uint8_t)(b.fabricante >> 8),
+      0x02, 21
+    };
+    memcpy(&carga[4], b.uuid128, 16);
+    carga[20] = b.major >> 8;
+    carga[21] = b.major & 0xff;
+    carga[22] = b.minor >> 8;
+    carga[23] = b.minor & 0xff;
+    carga[24] = (uint8_t)b.rssi;
+    anyadir(BLE_GAP_AD_TYPE_FLAGS, &flags, 1);
+    anyadir(BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, carga, sizeof(carga));
+  }  // ()
+
+  void restartOnDisconnect(bool) {
+    Anfitrion::anotar(Anfitrion::ADV_RESTART_ON_DISCONNECT);
+  }  // ()
+
+  void setInterval(uint16_t rapido, uint16_t lento) {
+    Anfitrion::anotar(Anfitrion::ADV_SET_INTERVAL);
+    intervaloRapido = rapido ? rapido : 1;
+    intervaloLento = lento ? lento : 1;
+  }  // ()
+
+  void setFastTimeout(uint16_t segundos) {
+    Anfitrion::anotar(Anfitrion::ADV_SET_FAST_TIMEOUT);
+    tiempoRapidoS = segundos;
+  }  // ()
+
+  bool start(uint16_t = 0) {
+    Anfitrion::anotar(Anfitrion::ADV_START);
+    if (Anfitrion::anuncioDirectoEnMarcha) {
+      return false;  // la SoftDevice no deja configurar un conjunto en marcha
+    }
+    Anfitrion::contadores.bytesAnuncio += cuenta;
+    enMarcha = true;
+    inicioUs = Anfitrion::relojUs;
+    return true;
+  }  // ()
+
+  bool stop() {
+    Anfitrion::anotar(Anfitrion::ADV_STOP);
+    if (enMarcha) {
+      contabilizar(Anfitrion::relojUs);
+    }
+    enMarcha = false;
+    return true;
+  }  // ()
+
+  bool isRunning() {
+    Anfitrion::anotar(Anfitrion::ADV_IS_RUNNING);
+    return enMarcha;
+  }  // ()
+
+  /**
+   * @brief Como isRunning(), sin anotarlo (para el sustituto de la SoftDevice).
+   */
+  bool enMarchaAhora() const {
+    return enMarcha;
+  }  // ()
+
+  /**
+   * @brief Lo que hace la SoftDevice al recibir datos nuevos sin parar el anuncio.
+   * @return false si no se está anunciando.
+   */
+  bool cambiarDatosEnMarcha(const uint8_t* p, uint16_t len) {
+    if (!enMarcha || len > BLE_GAP_ADV_SET_DATA_SIZE_MAX) {
+      return false;
+    }
+    contabilizar(Anfitrion::relojUs);  // lo emitido hasta ahora, con los datos viejos
+    inicioUs = Anfitrion::relojUs;
+    memcpy(datos, p, len);
+    cuenta = (uint8_t)len;
+    Anfitrion::contadores.bytesAnuncio += cuenta;
+    return true;
+  }  // ()
+};   // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+namespace Anfitrion {
+  int16_t huecosNotificacion = -1;  ///< Notificaciones que caben aún en la cola de envío de la SoftDevice (-1: sin límite).
+};
+
+class BLECharacteristic;
+
+typedef void (*write_cb_t)(uint16_t conn_hdl, BLECharacteristic* chr, uint8_t* data, uint16_t len);
+
+/**
+ * @class BLEService
+ * @brief Servicio GATT.
+ */
+class BLEService {
+public:
+  BLEUuid uuid;
+
+  BLEService(BLEUuid u)
+    : uuid(u) {
+  }  // ()
+
+  err_t begin() {
+    Anfitrion::anotar(Anfitrion::SERVICIO_BEGIN);
+    return 0;
+  }  // ()
+};   // class
+
+/**
+ * @class BLECharacteristic
+ * @brief Característica GATT. write()/notify() cuentan los bytes enviados.
+ */
+class BLECharacteristic {
+public:
+  BLEUuid uuid;
+  uint8_t propiedades;
+  uint16_t longitudMaxima;
+  write_cb_t callbackEscritura;
+
+  BLECharacteristic(BLEUuid u)
+    : uuid(u), propiedades(0), longitudMaxima(20), callbackEscritura(NULL) {
+  }  // ()
+
+  void setProperties(uint8_t p) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_CONFIGURAR);
+    propiedades = p;
+  }  // ()
+
+  void setPermission(SecureMode_t, SecureMode_t) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_CONFIGURAR);
+  }  // ()
+
+  void setMaxLen(uint16_t l) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_CONFIGURAR);
+    longitudMaxima = l;
+  }  // ()
+
+  void setFixedLen(uint16_t l) {
+    setMaxLen(l);
+  }  // ()
+
+  void setWriteCallback(write_cb_t cb) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_CONFIGURAR);
+    callbackEscritura = cb;
+  }  // ()
+
+  err_t begin() {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_BEGIN);
+    return 0;
+  }  // ()
+
+  uint16_t write(const void* datos, uint16_t len) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_WRITE);
+    uint16_t n = len < longitudMaxima ? len : longitudMaxima;
+    Anfitrion::contadores.bytesNotificados += n;
+    (void)datos;
+    return n;
+  }  // ()
+
+  uint16_t write(const char* str) {
+    return write(str, strlen(str));
+  }  // ()
+
+  bool notify(const void* datos, uint16_t len) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_NOTIFY);
+    if (Anfitrion::huecosNotificacion == 0) {
+      return false;  // cola de envío llena
+    }
+    if (Anfitrion::huecosNotificacion > 0) {
+      Anfitrion::huecosNotificacion--;
+    }
+    Anfitrion::contadores.bytesNotificados += len;
+    (void)datos;
+    return true;
+  }  // ()
+
+  bool notify(const char* str) {
+    return notify(str, strlen(str));
+  }  // ()
+
+  bool notify(uint16_t conn, const void* datos, uint16_t len);  // (después de Bluefruit)
+
+  /**
+   * @brief Simula que un teléfono escribe en la característica.
+   */
+  void simularEscritura(uint16_t connHandle, uint8_t* datos, uint16_t len) {
+    if (callbackEscritura) {
+      callbackEscritura(connHandle, this, datos, len);
+    }
+  }  // ()
+};   // class
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+
+/**
+ * @struct ble_gap_data_length_params_t
+ * @brief Lo que se pide al actualizar la longitud de datos.
+ */
+typedef struct {
+  uint16_t max_tx_octets;   ///< Carga de cada PDU de datos (27 a 251).
+  uint16_t max_rx_octets;
+  uint16_t max_tx_time_us;  ///< BLE_GAP_DATA_LENGTH_AUTO: lo que corresponda.
+  uint16_t max_rx_time_us;
+} ble_gap_data_length_params_t;
+
+namespace Anfitrion {
+
+  /**
+   * @struct Central
+   * @brief Lo que admite el teléfono: lo que pide el periférico se queda en esto.
+   */
+  struct Central {
+    uint16_t mtuMaximo;
+    uint16_t longitudDatosMaxima;
+    bool admite2M;
+    uint16_t intervaloMinimo;  ///< En unidades de 1.25 ms.
+  };
+
+  Central elCentral = { 247, 251, true, 6 };  ///< Un Android reciente.
+
+};  // namespace
+
+/**
+ * @class BLEConnection
+ * @brief Conexión con un central.
+ *
+ * Empieza como la deja el teléfono (30 ms, 27 bytes por paquete, 1M) y
+ * cada request*() se aplica enseguida, hasta donde admitan Anfitrion::elCentral
+ * y la configuración de Bluefruit. Una notificación ocupa el enlace lo
+ * que tardan sus paquetes (cada uno con la respuesta vacía del central y
+ * los dos IFS) repartidos en eventos de conexión; si la cola de la
+ * SoftDevice está llena, notify() devuelve false.
+ */
+class BLEConnection {
+public:
+  uint16_t manejador;
+  uint16_t mtu;
+  uint16_t intervalo;      ///< En unidades de 1.25 ms.
+  uint16_t latencia;
+  uint16_t supervision;    ///< En unidades de 10 ms.
+  uint16_t longitudDatos;  ///< Carga de cada PDU.
+  uint8_t phy;
+  uint64_t ocupadaHastaUs;  ///< Cuándo acaba de salir lo que hay en la cola.
+
+  BLEConnection(uint16_t h = BLE_CONN_HANDLE_INVALID)
+    : manejador(h), mtu(BLE_GATT_ATT_MTU_DEFAULT), intervalo(24), latencia(0), supervision(400),
+      longitudDatos(BLE_GAP_DATA_LENGTH_DEFAULT), phy(BLE_GAP_PHY_1MBPS), ocupadaHastaUs(0) {
+  }  // ()
+
+  uint16_t getMtu() const {
+    return mtu;
+  }  // ()
+
+  uint16_t getConnectionInterval() const {
+    return intervalo;
+  }  // ()
+
+  uint16_t getSlaveLatency() const {
+    return latencia;
+  }  // ()
+
+  uint16_t getSupervisionTimeout() const {
+    return supervision;
+  }  // ()
+
+  uint16_t getDataLength() const {
+    return longitudDatos;
+  }  // ()
+
+  uint8_t getPHY() const {
+    return phy;
+  }  // ()
+
+  uint16_t handle() const {
+    return manejador;
+  }  // ()
+
+  bool connected() const {
+    return manejador != BLE_CONN_HANDLE_INVALID;
+  }  // ()
+
+  bool requestConnectionParameter(uint16_t intervalo_, uint16_t latencia_ = 0, uint16_t supervision_ = 400) {
+    Anfitrion::anotar(Anfitrion::CONEXION_PETICION);
+    if (!connected()) {
+      return false;
+    }
+    intervalo = intervalo_ > Anfitrion::elCentral.intervaloMinimo ? intervalo_ : Anfitrion::elCentral.intervaloMinimo;
+    latencia = latencia_;
+    supervision = supervision_;
+    return true;
+  }  // ()
+
+  bool requestMtuExchange(uint16_t m);  // (necesita la configuración de Bluefruit)
+
+  bool requestDataLengthUpdate(const ble_gap_data_length_params_t* p = NULL, void* = NULL) {
+    Anfitrion::anotar(Anfitrion::CONEXION_PETICION);
+    if (!connected()) {
+      return false;
+    }
+    uint16_t pedida = (p == NULL ? BLE_GAP_DATA_LENGTH_MAX : p->max_tx_octets);
+    longitudDatos = pedida < Anfitrion::elCentral.longitudDatosMaxima ? pedida : Anfitrion::elCentral.longitudDatosMaxima;
+    return true;
+  }  // ()
+
+  bool requestPHY(uint8_t p = BLE_GAP_PHY_AUTO) {
+    Anfitrion::anotar(Anfitrion::CONEXION_PETICION);
+    if (!connected()) {
+      return false;
+    }
+    phy = ((p & BLE_GAP_PHY_2MBPS) && Anfitrion::elCentral.admite2M) ? BLE_GAP_PHY_2MBPS : BLE_GAP_PHY_1MBPS;
+    return true;
+  }  // ()
+
+  /**
+   * @brief Lo que tarda en salir una notificación de len bytes.
+   * @param longitudEvento La de Bluefruit.configPrphConn(), en unidades de 1.25 ms.
+   */
+  uint64_t duracionNotificacionUs(uint16_t len, uint16_t longitudEvento) const {
+    uint16_t bytes = len + 3 + 4;  // cabeceras ATT y L2CAP
+    uint32_t pdus = (bytes + longitudDatos - 1) / longitudDatos;
+    uint32_t parUs = Anfitrion::duracionPaqueteUs(phy, 2 + longitudDatos) + 150
+                     + Anfitrion::duracionPaqueteUs(phy, 2) + 150;
+    uint32_t eventoUs = (longitudEvento < intervalo ? longitudEvento : intervalo) * 1250;
+    uint32_t porEvento = eventoUs / parUs;
+    if (porEvento == 0) {
+      porEvento = 1;
+    }
+    return (uint64_t)pdus * intervalo * 1250 / porEvento;
+  }  // ()
+};   // class
+
+/**
+ * @class BLEPeriph
+ * @brief Papel de periférico: callbacks de conexión y desconexión.
+ */
+class BLEPeriph {
+public:
+  typedef void (*connect_callback_t)(uint16_t conn_hdl);
+  typedef void (*disconnect_callback_t)(uint16_t conn_hdl, uint8_t reason);
+
+  connect_callback_t alConectar;
+  disconnect_callback_t alDesconectar;
+
+  BLEPeriph()
+    : alConectar(NULL), alDesconectar(NULL) {
+  }  // ()
+
+  void setConnectCallback(connect_callback_t cb) {
+    Anfitrion::anotar(Anfitrion::PERIPH_CALLBACK);
+    alConectar = cb;
+  }  // ()
+
+  void setDisconnectCallback(disconnect_callback_t cb) {
+    Anfitrion::anotar(Anfitrion::PERIPH_CALLBACK);
+    alDesconectar = cb;
+  }  // ()
+};   // class
+
+/**
+ * @class AdafruitBluefruit
+ * @brief El objeto global Bluefruit.
+ */
+class AdafruitBluefruit {
+public:
+  BLEAdvertising Advertising;
+  BLEAdvertisingData ScanResponse;
+  BLEPeriph Periph;
+
+  const char* nombre;
+  int8_t potencia;
+  BLEConnection conexiones[4];
+
+  uint16_t mtuMaximo;       ///< configPrphConn(): hasta dónde llega el intercambio de MTU.
+  uint16_t longitudEvento;  ///< Tiempo de radio por evento de conexión, en unidades de 1.25 ms.
+  uint8_t colaNotificaciones;
+
+  AdafruitBluefruit()
+    : ScanResponse(Anfitrion::SCAN_RESPONSE), nombre("Bluefruit52"), potencia(0),
+      mtuMaximo(BLE_GATT_ATT_MTU_DEFAULT), longitudEvento(BLE_GAP_EVENT_LENGTH_DEFAULT),
+      colaNotificaciones(BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT) {
+  }  // ()
+
+  /**
+   * @brief Lo que reserva la SoftDevice para cada conexión (antes de begin()).
+   */
+  void configPrphConn(uint16_t mtu, uint16_t evento, uint8_t colaHvn, uint8_t /* colaEscrituras */) {
+    Anfitrion::anotar(Anfitrion::BLUEFRUIT_CONFIGURAR);
+    mtuMaximo = mtu;
+    longitudEvento = evento;
+    colaNotificaciones = colaHvn;
+  }  // ()
+
+  bool begin(uint8_t = 1, uint8_t = 0) {
+    Anfitrion::anotar(Anfitrion::BLUEFRUIT_BEGIN);
+    return true;
+  }  // ()
+
+  bool setTxPower(int8_t p) {
+    Anfitrion::anotar(Anfitrion::BLUEFRUIT_SET_TX_POWER);
+    potencia = p;
+    return true;
+  }  // ()
+
+  void setName(const char* n) {
+    Anfitrion::anotar(Anfitrion::BLUEFRUIT_SET_NAME);
+    nombre = n;
+  }  // ()
+
+  const char* getName() const {
+    return nombre;
+  }  // ()
+
+  BLEConnection* Connection(uint16_t h) {
+    return h < 4 ? &conexiones[h] : NULL;
+  }  // ()
+
+  /**
+   * @brief Simula que un central se conecta.
+   * @param mtu El que pide el teléfono (23: no pide nada); se queda en mtuMaximo.
+   */
+  void simularConexion(uint16_t h, uint16_t mtu = BLE_GATT_ATT_MTU_DEFAULT) {
+    if (h < 4) {
+      conexiones[h] = BLEConnection(h);
+      conexiones[h].mtu = mtu < mtuMaximo ? mtu : mtuMaximo;
+    }
+    if (Periph.alConectar) {
+      Periph.alConectar(h);
+    }
+  }  // ()
+
+  /**
+   * @brief Simula que un central se desconecta.
+   */
+  void simularDesconexion(uint16_t h, uint8_t razon) {
+    if (Periph.alDesconectar) {
+      Periph.alDesconectar(h, razon);
+    }
+    if (h < 4) {
+      conexiones[h].manejador = BLE_CONN_HANDLE_INVALID;
+    }
+  }  // ()
+};   // class
+
+AdafruitBluefruit Bluefruit;
+
+inline bool BLEConnection::requestMtuExchange(uint16_t m) {
+  Anfitrion::anotar(Anfitrion::CONEXION_PETICION);
+  if (!connected()) {
+    return false;
+  }
+  uint16_t acordado = m < Anfitrion::elCentral.mtuMaximo ? m : Anfitrion::elCentral.mtuMaximo;
+  if (acordado > Bluefruit.mtuMaximo) {
+    acordado = Bluefruit.mtuMaximo;
+  }
+  if (acordado > mtu) {
+    mtu = acordado;
+  }
+  return true;
+}  // ()
+
+inline bool BLECharacteristic::notify(uint16_t conn, const void* datos, uint16_t len) {
+  BLEConnection* c = Bluefruit.Connection(conn);
+  if (c == NULL || !c->connected()) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_NOTIFY);
+    return false;
+  }
+  uint64_t ahora = Anfitrion::relojUs;
+  uint64_t dura = c->duracionNotificacionUs(len, Bluefruit.longitudEvento);
+  uint64_t desde = c->ocupadaHastaUs > ahora ? c->ocupadaHastaUs : ahora;
+  if (desde - ahora >= Bluefruit.colaNotificaciones * dura) {
+    Anfitrion::anotar(Anfitrion::CARACTERISTICA_NOTIFY);
+    return false;  // cola de envío llena
+  }
+  if (!notify(datos, len)) {
+    return false;
+  }
+  c->ocupadaHastaUs = desde + dura;
+  return true;
+}  // ()
+
+// ----------------------------------------------------------
+// SoftDevice (sólo lo que usamos directamente)
+// ----------------------------------------------------------
+
+/**
+ * @struct ble_data_t
+ * @brief Buffer de datos para la SoftDevice.
+ */
+typedef struct {
+  uint8_t* p_data;
+  uint16_t len;
+} ble_data_t;
+
+/**
+ * @struct ble_gap_adv_data_t
+ * @brief Datos de anuncio y de respuesta de escaneo.
+ */
+typedef struct {
+  ble_data_t adv_data;
+  ble_data_t scan_rsp_data;
+} ble_gap_adv_data_t;
+
+/**
+ * @struct ble_gap_adv_properties_t
+ * @brief Tipo de anuncio.
+ */
+typedef struct {
+  uint8_t type;  ///< BLE_GAP_ADV_TYPE_*.
+  uint8_t anonymous : 1;
+  uint8_t include_tx_power : 1;
+} ble_gap_adv_properties_t;
+
+/**
+ * @struct ble_gap_adv_params_t
+ * @brief Parámetros de un conjunto de anuncio.
+ */
+typedef struct {
+  ble_gap_adv_properties_t properties;
+  const void* p_peer_addr;
+  uint32_t interval;  ///< En unidades de 0.625 ms.
+  uint16_t duration;  ///< En unidades de 10 ms; 0 = sin límite.
+  uint8_t max_adv_evts;
+  uint8_t channel_mask[5];
+  uint8_t filter_policy;
+  uint8_t primary_phy;    ///< BLE_GAP_PHY_1MBPS o _CODED.
+  uint8_t secondary_phy;  ///< BLE_GAP_PHY_1MBPS, _2MBPS o _CODED (sólo los extendidos).
+  uint8_t set_id : 4;
+  uint8_t scan_req_notification : 1;
+} ble_gap_adv_params_t;
+
+namespace Anfitrion {
+
+  bool anuncioExtendidoDisponible = true;  ///< false: la SoftDevice rechaza los anuncios extendidos.
+
+  /**
+   * @class ConjuntoAnuncio
+   * @brief El conjunto de anuncio 0 cuando se maneja directamente con sd_ble_gap_adv_*().
+   *
+   * Un evento de anuncio extendido son tres ADV_EXT_IND en los canales
+   * primarios (37, 38, 39, con el PHY primario) que apuntan a un AUX_ADV_IND
+   * en un canal secundario, con el PHY secundario y los datos. Lo que no cabe
+   * en un PDU (255 bytes) sigue en AUX_CHAIN_IND.
+   */
+  class ConjuntoAnuncio {
+  private:
+    bool configurado;
+    uint64_t inicioUs;
+    ble_gap_adv_params_t parametros;
+    uint16_t tamanyo;
+
+    static bool esTipoExtendido(uint8_t tipo) {
+      return tipo >= 0x06;  // BLE_GAP_ADV_TYPE_EXTENDED_*
+    }  // ()
+
+    bool esExtendido() const {
+      return esTipoExtendido(parametros.properties.type);
+    }  // ()
+
+    void contabilizar(uint64_t hastaUs) {
+      uint64_t duracion = hastaUs - inicioUs;
+      uint32_t eventos = (uint32_t)(duracion / (parametros.interval * 625ULL));
+      if (duracion > 0 && eventos == 0) {
+        eventos = 1;  // el primero sale al empezar
+      }
+
+      uint32_t paquetes = 3;
+      uint64_t us = 0;
+      if (!esExtendido()) {
+        us = 3 * (uint64_t)duracionPaqueteUs(BLE_GAP_PHY_1MBPS, 2 + 6 + tamanyo);
+      } else {
+        // ADV_EXT_IND: cabecera extendida 1, banderas 1, ADI 2, AuxPtr 3
+        us = 3 * (uint64_t)duracionPaqueteUs(parametros.primary_phy, 2 + 7);
+        // AUX_ADV_IND: 1, banderas 1, AdvA 6, ADI 2 (+ AuxPtr 3 si sigue otro)
+        // AUX_CHAIN_IND: 1, banderas 1, ADI 2 (+ AuxPtr 3 si sigue otro)
+        uint16_t quedan = tamanyo;
+        uint16_t cabecera = 10;
+        do {
+          uint16_t cabe = 255 - cabecera;
+          if (quedan > cabe) {
+            cabe -= 3;
+          }
+          uint16_t van = quedan < cabe ? quedan : cabe;
+          uint16_t cabeceraAhora = cabecera + (quedan > van ? 3 : 0);
+          us += duracionPaqueteUs(parametros.secondary_phy, 2 + cabeceraAhora + van);
+          paquetes++;
+          quedan -= van;
+          cabecera = 4;
+        } while (quedan > 0);
+      }
+
+      contadores.eventosAnuncio += eventos;
+      contadores.bytesAire += eventos * tamanyo;
+      contadores.paquetesAire += eventos * paquetes;
+      contadores.tiempoRadioUs += duracion;
+      contadores.tiempoTransmisionUs += eventos * us;
+    }  // ()
+
+  public:
+    bool enMarcha;
+
+    ConjuntoAnuncio()
+      : configurado(false), inicioUs(0), parametros(), tamanyo(0), enMarcha(false) {
+    }  // ()
+
+    uint32_t configurar(const ble_gap_adv_params_t& p, const ble_data_t* datos) {
+      if (enMarcha) {
+        return NRF_ERROR_INVALID_STATE;
+      }
+      bool extendido = esTipoExtendido(p.properties.type);
+      if (extendido && !anuncioExtendidoDisponible) {
+        return NRF_ERROR_NOT_SUPPORTED;
+      }
+      uint16_t len = datos ? datos->len : 0;
+      if (len > (extendido ? BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED
+                           : BLE_GAP_ADV_SET_DATA_SIZE_MAX)) {
+        return NRF_ERROR_INVALID_LENGTH;
+      }
+      parametros = p;
+      if (parametros.interval == 0) {
+        parametros.interval = 1;
+      }
+      tamanyo = len;
+      configurado = true;
+      return NRF_SUCCESS;
+    }  // ()
+
+    uint32_t cambiarDatos(const ble_data_t& datos) {
+      if (datos.len > (esExtendido() ? BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED
+                                     : BLE_GAP_ADV_SET_DATA_SIZE_MAX)) {
+        return NRF_ERROR_INVALID_LENGTH;
+      }
+      if (enMarcha) {
+        contabilizar(relojUs);  // lo emitido hasta ahora, con los datos viejos
+        inicioUs = relojUs;
+        contadores.bytesAnuncio += datos.len;
+      }
+      tamanyo = datos.len;
+      return NRF_SUCCESS;
+    }  // ()
+
+    uint32_t empezar() {
+      if (!configurado || enMarcha) {
+        return NRF_ERROR_INVALID_STATE;
+      }
+      enMarcha = true;
+      anuncioDirectoEnMarcha = true;
+      inicioUs = relojUs;
+      contadores.bytesAnuncio += tamanyo;
+      return NRF_SUCCESS;
+    }  // ()
+
+    uint32_t parar() {
+      if (!enMarcha) {
+        return NRF_ERROR_INVALID_STATE;
+      }
+      contabilizar(relojUs);
+      enMarcha = false;
+      anuncioDirectoEnMarcha = false;
+      return NRF_SUCCESS;
+    }  // ()
+  };  // class
+
+  ConjuntoAnuncio elConjuntoAnuncio;
+
+};  // namespace
+
+/**
+ * @brief Imitación de sd_ble_gap_adv_set_configure(). Sólo hay un conjunto,
+ * el 0 (el que crea Bluefruit).
+ *
+ * Con p_adv_params == NULL cambia los datos sin parar el anuncio, sea el de
+ * Bluefruit o uno arrancado con sd_ble_gap_adv_start(). Con parámetros, el
+ * conjunto tiene que estar parado.
+ */
+inline uint32_t sd_ble_gap_adv_set_configure(uint8_t* p_adv_handle,
+                                             ble_gap_adv_data_t const* p_adv_data,
+                                             ble_gap_adv_params_t const* p_adv_params) {
+  Anfitrion::anotar(Anfitrion::SD_ADV_SET_CONFIGURE);
+  if (p_adv_handle == NULL || *p_adv_handle != 0) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+
+  if (p_adv_params != NULL) {
+    if (Bluefruit.Advertising.enMarchaAhora()) {
+      return NRF_ERROR_INVALID_STATE;
+    }
+    return Anfitrion::elConjuntoAnuncio.configurar(*p_adv_params,
+                                                   p_adv_data ? &p_adv_data->adv_data : NULL);
+  }
+
+  if (p_adv_data == NULL) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+  if (Anfitrion::elConjuntoAnuncio.enMarcha) {
+    return Anfitrion::elConjuntoAnuncio.cambiarDatos(p_adv_data->adv_data);
+  }
+  if (!Bluefruit.Advertising.cambiarDatosEnMarcha(p_adv_data->adv_data.p_data,
+                                                  p_adv_data->adv_data.len)) {
+    return NRF_ERROR_INVALID_STATE;
+  }
+  return NRF_SUCCESS;
+}  // ()
+
+/**
+ * @brief Imitación de sd_ble_gap_adv_start().
+ */
+inline uint32_t sd_ble_gap_adv_start(uint8_t adv_handle, uint8_t /* conn_cfg_tag */) {
+  Anfitrion::anotar(Anfitrion::SD_ADV_START);
+  if (adv_handle != 0) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+  if (Bluefruit.Advertising.enMarchaAhora()) {
+    return NRF_ERROR_INVALID_STATE;
+  }
+  return Anfitrion::elConjuntoAnuncio.empezar();
+}  // ()
+
+/**
+ * @brief Imitación de sd_ble_gap_adv_stop().
+ */
+inline uint32_t sd_ble_gap_adv_stop(uint8_t adv_handle) {
+  Anfitrion::anotar(Anfitrion::SD_ADV_STOP);
+  if (adv_handle != 0) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+  return Anfitrion::elConjuntoAnuncio.parar();
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+inline bool BLEAdvertisingData::addName() {
+  anotar(Anfitrion::ADV_ADD_NAME);
+  const char* n = Bluefruit.getName();
+  return anyadir(BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME, n, (uint8_t)strlen(n));
+}  // ()
+
+inline bool BLEAdvertisingData::addService(BLEService& servicio) {
+  anotar(Anfitrion::ADV_ADD_SERVICE);
+  if (!servicio.uuid.es128) {
+    return anyadir(0x03, &servicio.uuid.uuid16, 2);
+  }
+  return anyadir(BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE, servicio.uuid.uuid128, 16);
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
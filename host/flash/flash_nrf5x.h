@@ -0,0 +1,154 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file flash_nrf5x.h
+ * @brief Sustituto para el ordenador (host) de la flash interna del núcleo de Adafruit.
+ * @author Sento Marcos Ibarra
+ *
+ * La flash es un array en RAM (FLASH_TAMANYO bytes, borrado a 0xFF). Como en
+ * el núcleo de verdad, las escrituras van a una caché de una página: al
+ * cambiar de página o con flash_nrf5x_flush() la página se borra entera y
+ * se vuelve a programar. Cada borrado y cada byte programado se cuentan en
+ * Anfitrion::contadores, y por página en Anfitrion::borradosPagina (para
+ * ver el desgaste).
+ *
+ * También lo que tardan: borrar una página (85 ms) y programar cada palabra
+ * (41 us), lo peor de la hoja de datos del nRF52840. Con la SoftDevice, quien
+ * llama se queda esperando al evento de la SoC y las demás tareas siguen:
+ * aquí, Anfitrion::bloquear().
+ */
+
+#ifndef ANFITRION_FLASH_NRF5X_H_INCLUIDO
+#define ANFITRION_FLASH_NRF5X_H_INCLUIDO
+
+#include "../Arduino.h"
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+namespace Anfitrion {
+
+  const uint32_t FLASH_TAMANYO = 1024 * 1024;  ///< nRF52840.
+  const uint32_t FLASH_PAGINA = 4096;
+
+  const uint32_t FLASH_BORRADO_US = 85000;  ///< Una página.
+  const uint32_t FLASH_PALABRA_US = 41;     ///< 4 bytes.
+
+  uint8_t* memoriaFlash() {
+    static uint8_t* laFlash = NULL;
+    if (laFlash == NULL) {
+      laFlash = (uint8_t*)malloc(FLASH_TAMANYO);
+      memset(laFlash, 0xFF, FLASH_TAMANYO);
+    }
+    return laFlash;
+  }  // ()
+
+  uint32_t borradosPagina[FLASH_TAMANYO / FLASH_PAGINA] = {};  ///< Veces que se ha borrado cada página.
+
+  /**
+   * @brief La caché de una página de flash_nrf5x (flash_cache.c).
+   */
+  struct CacheFlash {
+    static const uint32_t NINGUNA = 0xFFFFFFFF;
+    uint32_t pagina;  ///< Dirección de la página en la caché, o NINGUNA.
+    uint8_t datos[FLASH_PAGINA];
+  };
+
+  CacheFlash laCacheFlash = { CacheFlash::NINGUNA, {} };
+
+  inline void borrarPaginaFlash(uint32_t pagina) {
+    memset(memoriaFlash() + pagina, 0xFF, FLASH_PAGINA);
+    borradosPagina[pagina / FLASH_PAGINA]++;
+    contadores.paginasFlashBorradas++;
+  }  // ()
+
+  // .........................................................
+  // lo que tarda la flash: quien llama se queda esperando
+  // .........................................................
+  inline void esperarFlash(uint32_t us) {
+    contadores.tiempoFlashUs += us;
+    bloquear(us);
+  }  // ()
+
+};  // namespace
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+
+/**
+ * @brief Escribe la página de la caché, si la hay (borrado y programación).
+ */
+inline void flash_nrf5x_flush(void) {
+  using namespace Anfitrion;
+  if (laCacheFlash.pagina == CacheFlash::NINGUNA) {
+    return;
+  }
+  if (memcmp(memoriaFlash() + laCacheFlash.pagina, laCacheFlash.datos, FLASH_PAGINA) != 0) {
+    borrarPaginaFlash(laCacheFlash.pagina);
+    memcpy(memoriaFlash() + laCacheFlash.pagina, laCacheFlash.datos, FLASH_PAGINA);
+    contadores.bytesFlashEscritos += FLASH_PAGINA;
+    esperarFlash(FLASH_BORRADO_US + FLASH_PAGINA / 4 * FLASH_PALABRA_US);
+  }
+  laCacheFlash.pagina = CacheFlash::NINGUNA;
+}  // ()
+
+/**
+ * @brief Escribe len bytes en dst, a través de la caché.
+ * @return Bytes escritos.
+ */
+inline int flash_nrf5x_write(uint32_t dst, void const* src, int len) {
+  using namespace Anfitrion;
+  const uint8_t* p = (const uint8_t*)src;
+  int hechos = 0;
+  while (hechos < len && dst < FLASH_TAMANYO) {
+    uint32_t pagina = dst & ~(FLASH_PAGINA - 1);
+    if (laCacheFlash.pagina != pagina) {
+      flash_nrf5x_flush();
+      laCacheFlash.pagina = pagina;
+      memcpy(laCacheFlash.datos, memoriaFlash() + pagina, FLASH_PAGINA);
+    }
+    uint32_t desde = dst - pagina;
+    uint32_t n = FLASH_PAGINA - desde;
+    if (n > (uint32_t)(len - hechos)) {
+      n = len - hechos;
+    }
+    memcpy(&laCacheFlash.datos[desde], p + hechos, n);
+    hechos += n;
+    dst += n;
+  }
+  return hechos;
+}  // ()
+
+/**
+ * @brief Lee len bytes de src (lo que haya en la caché, si está ahí).
+ * @return Bytes leídos.
+ */
+inline int flash_nrf5x_read(void* dst, uint32_t src, int len) {
+  using namespace Anfitrion;
+  uint8_t* p = (uint8_t*)dst;
+  for (int i = 0; i < len && src + i < FLASH_TAMANYO; i++) {
+    uint32_t a = src + i;
+    p[i] = ((a & ~(FLASH_PAGINA - 1)) == laCacheFlash.pagina)
+           ? laCacheFlash.datos[a & (FLASH_PAGINA - 1)]
+           : memoriaFlash()[a];
+  }
+  return len;
+}  // ()
+
+/**
+ * @brief Borra la página que empieza en addr (fuera de la caché).
+ */
+inline bool flash_nrf5x_erase(uint32_t addr) {
+  using namespace Anfitrion;
+  if (addr >= FLASH_TAMANYO || (addr & (FLASH_PAGINA - 1)) != 0) {
+    return false;
+  }
+  borrarPaginaFlash(addr);
+  esperarFlash(FLASH_BORRADO_US);
+  return true;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
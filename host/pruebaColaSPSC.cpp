@@ -0,0 +1,253 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file pruebaColaSPSC.cpp
+ * @brief Prueba en el ordenador de ColaSPSC.h: un productor y un consumidor en dos hilos.
+ * @author Sento Marcos Ibarra
+ *
+ * Un hilo mete registros numerados (de uno en uno o por lotes) y otro los
+ * saca, sin más sincronización que la de la cola. Cada registro lleva su
+ * número de secuencia también en los otros campos, así que un elemento
+ * copiado a medias se ve. Se prueba de dos maneras:
+ *
+ *  - reintentando: el productor vuelve a meter lo que no cabe; tienen que
+ *    llegar todos, en orden (perdidas() cuenta los intentos que no cabían)
+ *  - sin esperar (como el muestreo): lo que no cabe se pierde; puede haber
+ *    huecos, pero no desorden, y recibidos + perdidas() = metidos
+ *
+ * y escribe, para comparar, los millones de registros por segundo de la
+ * cola y los de una std::deque con un mutex. En un ordenador con varios
+ * núcleos los dos hilos van a la vez de verdad, que es lo que más aprieta
+ * los acquire/release; en la placa hay un núcleo y el productor es una
+ * tarea de más prioridad.
+ *
+ *   g++ -std=gnu++11 -O2 -pthread host/pruebaColaSPSC.cpp -o pruebaColaSPSC
+ *   ./pruebaColaSPSC
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <new>
+#include <deque>
+#include <chrono>
+
+#define ANFITRION 1  // como con host/Arduino.h: los índices en líneas de caché distintas
+#include "../ColaSPSC.h"
+
+// ..........................................................
+// ..........................................................
+int fallos = 0;
+
+#define COMPROBAR(c)                                                 \
+  do {                                                               \
+    if (!(c)) {                                                      \
+      printf("FALLO %s:%d %s\n", __FILE__, __LINE__, #c);           \
+      fallos++;                                                      \
+    }                                                                \
+  } while (0)
+
+/**
+ * @brief Lo que va por la cola: del tamaño de una medición.
+ */
+struct Registro {
+  uint32_t secuencia;
+  uint32_t complemento;  ///< ~secuencia.
+  int16_t valores[3];    ///< secuencia, 1, 2.
+};
+
+const uint16_t MAX_LOTE = 64;
+
+// ..........................................................
+// ..........................................................
+Registro registro(uint32_t s) {
+  Registro r = { s, ~s, { (int16_t)s, 1, 2 } };
+  return r;
+}  // ()
+
+bool estaEntero(const Registro& r) {
+  return r.complemento == ~r.secuencia && r.valores[0] == (int16_t)r.secuencia
+         && r.valores[1] == 1 && r.valores[2] == 2;
+}  // ()
+
+/**
+ * @brief Una prueba: la cola, lo que mete el productor y cómo.
+ */
+template<uint16_t N>
+struct Prueba {
+
+  ColaSPSC<Registro, N> laCola;
+
+  uint32_t total;
+  uint16_t lote;
+  bool reintenta;
+
+  std::atomic<bool> acabado;  ///< El productor ya no va a meter más.
+
+  // ........................................................
+  // ........................................................
+  static void* productor(void* p) {
+    Prueba& yo = *(Prueba*)p;
+    Registro lote[MAX_LOTE];
+    uint32_t s = 0;
+    while (s < yo.total) {
+      uint16_t n = (yo.total - s < yo.lote ? (uint16_t)(yo.total - s) : yo.lote);
+      for (uint16_t i = 0; i < n; i++) {
+        lote[i] = registro(s + i);
+      }
+      uint16_t metidos = (n == 1 ? (yo.laCola.meter(lote[0]) ? 1 : 0) : yo.laCola.meter(&lote[0], n));
+      while (yo.reintenta && metidos < n) {
+        sched_yield();
+        metidos += yo.laCola.meter(&lote[metidos], n - metidos);
+      }
+      if (metidos < n) {
+        sched_yield();  // sin esperar: deja al consumidor ponerse al día
+      }
+      s += n;
+    }
+    yo.acabado.store(true);
+    return NULL;
+  }  // ()
+
+  // ........................................................
+  // ........................................................
+  void correr() {
+    acabado.store(false);
+
+    auto t0 = std::chrono::steady_clock::now();
+    pthread_t hilo;
+    pthread_create(&hilo, NULL, productor, this);
+
+    uint64_t recibidos = 0;
+    uint32_t desordenados = 0;
+    uint32_t rotos = 0;
+    uint32_t siguiente = 0;  // el que se espera
+    Registro r[MAX_LOTE];
+    for (;;) {
+      bool fin = acabado.load();  // antes de sacar: si ya había acabado, lo que saque es lo último
+      uint16_t n = (lote == 1 ? (laCola.sacar(r[0]) ? 1 : 0) : laCola.sacar(&r[0], MAX_LOTE));
+      for (uint16_t i = 0; i < n; i++) {
+        if (reintenta ? r[i].secuencia != siguiente : r[i].secuencia < siguiente) {
+          desordenados++;
+        }
+        if (!estaEntero(r[i])) {
+          rotos++;
+        }
+        siguiente = r[i].secuencia + 1;
+      }
+      recibidos += n;
+      if (n == 0) {
+        if (fin) {
+          break;
+        }
+        sched_yield();
+      }
+    }  // for
+    pthread_join(hilo, NULL);
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("N=%4u lote=%2u %s: recibidos=%9llu perdidos=%9u desordenados=%u rotos=%u %6.1f M/s\n",
+           N, lote, reintenta ? "reintentando" : "sin esperar ",
+           (unsigned long long)recibidos, laCola.perdidas(), desordenados, rotos, recibidos / s / 1e6);
+
+    COMPROBAR(desordenados == 0);
+    COMPROBAR(rotos == 0);
+    if (reintenta) {
+      COMPROBAR(recibidos == total);
+    } else {
+      COMPROBAR(recibidos + laCola.perdidas() == total);
+    }
+  }  // ()
+};  // struct
+
+// ..........................................................
+// ..........................................................
+template<uint16_t N>
+void probar(uint32_t total, uint16_t lote, bool reintenta) {
+  static Prueba<N> p;  // grande: mejor estática
+  new (&p.laCola) ColaSPSC<Registro, N>();
+  p.total = total;
+  p.lote = lote;
+  p.reintenta = reintenta;
+  p.correr();
+}  // ()
+
+// ..........................................................
+// lo mismo con una std::deque de como mucho 256 y un mutex, reintentando
+// ..........................................................
+struct ConMutex {
+  pthread_mutex_t elMutex;
+  std::deque<Registro> laCola;
+  uint32_t total;
+
+  static void* productor(void* p) {
+    ConMutex& yo = *(ConMutex*)p;
+    uint32_t s = 0;
+    while (s < yo.total) {
+      pthread_mutex_lock(&yo.elMutex);
+      bool llena = yo.laCola.size() >= 256;
+      if (!llena) {
+        yo.laCola.push_back(registro(s++));
+      }
+      pthread_mutex_unlock(&yo.elMutex);
+      if (llena) {
+        sched_yield();
+      }
+    }
+    return NULL;
+  }  // ()
+};  // struct
+
+void probarConMutex(uint32_t total) {
+  ConMutex c;
+  pthread_mutex_init(&c.elMutex, NULL);
+  c.total = total;
+
+  auto t0 = std::chrono::steady_clock::now();
+  pthread_t hilo;
+  pthread_create(&hilo, NULL, ConMutex::productor, &c);
+  uint32_t siguiente = 0;
+  uint32_t desordenados = 0;
+  while (siguiente < total) {
+    pthread_mutex_lock(&c.elMutex);
+    bool vacia = c.laCola.empty();
+    while (!c.laCola.empty()) {
+      if (c.laCola.front().secuencia != siguiente) {
+        desordenados++;
+      }
+      siguiente++;
+      c.laCola.pop_front();
+    }
+    pthread_mutex_unlock(&c.elMutex);
+    if (vacia) {
+      sched_yield();
+    }
+  }
+  pthread_join(hilo, NULL);
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  pthread_mutex_destroy(&c.elMutex);
+
+  printf("deque(256) con mutex, de uno en uno: %6.1f M/s\n", total / s / 1e6);
+  COMPROBAR(desordenados == 0);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+int main() {
+  probar<4>(2000000, 1, true);
+  probar<4>(2000000, 4, true);
+  probar<256>(20000000, 1, true);
+  probar<256>(20000000, 32, true);
+  probar<4>(20000000, 1, false);
+  probar<256>(20000000, 32, false);
+  probarConMutex(20000000);
+
+  printf("fallos=%d\n", fallos);
+  return fallos == 0 ? 0 : 1;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
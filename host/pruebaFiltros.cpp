@@ -0,0 +1,325 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file pruebaFiltros.cpp
+ * @brief Prueba en el ordenador de Filtros.h: frente a las cuentas en double, y lo que tarda.
+ * @author Sento Marcos Ibarra
+ *
+ * Pasa por cada filtro señales de prueba (escalón, ruido, seno) y compara
+ * con lo mismo hecho en double: la mediana con ordenar, la media móvil y
+ * la EMA con su fórmula, y el biquad con los coeficientes sin cuantizar
+ * (el error que sale es el de los coeficientes en Q14 más el de las
+ * cuentas en enteros) y con los cuantizados (sólo el de las cuentas).
+ * Al final, ns por muestra por bloques y de una en una, y una huella de
+ * todas las salidas.
+ *
+ * Con -DFILTROS_SIMD se compila el camino de la placa (__SMLAD, __QSUB16)
+ * con esas instrucciones hechas a mano aquí: la huella tiene que ser la
+ * misma que sin él, porque los dos caminos dan lo mismo bit a bit. Lo que
+ * tardan de verdad sólo se ve en la placa (MEDIR_TRAMO en el Medidor).
+ *
+ *   g++ -std=gnu++11 -O2 host/pruebaFiltros.cpp -o pruebaFiltros
+ *   g++ -std=gnu++11 -O2 -DFILTROS_SIMD host/pruebaFiltros.cpp -o pruebaFiltrosSimd
+ *   ./pruebaFiltros && ./pruebaFiltrosSimd
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef FILTROS_SIMD
+// ..........................................................
+// lo que hacen las de CMSIS (ARMv7E-M), para probar ese camino aquí
+// ..........................................................
+inline uint32_t __SMLAD(uint32_t x, uint32_t y, uint32_t acc) {
+  return acc + (int32_t)(int16_t)(x & 0xFFFF) * (int16_t)(y & 0xFFFF)
+         + (int32_t)(int16_t)(x >> 16) * (int16_t)(y >> 16);
+}  // ()
+
+inline uint32_t __QSUB16(uint32_t x, uint32_t y) {
+  int32_t bajo = (int32_t)(int16_t)(x & 0xFFFF) - (int16_t)(y & 0xFFFF);
+  int32_t alto = (int32_t)(int16_t)(x >> 16) - (int16_t)(y >> 16);
+  bajo = (bajo > 32767 ? 32767 : bajo < -32768 ? -32768 : bajo);
+  alto = (alto > 32767 ? 32767 : alto < -32768 ? -32768 : alto);
+  return (uint16_t)bajo | ((uint32_t)(uint16_t)alto << 16);
+}  // ()
+#endif
+
+#include "../Filtros.h"
+
+// ..........................................................
+// ..........................................................
+const int N = 4096;    ///< Muestras de cada señal.
+const int BLOQUE = 64; ///< Como el Medidor.
+
+int fallos = 0;
+uint32_t huella = 2166136261u;  // FNV-1a de todas las salidas
+
+#define COMPROBAR(c)                                                 \
+  do {                                                               \
+    if (!(c)) {                                                      \
+      printf("FALLO %s:%d %s\n", __FILE__, __LINE__, #c);           \
+      fallos++;                                                      \
+    }                                                                \
+  } while (0)
+
+// ..........................................................
+// ..........................................................
+void anotarHuella(const int16_t* x, int n) {
+  for (int i = 0; i < n; i++) {
+    huella = (huella ^ (uint16_t)x[i]) * 16777619u;
+  }
+}  // ()
+
+// ..........................................................
+// señal 0: escalón; 1: ruido; 2: seno lento con ruido; 3: picos sueltos
+// ..........................................................
+void senyal(int cual, int16_t* x) {
+  srand(1234 + cual);
+  for (int i = 0; i < N; i++) {
+    int ruido = rand() % 401 - 200;
+    switch (cual) {
+    case 0:
+      x[i] = (int16_t)(i < N / 4 ? 100 : 2100);
+      break;
+    case 1:
+      x[i] = (int16_t)(1000 + ruido * 5);
+      break;
+    case 2:
+      x[i] = (int16_t)(8000 * sin(2 * 3.14159265358979 * i / 500.0) + ruido);
+      break;
+    default:
+      x[i] = (int16_t)(500 + ruido / 20 + (rand() % 50 == 0 ? 20000 : 0));
+      break;
+    }
+  }
+}  // ()
+
+// ..........................................................
+// por bloques de BLOQUE, como en el Medidor
+// ..........................................................
+template<typename F>
+void porBloques(F& f, int16_t* x) {
+  for (int i = 0; i < N; i += BLOQUE) {
+    f.procesar(&x[i], BLOQUE);
+  }
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void probarSumarRestar(const int16_t* a, const int16_t* b) {
+  double suma = 0;
+  for (int i = 0; i < N; i++) {
+    suma += a[i];
+  }
+  COMPROBAR(Filtros::sumar(a, N) == (int32_t)suma);
+  COMPROBAR(Filtros::sumar(a, N - 1) == (int32_t)(suma - a[N - 1]));
+
+  int16_t r[N];
+  Filtros::restar(a, b, r, N);
+  int malas = 0;
+  for (int i = 0; i < N; i++) {
+    double d = (double)a[i] - b[i];
+    d = (d > 32767 ? 32767 : d < -32768 ? -32768 : d);
+    malas += (r[i] != (int16_t)d);
+  }
+  COMPROBAR(malas == 0);
+  anotarHuella(r, N);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void probarMediana(const int16_t* entrada) {
+  const int M = 5;
+  int16_t x[N];
+  std::copy(entrada, entrada + N, x);
+  Filtros::Mediana<M> f;
+  porBloques(f, x);
+
+  int malas = 0;
+  for (int i = 0; i < N; i++) {
+    int16_t v[M];
+    for (int k = 0; k < M; k++) {
+      int j = i - (M - 1) + k;
+      v[k] = entrada[j < 0 ? 0 : j];
+    }
+    std::sort(v, v + M);
+    malas += (x[i] != v[M / 2]);
+  }
+  COMPROBAR(malas == 0);
+  anotarHuella(x, N);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void probarMediaMovilEMA(const int16_t* entrada) {
+  const int M = 8;
+  int16_t x[N];
+  std::copy(entrada, entrada + N, x);
+  Filtros::MediaMovil<M> media;
+  porBloques(media, x);
+  int malas = 0;
+  for (int i = 0; i < N; i++) {
+    double s = 0;
+    for (int k = 0; k < M; k++) {
+      int j = i - k;
+      s += entrada[j < 0 ? 0 : j];
+    }
+    malas += (x[i] != (int16_t)(s / M));  // trunca hacia 0, como la división entera
+  }
+  COMPROBAR(malas == 0);
+  anotarHuella(x, N);
+
+  const int K = 3;
+  std::copy(entrada, entrada + N, x);
+  Filtros::EMA<K> ema;
+  porBloques(ema, x);
+  double y = entrada[0];
+  double errorMaximo = 0;
+  for (int i = 0; i < N; i++) {
+    y += (entrada[i] - y) / (1 << K);
+    errorMaximo = std::max(errorMaximo, fabs(x[i] - y));
+  }
+  COMPROBAR(errorMaximo <= 1.0);  // el estado lleva 8 bits de fracción
+  anotarHuella(x, N);
+}  // ()
+
+// ..........................................................
+// y con los coeficientes en double, en reposo con la primera muestra
+// ..........................................................
+void biquadDouble(double b0, double b1, double b2, double a1, double a2,
+                  const int16_t* x, double* y) {
+  double x1 = x[0], x2 = x[0];
+  double ganancia = (b0 + b1 + b2) / (1 + a1 + a2);
+  double y1 = x[0] * ganancia, y2 = y1;
+  for (int i = 0; i < N; i++) {
+    y[i] = b0 * x[i] + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+    x2 = x1;
+    x1 = x[i];
+    y2 = y1;
+    y1 = y[i];
+  }
+}  // ()
+
+// ..........................................................
+// ..........................................................
+void probarBiquad(const int16_t* entrada, int cual) {
+  static const double cortes[] = { 0.02, 0.05, 0.1, 0.2, 0.3, 0.45 };
+
+  for (unsigned c = 0; c < sizeof(cortes) / sizeof(cortes[0]); c++) {
+    double corte = cortes[c];
+    double k = tan(3.14159265358979 * corte);
+    double norma = 1 / (1 + 1.41421356237310 * k + k * k);
+    double b0 = k * k * norma;
+    double a1 = 2 * (k * k - 1) * norma;
+    double a2 = (1 - 1.41421356237310 * k + k * k) * norma;
+
+    int16_t x[N];
+    std::copy(entrada, entrada + N, x);
+    Filtros::Biquad f = Filtros::Biquad::pasoBajo(corte);
+    porBloques(f, x);
+
+    static double exacta[N], cuantizada[N];
+    biquadDouble(b0, 2 * b0, b0, a1, a2, entrada, exacta);
+    double q = 16384;
+    double qb0 = Filtros::Biquad::q14(b0) / q;
+    biquadDouble(qb0, Filtros::Biquad::q14(2 * b0) / q, qb0,
+                 Filtros::Biquad::q14(a1) / q, Filtros::Biquad::q14(a2) / q, entrada, cuantizada);
+
+    // sin el principio: la referencia empieza en reposo con la ganancia
+    // exacta y la cuantizada arranca en x[0]
+    double errorExacta = 0, errorCuentas = 0, escala = 0;
+    for (int i = 200; i < N; i++) {
+      errorExacta = std::max(errorExacta, fabs(x[i] - exacta[i]));
+      errorCuentas = std::max(errorCuentas, fabs(x[i] - cuantizada[i]));
+      escala = std::max(escala, fabs(exacta[i]));
+    }
+    printf("  biquad corte=%.2f señal %d: error max frente a double %6.1f"
+           " (coeficientes exactos, %.2f %% del fondo) %5.1f (cuantizados)\n",
+           corte, cual, errorExacta, 100 * errorExacta / (escala > 0 ? escala : 1), errorCuentas);
+
+    // el redondeo de y, que la realimentación amplifica (más cuanto más
+    // bajo el corte), y el de los coeficientes: Biquad::CORTE_MINIMO
+    COMPROBAR(errorCuentas <= 4 + 0.02 * escala);
+    COMPROBAR(errorExacta <= 4 + 0.02 * escala);
+    anotarHuella(x, N);
+  }
+}  // ()
+
+// ..........................................................
+// cortes fuera de lo que cabe en Q14: se llevan al borde, sin desbordar
+// ..........................................................
+void probarBordes() {
+  static const double cortes[] = { 0.0, 1e-6, 0.001, 0.01, 0.5, 0.7 };
+  for (unsigned c = 0; c < sizeof(cortes) / sizeof(cortes[0]); c++) {
+    Filtros::Biquad f = Filtros::Biquad::pasoBajo(cortes[c]);
+    int16_t x[N];
+    for (int i = 0; i < N; i++) {
+      x[i] = (int16_t)(i < 10 ? 0 : 10000);
+    }
+    porBloques(f, x);
+    COMPROBAR(abs(x[N - 1] - 10000) <= 10000 / 50);  // ganancia 1 en continua (con un 2 %)
+  }
+  // a1 = -2 dado a mano: -a1 satura en vez de darse la vuelta
+  Filtros::Biquad g(0, 0, 0, -32768, 0);
+  int16_t x[4] = { 100, 100, 100, 100 };
+  g.procesar(x, 4);
+  COMPROBAR(x[3] >= 100);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+template<typename F>
+double nsPorMuestra(int16_t* x, int porLlamada) {
+  F f = F::pasoBajo(0.05);
+  const int VUELTAS = 2000;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int v = 0; v < VUELTAS; v++) {
+    for (int i = 0; i < N; i += porLlamada) {
+      f.procesar(&x[i], porLlamada);
+    }
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return s * 1e9 / ((double)VUELTAS * N);
+}  // ()
+
+// ..........................................................
+// ..........................................................
+int main() {
+#ifdef FILTROS_SIMD
+  printf("camino SIMD (__SMLAD y __QSUB16 hechas a mano)\n");
+#else
+  printf("camino escalar\n");
+#endif
+
+  static int16_t senyales[4][N];
+  for (int s = 0; s < 4; s++) {
+    senyal(s, senyales[s]);
+  }
+
+  probarSumarRestar(senyales[2], senyales[1]);
+  for (int s = 0; s < 4; s++) {
+    probarMediana(senyales[s]);
+    probarMediaMovilEMA(senyales[s]);
+  }
+  for (int s = 0; s < 3; s++) {
+    probarBiquad(senyales[s], s);
+  }
+  probarBordes();
+
+  int16_t x[N];
+  std::copy(senyales[1], senyales[1] + N, x);
+  printf("biquad: %.2f ns/muestra por bloques de %d, %.2f de una en una\n",
+         nsPorMuestra<Filtros::Biquad>(x, BLOQUE), BLOQUE, nsPorMuestra<Filtros::Biquad>(x, 1));
+
+  printf("huella=%08x fallos=%d\n", (unsigned)huella, fallos);
+  return fallos == 0 ? 0 : 1;
+}  // ()
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
@@ -0,0 +1,335 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file Decodificador.h
+ * @brief Receptor: de los anuncios recibidos a columnas de mediciones, por lotes.
+ * @author Sento Marcos Ibarra
+ *
+ * Deshace lo que hace Publicador con los tres formatos que emite:
+ *
+ *  - iBeacon de una medición: uuid "EPSG-GTI-PROY-3D", major = (tipo << 8)
+ *    + contador, minor = valor
+ *  - iBeacon libre con una TramaMediciones en los 21 bytes de carga
+ *  - iBeacon libre con el resumen de una ventana (TramaMediciones versión 2)
+ *  - anuncio extendido con una TramaMuestras (varias mediciones)
+ *
+ * Todos van como datos del fabricante 0x004C. Un lote de anuncios se
+ * decodifica de una vez en Columnas: un array por campo, una fila por
+ * medición, sin pedir memoria. Lo que no es nuestro se cuenta y se salta.
+ * Un resumen es una fila cuyo valor es la media; las demás filas son de
+ * una medición (cuantas = 1, mínimo = máximo = valor, varianza 0).
+ *
+ *   Receptor::Columnas<4096> lasColumnas;   // mejor estática: es grande
+ *   Receptor::Decodificador elDecodificador;
+ *
+ *   lasColumnas.vaciar();
+ *   uint32_t usados = elDecodificador.decodificar( informes, n, lasColumnas );
+ *   // si usados < n, las columnas están llenas: vaciarlas y seguir
+ *
+ * Usa las mismas cabeceras que el firmware (../TramaMediciones.h y
+ * ../TramaMuestras.h), así que un cambio de formato se ve en los dos lados.
+ * Es para el ordenador (la pasarela), pero no necesita más que C++11.
+ */
+
+#ifndef RECEPTOR_DECODIFICADOR_H_INCLUIDO
+#define RECEPTOR_DECODIFICADOR_H_INCLUIDO
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../TramaMediciones.h"
+#include "../TramaMuestras.h"
+
+namespace Receptor {
+
+  /**
+   * @struct InformeAnuncio
+   * @brief Un anuncio recibido, tal como lo da el escáner.
+   */
+  struct InformeAnuncio {
+    uint64_t direccion;    ///< Dirección BLE del emisor (48 bits).
+    uint32_t instante;     ///< Cuándo se recibió, en el reloj del receptor (ms).
+    int8_t rssi;           ///< dBm.
+    uint8_t tamanyo;       ///< Bytes de datos.
+    const uint8_t* datos;  ///< Datos del anuncio: estructuras AD (longitud, tipo, datos).
+  };
+
+  /**
+   * @brief Formato del que sale cada fila.
+   */
+  enum Formato {
+    IBEACON_MEDICION = 1,
+    TRAMA_MEDICIONES = 2,
+    TRAMA_MUESTRAS = 3,
+    TRAMA_RESUMEN = 4
+  };
+
+  /**
+   * @brief Filas que puede dar un solo anuncio (una TramaMuestras llena).
+   */
+  const uint32_t MAX_FILAS_POR_INFORME = TramaMuestras::MAX_MUESTRAS * 3;
+
+  /**
+   * @class Columnas
+   * @brief Mediciones decodificadas, un array por campo.
+   * @tparam CAPACIDAD Filas que caben (al menos MAX_FILAS_POR_INFORME).
+   */
+  template<uint32_t CAPACIDAD>
+  struct Columnas {
+
+    static_assert(CAPACIDAD >= MAX_FILAS_POR_INFORME, "tiene que caber un anuncio entero");
+
+    uint64_t nodo[CAPACIDAD];         ///< Dirección del emisor.
+    uint32_t instante[CAPACIDAD];     ///< Recepción (reloj del receptor, ms).
+    uint32_t marcaTiempo[CAPACIDAD];  ///< Medición (reloj del emisor, ms); 0 si el formato no la lleva.
+    uint16_t secuencia[CAPACIDAD];    ///< En IBEACON_MEDICION, el contador (8 bits).
+    int16_t valor[CAPACIDAD];         ///< En TRAMA_RESUMEN, la media.
+    uint16_t cuantas[CAPACIDAD];      ///< Mediciones que resume la fila.
+    int16_t minimo[CAPACIDAD];
+    int16_t maximo[CAPACIDAD];
+    uint32_t varianza[CAPACIDAD];
+    uint8_t tipo[CAPACIDAD];          ///< TramaMediciones::ID_*.
+    uint8_t formato[CAPACIDAD];       ///< Formato.
+    int8_t rssi[CAPACIDAD];
+
+    uint32_t filas;  ///< Las que hay.
+
+    Columnas()
+      : filas(0) {
+    }  // ()
+
+    void vaciar() {
+      (*this).filas = 0;
+    }  // ()
+
+    uint32_t libres() const {
+      return CAPACIDAD - (*this).filas;
+    }  // ()
+  };  // struct
+
+  /**
+   * @class Decodificador
+   * @brief Decodifica lotes de anuncios en Columnas y cuenta lo que ve.
+   */
+  class Decodificador {
+
+  private:
+
+    Uuid128 uuid;  ///< El de los iBeacon de una medición, como se emite.
+
+    uint32_t informes;  ///< Anuncios decodificados.
+    uint32_t ajenos;    ///< Anuncios que no son nuestros.
+
+    // .........................................................
+    // el prefijo de un iBeacon: flags (3) y la cabecera de los datos del
+    // fabricante (2); es lo más frecuente y se mira de una vez
+    // .........................................................
+    static bool esPrefijoIBeacon(const uint8_t* d, uint8_t tam) {
+      return tam >= 30 && d[0] == 0x02 && d[1] == 0x01 && d[3] == 0x1A && d[4] == 0xFF;
+    }  // ()
+
+    /**
+     * @brief Busca la estructura de datos del fabricante.
+     * @param tam Bytes de d.
+     * @param len Se deja en bytes de lo que se devuelve (companyID incluido).
+     * @return Dónde empieza el companyID; NULL si no hay.
+     */
+    static const uint8_t* buscarFabricante(const uint8_t* d, uint8_t tam, uint8_t& len) {
+      if (esPrefijoIBeacon(d, tam)) {
+        len = 25;
+        return &d[5];
+      }
+      uint16_t i = 0;
+      while (i + 1 < tam) {
+        uint8_t l = d[i];
+        if (l == 0 || i + 1 + l > tam) {
+          return NULL;
+        }
+        if (d[i + 1] == 0xFF && l >= 3) {
+          len = l - 1;
+          return &d[i + 2];
+        }
+        i += 1 + l;
+      }
+      return NULL;
+    }  // ()
+
+    // .........................................................
+    // .........................................................
+    template<uint32_t C>
+    static void anyadirFila(Columnas<C>& col, const InformeAnuncio& inf, uint8_t formato,
+                            uint8_t tipo, int16_t valor, uint16_t secuencia, uint32_t marca) {
+      uint32_t f = col.filas++;
+      col.nodo[f] = inf.direccion;
+      col.instante[f] = inf.instante;
+      col.marcaTiempo[f] = marca;
+      col.secuencia[f] = secuencia;
+      col.valor[f] = valor;
+      col.cuantas[f] = 1;
+      col.minimo[f] = valor;
+      col.maximo[f] = valor;
+      col.varianza[f] = 0;
+      col.tipo[f] = tipo;
+      col.formato[f] = formato;
+      col.rssi[f] = inf.rssi;
+    }  // ()
+
+    // .........................................................
+    // una fila con el resumen de una ventana; marca: su principio
+    // false (y ninguna fila) si presente no es el bit de uno de los sensores
+    // .........................................................
+    template<uint32_t C>
+    static bool anyadirResumen(Columnas<C>& col, const InformeAnuncio& inf,
+                               const TramaMediciones::Resumen& r) {
+      static const uint8_t tipos[] = {
+        TramaMediciones::ID_CO2, TramaMediciones::ID_TEMPERATURA, TramaMediciones::ID_RUIDO
+      };
+      for (uint8_t k = 0; k < sizeof(tipos); k++) {
+        if (r.presente == (1 << k)) {
+          anyadirFila(col, inf, TRAMA_RESUMEN, tipos[k], r.media, r.secuencia, r.inicio);
+          uint32_t f = col.filas - 1;
+          col.cuantas[f] = r.cuantas;
+          col.minimo[f] = r.minimo;
+          col.maximo[f] = r.maximo;
+          col.varianza[f] = r.varianza;
+          return true;
+        }
+      }  // for
+      return false;
+    }  // ()
+
+    /**
+     * @brief Los 21 bytes de un iBeacon: de una medición, TramaMediciones o resumen.
+     */
+    template<uint32_t C>
+    bool decodificarIBeacon(const uint8_t* carga, const InformeAnuncio& inf, Columnas<C>& col) const {
+
+      if (memcmp(carga, &(*this).uuid.bytes[0], 16) == 0) {
+        uint16_t major = TramaMediciones::leer16(&carga[16]);
+        anyadirFila(col, inf, IBEACON_MEDICION,
+                    TramaMediciones::idDeMajor(major),
+                    (int16_t)TramaMediciones::leer16(&carga[18]),
+                    TramaMediciones::contadorDeMajor(major), 0);
+        return true;
+      }
+
+      TramaMediciones::Resumen r;
+      if (TramaMediciones::desempaquetarResumen(carga, TramaMediciones::TAMANYO, r)) {
+        return anyadirResumen(col, inf, r);
+      }
+
+      TramaMediciones t;
+      if (!TramaMediciones::desempaquetar(carga, TramaMediciones::TAMANYO, t)) {
+        return false;
+      }
+      uint32_t marca = (t.presentes & TramaMediciones::HAY_MARCA_TIEMPO) ? t.marcaTiempo : 0;
+      if (t.presentes & TramaMediciones::HAY_CO2) {
+        anyadirFila(col, inf, TRAMA_MEDICIONES, TramaMediciones::ID_CO2, t.co2, t.secuencia, marca);
+      }
+      if (t.presentes & TramaMediciones::HAY_TEMPERATURA) {
+        anyadirFila(col, inf, TRAMA_MEDICIONES, TramaMediciones::ID_TEMPERATURA,
+                    t.temperatura, t.secuencia, marca);
+      }
+      if (t.presentes & TramaMediciones::HAY_RUIDO) {
+        anyadirFila(col, inf, TRAMA_MEDICIONES, TramaMediciones::ID_RUIDO, t.ruido, t.secuencia, marca);
+      }
+      return true;
+    }  // ()
+
+    /**
+     * @brief Una TramaMuestras: en cada muestra, una fila por valor presente.
+     */
+    template<uint32_t C>
+    static bool decodificarMuestras(const uint8_t* carga, uint8_t tam,
+                                    const InformeAnuncio& inf, Columnas<C>& col) {
+      TramaMuestras::Muestra m[TramaMuestras::MAX_MUESTRAS];
+      uint16_t secuencia;
+      uint8_t n = TramaMuestras::desempaquetar(carga, tam, secuencia, &m[0], TramaMuestras::MAX_MUESTRAS);
+      if (n == 0) {
+        return TramaMuestras::esTramaMuestras(carga, tam);  // vacía, pero nuestra
+      }
+      static const uint8_t IDS[TramaMediciones::MAX_VALORES] = {
+        TramaMediciones::ID_CO2, TramaMediciones::ID_TEMPERATURA, TramaMediciones::ID_RUIDO
+      };
+      uint8_t presentes = carga[TramaMuestras::POS_CABECERA] & 0x0F;
+      for (uint8_t i = 0; i < n; i++) {
+        uint16_t s = (uint16_t)(secuencia - i);
+        for (uint8_t k = 0; k < TramaMediciones::MAX_VALORES; k++) {
+          if (presentes & (1 << k)) {
+            anyadirFila(col, inf, TRAMA_MUESTRAS, IDS[k], m[i].valores[k], s, m[i].marcaTiempo);
+          }
+        }
+      }
+      return true;
+    }  // ()
+
+  public:
+
+    /**
+     * @brief Constructor.
+     */
+    Decodificador()
+      : uuid(TramaMediciones::uuidBeacon()), informes(0), ajenos(0) {
+    }  // ()
+
+    /**
+     * @function decodificarUno
+     * @brief Decodifica un anuncio. Tiene que haber MAX_FILAS_POR_INFORME filas libres.
+     * @return false si no es de ninguno de nuestros formatos.
+     */
+    template<uint32_t C>
+    bool decodificarUno(const InformeAnuncio& inf, Columnas<C>& col) {
+      uint8_t len = 0;
+      const uint8_t* m = buscarFabricante(inf.datos, inf.tamanyo, len);
+
+      bool nuestro = false;
+      if (m != NULL && len >= 2 && m[0] == 0x4C && m[1] == 0x00) {
+        if (len >= 4 + TramaMediciones::TAMANYO && m[2] == 0x02 && m[3] == 0x15) {
+          nuestro = (*this).decodificarIBeacon(&m[4], inf, col);
+        } else {
+          nuestro = decodificarMuestras(&m[2], len - 2, inf, col);
+        }
+      }
+
+      if (nuestro) {
+        (*this).informes++;
+      } else {
+        (*this).ajenos++;
+      }
+      return nuestro;
+    }  // ()
+
+    /**
+     * @function decodificar
+     * @brief Decodifica un lote de anuncios, hasta que se acaban o no caben en col.
+     * @param lote Anuncios recibidos.
+     * @param n Cuántos.
+     * @param col Donde se añaden las filas.
+     * @return Anuncios usados (si es menos que n, col está llena).
+     */
+    template<uint32_t C>
+    uint32_t decodificar(const InformeAnuncio* lote, uint32_t n, Columnas<C>& col) {
+      uint32_t i = 0;
+      for (; i < n && col.libres() >= MAX_FILAS_POR_INFORME; i++) {
+        (*this).decodificarUno(lote[i], col);
+      }
+      return i;
+    }  // ()
+
+    uint32_t informesDecodificados() const {
+      return (*this).informes;
+    }  // ()
+
+    uint32_t informesAjenos() const {
+      return (*this).ajenos;
+    }  // ()
+
+  };  // class
+
+};  // namespace
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif
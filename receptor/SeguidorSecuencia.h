@@ -0,0 +1,236 @@
+// -*- mode: c++ -*-
+
+/**
+ * @file SeguidorSecuencia.h
+ * @brief Receptor: pérdidas, repetidos y desorden de cada nodo, a partir de sus números de secuencia.
+ * @author Sento Marcos Ibarra
+ *
+ * Por cada trama recibida se anota la clave del emisor y los bits de
+ * secuencia que van en el aire. Con ellos se recupera la secuencia de 32 bits
+ * (TramaMediciones::extenderSecuencia(), respecto a la mayor vista) y se
+ * mira en una ventana de bits de las VENTANA últimas:
+ *
+ *  - más alta que todas: nueva (la ventana se desplaza)
+ *  - dentro de la ventana y ya marcada: repetida (otro evento del mismo anuncio)
+ *  - dentro de la ventana sin marcar: atrasada, llega tras una posterior;
+ *    cuánto atrás es el desorden
+ *  - más atrás que la ventana: no se puede saber, se cuenta aparte
+ *
+ * Todo es O(1) por trama: la tabla de nodos es de tamaño fijo con
+ * direccionamiento abierto, y la ventana, un uint64_t.
+ *
+ * Perdidas = esperadas (de la primera a la mayor) - distintas recibidas. Las
+ * que aún pueden llegar atrasadas cuentan como perdidas hasta que llegan.
+ *
+ * Clave: la dirección del emisor. En los iBeacon de una medición el contador
+ * es el mismo para CO2 y temperatura: clave(direccion, tipo) los separa.
+ *
+ * @see Decodificador.h
+ */
+
+#ifndef RECEPTOR_SEGUIDOR_SECUENCIA_H_INCLUIDO
+#define RECEPTOR_SEGUIDOR_SECUENCIA_H_INCLUIDO
+
+#include <stdint.h>
+
+#include "../TramaMediciones.h"
+
+namespace Receptor {
+
+  /**
+   * @class SeguidorSecuencia
+   * @brief Tabla de nodos con su estado de secuencia y sus cuentas.
+   * @tparam MAX_NODOS Nodos que caben (potencia de 2).
+   */
+  template<uint16_t MAX_NODOS>
+  class SeguidorSecuencia {
+
+    static_assert(MAX_NODOS > 0 && (MAX_NODOS & (MAX_NODOS - 1)) == 0, "MAX_NODOS potencia de 2");
+
+  public:
+
+    static const uint8_t VENTANA = 64;  ///< Secuencias que se recuerdan por debajo de la mayor.
+
+    /**
+     * @brief Qué era la trama anotada.
+     */
+    enum Resultado {
+      PRIMERA,           ///< La primera de un nodo.
+      NUEVA,
+      ATRASADA,          ///< Nueva, pero llega después de otra posterior.
+      REPETIDA,
+      FUERA_DE_VENTANA,  ///< Demasiado atrás para saberlo.
+      SIN_SITIO          ///< La tabla de nodos está llena.
+    };
+
+    /**
+     * @struct Nodo
+     * @brief Estado y cuentas de un nodo.
+     */
+    struct Nodo {
+      uint64_t clave;
+      uint32_t primera;         ///< Secuencia (32 bits) más baja recibida.
+      uint32_t mayor;           ///< Secuencia (32 bits) más alta recibida.
+      uint64_t ventana;         ///< Bit i: recibida (mayor - i).
+      uint32_t recibidas;       ///< Tramas, con las repetidas.
+      uint32_t distintas;       ///< Secuencias distintas.
+      uint32_t repetidas;
+      uint32_t atrasadas;
+      uint32_t fueraDeVentana;
+      uint8_t maxDesorden;      ///< Lo más atrás que ha llegado una atrasada.
+      bool usado;
+
+      uint32_t esperadas() const {
+        return mayor - primera + 1;
+      }  // ()
+
+      uint32_t perdidas() const {
+        return esperadas() - distintas;
+      }  // ()
+
+      double tasaPerdidas() const {
+        return (double)perdidas() / esperadas();
+      }  // ()
+
+      double tasaRepetidas() const {
+        return recibidas == 0 ? 0.0 : (double)repetidas / recibidas;
+      }  // ()
+    };  // struct
+
+  private:
+
+    Nodo losNodos[MAX_NODOS];
+    uint16_t numNodos;
+
+    // .........................................................
+    // el sitio de la clave, o el primero libre de su recorrido
+    // .........................................................
+    Nodo* buscarSitio(uint64_t clave) {
+      uint16_t i = (uint16_t)((clave * 0x9E3779B97F4A7C15ULL) >> 48) & (MAX_NODOS - 1);
+      for (uint16_t n = 0; n < MAX_NODOS; n++) {
+        Nodo& nodo = (*this).losNodos[i];
+        if (!nodo.usado || nodo.clave == clave) {
+          return &nodo;
+        }
+        i = (i + 1) & (MAX_NODOS - 1);
+      }
+      return NULL;
+    }  // ()
+
+  public:
+
+    /**
+     * @brief Constructor: sin nodos.
+     */
+    SeguidorSecuencia()
+      : losNodos(), numNodos(0) {
+    }  // ()
+
+    /**
+     * @function clave
+     * @brief Clave de un flujo de secuencias: dirección y, si hace falta, el tipo de medición.
+     * @param direccion Dirección BLE (48 bits).
+     * @param flujo 0, o el tipo de medición en los iBeacon de una medición.
+     */
+    static uint64_t clave(uint64_t direccion, uint8_t flujo = 0) {
+      return (direccion & 0xFFFFFFFFFFFFULL) | ((uint64_t)flujo << 48);
+    }  // ()
+
+    /**
+     * @function anotar
+     * @brief Anota una trama recibida.
+     * @param clave_ Del emisor (ver clave()).
+     * @param enAire Bits de secuencia recibidos.
+     * @param bits Cuántos: TramaMediciones::BITS_SECUENCIA o BITS_CONTADOR_MAJOR.
+     */
+    Resultado anotar(uint64_t clave_, uint32_t enAire, uint8_t bits) {
+      Nodo* n = (*this).buscarSitio(clave_);
+      if (n == NULL) {
+        return SIN_SITIO;
+      }
+
+      if (!n->usado) {
+        *n = Nodo();
+        n->usado = true;
+        n->clave = clave_;
+        n->primera = n->mayor = enAire;
+        n->ventana = 1;
+        n->recibidas = n->distintas = 1;
+        (*this).numNodos++;
+        return PRIMERA;
+      }
+
+      uint32_t s = TramaMediciones::extenderSecuencia(n->mayor, enAire, bits);
+      n->recibidas++;
+
+      int32_t adelante = (int32_t)(s - n->mayor);
+      if (adelante > 0) {
+        n->ventana = (adelante >= VENTANA ? 1 : (n->ventana << adelante) | 1);
+        n->mayor = s;
+        n->distintas++;
+        return NUEVA;
+      }
+
+      uint32_t atras = (uint32_t)-adelante;
+      if (atras >= VENTANA) {
+        n->fueraDeVentana++;
+        return FUERA_DE_VENTANA;
+      }
+
+      uint64_t bit = 1ULL << atras;
+      if (n->ventana & bit) {
+        n->repetidas++;
+        return REPETIDA;
+      }
+
+      n->ventana |= bit;
+      n->distintas++;
+      n->atrasadas++;
+      if (atras > n->maxDesorden) {
+        n->maxDesorden = (uint8_t)atras;
+      }
+      if ((int32_t)(s - n->primera) < 0) {
+        n->primera = s;  // llega una anterior a la primera que se vio
+      }
+      return ATRASADA;
+    }  // ()
+
+    /**
+     * @function nodo
+     * @brief El estado de un nodo; NULL si no se ha visto.
+     */
+    const Nodo* nodo(uint64_t clave_) const {
+      const Nodo* n = const_cast<SeguidorSecuencia*>(this)->buscarSitio(clave_);
+      return (n != NULL && n->usado) ? n : NULL;
+    }  // ()
+
+    /**
+     * @function nodos
+     * @brief Cuántos nodos hay en la tabla.
+     */
+    uint16_t nodos() const {
+      return (*this).numNodos;
+    }  // ()
+
+    /**
+     * @function paraCadaNodo
+     * @brief Llama a f(const Nodo&) con cada nodo de la tabla.
+     */
+    template<typename F>
+    void paraCadaNodo(F f) const {
+      for (uint16_t i = 0; i < MAX_NODOS; i++) {
+        if ((*this).losNodos[i].usado) {
+          f((*this).losNodos[i]);
+        }
+      }
+    }  // ()
+
+  };  // class
+
+};  // namespace
+
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+// ----------------------------------------------------------
+#endif